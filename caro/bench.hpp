@@ -0,0 +1,490 @@
+// bench.hpp - Microbenchmarks of the individual kernels.
+//
+// Every kernel is registered below with the input sizes to run and whether it
+// has SIMD dispatch variants (then it runs once per level up to what the CPU
+// supports, forced with simdLevelCap()). Each (kernel, variant, size) is
+// warmed up, calibrated to take at least 2 ms per sample, then sampled
+// repeatedly on a thread pinned to one CPU. Results are cycles per item (byte
+// or pixel) with their spread, and items per second.
+//
+// Cycles come from the CPU cycle counter through perf_event_open when the
+// kernel allows it, otherwise from the time-stamp counter (reference cycles
+// at the nominal frequency), otherwise from the steady clock.
+//
+// New SIMD kernels: add an entry to registerKernels().
+#pragma once
+
+#include <algorithm>    // For std::sort, std::min
+#include <chrono>       // For wall-clock timing
+#include <cmath>        // For std::sqrt
+#include <cstdint>      // For fixed-width integers
+#include <cstdio>       // For std::snprintf
+#include <cstdlib>      // For std::strtod, std::strtoull
+#include <cstring>      // For std::memset
+#include <functional>   // For the kernel bodies
+#include <memory>       // For inputs shared with the timed closures
+#include <sstream>      // For the JSON report
+#include <string>       // For names
+#include <vector>       // For samples
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "blake3.hpp"
+#include "cdc.hpp"
+#include "classify.hpp"
+#include "imagediff.hpp"
+#include "jpeg_transform.hpp"
+#include "palette.hpp"
+#include "simd.hpp"
+#include "svg_optimizer.hpp"
+#include "watermark.hpp"
+
+namespace bench {
+
+enum class Unit { Byte, Pixel };
+
+struct Kernel {
+    std::string name;
+    Unit unit = Unit::Byte;
+    std::vector<std::size_t> sizes; // Input sizes in items
+    bool dispatched = false;        // Has scalar/SSE2/AVX2 variants
+    // Builds the input for one size and returns the work to time (one call = 'size' items).
+    std::function<std::function<void()>(std::size_t size)> prepare;
+};
+
+struct Result {
+    std::string kernel;
+    std::string variant;            // SIMD level, or "-" for kernels without variants
+    Unit unit = Unit::Byte;
+    std::size_t size = 0;
+    double cycles_per_item = 0;     // Median over the samples
+    double cycles_stddev = 0;       // Spread of cycles per item
+    double items_per_second = 0;    // From the median sample's wall time
+    int samples = 0;
+};
+
+// Keeps a value alive so the compiler cannot drop the work producing it.
+template <typename T>
+inline void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+// Deterministic test data (xorshift), so runs are comparable.
+inline std::vector<std::uint8_t> randomBytes(std::size_t n, std::uint64_t seed = 0x9E3779B97F4A7C15ULL) {
+    std::vector<std::uint8_t> bytes(n);
+    std::uint64_t x = seed;
+    for (auto& b : bytes) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        b = static_cast<std::uint8_t>(x >> 24);
+    }
+    return bytes;
+}
+
+// A YCbCr 4:2:0 coefficient image with photo-like statistics: a smooth DC field
+// and a few decaying AC terms per block.
+inline jpeg::CoefImage syntheticJpeg(int width, int height) {
+    jpeg::CoefImage img;
+    img.width = width;
+    img.height = height;
+    img.comps.resize(3);
+    for (int c = 0; c < 3; ++c) {
+        img.comps[c].id = c + 1;
+        img.comps[c].h = img.comps[c].v = c == 0 ? 2 : 1;
+        img.comps[c].tq = c == 0 ? 0 : 1;
+    }
+    for (int q = 0; q < 2; ++q) {
+        img.qt_used[q] = true;
+        for (int k = 0; k < 64; ++k) {
+            img.qt[q][k] = static_cast<std::uint16_t>(4 + (k / 8 + k % 8) * (q ? 3 : 2));
+        }
+    }
+    img.layout();
+    std::uint32_t x = 12345;
+    for (auto& comp : img.comps) {
+        comp.grid_w = img.mcus_x * comp.h;
+        comp.grid_h = img.mcus_y * comp.v;
+        comp.coeffs.assign(static_cast<std::size_t>(comp.grid_w) * comp.grid_h * 64, 0);
+        for (int by = 0; by < comp.grid_h; ++by) {
+            for (int bx = 0; bx < comp.grid_w; ++bx) {
+                std::int16_t* block = comp.block(bx, by);
+                block[0] = static_cast<std::int16_t>(((bx * 7 + by * 5) % 64) - 32);
+                for (int k = 1; k < 16; ++k) {
+                    x = x * 1103515245u + 12345u;
+                    int v = static_cast<int>((x >> 16) % 9) - 4;
+                    block[jpeg::ZIGZAG[k]] = static_cast<std::int16_t>(k < 6 ? v * 2 : (v / 3));
+                }
+            }
+        }
+    }
+    return img;
+}
+
+// An RGBA PNG of a smooth gradient, Paeth-filtered and stored in uncompressed deflate
+// blocks: decoding it times the filters and box averaging rather than the Huffman decoder.
+inline std::string syntheticPng(int width, int height) {
+    std::string raw;
+    for (int y = 0; y < height; ++y) {
+        raw += static_cast<char>(4); // Paeth
+        for (int x = 0; x < width * 4; ++x) {
+            raw += static_cast<char>((x * 7 + y * 3) & 1); // Small residuals
+        }
+    }
+    std::string z = "\x78\x01";
+    for (std::size_t pos = 0; pos < raw.size(); pos += 65535) {
+        std::size_t n = std::min<std::size_t>(65535, raw.size() - pos);
+        z += static_cast<char>(pos + n == raw.size() ? 1 : 0);
+        z += static_cast<char>(n & 0xFF);
+        z += static_cast<char>(n >> 8);
+        z += static_cast<char>(~n & 0xFF);
+        z += static_cast<char>((~n >> 8) & 0xFF);
+        z.append(raw, pos, n);
+    }
+    z.append(4, '\0'); // Adler-32, not checked by the decoder
+    auto chunk = [](std::string& out, const char* tag, const std::string& body) {
+        std::uint32_t n = static_cast<std::uint32_t>(body.size());
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out += static_cast<char>((n >> shift) & 0xFF);
+        }
+        out += tag;
+        out += body;
+        out.append(4, '\0'); // CRC, not checked by the decoder
+    };
+    std::string ihdr;
+    for (int v : {width, height}) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            ihdr += static_cast<char>((v >> shift) & 0xFF);
+        }
+    }
+    ihdr += std::string("\x08\x06\x00\x00\x00", 5);
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    chunk(png, "IHDR", ihdr);
+    chunk(png, "IDAT", z);
+    chunk(png, "IEND", "");
+    return png;
+}
+
+inline std::vector<Kernel> registerKernels() {
+    std::vector<Kernel> kernels;
+
+    kernels.push_back({"blake3.chunks", Unit::Byte, {16 << 10, 256 << 10, 4 << 20}, true, [](std::size_t size) {
+        auto data = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size));
+        auto cvs = std::make_shared<std::vector<blake3::ChainingValue>>(size / blake3::CHUNK_LEN);
+        return std::function<void()>([data, cvs] {
+            blake3::hashChunks(data->data(), cvs->size(), 0, cvs->data());
+            keep(cvs->data()[0]);
+        });
+    }});
+
+    kernels.push_back({"blake3.hasher", Unit::Byte, {4 << 10, 64 << 10, 1 << 20}, false, [](std::size_t size) {
+        auto data = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size));
+        return std::function<void()>([data] {
+            blake3::Hasher hasher;
+            hasher.update(data->data(), data->size());
+            keep(hasher.finalize());
+        });
+    }});
+
+    kernels.push_back({"cdc.chunk", Unit::Byte, {64 << 10, 1 << 20, 16 << 20}, false, [](std::size_t size) {
+        auto data = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size));
+        return std::function<void()>([data] { keep(cdc::chunkBuffer(data->data(), data->size()).size()); });
+    }});
+
+    auto side = [](std::size_t pixels) { return static_cast<int>(std::sqrt(static_cast<double>(pixels))); };
+
+    kernels.push_back({"jpeg.decode", Unit::Pixel, {256 * 256, 1024 * 1024, 2048 * 2048}, false, [side](std::size_t size) {
+        auto bytes = std::make_shared<std::string>(jpeg::encodeBaseline(syntheticJpeg(side(size), side(size))));
+        return std::function<void()>([bytes] {
+            jpeg::CoefImage img;
+            std::string error;
+            jpeg::decodeCoefficients(reinterpret_cast<const std::uint8_t*>(bytes->data()), bytes->size(), img, error);
+            keep(img.width);
+        });
+    }});
+
+    kernels.push_back({"jpeg.encode", Unit::Pixel, {256 * 256, 1024 * 1024, 2048 * 2048}, false, [side](std::size_t size) {
+        auto img = std::make_shared<jpeg::CoefImage>(syntheticJpeg(side(size), side(size)));
+        return std::function<void()>([img] { keep(jpeg::encodeBaseline(*img).size()); });
+    }});
+
+    kernels.push_back({"jpeg.rotate90", Unit::Pixel, {256 * 256, 1024 * 1024, 2048 * 2048}, false, [side](std::size_t size) {
+        auto img = std::make_shared<jpeg::CoefImage>(syntheticJpeg(side(size), side(size)));
+        return std::function<void()>([img] {
+            jpeg::CoefImage out;
+            std::string error;
+            jpeg::transformImage(*img, jpeg::transformForOrientation(6), out, error);
+            keep(out.width);
+        });
+    }});
+
+    kernels.push_back({"palette.hist", Unit::Pixel, {4 << 10, 64 << 10, 1 << 20}, true, [](std::size_t size) {
+        auto rgba = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size * 4));
+        auto hist = std::make_shared<palette::Histogram>();
+        return std::function<void()>([rgba, hist, size] {
+            hist->add(rgba->data(), size);
+            keep(hist->count[0]);
+        });
+    }});
+
+    kernels.push_back({"classify", Unit::Pixel, {4 << 10, 64 << 10}, false, [side](std::size_t size) {
+        auto rgba = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size * 4));
+        int w = side(size);
+        return std::function<void()>([rgba, w] {
+            keep(classify::measure(rgba->data(), w, w, 0).flat);
+        });
+    }});
+
+    kernels.push_back({"diff.delta", Unit::Pixel, {4 << 10, 64 << 10, 1 << 20}, true, [](std::size_t size) {
+        auto a = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size * 4));
+        auto b = std::make_shared<std::vector<std::uint8_t>>(*a);
+        for (std::size_t i = 0; i < b->size(); i += 7) {
+            (*b)[i] ^= 0x15; // Small changes spread over every channel
+        }
+        auto out = std::make_shared<std::vector<std::uint8_t>>(size);
+        return std::function<void()>([a, b, out, size] {
+            imagediff::deltaRow(a->data(), b->data(), size, out->data());
+            keep(out->back());
+        });
+    }});
+
+    kernels.push_back({"watermark.blend", Unit::Pixel, {4 << 10, 64 << 10, 1 << 20}, true, [](std::size_t size) {
+        auto dst = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size * 4));
+        auto mark = std::make_shared<std::vector<std::uint8_t>>(randomBytes(size * 4));
+        watermark::premultiplyRow(mark->data(), size); // The kernel expects a premultiplied mark
+        return std::function<void()>([dst, mark, size] {
+            watermark::blendRow(dst->data(), mark->data(), size);
+            keep(dst->back());
+        });
+    }});
+
+    kernels.push_back({"png.decode", Unit::Pixel, {256 * 256, 1024 * 1024}, false, [side](std::size_t size) {
+        auto bytes = std::make_shared<std::string>(syntheticPng(side(size), side(size)));
+        return std::function<void()>([bytes] {
+            int w = 0, h = 0;
+            std::vector<std::uint8_t> rgba;
+            std::string error;
+            png::decodeScaled(reinterpret_cast<const std::uint8_t*>(bytes->data()), bytes->size(), w, h, rgba, error);
+            keep(w);
+        });
+    }});
+
+    kernels.push_back({"svgmin.path", Unit::Byte, {4 << 10, 64 << 10}, false, [](std::size_t size) {
+        // FontForge-style glyph outlines: absolute curves with full-precision coordinates.
+        auto d = std::make_shared<std::string>("M289.527 352.206");
+        std::uint32_t x = 7;
+        while (d->size() < size) {
+            char buf[96];
+            x = x * 1103515245u + 12345u;
+            double a = (x >> 16) % 5000 / 9.7, b = (x >> 8) % 4000 / 7.3;
+            std::snprintf(buf, sizeof buf, "c%.4f %.4f %.4f %.4f %.4f %.4f", a, -b, a * 0.5, b, -a, b * 0.25);
+            *d += buf;
+        }
+        auto optimizer = std::make_shared<svgmin::PathOptimizer>(2);
+        auto out = std::make_shared<std::string>();
+        return std::function<void()>([d, optimizer, out] {
+            optimizer->optimize(*d, *out);
+            keep(out->size());
+        });
+    }});
+
+    return kernels;
+}
+
+// Cycle counter for the calling thread.
+class CycleCounter {
+public:
+    CycleCounter() {
+#if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof attr;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+            source_ = "perf cycles";
+            return;
+        }
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+        source_ = "tsc";
+#else
+        source_ = "ns";
+#endif
+    }
+
+    ~CycleCounter() {
+#if defined(__linux__)
+        if (fd_ >= 0) close(fd_);
+#endif
+    }
+
+    CycleCounter(const CycleCounter&) = delete;
+    CycleCounter& operator=(const CycleCounter&) = delete;
+
+    std::uint64_t now() const {
+#if defined(__linux__)
+        if (fd_ >= 0) {
+            std::uint64_t count = 0;
+            if (read(fd_, &count, sizeof count) == static_cast<ssize_t>(sizeof count)) {
+                return count;
+            }
+        }
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_lfence();
+        std::uint64_t t = __rdtsc();
+        _mm_lfence();
+        return t;
+#else
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    const char* source() const { return source_; }
+
+private:
+    int fd_ = -1;
+    const char* source_ = "ns";
+};
+
+// Pins the calling thread to one CPU (-1 = the one it is running on). Returns the CPU or -1.
+inline int pinThread(int cpu) {
+#if defined(__linux__)
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof set, &set) == 0 ? cpu : -1;
+#else
+    (void)cpu;
+    return -1;
+#endif
+}
+
+// Times one prepared kernel body.
+inline Result measure(const CycleCounter& counter, const std::function<void()>& work, std::size_t items, int samples) {
+    using Clock = std::chrono::steady_clock;
+    work(); // Warm caches, page in the input
+    // Calibrate: enough repetitions for about 2 ms per sample.
+    std::size_t reps = 1;
+    for (;;) {
+        auto start = Clock::now();
+        for (std::size_t r = 0; r < reps; ++r) work();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (ms >= 2.0 || reps >= (1u << 20)) break;
+        reps *= 2;
+    }
+
+    std::vector<std::pair<double, double>> runs; // Cycles per item, seconds per call
+    for (int s = 0; s < samples; ++s) {
+        auto start = Clock::now();
+        std::uint64_t c0 = counter.now();
+        for (std::size_t r = 0; r < reps; ++r) work();
+        std::uint64_t c1 = counter.now();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        runs.push_back({static_cast<double>(c1 - c0) / static_cast<double>(reps * items), seconds / static_cast<double>(reps)});
+    }
+    std::sort(runs.begin(), runs.end());
+    double mean = 0;
+    for (const auto& run : runs) mean += run.first;
+    mean /= static_cast<double>(runs.size());
+    double var = 0;
+    for (const auto& run : runs) var += (run.first - mean) * (run.first - mean);
+
+    Result result;
+    const auto& median = runs[runs.size() / 2];
+    result.cycles_per_item = median.first;
+    result.cycles_stddev = runs.size() > 1 ? std::sqrt(var / static_cast<double>(runs.size() - 1)) : 0;
+    result.items_per_second = median.second > 0 ? static_cast<double>(items) / median.second : 0;
+    result.samples = samples;
+    return result;
+}
+
+// Runs every kernel whose name contains 'filter'. 'report' is called after each result.
+inline std::vector<Result> runAll(const std::string& filter, int samples, bool quick, const CycleCounter& counter,
+                                  const std::function<void(const Result&)>& report) {
+    std::vector<Result> results;
+    SimdLevel saved = simdLevelCapRef();
+    for (const auto& kernel : registerKernels()) {
+        if (kernel.name.find(filter) == std::string::npos) continue;
+        std::vector<SimdLevel> variants{SimdLevel::Avx2};
+        if (kernel.dispatched) {
+            variants.clear();
+            for (int level = 0; level <= static_cast<int>(detectSimdLevel()); ++level) {
+                variants.push_back(static_cast<SimdLevel>(level));
+            }
+        }
+        std::vector<std::size_t> sizes = kernel.sizes;
+        if (quick) sizes.resize(1); // Smallest size only
+        for (std::size_t size : sizes) {
+            std::function<void()> work = kernel.prepare(size);
+            for (SimdLevel level : variants) {
+                simdLevelCap(level);
+                Result result = measure(counter, work, size, samples);
+                result.kernel = kernel.name;
+                result.variant = kernel.dispatched ? simdLevelName(level) : "-";
+                result.unit = kernel.unit;
+                result.size = size;
+                results.push_back(result);
+                report(result);
+            }
+        }
+    }
+    simdLevelCap(saved);
+    return results;
+}
+
+// JSON report for 'bench --json' (and read back by --compare).
+inline std::string renderJson(const std::vector<Result>& results, const char* counter, int cpu) {
+    std::ostringstream out;
+    out << "{\n  \"counter\": \"" << counter << "\",\n  \"cpu\": " << cpu << ",\n  \"results\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"kernel\": \"" << r.kernel << "\", \"variant\": \"" << r.variant
+            << "\", \"unit\": \"" << (r.unit == Unit::Byte ? "byte" : "pixel") << "\", \"size\": " << r.size
+            << ", \"cycles_per_item\": " << r.cycles_per_item << ", \"cycles_stddev\": " << r.cycles_stddev
+            << ", \"items_per_second\": " << r.items_per_second << ", \"samples\": " << r.samples << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+// Finds the cycles per item of one result in a saved report (0 if absent).
+inline double baselineCycles(const std::string& json, const Result& r) {
+    std::string key = "{\"kernel\": \"" + r.kernel + "\", \"variant\": \"" + r.variant + "\"";
+    std::size_t pos = 0;
+    while ((pos = json.find(key, pos)) != std::string::npos) {
+        std::size_t line_end = json.find('}', pos);
+        std::string entry = json.substr(pos, line_end - pos);
+        pos = line_end;
+        std::size_t size_at = entry.find("\"size\": ");
+        if (size_at == std::string::npos || std::strtoull(entry.c_str() + size_at + 8, nullptr, 10) != r.size) continue;
+        std::size_t cycles_at = entry.find("\"cycles_per_item\": ");
+        return cycles_at == std::string::npos ? 0 : std::strtod(entry.c_str() + cycles_at + 19, nullptr);
+    }
+    return 0;
+}
+
+} // namespace bench
@@ -0,0 +1,503 @@
+// blake3.hpp - BLAKE3 content hashing for gallery files.
+//
+// A portable implementation of the BLAKE3 hash (default 32-byte output, no
+// key, no derive-key mode) plus a wide path that hashes one large file on all
+// cores with SIMD chunk compression. Content hashes identify image versions in
+// the gallery history and the object store.
+#pragma once
+
+#include <algorithm>    // For std::min
+#include <array>        // For fixed-size chaining values
+#include <cstdint>      // For std::uint32_t, std::uint64_t
+#include <cstring>      // For std::memcpy
+#include <filesystem>   // For fs::path
+#include <string>       // For hex digests
+#include <thread>       // For hashing chunk ranges in parallel
+#include <vector>       // For the chaining value stack
+
+#include "mapped_file.hpp"
+#include "simd.hpp"
+
+namespace fs = std::filesystem;
+
+namespace blake3 {
+
+constexpr std::size_t BLOCK_LEN = 64;   // Bytes per compression
+constexpr std::size_t CHUNK_LEN = 1024; // Bytes per leaf chunk
+constexpr std::size_t OUT_LEN = 32;     // Default digest size
+
+// Domain separation flags.
+constexpr std::uint32_t CHUNK_START = 1 << 0;
+constexpr std::uint32_t CHUNK_END = 1 << 1;
+constexpr std::uint32_t PARENT = 1 << 2;
+constexpr std::uint32_t ROOT = 1 << 3;
+
+constexpr std::uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+constexpr std::uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+using ChainingValue = std::array<std::uint32_t, 8>;
+
+inline std::uint32_t rotr(std::uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// The quarter-round mixing function.
+inline void g(std::uint32_t* s, int a, int b, int c, int d, std::uint32_t mx, std::uint32_t my) {
+    s[a] = s[a] + s[b] + mx;
+    s[d] = rotr(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = rotr(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + my;
+    s[d] = rotr(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = rotr(s[b] ^ s[c], 7);
+}
+
+// Loads a 64-byte block as sixteen little-endian words.
+inline void loadBlock(const std::uint8_t* block, std::uint32_t* m) {
+    for (int i = 0; i < 16; ++i) {
+        m[i] = std::uint32_t(block[4 * i]) | (std::uint32_t(block[4 * i + 1]) << 8) |
+               (std::uint32_t(block[4 * i + 2]) << 16) | (std::uint32_t(block[4 * i + 3]) << 24);
+    }
+}
+
+// Runs the compression function and returns all 16 output words.
+inline void compress(const ChainingValue& cv, const std::uint32_t* m, std::uint64_t counter,
+                     std::uint32_t block_len, std::uint32_t flags, std::uint32_t* out) {
+    std::uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        static_cast<std::uint32_t>(counter), static_cast<std::uint32_t>(counter >> 32), block_len, flags,
+    };
+    for (const auto& sched : MSG_SCHEDULE) {
+        g(s, 0, 4, 8, 12, m[sched[0]], m[sched[1]]);
+        g(s, 1, 5, 9, 13, m[sched[2]], m[sched[3]]);
+        g(s, 2, 6, 10, 14, m[sched[4]], m[sched[5]]);
+        g(s, 3, 7, 11, 15, m[sched[6]], m[sched[7]]);
+        g(s, 0, 5, 10, 15, m[sched[8]], m[sched[9]]);
+        g(s, 1, 6, 11, 12, m[sched[10]], m[sched[11]]);
+        g(s, 2, 7, 8, 13, m[sched[12]], m[sched[13]]);
+        g(s, 3, 4, 9, 14, m[sched[14]], m[sched[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+// Compresses and keeps only the new chaining value.
+inline ChainingValue compressCv(const ChainingValue& cv, const std::uint32_t* m, std::uint64_t counter,
+                                std::uint32_t block_len, std::uint32_t flags) {
+    std::uint32_t out[16];
+    compress(cv, m, counter, block_len, flags, out);
+    ChainingValue next;
+    std::memcpy(next.data(), out, sizeof(std::uint32_t) * 8);
+    return next;
+}
+
+// The inputs of a not-yet-performed compression; the root node is finalized
+// with the ROOT flag, every other node is reduced to its chaining value.
+struct Output {
+    ChainingValue cv;
+    std::uint32_t block[16];
+    std::uint64_t counter;
+    std::uint32_t block_len;
+    std::uint32_t flags;
+
+    ChainingValue chainingValue() const {
+        return compressCv(cv, block, counter, block_len, flags);
+    }
+
+    std::array<std::uint8_t, OUT_LEN> rootBytes() const {
+        std::uint32_t words[16];
+        compress(cv, block, 0, block_len, flags | ROOT, words);
+        std::array<std::uint8_t, OUT_LEN> bytes;
+        for (std::size_t i = 0; i < OUT_LEN / 4; ++i) {
+            bytes[4 * i] = static_cast<std::uint8_t>(words[i]);
+            bytes[4 * i + 1] = static_cast<std::uint8_t>(words[i] >> 8);
+            bytes[4 * i + 2] = static_cast<std::uint8_t>(words[i] >> 16);
+            bytes[4 * i + 3] = static_cast<std::uint8_t>(words[i] >> 24);
+        }
+        return bytes;
+    }
+};
+
+// Builds the output of a parent node from its two children.
+inline Output parentOutput(const ChainingValue& left, const ChainingValue& right) {
+    Output out;
+    out.cv = {IV[0], IV[1], IV[2], IV[3], IV[4], IV[5], IV[6], IV[7]};
+    std::memcpy(out.block, left.data(), 32);
+    std::memcpy(out.block + 8, right.data(), 32);
+    out.counter = 0;
+    out.block_len = BLOCK_LEN;
+    out.flags = PARENT;
+    return out;
+}
+
+// Incremental state of one 1 KiB leaf chunk.
+struct ChunkState {
+    ChainingValue cv{IV[0], IV[1], IV[2], IV[3], IV[4], IV[5], IV[6], IV[7]};
+    std::uint64_t chunk_counter = 0;
+    std::uint8_t block[BLOCK_LEN] = {0};
+    std::size_t block_len = 0;
+    std::size_t blocks_compressed = 0;
+
+    std::size_t length() const {
+        return BLOCK_LEN * blocks_compressed + block_len;
+    }
+
+    std::uint32_t startFlag() const {
+        return blocks_compressed == 0 ? CHUNK_START : 0;
+    }
+
+    void update(const std::uint8_t* input, std::size_t len) {
+        while (len > 0) {
+            // A full buffered block is compressed only once more input arrives,
+            // because the last block of the chunk needs the CHUNK_END flag.
+            if (block_len == BLOCK_LEN) {
+                std::uint32_t m[16];
+                loadBlock(block, m);
+                cv = compressCv(cv, m, chunk_counter, BLOCK_LEN, startFlag());
+                ++blocks_compressed;
+                block_len = 0;
+                std::memset(block, 0, sizeof(block));
+            }
+            std::size_t take = std::min(BLOCK_LEN - block_len, len);
+            std::memcpy(block + block_len, input, take);
+            block_len += take;
+            input += take;
+            len -= take;
+        }
+    }
+
+    Output output() const {
+        Output out;
+        out.cv = cv;
+        loadBlock(block, out.block);
+        out.counter = chunk_counter;
+        out.block_len = static_cast<std::uint32_t>(block_len);
+        out.flags = startFlag() | CHUNK_END;
+        return out;
+    }
+};
+
+// Streaming BLAKE3 hasher.
+class Hasher {
+public:
+    void update(const void* data, std::size_t len) {
+        const std::uint8_t* input = static_cast<const std::uint8_t*>(data);
+        while (len > 0) {
+            // Finish the current chunk only when more input is known to follow it.
+            if (chunk_.length() == CHUNK_LEN) {
+                ChainingValue chunk_cv = chunk_.output().chainingValue();
+                std::uint64_t total_chunks = chunk_.chunk_counter + 1;
+                addChunkCv(chunk_cv, total_chunks);
+                chunk_ = ChunkState();
+                chunk_.chunk_counter = total_chunks;
+            }
+            std::size_t take = std::min(CHUNK_LEN - chunk_.length(), len);
+            chunk_.update(input, take);
+            input += take;
+            len -= take;
+        }
+    }
+
+    std::array<std::uint8_t, OUT_LEN> finalize() const {
+        Output out = chunk_.output();
+        for (std::size_t i = stack_.size(); i-- > 0;) {
+            out = parentOutput(stack_[i], out.chainingValue());
+        }
+        return out.rootBytes();
+    }
+
+private:
+    // Merges completed subtrees: every trailing zero bit of the chunk count closes one.
+    void addChunkCv(ChainingValue cv, std::uint64_t total_chunks) {
+        while ((total_chunks & 1) == 0) {
+            cv = parentOutput(stack_.back(), cv).chainingValue();
+            stack_.pop_back();
+            total_chunks >>= 1;
+        }
+        stack_.push_back(cv);
+    }
+
+    ChunkState chunk_;
+    std::vector<ChainingValue> stack_;
+};
+
+// Formats a digest as lowercase hex.
+inline std::string toHex(const std::array<std::uint8_t, OUT_LEN>& digest) {
+    static const char* digits = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(OUT_LEN * 2);
+    for (std::uint8_t byte : digest) {
+        hex += digits[byte >> 4];
+        hex += digits[byte & 15];
+    }
+    return hex;
+}
+
+// Hashes a byte range and returns the hex digest.
+inline std::string hashBytes(const void* data, std::size_t len) {
+    Hasher hasher;
+    hasher.update(data, len);
+    return toHex(hasher.finalize());
+}
+
+// ---------------------------------------------------------------------------
+// Wide hashing of whole buffers.
+//
+// A buffer of N chunks is the left-balanced tree of its chunk chaining values,
+// so every full chunk can be compressed independently: several chunks at once
+// in SIMD lanes (one chunk per lane) and disjoint chunk ranges on separate
+// threads. The parent nodes are then folded on one thread; they cost about one
+// sixteenth of the chunk work. The root hash is identical to Hasher's.
+// ---------------------------------------------------------------------------
+
+// Compresses 'count' full chunks starting at 'input' with the scalar kernel.
+inline void hashChunksScalar(const std::uint8_t* input, std::size_t count, std::uint64_t counter, ChainingValue* out) {
+    for (std::size_t c = 0; c < count; ++c) {
+        ChainingValue cv{IV[0], IV[1], IV[2], IV[3], IV[4], IV[5], IV[6], IV[7]};
+        const std::uint8_t* chunk = input + c * CHUNK_LEN;
+        for (std::size_t b = 0; b < CHUNK_LEN / BLOCK_LEN; ++b) {
+            std::uint32_t m[16];
+            loadBlock(chunk + b * BLOCK_LEN, m);
+            std::uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == CHUNK_LEN / BLOCK_LEN - 1 ? CHUNK_END : 0);
+            cv = compressCv(cv, m, counter + c, BLOCK_LEN, flags);
+        }
+        out[c] = cv;
+    }
+}
+
+#if CARO_X86_SIMD
+// The seven rounds on vectors of lanes. Written as macros rather than lambdas so the
+// vector values never cross a function boundary (no ABI issues without -mavx2).
+#define SSE_ROT16(x) _mm_or_si128(_mm_srli_epi32(x, 16), _mm_slli_epi32(x, 16))
+#define SSE_ROT12(x) _mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20))
+#define SSE_ROT8(x) _mm_or_si128(_mm_srli_epi32(x, 8), _mm_slli_epi32(x, 24))
+#define SSE_ROT7(x) _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25))
+#define AVX2_ROT16(x) _mm256_shuffle_epi8(x, rot16_mask)
+#define AVX2_ROT12(x) _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20))
+#define AVX2_ROT8(x) _mm256_shuffle_epi8(x, rot8_mask)
+#define AVX2_ROT7(x) _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25))
+#define CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, a, b, c, d, x, y)                   \
+    s[a] = ADD(ADD(s[a], s[b]), m[sched[x]]);                                                  \
+    s[d] = ROT16(XOR(s[d], s[a]));                                                             \
+    s[c] = ADD(s[c], s[d]);                                                                    \
+    s[b] = ROT12(XOR(s[b], s[c]));                                                             \
+    s[a] = ADD(ADD(s[a], s[b]), m[sched[y]]);                                                  \
+    s[d] = ROT8(XOR(s[d], s[a]));                                                              \
+    s[c] = ADD(s[c], s[d]);                                                                    \
+    s[b] = ROT7(XOR(s[b], s[c]));
+#define CARO_BLAKE3_ROUNDS(ADD, XOR, ROT16, ROT12, ROT8, ROT7)                                  \
+    for (const auto& sched : MSG_SCHEDULE) {                                                   \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 0, 4, 8, 12, 0, 1)                  \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 1, 5, 9, 13, 2, 3)                  \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 2, 6, 10, 14, 4, 5)                 \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 3, 7, 11, 15, 6, 7)                 \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 0, 5, 10, 15, 8, 9)                 \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 1, 6, 11, 12, 10, 11)               \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 2, 7, 8, 13, 12, 13)                \
+        CARO_BLAKE3_G(ADD, XOR, ROT16, ROT12, ROT8, ROT7, 3, 4, 9, 14, 14, 15)                \
+    }
+
+// Four chunks at once, one per SSE2 lane.
+inline void hashChunks4Sse2(const std::uint8_t* input, std::uint64_t counter, ChainingValue* out) {
+    __m128i h[8];
+    for (int i = 0; i < 8; ++i) {
+        h[i] = _mm_set1_epi32(static_cast<int>(IV[i]));
+    }
+    __m128i ctr_lo = _mm_setr_epi32(static_cast<int>(counter), static_cast<int>(counter + 1),
+                                    static_cast<int>(counter + 2), static_cast<int>(counter + 3));
+    __m128i ctr_hi = _mm_setr_epi32(static_cast<int>((counter) >> 32), static_cast<int>((counter + 1) >> 32),
+                                    static_cast<int>((counter + 2) >> 32), static_cast<int>((counter + 3) >> 32));
+    for (std::size_t b = 0; b < CHUNK_LEN / BLOCK_LEN; ++b) {
+        __m128i m[16];
+        for (int w = 0; w < 16; ++w) {
+            std::uint32_t lane[4];
+            for (int l = 0; l < 4; ++l) {
+                std::memcpy(&lane[l], input + l * CHUNK_LEN + b * BLOCK_LEN + w * 4, 4);
+            }
+            m[w] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane));
+        }
+        std::uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == CHUNK_LEN / BLOCK_LEN - 1 ? CHUNK_END : 0);
+        __m128i s[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm_set1_epi32(static_cast<int>(IV[0])), _mm_set1_epi32(static_cast<int>(IV[1])),
+            _mm_set1_epi32(static_cast<int>(IV[2])), _mm_set1_epi32(static_cast<int>(IV[3])),
+            ctr_lo, ctr_hi, _mm_set1_epi32(BLOCK_LEN), _mm_set1_epi32(static_cast<int>(flags)),
+        };
+        CARO_BLAKE3_ROUNDS(_mm_add_epi32, _mm_xor_si128, SSE_ROT16, SSE_ROT12, SSE_ROT8, SSE_ROT7)
+        for (int i = 0; i < 8; ++i) {
+            h[i] = _mm_xor_si128(s[i], s[i + 8]);
+        }
+    }
+    for (int i = 0; i < 8; ++i) {
+        std::uint32_t lane[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lane), h[i]);
+        for (int l = 0; l < 4; ++l) {
+            out[l][i] = lane[l];
+        }
+    }
+}
+
+// Eight chunks at once, one per AVX2 lane; message words are gathered across chunks.
+CARO_TARGET_AVX2 inline void hashChunks8Avx2(const std::uint8_t* input, std::uint64_t counter, ChainingValue* out) {
+    const __m256i rot16_mask = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                                2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8_mask = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                                               1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    const __m256i lanes = _mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792); // Chunk strides in words
+    __m256i h[8];
+    for (int i = 0; i < 8; ++i) {
+        h[i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+    }
+    alignas(32) std::uint32_t lo[8], hi[8];
+    for (int l = 0; l < 8; ++l) {
+        lo[l] = static_cast<std::uint32_t>(counter + l);
+        hi[l] = static_cast<std::uint32_t>((counter + l) >> 32);
+    }
+    __m256i ctr_lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(lo));
+    __m256i ctr_hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(hi));
+    for (std::size_t b = 0; b < CHUNK_LEN / BLOCK_LEN; ++b) {
+        __m256i m[16];
+        const int* block = reinterpret_cast<const int*>(input + b * BLOCK_LEN);
+        for (int w = 0; w < 16; ++w) {
+            m[w] = _mm256_i32gather_epi32(block + w, lanes, 4);
+        }
+        std::uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == CHUNK_LEN / BLOCK_LEN - 1 ? CHUNK_END : 0);
+        __m256i s[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm256_set1_epi32(static_cast<int>(IV[0])), _mm256_set1_epi32(static_cast<int>(IV[1])),
+            _mm256_set1_epi32(static_cast<int>(IV[2])), _mm256_set1_epi32(static_cast<int>(IV[3])),
+            ctr_lo, ctr_hi, _mm256_set1_epi32(BLOCK_LEN), _mm256_set1_epi32(static_cast<int>(flags)),
+        };
+        CARO_BLAKE3_ROUNDS(_mm256_add_epi32, _mm256_xor_si256, AVX2_ROT16, AVX2_ROT12, AVX2_ROT8, AVX2_ROT7)
+        for (int i = 0; i < 8; ++i) {
+            h[i] = _mm256_xor_si256(s[i], s[i + 8]);
+        }
+    }
+    for (int i = 0; i < 8; ++i) {
+        alignas(32) std::uint32_t lane[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lane), h[i]);
+        for (int l = 0; l < 8; ++l) {
+            out[l][i] = lane[l];
+        }
+    }
+}
+#undef CARO_BLAKE3_ROUNDS
+#undef CARO_BLAKE3_G
+#undef SSE_ROT16
+#undef SSE_ROT12
+#undef SSE_ROT8
+#undef SSE_ROT7
+#undef AVX2_ROT16
+#undef AVX2_ROT12
+#undef AVX2_ROT8
+#undef AVX2_ROT7
+#endif
+
+// Compresses 'count' full chunks with the widest kernel available.
+inline void hashChunks(const std::uint8_t* input, std::size_t count, std::uint64_t counter, ChainingValue* out) {
+    std::size_t c = 0;
+#if CARO_X86_SIMD
+    SimdLevel level = activeSimdLevel();
+    if (level == SimdLevel::Avx2) {
+        for (; c + 8 <= count; c += 8) {
+            hashChunks8Avx2(input + c * CHUNK_LEN, counter + c, out + c);
+        }
+    }
+    if (level != SimdLevel::Scalar) {
+        for (; c + 4 <= count; c += 4) {
+            hashChunks4Sse2(input + c * CHUNK_LEN, counter + c, out + c);
+        }
+    }
+#endif
+    hashChunksScalar(input + c * CHUNK_LEN, count - c, counter + c, out + c);
+}
+
+// Folds the chaining values of 'count' consecutive chunks into the chaining value of their subtree.
+inline ChainingValue foldSubtree(const ChainingValue* cvs, std::size_t count) {
+    if (count == 1) {
+        return cvs[0];
+    }
+    std::size_t left = 1;
+    while (left * 2 < count) {
+        left *= 2; // Largest power of two strictly below count
+    }
+    return parentOutput(foldSubtree(cvs, left), foldSubtree(cvs + left, count - left)).chainingValue();
+}
+
+// Hashes a buffer using up to 'threads' threads. The result equals Hasher's.
+inline std::array<std::uint8_t, OUT_LEN> hashParallel(const std::uint8_t* data, std::size_t len, unsigned threads) {
+    std::size_t chunks = len == 0 ? 1 : (len + CHUNK_LEN - 1) / CHUNK_LEN;
+    if (chunks == 1) {
+        Hasher hasher;
+        hasher.update(data, len);
+        return hasher.finalize();
+    }
+
+    // Every chunk but the last is full and goes through the wide kernels.
+    std::vector<ChainingValue> cvs(chunks);
+    std::size_t full = chunks - 1;
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(full / 64 + 1))); // >= 64 KiB per thread
+    std::vector<std::thread> workers;
+    std::size_t per_thread = (full + threads - 1) / threads;
+    for (unsigned t = 0; t < threads; ++t) {
+        std::size_t first = t * per_thread;
+        std::size_t count = std::min(per_thread, full - std::min(full, first));
+        if (count == 0) {
+            break;
+        }
+        auto work = [=, &cvs] { hashChunks(data + first * CHUNK_LEN, count, first, cvs.data() + first); };
+        if (t + 1 == threads) {
+            work(); // The calling thread takes the last range
+        } else {
+            workers.emplace_back(work);
+        }
+    }
+
+    // The last (possibly partial) chunk.
+    ChunkState last;
+    last.chunk_counter = full;
+    last.update(data + full * CHUNK_LEN, len - full * CHUNK_LEN);
+    cvs[full] = last.output().chainingValue();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // The root is the parent of the two top subtrees, finalized with the ROOT flag.
+    std::size_t left = 1;
+    while (left * 2 < chunks) {
+        left *= 2;
+    }
+    return parentOutput(foldSubtree(cvs.data(), left), foldSubtree(cvs.data() + left, chunks - left)).rootBytes();
+}
+
+// Hashes a whole file and returns the hex digest, or an empty string if it cannot be read.
+// The file is memory-mapped and its chunks are spread over all cores.
+inline std::string hashFile(const fs::path& path, unsigned threads = 0) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return "";
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return toHex(hashParallel(file.data(), file.size(), threads));
+}
+
+} // namespace blake3
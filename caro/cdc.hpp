@@ -0,0 +1,109 @@
+// cdc.hpp - FastCDC content-defined chunking.
+//
+// Splits a file into variable-size chunks whose boundaries depend only on the
+// bytes around them, so an edit (new metadata, an appended chunk) moves only
+// the boundaries next to it and every other chunk keeps its hash. Follows
+// FastCDC: a gear rolling hash, a cut-point skip up to the minimum size,
+// normalized chunking (a stricter mask before the average size and a looser
+// one after it) and rolling two bytes per loop iteration.
+//
+// There is no SIMD kernel. The fingerprint at a byte depends only on the 64
+// bytes ending there, so lanes could each roll a segment (warmed up over the
+// 64 bytes before it) and merge their first candidates in order. Every lane
+// still needs one gear-table load per byte, though, and the loop below already
+// runs at about one cycle per byte: SSE2 and AVX2 versions, with or without
+// gathers, measured from even to 2.9 times slower in 'caro bench cdc'.
+#pragma once
+
+#include <array>        // For the gear tables
+#include <cstdint>      // For std::uint64_t
+#include <vector>       // For chunk lists
+
+namespace cdc {
+
+constexpr std::size_t MIN_SIZE = 2 * 1024;    // No cut before this many bytes
+constexpr std::size_t AVG_SIZE = 8 * 1024;    // Target average chunk size
+constexpr std::size_t MAX_SIZE = 64 * 1024;   // Forced cut after this many bytes
+
+// Normalization level 2 masks for an 8 KiB average: 15 effective bits before the
+// average size, 11 after, spread over the high bits where the gear hash mixes best.
+constexpr std::uint64_t MASK_S = 0x0003590703530000ULL;
+constexpr std::uint64_t MASK_L = 0x0000d90003530000ULL;
+constexpr std::uint64_t MASK_S_LS = MASK_S << 1;
+constexpr std::uint64_t MASK_L_LS = MASK_L << 1;
+
+// 256 pseudo-random 64-bit values (splitmix64 from a fixed seed). Changing the seed
+// changes every boundary and therefore invalidates existing chunk stores.
+constexpr std::array<std::uint64_t, 256> makeGear(int shift) {
+    std::array<std::uint64_t, 256> table{};
+    std::uint64_t state = 0x63617266646300ULL; // Fixed seed
+    for (auto& value : table) {
+        state += 0x9E3779B97F4A7C15ULL;
+        std::uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        value = (z ^ (z >> 31)) << shift;
+    }
+    return table;
+}
+
+constexpr std::array<std::uint64_t, 256> GEAR = makeGear(0);
+constexpr std::array<std::uint64_t, 256> GEAR_LS = makeGear(1); // Pre-shifted for the two-byte step
+
+// Returns the length of the chunk starting at 'src' (at most 'len' bytes).
+inline std::size_t cutPoint(const std::uint8_t* src, std::size_t len) {
+    if (len <= MIN_SIZE) {
+        return len;
+    }
+    std::size_t normal = AVG_SIZE;
+    std::size_t limit = len < MAX_SIZE ? len : MAX_SIZE;
+    if (limit < normal) {
+        normal = limit;
+    }
+    std::uint64_t fp = 0;
+    std::size_t i = MIN_SIZE;
+    // Bytes before MIN_SIZE can never end the chunk, so hashing starts there. The hash
+    // shifts one bit per byte, so after 64 bytes it depends only on the bytes in that window.
+    for (; i + 1 < normal; i += 2) {
+        fp = (fp << 2) + GEAR_LS[src[i]];
+        if (!(fp & MASK_S_LS)) {
+            return i;
+        }
+        fp += GEAR[src[i + 1]];
+        if (!(fp & MASK_S)) {
+            return i + 1;
+        }
+    }
+    for (; i + 1 < limit; i += 2) {
+        fp = (fp << 2) + GEAR_LS[src[i]];
+        if (!(fp & MASK_L_LS)) {
+            return i;
+        }
+        fp += GEAR[src[i + 1]];
+        if (!(fp & MASK_L)) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+// One chunk of a buffer.
+struct Chunk {
+    std::size_t offset;
+    std::size_t length;
+};
+
+// Splits a whole buffer into chunks.
+inline std::vector<Chunk> chunkBuffer(const std::uint8_t* data, std::size_t len) {
+    std::vector<Chunk> chunks;
+    chunks.reserve(len / AVG_SIZE + 1);
+    std::size_t offset = 0;
+    while (offset < len) {
+        std::size_t size = cutPoint(data + offset, len - offset);
+        chunks.push_back({offset, size});
+        offset += size;
+    }
+    return chunks;
+}
+
+} // namespace cdc
@@ -0,0 +1,223 @@
+// classify.hpp - Photo-vs-graphic classifier that picks a codec per image.
+//
+// The neighbour steps are measured on the same 1/8-scale decode as the palette
+// (palette.hpp). Photos are continuous tone: most neighbouring pixels differ a
+// little and few are equal. Graphics are flat fills with sharp edges: many
+// neighbours are identical and the rest jump. Whether 256 colors cover the
+// image is counted on exact 24-bit colors of the full-size decode instead: the
+// 8x8 means blend the edges of a graphic into colors it does not have, and
+// coarse bins would make nearly every photo fit. From the share of flat,
+// smooth and edge steps, that palette share and the presence of alpha, the
+// cheapest adequate format is chosen:
+//
+//   photo, opaque                      -> JPEG
+//   photo, with transparency           -> WebP (JPEG has no alpha, PNG is huge)
+//   graphic, 256 colors cover it       -> palette PNG
+//   graphic, sharp edges or alpha      -> lossless PNG (JPEG rings around text and lines)
+//   graphic, soft many-color artwork   -> JPEG
+#pragma once
+
+#include <algorithm>    // For std::nth_element, std::max
+#include <cstdint>      // For counters
+#include <cstdlib>      // For std::abs
+#include <functional>   // For std::greater
+#include <string>       // For format names
+#include <vector>       // For the color histogram
+
+#include "jpeg.hpp"
+#include "mapped_file.hpp"
+#include "palette.hpp"  // For 1/8-scale decodes
+#include "png.hpp"
+
+namespace classify {
+
+constexpr int SMOOTH_STEP = 24;  // Largest channel step still counted as continuous tone
+constexpr int EDGE_STEP = 64;    // Smallest channel step counted as an edge
+constexpr int MAX_COLORS = 256;  // Palette PNG limit
+constexpr double PALETTE_SHARE = 0.95; // Share of pixels a palette must cover exactly enough
+constexpr double SHARP_EDGES = 0.08;   // Edge share above which lossy codecs visibly ring
+constexpr std::size_t PALETTE_SAMPLES = 1 << 18; // Pixels counted for the palette share at most
+
+struct Features {
+    double flat = 0;   // Share of neighbour pairs with the same color
+    double smooth = 0; // Share of small nonzero steps
+    double edges = 0;  // Share of steps of EDGE_STEP or more
+    double palette_share = -1; // Share of pixels in the MAX_COLORS most common exact colors (-1: not measured)
+    bool alpha = false;
+};
+
+enum class Format { PalettePng, Png, Jpeg, Webp };
+
+inline const char* formatName(Format format) {
+    switch (format) {
+    case Format::PalettePng: return "png8";
+    case Format::Png: return "png";
+    case Format::Jpeg: return "jpeg";
+    case Format::Webp: return "webp";
+    }
+    return "png";
+}
+
+// File extension for a format name ("png8", "png", "jpeg", "webp", "gif"); 'current'
+// keeps the gallery's spelling when it already fits.
+inline std::string formatExtension(const std::string& format, const std::string& current) {
+    std::string lower = current;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (format == "png8" || format == "png") {
+        return lower == "png" ? current : "png";
+    }
+    if (format == "jpeg") {
+        return lower == "jpg" || lower == "jpeg" ? current : "jpg";
+    }
+    if (format == "webp" || format == "gif") {
+        return lower == format ? current : format;
+    }
+    return current;
+}
+
+// Grid spacing that keeps a w x h image to at most PALETTE_SAMPLES pixels.
+inline int sampleStep(int w, int h) {
+    int step = 1;
+    while (static_cast<std::size_t>((w + step - 1) / step) * static_cast<std::size_t>((h + step - 1) / step) >
+           PALETTE_SAMPLES) {
+        ++step;
+    }
+    return step;
+}
+
+// Share of pixels covered by the MAX_COLORS most common exact colors (fully transparent
+// pixels count as one color). Large images are sampled on a regular grid of at most
+// PALETTE_SAMPLES pixels; sampling, unlike averaging, never invents colors.
+inline double paletteShare(const std::uint8_t* rgba, int w, int h) {
+    if (w <= 0 || h <= 0) {
+        return 1;
+    }
+    std::size_t stride = static_cast<std::size_t>(sampleStep(w, h));
+    std::vector<std::uint32_t> colors;
+    colors.reserve(((w + stride - 1) / stride) * ((h + stride - 1) / stride));
+    for (std::size_t y = 0; y < static_cast<std::size_t>(h); y += stride) {
+        const std::uint8_t* row = rgba + y * w * 4;
+        for (std::size_t x = 0; x < static_cast<std::size_t>(w); x += stride) {
+            const std::uint8_t* p = row + 4 * x;
+            colors.push_back(p[3] == 0 ? 0 : static_cast<std::uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+        }
+    }
+    std::sort(colors.begin(), colors.end());
+    std::vector<std::uint32_t> counts;
+    for (std::size_t i = 0, j = 0; i < colors.size(); i = j) {
+        while (j < colors.size() && colors[j] == colors[i]) {
+            ++j;
+        }
+        counts.push_back(static_cast<std::uint32_t>(j - i));
+    }
+    std::uint64_t covered = 0;
+    if (counts.size() > MAX_COLORS) {
+        std::nth_element(counts.begin(), counts.begin() + MAX_COLORS, counts.end(), std::greater<std::uint32_t>());
+        counts.resize(MAX_COLORS);
+    }
+    for (std::uint32_t count : counts) {
+        covered += count;
+    }
+    return static_cast<double>(covered) / colors.size();
+}
+
+// Neighbour steps and alpha; 'tolerance' absorbs the quantization noise of JPEG sources
+// in flat areas. The palette share is left to paletteShare().
+inline Features measure(const std::uint8_t* rgba, int w, int h, int tolerance) {
+    Features f;
+    std::uint64_t pairs = 0, flat = 0, smooth = 0, edges = 0;
+    auto step = [](const std::uint8_t* a, const std::uint8_t* b) {
+        int d = 0;
+        for (int c = 0; c < 4; ++c) {
+            d = std::max(d, std::abs(a[c] - b[c]));
+        }
+        return d;
+    };
+    for (int y = 0; y < h; ++y) {
+        const std::uint8_t* row = rgba + static_cast<std::size_t>(y) * w * 4;
+        for (int x = 0; x < w; ++x) {
+            const std::uint8_t* p = row + 4 * x;
+            f.alpha = f.alpha || p[3] != 255;
+            for (int n = 0; n < 2; ++n) {
+                if (n == 0 ? x + 1 == w : y + 1 == h) {
+                    continue;
+                }
+                int d = step(p, n == 0 ? p + 4 : p + static_cast<std::size_t>(w) * 4);
+                ++pairs;
+                if (d <= tolerance) {
+                    ++flat;
+                } else if (d <= SMOOTH_STEP) {
+                    ++smooth;
+                } else if (d >= EDGE_STEP) {
+                    ++edges;
+                }
+            }
+        }
+    }
+    if (pairs) {
+        f.flat = static_cast<double>(flat) / pairs;
+        f.smooth = static_cast<double>(smooth) / pairs;
+        f.edges = static_cast<double>(edges) / pairs;
+    }
+    return f;
+}
+
+// Continuous tone dominates: more small steps than equal neighbours, and few hard edges
+// (small icons and line art have few equal neighbours too, but many jumps).
+inline bool isPhoto(const Features& f) {
+    return f.smooth > f.flat && f.flat < 0.5 && f.edges < SHARP_EDGES;
+}
+
+inline Format choose(const Features& f) {
+    if (isPhoto(f)) {
+        return f.alpha ? Format::Webp : Format::Jpeg;
+    }
+    if (f.palette_share >= PALETTE_SHARE) {
+        return Format::PalettePng;
+    }
+    return f.alpha || f.edges >= SHARP_EDGES ? Format::Png : Format::Jpeg;
+}
+
+// Measures a PNG or JPEG file: steps from its 1/8-scale decode, the palette share from
+// exact pixels (a full-size PNG decode, sampled JPEG pixels). Photos never become palette
+// PNGs, so theirs is not measured.
+inline bool measureFile(const fs::path& path, const std::string& format, Features& out, std::string& error) {
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "cannot read file";
+        return false;
+    }
+    int w = 0, h = 0;
+    std::vector<std::uint8_t> rgba;
+    if (format == "jpeg") {
+        jpeg::CoefImage img; // Entropy-decoded once for both decodes
+        if (!jpeg::decodeCoefficients(file.data(), file.size(), img, error) || !jpeg::dcThumbnail(img, w, h, rgba, error)) {
+            return false;
+        }
+        out = measure(rgba.data(), w, h, 2);
+        if (!isPhoto(out)) {
+            if (!jpeg::samplePixels(img, sampleStep(img.width, img.height), w, h, rgba, error)) {
+                return false;
+            }
+            out.palette_share = paletteShare(rgba.data(), w, h);
+        }
+        return true;
+    }
+    if (format != "png") {
+        error = format + " images are not supported";
+        return false;
+    }
+    if (!png::decodeScaled(file.data(), file.size(), w, h, rgba, error)) {
+        return false;
+    }
+    out = measure(rgba.data(), w, h, 0);
+    if (!isPhoto(out)) {
+        if (!png::decode(file.data(), file.size(), w, h, rgba, error)) {
+            return false;
+        }
+        out.palette_share = paletteShare(rgba.data(), w, h);
+    }
+    return true;
+}
+
+} // namespace classify
@@ -0,0 +1,261 @@
+// compact.hpp - Rebuilds a directory to shrink its on-disk index.
+//
+// Filesystems rarely shrink a directory: after many renames an ext4 htree (or
+// a btrfs/XFS directory) keeps its grown, half-empty blocks, and every listing
+// and lookup walks them. A fresh directory holding the same entries is small
+// and dense again. The rebuild creates a sibling directory, hard-links every
+// file into it in the requested order (numeric for a gallery, which small
+// linear directories then also list in), moves subdirectories across, then
+// swaps the two directories in one step with renameat2(RENAME_EXCHANGE) and
+// removes the old one. Files keep their inodes, so contents, timestamps and
+// open handles are untouched.
+//
+// Linux only; elsewhere rebuild() reports that it is unsupported.
+#pragma once
+
+#include <algorithm>    // For std::sort
+#include <chrono>       // For timing listings and lookups
+#include <cstdint>      // For sizes
+#include <filesystem>   // For fs::path
+#include <set>          // For the names already linked
+#include <string>       // For names and errors
+#include <vector>       // For entry lists
+
+#if defined(__linux__)
+#include <cerrno>       // For errno
+#include <cstring>      // For std::strerror
+#include <dirent.h>     // For fdopendir, readdir
+#include <fcntl.h>      // For open, AT_* flags
+#include <sys/stat.h>   // For fstatat, mkdir, chmod
+#include <sys/syscall.h> // For SYS_renameat2
+#include <unistd.h>     // For linkat, unlinkat, close
+#endif
+
+namespace fs = std::filesystem;
+
+namespace compact {
+
+// Size and access speed of a directory.
+struct DirStats {
+    std::uint64_t bytes = 0;     // st_size of the directory itself
+    std::uint64_t blocks = 0;    // 512-byte blocks allocated to it
+    std::size_t entries = 0;
+    double list_ns = 0;          // Nanoseconds per entry for a full listing
+    double lookup_ns = 0;        // Nanoseconds per entry for stat by name
+};
+
+#if defined(__linux__)
+
+inline std::string systemError(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+// Names in a directory (without "." and ".."), in on-disk order. d_type is kept so
+// subdirectories can be told apart without a stat.
+inline bool listNames(int dirfd, std::vector<std::pair<std::string, bool>>& names, std::string& error) {
+    int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* dir = fd < 0 ? nullptr : fdopendir(fd);
+    if (!dir) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        error = systemError("cannot list directory");
+        return false;
+    }
+    names.clear();
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        names.push_back({name, is_dir});
+    }
+    closedir(dir);
+    return true;
+}
+
+// Times 'body' repeatedly for about 20 ms and returns its fastest run in nanoseconds
+// (the first run warms the caches, like a busy web server's).
+template <typename Fn>
+inline double fastestRun(Fn body) {
+    using Clock = std::chrono::steady_clock;
+    double best = 0;
+    auto start = Clock::now();
+    do {
+        auto t0 = Clock::now();
+        body();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+        best = best == 0 || ns < best ? ns : best;
+    } while (Clock::now() - start < std::chrono::milliseconds(20));
+    return best;
+}
+
+// Measures a directory: its size, a full listing and a lookup of every name.
+inline bool measure(const fs::path& path, DirStats& out, std::string& error) {
+    int dirfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (dirfd < 0 || fstat(dirfd, &st) != 0) {
+        error = systemError("cannot open " + path.string());
+        if (dirfd >= 0) {
+            close(dirfd);
+        }
+        return false;
+    }
+    out.bytes = static_cast<std::uint64_t>(st.st_size);
+    out.blocks = static_cast<std::uint64_t>(st.st_blocks);
+    std::vector<std::pair<std::string, bool>> names;
+    if (!listNames(dirfd, names, error)) {
+        close(dirfd);
+        return false;
+    }
+    out.entries = names.size();
+    double per_entry = static_cast<double>(std::max<std::size_t>(1, names.size()));
+    std::vector<std::pair<std::string, bool>> again;
+    out.list_ns = fastestRun([&] { listNames(dirfd, again, error); }) / per_entry;
+    out.lookup_ns = fastestRun([&] {
+        for (const auto& name : names) {
+            fstatat(dirfd, name.first.c_str(), &st, AT_SYMLINK_NOFOLLOW);
+        }
+    }) / per_entry;
+    close(dirfd);
+    return true;
+}
+
+// Rebuilds 'path' with the names in 'order' first (in that order) and everything else
+// after them by name. On failure before the swap the original directory is left as it
+// was; subdirectories already moved are moved back.
+inline bool rebuild(const fs::path& path, const std::vector<std::string>& order, std::string& error) {
+    fs::path dir = fs::absolute(path).lexically_normal();
+    if (dir.filename().empty()) {
+        dir = dir.parent_path();
+    }
+    fs::path fresh = dir.parent_path() / ("." + dir.filename().string() + ".compact");
+    int old_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (old_fd < 0 || fstat(old_fd, &st) != 0) {
+        error = systemError("cannot open " + dir.string());
+        if (old_fd >= 0) {
+            close(old_fd);
+        }
+        return false;
+    }
+    if (mkdir(fresh.c_str(), st.st_mode & 07777) != 0) {
+        error = systemError("cannot create " + fresh.string());
+        close(old_fd);
+        return false;
+    }
+    chmod(fresh.c_str(), st.st_mode & 07777); // mkdir applies the umask
+    int new_fd = open(fresh.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    std::vector<std::pair<std::string, bool>> names;
+    std::vector<std::string> subdirs;
+    auto cleanup = [&]() {
+        for (const auto& name : subdirs) {
+            renameat(new_fd, name.c_str(), old_fd, name.c_str());
+        }
+        std::vector<std::pair<std::string, bool>> linked;
+        std::string ignored;
+        if (listNames(new_fd, linked, ignored)) {
+            for (const auto& entry : linked) {
+                unlinkat(new_fd, entry.first.c_str(), 0);
+            }
+        }
+        close(new_fd);
+        close(old_fd);
+        rmdir(fresh.c_str());
+    };
+    if (new_fd < 0 || !listNames(old_fd, names, error)) {
+        error = error.empty() ? systemError("cannot open " + fresh.string()) : error;
+        cleanup();
+        return false;
+    }
+
+    // Final order: the requested names, then the rest alphabetically.
+    std::set<std::string> present;
+    for (const auto& entry : names) {
+        if (entry.second) {
+            subdirs.push_back(entry.first);
+        } else {
+            present.insert(entry.first);
+        }
+    }
+    std::vector<std::string> files;
+    for (const auto& name : order) {
+        if (present.erase(name)) {
+            files.push_back(name);
+        }
+    }
+    files.insert(files.end(), present.begin(), present.end());
+
+    for (const auto& name : files) {
+        if (linkat(old_fd, name.c_str(), new_fd, name.c_str(), 0) != 0) {
+            error = systemError("cannot link " + name);
+            subdirs.clear(); // None moved yet
+            cleanup();
+            return false;
+        }
+    }
+    std::sort(subdirs.begin(), subdirs.end());
+    std::vector<std::string> moved;
+    for (const auto& name : subdirs) {
+        if (renameat(old_fd, name.c_str(), new_fd, name.c_str()) != 0) {
+            error = systemError("cannot move " + name);
+            subdirs = moved;
+            cleanup();
+            return false;
+        }
+        moved.push_back(name);
+    }
+
+    if (syscall(SYS_renameat2, AT_FDCWD, fresh.c_str(), AT_FDCWD, dir.c_str(), RENAME_EXCHANGE) != 0) {
+        error = systemError("cannot swap directories (RENAME_EXCHANGE)");
+        cleanup();
+        return false;
+    }
+
+    // The descriptors follow the directories: old_fd is now the bloated one at 'fresh'.
+    // Anything created or replaced there during the rebuild is moved across; the rest
+    // are second links and go away.
+    std::vector<std::pair<std::string, bool>> leftovers;
+    if (listNames(old_fd, leftovers, error)) {
+        for (const auto& entry : leftovers) {
+            struct stat a, b;
+            bool same = fstatat(old_fd, entry.first.c_str(), &a, AT_SYMLINK_NOFOLLOW) == 0 &&
+                        fstatat(new_fd, entry.first.c_str(), &b, AT_SYMLINK_NOFOLLOW) == 0 &&
+                        a.st_ino == b.st_ino && a.st_dev == b.st_dev;
+            if (same) {
+                unlinkat(old_fd, entry.first.c_str(), 0);
+            } else {
+                renameat(old_fd, entry.first.c_str(), new_fd, entry.first.c_str());
+            }
+        }
+    }
+    close(new_fd);
+    close(old_fd);
+    if (rmdir(fresh.c_str()) != 0) {
+        error = systemError("swapped, but cannot remove " + fresh.string());
+        return false;
+    }
+    return true;
+}
+
+#else
+
+inline bool measure(const fs::path&, DirStats&, std::string& error) {
+    error = "directory statistics need Linux";
+    return false;
+}
+
+inline bool rebuild(const fs::path&, const std::vector<std::string>&, std::string& error) {
+    error = "compacting directories needs Linux (renameat2 with RENAME_EXCHANGE)";
+    return false;
+}
+
+#endif
+
+} // namespace compact
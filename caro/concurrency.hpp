@@ -0,0 +1,233 @@
+// concurrency.hpp - Hill-climbing worker counts for the pipeline stages.
+//
+// How many workers a stage wants depends on the machine: a probe stage on a
+// network mount spends its time waiting and scales well past the core count,
+// a decode stage on a laptop stops scaling at the core count, and on a big
+// host a single stage can starve everything behind it. The Controller watches
+// per-stage queue depths and busy time and moves the busiest stage with work
+// waiting up by a step; if pipeline throughput (source bytes finished per
+// second, which evens out small and large images better than a job count)
+// does not improve by at least 5% the step is taken back and the stage is
+// left alone for a while. Accepted steps double, so a fresh machine converges
+// in a few measurement windows.
+// Workers are shed when the process uses more memory than allowed.
+//
+// Windows are not fixed in time: a window closes once the last stage has
+// finished at least three jobs per worker, so slow jobs do not turn the
+// comparison into noise.
+#pragma once
+
+#include <algorithm>   // For std::max, std::min
+#include <cstdint>     // For byte counts
+#include <cstdio>      // For std::snprintf
+#include <functional>  // For the log callback
+#include <string>      // For stage names and log lines
+#include <vector>      // For per-stage state
+
+#if defined(__linux__)
+#include <fstream>     // For /proc/self/statm
+#include <unistd.h>    // For sysconf
+#endif
+
+namespace concurrency {
+
+// What one stage did since the previous sample.
+struct StageSample {
+    std::string name;
+    int workers = 1;             // Workers currently allowed to take jobs
+    std::size_t queued = 0;      // Jobs waiting in front of the stage right now
+    std::uint64_t completed = 0; // Jobs finished since the previous sample
+    std::uint64_t bytes = 0;     // Their source bytes
+    double busy = 0;             // Seconds spent running jobs since the previous sample, over all workers
+    bool drained = false;        // Every job has passed the stage
+};
+
+struct Limits {
+    int max_threads = 1;       // Workers of all stages together
+    std::uint64_t max_rss = 0; // Resident bytes above which workers are shed (0 = no limit)
+};
+
+// Resident memory of this process in bytes (0 where unknown).
+inline std::uint64_t residentMemory() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    std::uint64_t size = 0;
+    std::uint64_t resident = 0;
+    if (statm >> size >> resident) {
+        return resident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+// Physical memory of the machine in bytes (0 where unknown).
+inline std::uint64_t physicalMemory() {
+#if defined(__linux__)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0) {
+        return static_cast<std::uint64_t>(pages) * static_cast<std::uint64_t>(page_size);
+    }
+#endif
+    return 0;
+}
+
+class Controller {
+public:
+    Controller(Limits limits, std::function<void(const std::string&)> log)
+        : limits_(limits), log_(std::move(log)) {}
+
+    // Folds in samples covering 'seconds' and returns the worker count every stage should
+    // have from now on (unchanged until a measurement window closes).
+    std::vector<int> update(const std::vector<StageSample>& samples, double seconds, std::uint64_t rss) {
+        std::size_t n = samples.size();
+        std::vector<int> counts(n);
+        int total = 0;
+        for (std::size_t s = 0; s < n; ++s) {
+            counts[s] = samples[s].workers;
+            total += samples[s].drained ? 0 : counts[s];
+        }
+        if (window_.size() != n) {
+            window_.assign(n, Window());
+            step_.assign(n, 1);
+            hold_.assign(n, 0);
+        }
+        for (std::size_t s = 0; s < n; ++s) {
+            window_[s].completed += samples[s].completed;
+            window_[s].bytes += samples[s].bytes;
+            window_[s].busy += samples[s].busy;
+            window_[s].worker_seconds += samples[s].workers * seconds;
+        }
+        window_seconds_ += seconds;
+
+        // Memory is checked every sample: shed a worker from the largest stage.
+        if (limits_.max_rss > 0 && rss > limits_.max_rss) {
+            std::size_t largest = n;
+            for (std::size_t s = 0; s < n; ++s) {
+                if (!samples[s].drained && counts[s] > 1 && (largest == n || counts[s] > counts[largest])) {
+                    largest = s;
+                }
+            }
+            if (largest < n) {
+                trial_.active = false;
+                hold_[largest] = kHoldWindows;
+                say(samples[largest].name, counts[largest], counts[largest] - 1,
+                    "resident memory " + mebibytes(rss) + " over the " + mebibytes(limits_.max_rss) + " limit");
+                --counts[largest];
+                restartWindow();
+                return counts;
+            }
+        }
+
+        std::uint64_t finished = n ? window_[n - 1].completed : 0;
+        if (n == 0 || window_seconds_ <= 0 || finished < static_cast<std::uint64_t>(std::max(8, 3 * total))) {
+            return counts;
+        }
+        double throughput = static_cast<double>(window_[n - 1].bytes) / window_seconds_;
+        std::vector<double> busy(n); // Jobs are timed when they end, so long ones can push this past 1
+        for (std::size_t s = 0; s < n; ++s) {
+            busy[s] = std::min(1.0, window_[s].busy / std::max(1e-9, window_[s].worker_seconds));
+        }
+        restartWindow();
+        for (auto& hold : hold_) {
+            hold = std::max(0, hold - 1);
+        }
+
+        // Judge the step taken at the end of the previous window.
+        if (trial_.active) {
+            trial_.active = false;
+            std::size_t s = trial_.stage;
+            if (throughput < trial_.baseline * 1.05) {
+                say(samples[s].name, counts[s], trial_.from,
+                    "no gain: " + rate(throughput) + " vs " + rate(trial_.baseline));
+                counts[s] = trial_.from;
+                step_[s] = 1;
+                hold_[s] = kHoldWindows;
+                return counts;
+            }
+            step_[s] = std::min(step_[s] * 2, 16);
+        }
+
+        // Step up the busiest stage that has work waiting.
+        std::size_t bottleneck = n;
+        for (std::size_t s = 0; s < n; ++s) {
+            if (!samples[s].drained && samples[s].queued > 0 && hold_[s] == 0 &&
+                (bottleneck == n || busy[s] > busy[bottleneck])) {
+                bottleneck = s;
+            }
+        }
+        bool memory_left = limits_.max_rss == 0 || rss <= limits_.max_rss;
+        if (bottleneck < n && busy[bottleneck] >= 0.75 && total < limits_.max_threads && memory_left) {
+            std::size_t s = bottleneck;
+            int step = std::min(step_[s], limits_.max_threads - total);
+            char detail[96];
+            std::snprintf(detail, sizeof detail, "%zu queued, %.0f%% busy, %s", samples[s].queued,
+                          busy[s] * 100, rate(throughput).c_str());
+            say(samples[s].name, counts[s], counts[s] + step, detail);
+            trial_ = {true, s, counts[s], throughput};
+            counts[s] += step;
+            return counts;
+        }
+
+        // At the thread limit, give back workers that mostly wait for input.
+        if (total >= limits_.max_threads) {
+            for (std::size_t s = 0; s < n; ++s) {
+                if (!samples[s].drained && counts[s] > 1 && busy[s] < 0.4) {
+                    char detail[64];
+                    std::snprintf(detail, sizeof detail, "%.0f%% busy at the thread limit", busy[s] * 100);
+                    say(samples[s].name, counts[s], counts[s] - 1, detail);
+                    --counts[s];
+                }
+            }
+        }
+        return counts;
+    }
+
+private:
+    static constexpr int kHoldWindows = 4; // Windows a stage is left alone after a rejected step
+
+    struct Window {
+        std::uint64_t completed = 0;
+        std::uint64_t bytes = 0;
+        double busy = 0;
+        double worker_seconds = 0; // Workers allowed, integrated over the window
+    };
+
+    struct Trial {
+        bool active = false;
+        std::size_t stage = 0;
+        int from = 0;        // Worker count before the step
+        double baseline = 0; // Bytes per second before the step
+    };
+
+    void restartWindow() {
+        window_.assign(window_.size(), Window());
+        window_seconds_ = 0;
+    }
+
+    void say(const std::string& stage, int from, int to, const std::string& why) const {
+        if (log_) {
+            log_(stage + " " + std::to_string(from) + " -> " + std::to_string(to) + " (" + why + ")");
+        }
+    }
+
+    static std::string rate(double bytes_per_second) {
+        char text[32];
+        std::snprintf(text, sizeof text, "%.1f MiB/s", bytes_per_second / (1 << 20));
+        return text;
+    }
+
+    static std::string mebibytes(std::uint64_t bytes) {
+        return std::to_string(bytes >> 20) + " MiB";
+    }
+
+    Limits limits_;
+    std::function<void(const std::string&)> log_;
+    std::vector<Window> window_;
+    double window_seconds_ = 0;
+    std::vector<int> step_; // Next step size per stage
+    std::vector<int> hold_; // Windows left before a stage may step up again
+    Trial trial_;
+};
+
+} // namespace concurrency
@@ -0,0 +1,332 @@
+// corpus.hpp - Reproducible synthetic image corpora for pipeline benchmarks.
+//
+// A corpus is planned from one seed: the kind and size of every image come
+// from a splitmix64 sequence (not <random>, whose distributions differ between
+// standard libraries), and each image is then drawn from its own generator
+// seeded with the corpus seed and its number, so the files do not depend on
+// the order in which threads render them. The same seed, mix and sizes give
+// the same files on every machine whose build rounds floating point the same
+// way (any x86-64 build); the corpus fingerprint says whether two corpora match.
+//
+// Kinds, each with a share of the corpus ("mix") and a range for the longer side:
+//   photo     value-noise fields with grain, JPEG
+//   graphic   flat shapes in a small palette, PNG
+//   gradient  linear or radial two-color gradients, PNG or JPEG
+//   alpha     soft-edged shapes on a transparent background, PNG
+//   poster    photos at poster size, JPEG
+//   icon      tiny graphics with transparent corners, PNG
+#pragma once
+
+#include <algorithm>    // For std::min, std::max
+#include <array>        // For the kind table
+#include <cmath>        // For std::exp, std::log, std::sqrt
+#include <cstdint>      // For the generator state
+#include <cstdlib>      // For std::atof, std::atoi
+#include <sstream>      // For parsing specs
+#include <string>       // For encoded images and errors
+#include <vector>       // For pixels and the plan
+
+#include "jpeg.hpp"
+#include "png.hpp"
+
+namespace corpus {
+
+enum Kind { PHOTO, GRAPHIC, GRADIENT, ALPHA, POSTER, ICON, KIND_COUNT };
+
+constexpr const char* KIND_NAMES[KIND_COUNT] = {"photo", "graphic", "gradient", "alpha", "poster", "icon"};
+
+struct KindSpec {
+    double weight = 0;            // Share of the corpus (relative)
+    int min_side = 0, max_side = 0; // Longer side in pixels, drawn log-uniformly
+};
+
+using Kinds = std::array<KindSpec, KIND_COUNT>;
+
+inline Kinds defaultKinds() {
+    return {KindSpec{40, 800, 2400}, KindSpec{20, 600, 1600}, KindSpec{10, 800, 1920},
+            KindSpec{10, 256, 1024}, KindSpec{3, 5000, 8000}, KindSpec{17, 16, 128}};
+}
+
+// splitmix64: the same sequence everywhere.
+class Rng {
+public:
+    explicit Rng(std::uint64_t seed) : state_(seed) {}
+
+    std::uint64_t next() {
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [lo, hi].
+    int range(int lo, int hi) { return lo + static_cast<int>(next() % static_cast<std::uint64_t>(hi - lo + 1)); }
+
+    // Uniform in [0, 1).
+    double unit() { return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+    std::uint64_t state_;
+};
+
+struct Spec {
+    std::uint64_t seed = 1;
+    int count = 100;
+    int quality = 85; // JPEG quality
+    Kinds kinds = defaultKinds();
+};
+
+// "photo=40,icon=10": weights of the kinds listed; the others get 0.
+inline bool parseMix(const std::string& text, Kinds& kinds, std::string& error) {
+    Kinds parsed = kinds;
+    for (auto& kind : parsed) {
+        kind.weight = 0;
+    }
+    std::stringstream list(text);
+    for (std::string item; std::getline(list, item, ',');) {
+        std::size_t eq = item.find('=');
+        int k = 0;
+        while (k < KIND_COUNT && item.compare(0, eq, KIND_NAMES[k]) != 0) {
+            ++k;
+        }
+        double weight = eq == std::string::npos ? -1 : std::atof(item.c_str() + eq + 1);
+        if (k == KIND_COUNT || weight < 0) {
+            error = "bad mix entry '" + item + "' (expected KIND=WEIGHT)";
+            return false;
+        }
+        parsed[k].weight = weight;
+    }
+    kinds = parsed;
+    return true;
+}
+
+// "photo=1000-3000,icon=32-32": longer-side ranges of the kinds listed.
+inline bool parseSizes(const std::string& text, Kinds& kinds, std::string& error) {
+    std::stringstream list(text);
+    for (std::string item; std::getline(list, item, ',');) {
+        std::size_t eq = item.find('='), dash = item.find('-', eq);
+        int k = 0;
+        while (k < KIND_COUNT && item.compare(0, eq, KIND_NAMES[k]) != 0) {
+            ++k;
+        }
+        int lo = eq == std::string::npos ? 0 : std::atoi(item.c_str() + eq + 1);
+        int hi = dash == std::string::npos ? lo : std::atoi(item.c_str() + dash + 1);
+        if (k == KIND_COUNT || lo < 1 || hi < lo || hi > 16384) {
+            error = "bad size entry '" + item + "' (expected KIND=MIN-MAX, at most 16384)";
+            return false;
+        }
+        kinds[k].min_side = lo;
+        kinds[k].max_side = hi;
+    }
+    return true;
+}
+
+struct Item {
+    int number = 0;
+    Kind kind = PHOTO;
+    int width = 0, height = 0;
+    std::string format; // "png" or "jpeg"
+};
+
+// Kinds, sizes and formats of the whole corpus, from the corpus seed alone.
+inline std::vector<Item> plan(const Spec& spec) {
+    static const int ASPECTS[][2] = {{1, 1}, {4, 3}, {3, 2}, {16, 9}, {3, 4}, {2, 3}, {9, 16}};
+    double total = 0;
+    for (const auto& kind : spec.kinds) {
+        total += kind.weight;
+    }
+    Rng rng(spec.seed);
+    std::vector<Item> items;
+    for (int n = 1; n <= spec.count && total > 0; ++n) {
+        Item item;
+        item.number = n;
+        double pick = rng.unit() * total;
+        int k = 0;
+        while (k + 1 < KIND_COUNT && (pick -= spec.kinds[k].weight) >= 0) {
+            ++k;
+        }
+        while (spec.kinds[k].weight <= 0) { // Rounding at the end of the table
+            --k;
+        }
+        item.kind = static_cast<Kind>(k);
+        const KindSpec& kind = spec.kinds[k];
+        int side = static_cast<int>(std::exp(std::log(kind.min_side) + rng.unit() * (std::log(kind.max_side + 1.0) - std::log(kind.min_side))));
+        side = std::max(kind.min_side, std::min(kind.max_side, side));
+        const int* aspect = ASPECTS[item.kind == ICON ? 0 : rng.range(0, 6)];
+        bool wide = aspect[0] >= aspect[1];
+        item.width = wide ? side : std::max(1, side * aspect[0] / aspect[1]);
+        item.height = wide ? std::max(1, side * aspect[1] / aspect[0]) : side;
+        bool jpeg = item.kind == PHOTO || item.kind == POSTER || (item.kind == GRADIENT && rng.range(0, 1) == 1);
+        item.format = jpeg ? "jpeg" : "png";
+        items.push_back(item);
+    }
+    return items;
+}
+
+struct Color {
+    int r = 0, g = 0, b = 0;
+};
+
+inline Color randomColor(Rng& rng) {
+    return {rng.range(0, 255), rng.range(0, 255), rng.range(0, 255)};
+}
+
+inline void putPixel(std::uint8_t* px, double r, double g, double b, double a = 255) {
+    auto clamp = [](double v) { return static_cast<std::uint8_t>(std::max(0.0, std::min(255.0, v + 0.5))); };
+    px[0] = clamp(r);
+    px[1] = clamp(g);
+    px[2] = clamp(b);
+    px[3] = clamp(a);
+}
+
+// Sum of octaves of smoothly interpolated lattice noise, roughly in [0, 1].
+class ValueNoise {
+public:
+    ValueNoise(Rng& rng, int width, int height, int octaves) {
+        int cell = std::max(8, std::max(width, height) / rng.range(3, 8));
+        for (int o = 0; o < octaves; ++o, cell = std::max(2, cell / 2)) {
+            Octave octave;
+            octave.cell = cell;
+            octave.w = width / cell + 2;
+            octave.h = height / cell + 2;
+            octave.values.resize(static_cast<std::size_t>(octave.w) * octave.h);
+            for (auto& v : octave.values) {
+                v = static_cast<float>(rng.unit());
+            }
+            octaves_.push_back(std::move(octave));
+        }
+    }
+
+    float at(int x, int y) const {
+        float sum = 0, amplitude = 0.5f, norm = 0;
+        for (const auto& o : octaves_) {
+            int cx = x / o.cell, cy = y / o.cell;
+            float fx = static_cast<float>(x % o.cell) / o.cell, fy = static_cast<float>(y % o.cell) / o.cell;
+            fx = fx * fx * (3 - 2 * fx);
+            fy = fy * fy * (3 - 2 * fy);
+            const float* row0 = o.values.data() + static_cast<std::size_t>(cy) * o.w;
+            const float* row1 = row0 + o.w;
+            float top = row0[cx] + (row0[cx + 1] - row0[cx]) * fx;
+            float bottom = row1[cx] + (row1[cx + 1] - row1[cx]) * fx;
+            sum += amplitude * (top + (bottom - top) * fy);
+            norm += amplitude;
+            amplitude *= 0.5f;
+        }
+        return sum / norm;
+    }
+
+private:
+    struct Octave {
+        int cell = 0, w = 0, h = 0;
+        std::vector<float> values;
+    };
+    std::vector<Octave> octaves_;
+};
+
+inline void drawPhoto(Rng& rng, int width, int height, std::vector<std::uint8_t>& rgba) {
+    ValueNoise shape(rng, width, height, 5), light(rng, width, height, 3);
+    Color a = randomColor(rng), b = randomColor(rng), c = randomColor(rng);
+    int grain = rng.range(2, 12);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float t = shape.at(x, y), l = 0.6f + 0.8f * light.at(x, y);
+            const Color& from = t < 0.5f ? a : b;
+            const Color& to = t < 0.5f ? b : c;
+            float u = t < 0.5f ? t * 2 : t * 2 - 1;
+            double noise = rng.range(-grain, grain);
+            putPixel(rgba.data() + (static_cast<std::size_t>(y) * width + x) * 4, (from.r + (to.r - from.r) * u) * l + noise,
+                     (from.g + (to.g - from.g) * u) * l + noise, (from.b + (to.b - from.b) * u) * l + noise);
+        }
+    }
+}
+
+// Rectangles and circles in a few flat colors; 'transparent' draws them with varying
+// alpha and soft circle edges on a clear background.
+inline void drawShapes(Rng& rng, int width, int height, bool transparent, std::vector<std::uint8_t>& rgba) {
+    std::vector<Color> palette(rng.range(3, 6));
+    for (auto& color : palette) {
+        color = randomColor(rng);
+    }
+    const Color& background = palette[0];
+    for (std::size_t i = 0; i < rgba.size(); i += 4) {
+        putPixel(rgba.data() + i, background.r, background.g, background.b, transparent ? 0 : 255);
+    }
+    int shapes = rng.range(4, 20);
+    for (int s = 0; s < shapes; ++s) {
+        const Color& color = palette[rng.range(1, static_cast<int>(palette.size()) - 1)];
+        int cx = rng.range(0, width - 1), cy = rng.range(0, height - 1);
+        int rx = rng.range(1, std::max(1, width / 4)), ry = rng.range(1, std::max(1, height / 4));
+        bool circle = rng.range(0, 1) == 1;
+        double alpha = transparent ? rng.range(96, 255) : 255;
+        for (int y = std::max(0, cy - ry); y < std::min(height, cy + ry + 1); ++y) {
+            for (int x = std::max(0, cx - rx); x < std::min(width, cx + rx + 1); ++x) {
+                double coverage = 1;
+                if (circle) {
+                    double dx = static_cast<double>(x - cx) / rx, dy = static_cast<double>(y - cy) / ry;
+                    double d = std::sqrt(dx * dx + dy * dy);
+                    coverage = transparent ? std::max(0.0, std::min(1.0, (1 - d) * 8)) : (d <= 1 ? 1 : 0);
+                }
+                if (coverage > 0) {
+                    std::uint8_t* px = rgba.data() + (static_cast<std::size_t>(y) * width + x) * 4;
+                    double a = alpha * coverage / 255, under = px[3] / 255.0 * (1 - a), out = a + under;
+                    putPixel(px, (color.r * a + px[0] * under) / out, (color.g * a + px[1] * under) / out,
+                             (color.b * a + px[2] * under) / out, out * 255);
+                }
+            }
+        }
+    }
+}
+
+inline void drawGradient(Rng& rng, int width, int height, std::vector<std::uint8_t>& rgba) {
+    Color a = randomColor(rng), b = randomColor(rng);
+    bool radial = rng.range(0, 2) == 0;
+    double angle = rng.unit() * 6.283185307179586, dx = std::cos(angle), dy = std::sin(angle);
+    double span = std::abs(dx) * width + std::abs(dy) * height;
+    double cx = rng.unit() * width, cy = rng.unit() * height, reach = std::sqrt(double(width) * width + double(height) * height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double t = radial ? std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy)) / reach
+                              : ((x - (dx < 0 ? width : 0)) * dx + (y - (dy < 0 ? height : 0)) * dy) / span;
+            t = std::max(0.0, std::min(1.0, t));
+            putPixel(rgba.data() + (static_cast<std::size_t>(y) * width + x) * 4, a.r + (b.r - a.r) * t,
+                     a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t);
+        }
+    }
+}
+
+// A rounded square in two colors with transparent corners.
+inline void drawIcon(Rng& rng, int width, int height, std::vector<std::uint8_t>& rgba) {
+    drawShapes(rng, width, height, false, rgba);
+    double radius = std::min(width, height) * (0.1 + 0.3 * rng.unit());
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double qx = std::max(0.0, std::max(radius - x, x - (width - 1 - radius)));
+            double qy = std::max(0.0, std::max(radius - y, y - (height - 1 - radius)));
+            double outside = std::sqrt(qx * qx + qy * qy) - radius;
+            if (outside > -1) {
+                rgba[(static_cast<std::size_t>(y) * width + x) * 4 + 3] =
+                    static_cast<std::uint8_t>(255 * std::max(0.0, std::min(1.0, -outside)));
+            }
+        }
+    }
+}
+
+// Draws and encodes one image of the plan.
+inline std::string render(const Spec& spec, const Item& item) {
+    Rng rng(spec.seed * 0x2545F4914F6CDD1DULL + static_cast<std::uint64_t>(item.number));
+    std::vector<std::uint8_t> rgba(static_cast<std::size_t>(item.width) * item.height * 4);
+    bool alpha = false;
+    switch (item.kind) {
+    case PHOTO:
+    case POSTER: drawPhoto(rng, item.width, item.height, rgba); break;
+    case GRAPHIC: drawShapes(rng, item.width, item.height, false, rgba); break;
+    case GRADIENT: drawGradient(rng, item.width, item.height, rgba); break;
+    case ALPHA: drawShapes(rng, item.width, item.height, true, rgba); alpha = true; break;
+    case ICON: drawIcon(rng, item.width, item.height, rgba); alpha = true; break;
+    default: break;
+    }
+    return item.format == "jpeg" ? jpeg::encodePixels(item.width, item.height, rgba.data(), spec.quality)
+                                 : png::encode(item.width, item.height, rgba.data(), alpha);
+}
+
+} // namespace corpus
@@ -0,0 +1,294 @@
+// delta.hpp - Delta transfer of modified files using content-defined chunks.
+//
+// The sender keeps a chunk store mirroring what has already been deployed.
+// A delta carries the full recipe of a file (the ordered list of chunk hashes)
+// but the bytes of only those chunks the store does not have yet. Making a
+// delta leaves the store alone; once the delta has been applied on the other
+// side, confirming it adds the chunks it carried. The receiver
+// adds those chunks to its own store and rebuilds the file from the recipe,
+// checking the whole-file hash at the end.
+//
+// Delta file layout (all integers little-endian):
+//   "CARODLT1"                      magic
+//   u64 file size, 32-byte file BLAKE3
+//   u32 recipe length, then per entry: 32-byte chunk BLAKE3, u32 chunk size
+//   u32 new chunk count, then per chunk: 32-byte BLAKE3, u32 size, bytes
+#pragma once
+
+#include <array>        // For raw digests
+#include <cstdint>      // For fixed-width integers
+#include <cstring>      // For std::memcmp
+#include <filesystem>   // For fs::path
+#include <fstream>      // For delta files
+#include <set>          // For de-duplicating new chunks
+#include <string>       // For hex hashes and errors
+#include <vector>       // For recipes
+
+#include "blake3.hpp"
+#include "cdc.hpp"
+#include "mapped_file.hpp"
+#include "object_store.hpp"
+
+namespace fs = std::filesystem;
+
+namespace delta {
+
+using Digest = std::array<std::uint8_t, blake3::OUT_LEN>;
+
+struct RecipeEntry {
+    Digest hash;
+    std::uint32_t size;
+};
+
+// What making or applying a delta did, for reports.
+struct DeltaStats {
+    std::uint64_t file_bytes = 0;   // Size of the whole file
+    std::uint64_t sent_bytes = 0;   // Chunk payload carried by the delta
+    std::size_t chunks = 0;         // Chunks in the recipe
+    std::size_t new_chunks = 0;     // Chunks carried by the delta
+    std::uint64_t delta_bytes = 0;  // Size of the delta file itself
+};
+
+inline void putU32(std::string& out, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+inline void putU64(std::string& out, std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+inline bool getU32(std::istream& in, std::uint32_t& v) {
+    unsigned char b[4];
+    if (!in.read(reinterpret_cast<char*>(b), 4)) {
+        return false;
+    }
+    v = b[0] | (b[1] << 8) | (b[2] << 16) | (std::uint32_t(b[3]) << 24);
+    return true;
+}
+
+inline bool getU64(std::istream& in, std::uint64_t& v) {
+    std::uint32_t lo, hi;
+    if (!getU32(in, lo) || !getU32(in, hi)) {
+        return false;
+    }
+    v = lo | (std::uint64_t(hi) << 32);
+    return true;
+}
+
+inline Digest digestOf(const std::uint8_t* data, std::size_t len) {
+    blake3::Hasher hasher;
+    hasher.update(data, len);
+    return hasher.finalize();
+}
+
+// Chunks 'source' and writes a delta against 'store' to 'delta_path'. The store is
+// left alone: confirmDelta() records the chunks once the delta is known to be
+// deployed, so a delta that never arrives is simply made again.
+inline bool makeDelta(const fs::path& source, const fs::path& store, const fs::path& delta_path,
+                      DeltaStats& stats, std::string& error) {
+    MappedFile file;
+    if (!file.open(source)) {
+        error = "cannot read " + source.string();
+        return false;
+    }
+    const std::uint8_t* data = file.data();
+    std::vector<cdc::Chunk> chunks = cdc::chunkBuffer(data, file.size());
+
+    std::string out = "CARODLT1";
+    putU64(out, file.size());
+    Digest file_hash = blake3::hashParallel(data, file.size(), std::max(1u, std::thread::hardware_concurrency()));
+    out.append(reinterpret_cast<const char*>(file_hash.data()), file_hash.size());
+
+    std::vector<Digest> hashes;
+    hashes.reserve(chunks.size());
+    putU32(out, static_cast<std::uint32_t>(chunks.size()));
+    for (const auto& chunk : chunks) {
+        hashes.push_back(digestOf(data + chunk.offset, chunk.length));
+        out.append(reinterpret_cast<const char*>(hashes.back().data()), blake3::OUT_LEN);
+        putU32(out, static_cast<std::uint32_t>(chunk.length));
+    }
+
+    // Payload: every chunk the store has not seen, once.
+    std::string payload;
+    std::set<std::string> included;
+    std::size_t new_chunks = 0;
+    for (std::size_t i = 0; i < chunks.size(); ++i) {
+        std::string hex = blake3::toHex(hashes[i]);
+        if (hasObject(store, hex) || included.count(hex)) {
+            continue;
+        }
+        included.insert(hex);
+        payload.append(reinterpret_cast<const char*>(hashes[i].data()), blake3::OUT_LEN);
+        putU32(payload, static_cast<std::uint32_t>(chunks[i].length));
+        payload.append(reinterpret_cast<const char*>(data + chunks[i].offset), chunks[i].length);
+        stats.sent_bytes += chunks[i].length;
+        ++new_chunks;
+    }
+    putU32(out, static_cast<std::uint32_t>(new_chunks));
+    out += payload;
+
+    if (!writeFileAtomically(delta_path, out)) {
+        error = "cannot write " + delta_path.string();
+        return false;
+    }
+
+    stats.file_bytes = file.size();
+    stats.chunks = chunks.size();
+    stats.new_chunks = new_chunks;
+    stats.delta_bytes = out.size();
+    return true;
+}
+
+// Reads a delta's header and recipe. Lengths come from the file, so they are
+// checked against its size before anything is allocated.
+inline bool readRecipe(std::istream& in, const fs::path& delta_path, std::uint64_t& file_size,
+                       Digest& file_hash, std::vector<RecipeEntry>& recipe, std::string& error) {
+    char magic[8];
+    if (!in.read(magic, 8) || std::memcmp(magic, "CARODLT1", 8) != 0) {
+        error = delta_path.string() + " is not a delta file";
+        return false;
+    }
+    std::uint32_t recipe_len = 0;
+    if (!getU64(in, file_size) || !in.read(reinterpret_cast<char*>(file_hash.data()), file_hash.size()) ||
+        !getU32(in, recipe_len)) {
+        error = "truncated delta header";
+        return false;
+    }
+    std::error_code ec;
+    std::uint64_t delta_size = fs::file_size(delta_path, ec);
+    if (ec || recipe_len > delta_size / (sizeof(Digest) + 4)) {
+        error = "truncated recipe";
+        return false;
+    }
+    recipe.resize(recipe_len);
+    std::uint64_t recipe_bytes = 0;
+    for (auto& entry : recipe) {
+        if (!in.read(reinterpret_cast<char*>(entry.hash.data()), entry.hash.size()) || !getU32(in, entry.size)) {
+            error = "truncated recipe";
+            return false;
+        }
+        if (entry.size > cdc::MAX_SIZE) {
+            error = "recipe chunk of " + std::to_string(entry.size) + " bytes exceeds the chunk size limit";
+            return false;
+        }
+        recipe_bytes += entry.size;
+    }
+    if (recipe_bytes != file_size) {
+        error = "recipe does not add up to the file size";
+        return false;
+    }
+    return true;
+}
+
+// Reads the chunks a delta carries (after its recipe), verifies each one and adds
+// it to 'store'. Fails on the first damaged chunk or failed store write.
+inline bool storeDeltaChunks(std::istream& in, const fs::path& store, DeltaStats& stats, std::string& error) {
+    std::uint32_t new_chunks = 0;
+    if (!getU32(in, new_chunks)) {
+        error = "truncated delta";
+        return false;
+    }
+    std::vector<char> bytes;
+    for (std::uint32_t i = 0; i < new_chunks; ++i) {
+        Digest hash;
+        std::uint32_t size = 0;
+        if (!in.read(reinterpret_cast<char*>(hash.data()), hash.size()) || !getU32(in, size)) {
+            error = "truncated chunk header";
+            return false;
+        }
+        if (size > cdc::MAX_SIZE) {
+            error = "chunk of " + std::to_string(size) + " bytes exceeds the chunk size limit";
+            return false;
+        }
+        bytes.resize(size);
+        if (!in.read(bytes.data(), size)) {
+            error = "truncated chunk data";
+            return false;
+        }
+        // Never let a damaged delta poison the store.
+        if (digestOf(reinterpret_cast<const std::uint8_t*>(bytes.data()), size) != hash) {
+            error = "chunk " + blake3::toHex(hash).substr(0, 12) + " is corrupt";
+            return false;
+        }
+        if (!storeObjectBytes(store, blake3::toHex(hash), bytes.data(), size)) {
+            error = "cannot write to chunk store " + store.string();
+            return false;
+        }
+        stats.sent_bytes += size;
+    }
+    stats.new_chunks = new_chunks;
+    return true;
+}
+
+// Records a deployed delta on the sender's side: adds the chunks it carries to
+// 'store' so later deltas of this or any other file skip them.
+inline bool confirmDelta(const fs::path& delta_path, const fs::path& store, DeltaStats& stats, std::string& error) {
+    std::ifstream in(delta_path, std::ios::binary);
+    std::uint64_t file_size = 0;
+    Digest file_hash;
+    std::vector<RecipeEntry> recipe;
+    if (!readRecipe(in, delta_path, file_size, file_hash, recipe, error) ||
+        !storeDeltaChunks(in, store, stats, error)) {
+        return false;
+    }
+    std::error_code ec;
+    stats.file_bytes = file_size;
+    stats.chunks = recipe.size();
+    stats.delta_bytes = fs::file_size(delta_path, ec);
+    return true;
+}
+
+// Reads a delta, stores its chunks in 'store' and rebuilds the file at 'target'.
+inline bool applyDelta(const fs::path& delta_path, const fs::path& store, const fs::path& target,
+                       DeltaStats& stats, std::string& error) {
+    std::ifstream in(delta_path, std::ios::binary);
+    std::uint64_t file_size = 0;
+    Digest file_hash;
+    std::vector<RecipeEntry> recipe;
+    if (!readRecipe(in, delta_path, file_size, file_hash, recipe, error) ||
+        !storeDeltaChunks(in, store, stats, error)) {
+        return false;
+    }
+
+    // Assemble into a temporary file, verify, then move into place.
+    std::error_code ec;
+    std::vector<char> bytes;
+    fs::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        blake3::Hasher hasher;
+        for (const auto& entry : recipe) {
+            if (!readObject(store, blake3::toHex(entry.hash), bytes) || bytes.size() != entry.size) {
+                error = "chunk " + blake3::toHex(entry.hash).substr(0, 12) + " is missing from the store";
+                out.close();
+                fs::remove(tmp, ec);
+                return false;
+            }
+            hasher.update(bytes.data(), bytes.size());
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+        if (!out || hasher.finalize() != file_hash) {
+            error = "rebuilt file does not match the delta's hash";
+            out.close();
+            fs::remove(tmp, ec);
+            return false;
+        }
+    }
+    fs::rename(tmp, target, ec);
+    if (ec) {
+        error = "cannot replace " + target.string() + ": " + ec.message();
+        return false;
+    }
+
+    stats.file_bytes = file_size;
+    stats.chunks = recipe.size();
+    stats.delta_bytes = fs::file_size(delta_path, ec);
+    return true;
+}
+
+} // namespace delta
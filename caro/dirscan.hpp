@@ -0,0 +1,299 @@
+// dirscan.hpp - Overlapped listing and parsing of numbered gallery files.
+//
+// Listing a directory with millions of entries is dominated by the kernel
+// copying out dirents; parsing the names and ordering them should not add
+// to that. On Linux one thread reads the directory with getdents64 straight
+// into 256 KiB batches and hands each full batch to the calling thread
+// through a lock-free single-producer/single-consumer ring of reusable
+// buffers. The calling thread meanwhile parses every name ("NUMBER.EXT", or
+// the gallery's naming template) into a columnar index and counts the
+// digits of each number for a radix sort, so once the last batch is
+// parsed only the scatter passes remain (one per 11-bit digit in use: a
+// gallery numbered below 2048 needs a single pass). Elsewhere
+// fs::directory_iterator feeds the same parser.
+#pragma once
+
+#include <algorithm>    // For std::max
+#include <array>        // For the ring slots and radix histograms
+#include <atomic>       // For the ring indices
+#include <cstdint>      // For offsets and counts
+#include <filesystem>   // For fs::path
+#include <memory>       // For std::unique_ptr
+#include <string>       // For names and warnings
+#include <thread>       // For the reader thread
+#include <vector>       // For the index columns
+
+#if defined(__linux__)
+#include <cerrno>       // For errno
+#include <cstring>      // For std::strerror, std::strlen
+#include <dirent.h>     // For DT_* types
+#include <fcntl.h>      // For open
+#include <sys/stat.h>   // For fstatat
+#include <sys/syscall.h> // For SYS_getdents64
+#include <unistd.h>     // For syscall, close
+#endif
+
+#include "naming.hpp"
+
+namespace fs = std::filesystem;
+
+namespace dirscan {
+
+// Fixed-capacity ring between exactly one producer and one consumer thread. Slots are
+// filled in place and reused; the indices only ever grow.
+template <typename T, std::size_t N>
+class SpscRing {
+public:
+    // The slot to fill next, or nullptr while the ring is full.
+    T* claim() {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        return tail - head_.load(std::memory_order_acquire) == N ? nullptr : &slots_[tail % N];
+    }
+    // Hands the claimed slot to the consumer.
+    void publish() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // The oldest published slot, or nullptr while the ring is empty.
+    T* peek() {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        return tail_.load(std::memory_order_acquire) == head ? nullptr : &slots_[head % N];
+    }
+    // Returns the slot from peek() to the producer.
+    void release() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    std::array<T, N> slots_;
+    alignas(64) std::atomic<std::size_t> head_{0}; // Written by the consumer
+    alignas(64) std::atomic<std::size_t> tail_{0}; // Written by the producer
+};
+
+// Numbered files of one directory, one column per field. Names are stored back to
+// back as "NAME\0EXTENSION\0".
+struct Index {
+    std::vector<int> numbers;
+    std::vector<std::uint32_t> name_at; // Offset of each name in 'text'
+    std::vector<std::uint32_t> ext_at;  // Offset of each extension in 'text'
+    std::vector<std::uint64_t> sizes;   // File sizes, if the scan was asked for them
+    std::string text;
+    std::vector<std::uint32_t> order;   // Entries by ascending number (ties in listing order)
+    std::vector<std::string> warnings;  // Names that look numbered but cannot be used
+
+    std::size_t size() const { return numbers.size(); }
+    const char* name(std::size_t i) const { return text.c_str() + name_at[i]; }
+    const char* extension(std::size_t i) const { return text.c_str() + ext_at[i]; }
+};
+
+// Recognises the name of a numbered file: one made by 'naming', or "NUMBER.EXT" as the
+// regex "^(\d+)\.(.+)$" would. 'ext' receives the extension. Numbers that do not fit
+// an int are rejected with 'out_of_range' set.
+inline bool parseName(const NameTemplate& naming, const std::string& name, int& number, std::string& ext,
+                      bool& out_of_range) {
+    out_of_range = false;
+    if (!naming.isDefault() && naming.match(name, number, ext)) {
+        return true;
+    }
+    std::size_t digits = 0;
+    while (digits < name.size() && name[digits] >= '0' && name[digits] <= '9') {
+        ++digits;
+    }
+    if (digits == 0 || digits + 1 >= name.size() || name[digits] != '.') {
+        return false;
+    }
+    long long value = 0;
+    for (std::size_t i = 0; i < digits && value <= 0x7fffffff; ++i) {
+        value = value * 10 + (name[i] - '0');
+    }
+    if (value > 0x7fffffff) {
+        out_of_range = true;
+        return false;
+    }
+    number = static_cast<int>(value);
+    ext.assign(name, digits + 1, std::string::npos);
+    return true;
+}
+
+// Parses names into an Index and keeps the radix histograms up to date.
+class Parser {
+public:
+    Parser(Index& index, const NameTemplate& naming) : index_(index), naming_(naming) {}
+
+    // Adds 'name' to the index if it is numbered; returns whether it was.
+    bool add(const char* name, std::size_t len) {
+        int number = 0;
+        bool out_of_range = false;
+        name_.assign(name, len);
+        if (!parseName(naming_, name_, number, ext_, out_of_range)) {
+            if (out_of_range) {
+                index_.warnings.push_back("Number part of '" + name_ + "' is out of range");
+            }
+            return false;
+        }
+        push(name_, number, ext_);
+        return true;
+    }
+
+    // Fills index.order by a stable counting sort on each digit, least significant first.
+    // Digits that are 0 for every number are skipped.
+    void finish() {
+        std::size_t n = index_.size();
+        index_.order.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            index_.order[i] = static_cast<std::uint32_t>(i);
+        }
+        std::vector<std::uint32_t> scattered(n);
+        for (int pass = 0; pass < PASSES; ++pass) {
+            auto& counts = counts_[pass];
+            if (counts[0] == n) {
+                continue;
+            }
+            std::uint32_t start = 0;
+            for (auto& count : counts) { // Counts become the start of each digit's run
+                std::uint32_t c = count;
+                count = start;
+                start += c;
+            }
+            for (std::uint32_t i : index_.order) {
+                scattered[counts[digit(index_.numbers[i], pass)]++] = i;
+            }
+            index_.order.swap(scattered);
+        }
+    }
+
+private:
+    void push(const std::string& name, int number, const std::string& ext) {
+        index_.numbers.push_back(number);
+        index_.name_at.push_back(static_cast<std::uint32_t>(index_.text.size()));
+        index_.text.append(name).push_back('\0');
+        index_.ext_at.push_back(static_cast<std::uint32_t>(index_.text.size()));
+        index_.text.append(ext).push_back('\0');
+        for (int pass = 0; pass < PASSES; ++pass) {
+            ++counts_[pass][digit(number, pass)];
+        }
+    }
+
+    static constexpr int DIGIT_BITS = 11;
+    static constexpr int PASSES = 3; // Numbers are non-negative ints: 31 bits
+
+    static unsigned digit(int number, int pass) {
+        return static_cast<unsigned>(number) >> (DIGIT_BITS * pass) & ((1u << DIGIT_BITS) - 1);
+    }
+
+    Index& index_;
+    const NameTemplate& naming_;
+    std::string name_;
+    std::string ext_;
+    std::array<std::array<std::uint32_t, 1u << DIGIT_BITS>, PASSES> counts_{};
+};
+
+#if defined(__linux__)
+
+// A run of raw linux_dirent64 records as getdents64 returned them.
+struct Batch {
+    std::vector<char> bytes; // Allocated on first use: small directories fill one or two
+    long used = 0;  // Bytes of records; 0 marks the end of the listing
+    int error = 0;  // errno of a failed read (with used == 0)
+};
+
+// Layout of the records getdents64 writes (not declared by glibc before 2.30).
+struct Dirent64 {
+    std::uint64_t d_ino;
+    std::int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+// Lists the regular files (following symlinks, like fs::directory_entry::is_regular_file)
+// of 'dir' whose names are numbered into 'index', with their sizes if 'sizes' is set.
+// Returns false with 'error' if the directory cannot be read.
+inline bool scan(const fs::path& dir, const NameTemplate& naming, Index& index, std::string& error,
+                 bool sizes = false) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        error = dir.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    auto ring = std::make_unique<SpscRing<Batch, 8>>();
+    std::thread reader([&ring, fd] {
+        for (;;) {
+            Batch* batch;
+            while (!(batch = ring->claim())) {
+                std::this_thread::yield(); // The parser is behind
+            }
+            batch->bytes.resize(256 * 1024);
+            batch->used = syscall(SYS_getdents64, fd, batch->bytes.data(), batch->bytes.size());
+            batch->error = batch->used < 0 ? errno : 0;
+            batch->used = std::max(0L, batch->used);
+            bool last = batch->used == 0;
+            ring->publish();
+            if (last) {
+                return;
+            }
+        }
+    });
+
+    Parser parser(index, naming);
+    int read_error = 0;
+    for (;;) {
+        Batch* batch;
+        while (!(batch = ring->peek())) {
+            std::this_thread::yield(); // Waiting for the kernel
+        }
+        if (batch->used == 0) {
+            read_error = batch->error;
+            ring->release();
+            break;
+        }
+        for (long at = 0; at < batch->used;) {
+            const auto* entry = reinterpret_cast<const Dirent64*>(batch->bytes.data() + at);
+            at += entry->d_reclen;
+            struct stat st;
+            bool stated = false;
+            bool regular = entry->d_type == DT_REG;
+            if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+                stated = fstatat(fd, entry->d_name, &st, 0) == 0;
+                regular = stated && S_ISREG(st.st_mode);
+            }
+            if (regular && parser.add(entry->d_name, std::strlen(entry->d_name)) && sizes) {
+                stated = stated || fstatat(fd, entry->d_name, &st, 0) == 0;
+                index.sizes.push_back(stated ? static_cast<std::uint64_t>(st.st_size) : 0);
+            }
+        }
+        ring->release();
+    }
+    reader.join();
+    ::close(fd);
+    if (read_error) {
+        error = dir.string() + ": " + std::strerror(read_error);
+        return false;
+    }
+    parser.finish();
+    return true;
+}
+
+#else
+
+inline bool scan(const fs::path& dir, const NameTemplate& naming, Index& index, std::string& error,
+                 bool sizes = false) {
+    Parser parser(index, naming);
+    try {
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            if (entry.is_regular_file()) {
+                std::string name = entry.path().filename().string();
+                if (parser.add(name.data(), name.size()) && sizes) {
+                    std::error_code ec;
+                    std::uintmax_t size = entry.file_size(ec);
+                    index.sizes.push_back(ec ? 0 : static_cast<std::uint64_t>(size));
+                }
+            }
+        }
+    } catch (const fs::filesystem_error& e) {
+        error = e.what();
+        return false;
+    }
+    parser.finish();
+    return true;
+}
+
+#endif
+
+} // namespace dirscan
@@ -0,0 +1,228 @@
+// exif.hpp - Minimal EXIF (TIFF) reader for JPEG APP1 segments.
+//
+// Only what the gallery tools need: the Orientation tag of the main image
+// (and where its value sits, so it can be reset in place), the pixel size the
+// camera recorded, and where the embedded thumbnail (IFD1) lies. The writers
+// patch values in place; only a thumbnail at the end of the payload can grow.
+#pragma once
+
+#include <algorithm>    // For std::fill
+#include <cstdint>      // For fixed-width integers
+#include <cstring>      // For std::memcmp
+#include <string>       // For segment payloads
+
+namespace exif {
+
+// A view of a TIFF structure with its byte order.
+struct TiffView {
+    const std::uint8_t* data = nullptr; // Start of the TIFF header ("II*\0" or "MM\0*")
+    std::size_t size = 0;
+    bool little = true;
+
+    std::uint16_t u16(std::size_t off) const {
+        if (off + 2 > size) {
+            return 0;
+        }
+        return little ? static_cast<std::uint16_t>(data[off] | (data[off + 1] << 8))
+                      : static_cast<std::uint16_t>((data[off] << 8) | data[off + 1]);
+    }
+
+    std::uint32_t u32(std::size_t off) const {
+        if (off + 4 > size) {
+            return 0;
+        }
+        return little ? (data[off] | (data[off + 1] << 8) | (data[off + 2] << 16) | (std::uint32_t(data[off + 3]) << 24))
+                      : ((std::uint32_t(data[off]) << 24) | (data[off + 1] << 16) | (data[off + 2] << 8) | data[off + 3]);
+    }
+};
+
+// Opens the TIFF structure inside an APP1 payload ("Exif\0\0" + TIFF). Returns false if it is not EXIF.
+inline bool openExif(const std::uint8_t* payload, std::size_t len, TiffView& tiff) {
+    if (len < 14 || std::memcmp(payload, "Exif\0\0", 6) != 0) {
+        return false;
+    }
+    tiff.data = payload + 6;
+    tiff.size = len - 6;
+    if (tiff.data[0] == 'I' && tiff.data[1] == 'I') {
+        tiff.little = true;
+    } else if (tiff.data[0] == 'M' && tiff.data[1] == 'M') {
+        tiff.little = false;
+    } else {
+        return false;
+    }
+    return tiff.u16(2) == 42;
+}
+
+// Finds an entry of the IFD at 'ifd' with the given tag. Returns the entry offset or 0.
+inline std::size_t findTag(const TiffView& tiff, std::uint32_t ifd, std::uint16_t tag) {
+    if (ifd == 0 || ifd + 2 > tiff.size) {
+        return 0;
+    }
+    std::uint16_t count = tiff.u16(ifd);
+    for (std::uint16_t i = 0; i < count; ++i) {
+        std::size_t entry = ifd + 2 + 12u * i;
+        if (entry + 12 > tiff.size) {
+            return 0;
+        }
+        if (tiff.u16(entry) == tag) {
+            return entry;
+        }
+    }
+    return 0;
+}
+
+// Reads a SHORT or LONG value of one count from an IFD entry. Returns 0 for other types.
+inline std::uint32_t entryValue(const TiffView& tiff, std::size_t entry) {
+    if (entry == 0 || tiff.u32(entry + 4) != 1) {
+        return 0;
+    }
+    std::uint16_t type = tiff.u16(entry + 2);
+    return type == 3 ? tiff.u16(entry + 8) : type == 4 ? tiff.u32(entry + 8) : 0;
+}
+
+// Offset of the IFD that follows the one at 'ifd' (0 if none).
+inline std::uint32_t nextIfd(const TiffView& tiff, std::uint32_t ifd) {
+    if (ifd == 0 || ifd + 2 > tiff.size) {
+        return 0;
+    }
+    return tiff.u32(ifd + 2 + 12u * tiff.u16(ifd));
+}
+
+// Reads the Orientation tag (1..8) of IFD0. 'value_offset' receives the offset of the
+// value inside the payload so it can be patched. Returns 0 if there is no valid tag.
+inline int readOrientation(const std::uint8_t* payload, std::size_t len, std::size_t* value_offset = nullptr) {
+    TiffView tiff;
+    if (!openExif(payload, len, tiff)) {
+        return 0;
+    }
+    std::size_t entry = findTag(tiff, tiff.u32(4), 0x0112);
+    if (entry == 0 || tiff.u16(entry + 2) != 3) { // Must be a SHORT
+        return 0;
+    }
+    int orientation = tiff.u16(entry + 8);
+    if (orientation < 1 || orientation > 8) {
+        return 0;
+    }
+    if (value_offset) {
+        *value_offset = 6 + entry + 8;
+    }
+    return orientation;
+}
+
+// Reads PixelXDimension and PixelYDimension from the Exif IFD: the size the camera (or
+// the last editor that kept EXIF up to date) wrote. Returns false if either is missing.
+inline bool readPixelSize(const std::uint8_t* payload, std::size_t len, int& width, int& height) {
+    TiffView tiff;
+    if (!openExif(payload, len, tiff)) {
+        return false;
+    }
+    std::uint32_t exif_ifd = entryValue(tiff, findTag(tiff, tiff.u32(4), 0x8769));
+    width = static_cast<int>(entryValue(tiff, findTag(tiff, exif_ifd, 0xA002)));
+    height = static_cast<int>(entryValue(tiff, findTag(tiff, exif_ifd, 0xA003)));
+    return width > 0 && height > 0;
+}
+
+// Finds the JPEG thumbnail of IFD1 (JPEGInterchangeFormat and its length). 'offset' is
+// relative to the start of the payload. Returns false if there is none or it is cut off.
+inline bool findThumbnail(const std::uint8_t* payload, std::size_t len, std::size_t& offset, std::size_t& size) {
+    TiffView tiff;
+    if (!openExif(payload, len, tiff)) {
+        return false;
+    }
+    std::uint32_t ifd1 = nextIfd(tiff, tiff.u32(4));
+    std::uint32_t start = entryValue(tiff, findTag(tiff, ifd1, 0x0201));
+    std::uint32_t length = entryValue(tiff, findTag(tiff, ifd1, 0x0202));
+    if (start == 0 || length < 4 || start > tiff.size || length > tiff.size - start) {
+        return false;
+    }
+    offset = 6 + start;
+    size = length;
+    return true;
+}
+
+// Writes a SHORT or LONG value of one count into an IFD entry of 'payload', in the
+// byte order of 'tiff' (which must view the same payload). False for other types.
+inline bool setEntryValue(std::string& payload, const TiffView& tiff, std::size_t entry, std::uint32_t value) {
+    if (entry == 0 || tiff.u32(entry + 4) != 1) {
+        return false;
+    }
+    std::uint16_t type = tiff.u16(entry + 2);
+    int bytes = type == 3 ? 2 : type == 4 ? 4 : 0;
+    if (bytes == 0 || (bytes == 2 && value > 0xFFFF)) {
+        return false;
+    }
+    for (int i = 0; i < bytes; ++i) {
+        int shift = 8 * (tiff.little ? i : bytes - 1 - i);
+        payload[6 + entry + 8 + i] = static_cast<char>((value >> shift) & 0xFF);
+    }
+    return true;
+}
+
+// Updates PixelXDimension and PixelYDimension, where present, to a new pixel size.
+inline void setPixelSize(std::string& payload, int width, int height) {
+    TiffView tiff;
+    if (!openExif(reinterpret_cast<const std::uint8_t*>(payload.data()), payload.size(), tiff)) {
+        return;
+    }
+    std::uint32_t exif_ifd = entryValue(tiff, findTag(tiff, tiff.u32(4), 0x8769));
+    setEntryValue(payload, tiff, findTag(tiff, exif_ifd, 0xA002), static_cast<std::uint32_t>(width));
+    setEntryValue(payload, tiff, findTag(tiff, exif_ifd, 0xA003), static_cast<std::uint32_t>(height));
+}
+
+// Replaces the IFD1 JPEG thumbnail with 'jpeg'. It has to fit in the old one's place,
+// unless the old one ends the payload, in which case the payload is resized (up to the
+// 65533 bytes an APP1 segment can hold). Returns false, changing nothing, otherwise.
+inline bool replaceThumbnail(std::string& payload, const std::string& jpeg) {
+    std::size_t offset = 0, size = 0;
+    if (!findThumbnail(reinterpret_cast<const std::uint8_t*>(payload.data()), payload.size(), offset, size)) {
+        return false;
+    }
+    bool at_end = offset + size == payload.size();
+    if (jpeg.size() > size && (!at_end || offset + jpeg.size() > 65533)) {
+        return false;
+    }
+    TiffView tiff;
+    openExif(reinterpret_cast<const std::uint8_t*>(payload.data()), payload.size(), tiff);
+    std::size_t length = findTag(tiff, nextIfd(tiff, tiff.u32(4)), 0x0202);
+    if (!setEntryValue(payload, tiff, length, static_cast<std::uint32_t>(jpeg.size()))) {
+        return false;
+    }
+    if (at_end) {
+        payload.resize(offset);
+        payload += jpeg;
+    } else {
+        payload.replace(offset, jpeg.size(), jpeg);
+        std::fill(payload.begin() + offset + jpeg.size(), payload.begin() + offset + size, '\0');
+    }
+    return true;
+}
+
+// Unlinks IFD1 (and with it the thumbnail) from IFD0. False if there is no IFD1.
+inline bool dropThumbnail(std::string& payload) {
+    TiffView tiff;
+    if (!openExif(reinterpret_cast<const std::uint8_t*>(payload.data()), payload.size(), tiff)) {
+        return false;
+    }
+    std::uint32_t ifd0 = tiff.u32(4);
+    std::size_t link = ifd0 + 2 + 12u * tiff.u16(ifd0);
+    if (nextIfd(tiff, ifd0) == 0 || link + 4 > tiff.size) {
+        return false;
+    }
+    std::fill(payload.begin() + 6 + link, payload.begin() + 6 + link + 4, '\0');
+    return true;
+}
+
+// Sets the Orientation tag of an APP1 payload to 1 ("normal") in place.
+inline bool resetOrientation(std::string& payload) {
+    std::size_t offset = 0;
+    const auto* bytes = reinterpret_cast<const std::uint8_t*>(payload.data());
+    if (readOrientation(bytes, payload.size(), &offset) == 0) {
+        return false;
+    }
+    bool little = payload[6] == 'I';
+    payload[offset] = little ? 1 : 0;
+    payload[offset + 1] = little ? 0 : 1;
+    return true;
+}
+
+} // namespace exif
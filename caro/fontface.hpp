@@ -0,0 +1,237 @@
+// fontface.hpp - Rewrites @font-face src lists to offer WOFF2 first.
+//
+// Browsers take the first src entry whose format they support, so a list that
+// starts with WOFF or TrueType downloads the larger file even when a WOFF2
+// sits next to it. For every @font-face src list with format() hints this adds
+// a url(...) format("woff2") entry for a .woff2 sibling of a listed font (if
+// the file exists) or moves an existing WOFF2 entry to the front. Lone
+// src: url(x.eot) declarations for old IE are left alone, as are quote style,
+// separators and cache-busting query strings.
+#pragma once
+
+#include <filesystem>   // For finding .woff2 siblings
+#include <string>       // For CSS text
+#include <vector>       // For src entries
+
+namespace fs = std::filesystem;
+
+namespace fontface {
+
+// One "url(...) format(...)" entry of a src list.
+struct Source {
+    std::string text;   // The entry as written, without surrounding whitespace
+    std::string url;    // URL without quotes
+    std::string format; // format() value without quotes, empty if absent
+    char quote = 0;     // Quote used around the URL, 0 if none
+    char format_quote = '"';
+};
+
+// Contents of the first "name(...)" in 'entry', without quotes.
+inline bool function(const std::string& entry, const std::string& name, std::string& value, char& quote) {
+    std::size_t start = entry.find(name + "(");
+    if (start == std::string::npos) {
+        return false;
+    }
+    start += name.size() + 1;
+    std::size_t end = entry.find(')', start);
+    if (end == std::string::npos) {
+        return false;
+    }
+    value = entry.substr(start, end - start);
+    std::size_t first = value.find_first_not_of(" \t\r\n");
+    std::size_t last = value.find_last_not_of(" \t\r\n");
+    value = first == std::string::npos ? "" : value.substr(first, last - first + 1);
+    quote = 0;
+    if (value.size() >= 2 && (value[0] == '"' || value[0] == '\'') && value.back() == value[0]) {
+        quote = value[0];
+        value = value.substr(1, value.size() - 2);
+    }
+    return true;
+}
+
+// Splits a src value at top-level commas (not inside quotes or parentheses).
+// 'separator' receives the text of the first separator, e.g. ",\n       " or ",".
+inline std::vector<Source> splitSources(const std::string& value, std::string& separator) {
+    std::vector<Source> sources;
+    std::size_t start = 0;
+    int depth = 0;
+    char quote = 0;
+    separator = ", ";
+    bool first_separator = true;
+    for (std::size_t i = 0; i <= value.size(); ++i) {
+        char c = i < value.size() ? value[i] : ',';
+        if (quote) {
+            quote = c == quote ? 0 : quote;
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')') {
+            --depth;
+        } else if (c == ',' && depth == 0) {
+            Source source;
+            std::size_t first = value.find_first_not_of(" \t\r\n", start);
+            std::size_t last = value.find_last_not_of(" \t\r\n", i ? i - 1 : 0);
+            if (first != std::string::npos && first < i) {
+                source.text = value.substr(first, last - first + 1);
+            }
+            char q = 0;
+            function(source.text, "url", source.url, source.quote);
+            if (function(source.text, "format", source.format, q) && q) {
+                source.format_quote = q;
+            }
+            sources.push_back(source);
+            if (i < value.size() && first_separator) {
+                std::size_t next = value.find_first_not_of(" \t\r\n", i + 1);
+                separator = value.substr(i, (next == std::string::npos ? value.size() : next) - i);
+                first_separator = false;
+            }
+            start = i + 1;
+        }
+    }
+    return sources;
+}
+
+// The URL path without its query string and fragment.
+inline std::string urlPath(const std::string& url) {
+    return url.substr(0, url.find_first_of("?#"));
+}
+
+inline bool isWoff2(const Source& source) {
+    std::string path = urlPath(source.url);
+    return source.format == "woff2" || (path.size() > 6 && path.compare(path.size() - 6, 6, ".woff2") == 0);
+}
+
+// Moves an existing WOFF2 entry to the front; false if there is none or it is first.
+inline bool moveWoff2First(std::vector<Source>& sources) {
+    for (std::size_t i = 1; i < sources.size(); ++i) {
+        if (isWoff2(sources[i])) {
+            Source woff2 = sources[i];
+            sources.erase(sources.begin() + static_cast<std::ptrdiff_t>(i));
+            sources.insert(sources.begin(), woff2);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds an entry for the .woff2 sibling of a listed TTF, OTF or WOFF file, if it exists.
+inline bool addWoff2(std::vector<Source>& sources, const fs::path& css_dir) {
+    for (const auto& source : sources) {
+        if (isWoff2(source)) {
+            return false; // Already first
+        }
+    }
+    for (const auto& source : sources) {
+        std::string path = urlPath(source.url);
+        std::size_t dot = path.rfind('.');
+        if (source.url.empty() || dot == std::string::npos || path.find(':') != std::string::npos) {
+            continue;
+        }
+        std::string ext = path.substr(dot + 1);
+        if (ext != "ttf" && ext != "otf" && ext != "woff") {
+            continue;
+        }
+        std::string woff2_path = path.substr(0, dot) + ".woff2";
+        std::error_code ec;
+        if (!fs::exists(css_dir / woff2_path, ec)) {
+            continue;
+        }
+        // Keep a cache-busting query string, drop fragments such as "#iefix".
+        std::size_t query = source.url.find('?');
+        std::string suffix = query == std::string::npos ? "" : source.url.substr(query);
+        suffix = suffix.substr(0, suffix.find('#'));
+        std::string q = source.quote ? std::string(1, source.quote) : "";
+        std::string fq(1, source.format_quote);
+        Source woff2;
+        woff2.text = "url(" + q + woff2_path + suffix + q + ") format(" + fq + "woff2" + fq + ")";
+        sources.insert(sources.begin(), woff2);
+        return true;
+    }
+    return false;
+}
+
+// Rewrites one src value; returns true if it changed. 'css_dir' resolves relative URLs.
+inline bool rewriteSources(const std::string& value, const fs::path& css_dir, std::string& out) {
+    std::string separator;
+    std::vector<Source> sources = splitSources(value, separator);
+    bool hinted = false;
+    for (const auto& source : sources) {
+        hinted = hinted || !source.format.empty();
+    }
+    if (!hinted || sources.empty()) {
+        return false;
+    }
+    if (!moveWoff2First(sources) && !addWoff2(sources, css_dir)) {
+        return false;
+    }
+
+    std::size_t lead = value.find_first_not_of(" \t\r\n");
+    std::size_t trail = value.find_last_not_of(" \t\r\n");
+    out = value.substr(0, lead);
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+        out += (i ? separator : "") + sources[i].text;
+    }
+    out += value.substr(trail + 1);
+    return true;
+}
+
+// Rewrites every @font-face src list in a stylesheet. Returns the number changed.
+inline int rewriteStylesheet(const std::string& css, const fs::path& css_dir, std::string& out) {
+    out.clear();
+    int changed = 0;
+    std::size_t pos = 0;
+    for (;;) {
+        std::size_t at = css.find("@font-face", pos);
+        std::size_t open = at == std::string::npos ? at : css.find('{', at);
+        std::size_t close = open == std::string::npos ? open : css.find('}', open);
+        if (close == std::string::npos) {
+            out.append(css, pos, std::string::npos);
+            return changed;
+        }
+        out.append(css, pos, open + 1 - pos);
+        // Declarations of the block: copy each, rewriting the src ones.
+        std::size_t decl = open + 1;
+        while (decl < close) {
+            std::size_t end = decl;
+            char quote = 0;
+            int depth = 0;
+            for (; end < close; ++end) {
+                char c = css[end];
+                if (quote) {
+                    quote = c == quote ? 0 : quote;
+                } else if (c == '"' || c == '\'') {
+                    quote = c;
+                } else if (c == '(') {
+                    ++depth;
+                } else if (c == ')') {
+                    --depth;
+                } else if (c == ';' && depth == 0) {
+                    break;
+                }
+            }
+            std::string declaration = css.substr(decl, end - decl);
+            std::size_t name = declaration.find_first_not_of(" \t\r\n");
+            std::size_t colon = declaration.find(':');
+            std::string rewritten;
+            if (name != std::string::npos && colon != std::string::npos &&
+                declaration.compare(name, 3, "src") == 0 &&
+                declaration.find_first_not_of(" \t", name + 3) == colon &&
+                rewriteSources(declaration.substr(colon + 1), css_dir, rewritten)) {
+                declaration = declaration.substr(0, colon + 1) + rewritten;
+                ++changed;
+            }
+            out += declaration;
+            if (end < close) {
+                out += ';';
+            }
+            decl = end + 1;
+        }
+        out += '}';
+        pos = close + 1;
+    }
+}
+
+} // namespace fontface
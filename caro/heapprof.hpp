@@ -0,0 +1,449 @@
+// heapprof.hpp - Sampling heap profiler by allocation site (opt-in).
+//
+// Built with -DCARO_HEAP_PROFILE (Linux, glibc), caro replaces malloc, calloc,
+// realloc, free and the global operator new/delete. Allocations are sampled by
+// size: on average one every CARO_HEAP_SAMPLE bytes (default 512 KiB), so big
+// decode buffers are nearly always seen and small strings rarely, and each
+// sample is weighted to estimate the bytes and allocations it stands for. A
+// sample records a short stack starting at the first frame outside the
+// profiler, the allocator and the standard library; that stack is the site.
+// phase() prints the live bytes and allocations per site at a boundary the
+// caller names, and the report at exit adds the sites as they were when RSS
+// peaked.
+//
+// Between samples an allocation costs a thread-local subtraction and a free a
+// probe of the sampled-pointer table, which keeps the overhead in the low
+// percent. Symbols need -rdynamic; without it sites print as caro+0xOFFSET for
+// addr2line -f -C -e caro, and may start in standard library code, which can
+// then not be told apart from the caller's.
+//
+// The replacement functions are ordinary (not inline) definitions, so this
+// header must be included by a single translation unit: main.cpp. Without the
+// macro only the no-op phase() remains.
+#pragma once
+
+#if defined(CARO_HEAP_PROFILE) && defined(__linux__) && defined(__GLIBC__)
+#define CARO_HEAP_PROFILER 1
+#else
+#define CARO_HEAP_PROFILER 0
+#endif
+
+#if CARO_HEAP_PROFILER
+#include <algorithm>    // For sorting the report
+#include <atomic>       // For the sampled-pointer table and the lock
+#include <cmath>        // For the sampling interval and weights
+#include <cstdint>      // For hashes
+#include <cstdio>       // For the report
+#include <cstdlib>      // For std::getenv, std::atexit
+#include <cstring>      // For std::strncmp, std::strrchr, std::strstr
+#include <new>          // For the operator new signatures
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/resource.h>
+
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void __libc_free(void* ptr);
+}
+#endif
+
+namespace heapprof {
+
+#if CARO_HEAP_PROFILER
+
+constexpr int FRAMES = 8;              // Return addresses kept per site, from the caller on
+constexpr int SKIPPED = 8;             // Extra frames captured for the profiler and allocator
+constexpr std::size_t SITES = 4096;    // Distinct sites; site 0 collects the overflow
+constexpr std::size_t LIVE = 1 << 16;  // Slots for sampled allocations still alive
+constexpr int SHOWN = 12;              // Sites per report
+
+struct Site {
+    std::uint64_t hash = 0;
+    void* frames[FRAMES] = {};
+    int depth = 0;
+    double live_bytes = 0, live_count = 0;   // Estimated, from the samples still alive
+    double phase_bytes = 0, phase_count = 0; // Estimated, allocated since the last phase
+};
+
+// Everything is zero-initialized and constant-initialized: it is ready before the first allocation.
+struct State {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    std::size_t rate = 0;       // Mean bytes between samples, 0 until read from the environment
+    Site sites[SITES] = {};
+    std::atomic<void*> keys[LIVE] = {}; // Sampled pointers; TOMBSTONE marks freed slots
+    std::uint32_t key_site[LIVE] = {};
+    float key_bytes[LIVE] = {}, key_count[LIVE] = {};
+    std::atomic<std::size_t> alive{0}; // Sampled allocations in 'keys'
+    std::uint64_t samples = 0, dropped = 0;
+    long peak_rss_kb = 0;       // RSS at the last peak snapshot
+    double peak_bytes[SITES] = {}, peak_count[SITES] = {};
+};
+
+inline State g_state;
+
+inline void* const TOMBSTONE = reinterpret_cast<void*>(1);
+
+// Per thread: bytes left until the next sample, and whether the profiler itself is running.
+inline thread_local long t_countdown __attribute__((tls_model("initial-exec"))) = 0;
+inline thread_local bool t_busy __attribute__((tls_model("initial-exec"))) = false;
+inline thread_local std::uint64_t t_rng __attribute__((tls_model("initial-exec"))) = 0;
+
+struct Guard {
+    Guard() { while (g_state.lock.test_and_set(std::memory_order_acquire)) {} }
+    ~Guard() { g_state.lock.clear(std::memory_order_release); }
+};
+
+inline std::size_t slotOf(const void* ptr) {
+    std::uint64_t h = reinterpret_cast<std::uintptr_t>(ptr) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<std::size_t>(h >> 48) & (LIVE - 1);
+}
+
+// Exponentially distributed gap with mean 'rate', so samples form a Poisson process over bytes.
+inline long nextInterval() {
+    if (g_state.rate == 0) {
+        const char* env = std::getenv("CARO_HEAP_SAMPLE");
+        long rate = env ? std::atol(env) : 0;
+        g_state.rate = static_cast<std::size_t>(rate > 0 ? rate : 512 * 1024);
+    }
+    if (t_rng == 0) {
+        t_rng = reinterpret_cast<std::uintptr_t>(&t_rng) | 1;
+    }
+    t_rng ^= t_rng << 13;
+    t_rng ^= t_rng >> 7;
+    t_rng ^= t_rng << 17;
+    double u = (static_cast<double>(t_rng >> 11) + 1) * (1.0 / 9007199254740993.0);
+    return static_cast<long>(-std::log(u) * static_cast<double>(g_state.rate)) + 1;
+}
+
+inline long currentMaxRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// "fn" for a frame: the demangled symbol without arguments, or module+offset.
+inline void frameName(void* frame, char* out, std::size_t len) {
+    Dl_info info;
+    if (!dladdr(frame, &info) || !info.dli_fname) {
+        std::snprintf(out, len, "%p", frame);
+        return;
+    }
+    if (!info.dli_sname) {
+        const char* module = std::strrchr(info.dli_fname, '/');
+        std::snprintf(out, len, "%s+0x%lx", module ? module + 1 : info.dli_fname,
+                      static_cast<unsigned long>(static_cast<char*>(frame) - static_cast<char*>(info.dli_fbase) - 1));
+        return;
+    }
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    const char* name = status == 0 && demangled ? demangled : info.dli_sname;
+    // Up to the argument list; long template arguments (lambdas, allocators of allocators) become <...>.
+    std::size_t n = 0;
+    for (std::size_t i = 0; name[i] && name[i] != '(' && n + 6 < len; ++i) {
+        std::size_t end = i;
+        for (int depth = 0; name[i] == '<' && name[end] && (end == i || depth > 0); ++end) {
+            depth += name[end] == '<' ? 1 : name[end] == '>' ? -1 : 0;
+        }
+        if (name[i] == '<' && end - i > 64) {
+            std::memcpy(out + n, "<...>", 5);
+            n += 5;
+            i = end - 1;
+        } else {
+            out[n++] = name[i];
+        }
+    }
+    out[n] = '\0';
+    std::free(demangled);
+}
+
+// True for malloc, calloc, realloc and the operator new variants.
+inline bool entryPoint(const char* name) {
+    return std::strncmp(name, "operator new", 12) == 0 || std::strcmp(name, "malloc") == 0 ||
+           std::strcmp(name, "calloc") == 0 || std::strcmp(name, "realloc") == 0;
+}
+
+// True for code of the profiler and the standard library (allocators, containers).
+inline bool libraryFrame(const char* name) {
+    // Function templates demangle with their return type first: "void std::vector<...>::...".
+    const char* space = std::strchr(name, ' ');
+    const char* scope = std::strstr(name, "::");
+    if (space && scope && space < scope) {
+        name = space + 1;
+    }
+    return std::strncmp(name, "std::", 5) == 0 || std::strncmp(name, "__gnu_cxx::", 11) == 0 ||
+           std::strncmp(name, "heapprof::", 10) == 0 || entryPoint(name);
+}
+
+// Number of leading frames that say nothing about the site: the profiler, the allocator
+// entry point and the library code between it and the caller. Frames before the entry
+// point are the profiler's even when they have no symbol.
+inline int internalFrames(void* const* frames, int depth) {
+    char name[160];
+    int first = 0;
+    for (int i = 0; i < depth && i < 6; ++i) {
+        frameName(frames[i], name, sizeof(name));
+        if (entryPoint(name)) {
+            first = i + 1; // operator new[] calls operator new: the last one counts
+        }
+    }
+    for (; first < depth; ++first) {
+        frameName(frames[first], name, sizeof(name));
+        if (!libraryFrame(name)) {
+            break;
+        }
+    }
+    return first < depth ? first : 0;
+}
+
+inline void recordSample(void* ptr, std::size_t size) {
+    t_busy = true;
+    void* raw[SKIPPED + FRAMES];
+    int raw_depth = backtrace(raw, SKIPPED + FRAMES);
+    // The site starts at the caller, so the same call reached through new or malloc, or
+    // another container method, is one site and the kept frames are all the caller's.
+    int first = internalFrames(raw, raw_depth);
+    void* const* frames = raw + first;
+    int depth = std::min(FRAMES, raw_depth - first);
+    std::uint64_t hash = 1469598103934665603ULL;
+    for (int i = 0; i < depth; ++i) {
+        hash = (hash ^ reinterpret_cast<std::uintptr_t>(frames[i])) * 1099511628211ULL;
+    }
+    // One sample stands for 1 / P(sampled) allocations of this size.
+    double scale = 1.0 / (1.0 - std::exp(-static_cast<double>(size) / static_cast<double>(g_state.rate)));
+    long rss = currentMaxRssKb();
+    {
+        Guard guard;
+        std::size_t s = hash % (SITES - 1) + 1;
+        for (std::size_t probes = 0; probes < SITES - 1; ++probes, s = s % (SITES - 1) + 1) {
+            if (g_state.sites[s].hash == hash || g_state.sites[s].hash == 0) {
+                break;
+            }
+        }
+        Site& site = g_state.sites[s].hash == hash || g_state.sites[s].hash == 0 ? g_state.sites[s] : g_state.sites[0];
+        if (site.hash == 0 && &site != &g_state.sites[0]) {
+            site.hash = hash;
+            site.depth = depth;
+            std::copy(frames, frames + depth, site.frames);
+        }
+        site.phase_bytes += size * scale;
+        site.phase_count += scale;
+        ++g_state.samples;
+        if (g_state.alive < LIVE / 2) {
+            std::size_t slot = slotOf(ptr);
+            while (g_state.keys[slot].load(std::memory_order_relaxed) > TOMBSTONE) {
+                slot = (slot + 1) & (LIVE - 1);
+            }
+            g_state.key_site[slot] = static_cast<std::uint32_t>(&site - g_state.sites);
+            g_state.key_bytes[slot] = static_cast<float>(size * scale);
+            g_state.key_count[slot] = static_cast<float>(scale);
+            g_state.keys[slot].store(ptr, std::memory_order_release);
+            ++g_state.alive;
+            site.live_bytes += size * scale;
+            site.live_count += scale;
+        } else {
+            ++g_state.dropped;
+        }
+        // RSS grew past the last snapshot: keep the sites as they are now.
+        if (rss > g_state.peak_rss_kb + g_state.peak_rss_kb / 50) {
+            g_state.peak_rss_kb = rss;
+            for (std::size_t i = 0; i < SITES; ++i) {
+                g_state.peak_bytes[i] = g_state.sites[i].live_bytes;
+                g_state.peak_count[i] = g_state.sites[i].live_count;
+            }
+        }
+    }
+    t_busy = false;
+}
+
+inline void* allocated(void* ptr, std::size_t size) {
+    if (ptr && !t_busy && (t_countdown -= static_cast<long>(size)) <= 0) {
+        bool first = t_rng == 0; // A new thread: start counting first
+        t_countdown = nextInterval();
+        if (!first) {
+            recordSample(ptr, size);
+        }
+    }
+    return ptr;
+}
+
+inline void released(void* ptr) {
+    if (!ptr || g_state.alive.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    // The pointer belongs to the caller, so it cannot be inserted concurrently; chains only
+    // ever gain keys or tombstones, so probing without the lock finds it if it is there.
+    std::size_t slot = slotOf(ptr);
+    for (std::size_t probes = 0; probes < LIVE; ++probes, slot = (slot + 1) & (LIVE - 1)) {
+        void* key = g_state.keys[slot].load(std::memory_order_acquire);
+        if (key == nullptr) {
+            return;
+        }
+        if (key != ptr) {
+            continue;
+        }
+        Guard guard;
+        Site& site = g_state.sites[g_state.key_site[slot]];
+        site.live_bytes -= g_state.key_bytes[slot];
+        site.live_count -= g_state.key_count[slot];
+        --g_state.alive;
+        // A tombstone just before an empty slot ends no chain: clear it and those before it.
+        bool last = g_state.keys[(slot + 1) & (LIVE - 1)].load(std::memory_order_relaxed) == nullptr;
+        g_state.keys[slot].store(last ? nullptr : TOMBSTONE, std::memory_order_release);
+        for (std::size_t prev = (slot - 1) & (LIVE - 1); last && g_state.keys[prev].load(std::memory_order_relaxed) == TOMBSTONE;
+             prev = (prev - 1) & (LIVE - 1)) {
+            g_state.keys[prev].store(nullptr, std::memory_order_release);
+        }
+        return;
+    }
+}
+
+inline void printSites(const double* bytes, const double* count, const double* phase_bytes, const double* phase_count) {
+    static std::uint32_t order[SITES];
+    for (std::size_t i = 0; i < SITES; ++i) {
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+    auto weight = [&](std::uint32_t i) { return bytes[i] + (phase_bytes ? phase_bytes[i] : 0); };
+    std::sort(order, order + SITES, [&](std::uint32_t a, std::uint32_t b) { return weight(a) > weight(b); });
+    std::fprintf(stderr, "    live KiB    live n   new KiB     new n  site\n");
+    for (int shown = 0; shown < SHOWN && weight(order[shown]) >= 1; ++shown) {
+        const Site& site = g_state.sites[order[shown]];
+        auto positive = [](double v) { return std::max(0.0, v); }; // Estimates can dip below 0
+        std::fprintf(stderr, "  %10.0f %9.0f", positive(bytes[order[shown]] / 1024), positive(count[order[shown]]));
+        if (phase_bytes) {
+            std::fprintf(stderr, " %9.0f %9.0f", phase_bytes[order[shown]] / 1024, phase_count[order[shown]]);
+        } else {
+            std::fprintf(stderr, " %9s %9s", "", "");
+        }
+        std::fprintf(stderr, "  ");
+        if (order[shown] == 0) {
+            std::fprintf(stderr, "(other sites)");
+        }
+        char name[160];
+        for (int f = 0; f < site.depth && f < 4; ++f) {
+            frameName(site.frames[f], name, sizeof(name));
+            std::fprintf(stderr, "%s%s", f ? " <- " : "", name);
+        }
+        std::fprintf(stderr, "\n");
+    }
+}
+
+// Prints the sites by live bytes plus what they allocated since the last phase, and starts a new phase.
+inline void phase(const char* label) {
+    if (g_state.rate == 0) {
+        return; // Nothing sampled yet
+    }
+    t_busy = true;
+    static double bytes[SITES], count[SITES], phase_bytes[SITES], phase_count[SITES];
+    double live = 0;
+    std::uint64_t samples = 0, dropped = 0;
+    {
+        Guard guard;
+        for (std::size_t i = 0; i < SITES; ++i) {
+            Site& site = g_state.sites[i];
+            bytes[i] = site.live_bytes;
+            count[i] = site.live_count;
+            phase_bytes[i] = site.phase_bytes;
+            phase_count[i] = site.phase_count;
+            site.phase_bytes = site.phase_count = 0;
+            live += site.live_bytes;
+        }
+        samples = g_state.samples;
+        dropped = g_state.dropped;
+    }
+    live = std::max(0.0, live);
+    std::fprintf(stderr, "heap [%s]: ~%.1f MiB live, peak RSS %.1f MiB, %llu samples (1 per %zu bytes)%s\n", label,
+                 live / 1048576, currentMaxRssKb() / 1024.0, static_cast<unsigned long long>(samples), g_state.rate,
+                 dropped ? ", some not tracked to their free" : "");
+    printSites(bytes, count, phase_bytes, phase_count);
+    t_busy = false;
+}
+
+inline void reportAtExit() {
+    phase("exit");
+    t_busy = true;
+    std::fprintf(stderr, "heap [at peak RSS %.1f MiB]:\n", g_state.peak_rss_kb / 1024.0);
+    printSites(g_state.peak_bytes, g_state.peak_count, nullptr, nullptr);
+    t_busy = false;
+}
+
+inline const int g_registered = std::atexit(reportAtExit);
+
+#else
+
+inline void phase(const char*) {}
+
+#endif
+
+} // namespace heapprof
+
+#if CARO_HEAP_PROFILER
+
+extern "C" {
+void* malloc(std::size_t size) {
+    return heapprof::allocated(__libc_malloc(size), size);
+}
+
+void* calloc(std::size_t count, std::size_t size) {
+    return heapprof::allocated(__libc_calloc(count, size), count * size);
+}
+
+void* realloc(void* ptr, std::size_t size) {
+    heapprof::released(ptr);
+    return heapprof::allocated(__libc_realloc(ptr, size), size);
+}
+
+void free(void* ptr) {
+    heapprof::released(ptr);
+    __libc_free(ptr);
+}
+}
+
+void* operator new(std::size_t size) {
+    void* ptr = heapprof::allocated(__libc_malloc(size ? size : 1), size);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return heapprof::allocated(__libc_malloc(size ? size : 1), size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return heapprof::allocated(__libc_malloc(size ? size : 1), size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    void* ptr = heapprof::allocated(__libc_memalign(static_cast<std::size_t>(align), size ? size : 1), size);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { free(ptr); }
+
+#endif
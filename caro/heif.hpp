@@ -0,0 +1,87 @@
+// heif.hpp - HEIF/HEIC decoding through libheif.
+//
+// Phones save photos as HEIC, which browsers do not display; ingest decodes
+// them here and transcodes them to JPEG or PNG. Large HEIC photos are grids
+// of independently coded tiles, which libheif decodes on 'threads' threads.
+// The image comes out upright (libheif applies the rotation and mirroring
+// properties) as 8-bit RGBA.
+//
+// libheif is an optional dependency: build with -DCARO_WITH_LIBHEIF and link
+// -lheif. Without it, HEIF files are still recognised (see image_probe.hpp)
+// but decode() reports that they cannot be converted.
+#pragma once
+
+#include <cstdint>      // For pixels
+#include <cstring>      // For std::memcpy
+#include <filesystem>   // For fs::path
+#include <string>       // For errors
+#include <vector>       // For pixels
+
+#if defined(CARO_WITH_LIBHEIF)
+#include <libheif/heif.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace heif {
+
+// Decodes the primary image of 'path' into RGBA; 'alpha' is set if it has an alpha plane.
+inline bool decode(const fs::path& path, int threads, int& width, int& height, std::vector<std::uint8_t>& rgba,
+                   bool& alpha, std::string& error) {
+#if defined(CARO_WITH_LIBHEIF)
+    heif_context* ctx = heif_context_alloc();
+    heif_image_handle* handle = nullptr;
+    heif_image* image = nullptr;
+    auto cleanup = [&] {
+        if (image) heif_image_release(image);
+        if (handle) heif_image_handle_release(handle);
+        heif_context_free(ctx);
+    };
+    auto failed = [&](const heif_error& err) {
+        if (err.code == heif_error_Ok) {
+            return false;
+        }
+        error = err.message ? err.message : "libheif error";
+        cleanup();
+        return true;
+    };
+#if LIBHEIF_HAVE_VERSION(1, 13, 0)
+    heif_context_set_max_decoding_threads(ctx, threads > 0 ? threads : 1);
+#else
+    (void)threads;
+#endif
+    if (failed(heif_context_read_from_file(ctx, path.string().c_str(), nullptr)) ||
+        failed(heif_context_get_primary_image_handle(ctx, &handle)) ||
+        failed(heif_decode_image(handle, &image, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, nullptr))) {
+        return false;
+    }
+    alpha = heif_image_handle_has_alpha_channel(handle) != 0;
+    width = heif_image_get_width(image, heif_channel_interleaved);
+    height = heif_image_get_height(image, heif_channel_interleaved);
+    int stride = 0;
+    const std::uint8_t* plane = heif_image_get_plane_readonly(image, heif_channel_interleaved, &stride);
+    if (!plane || width <= 0 || height <= 0) {
+        error = "no pixels in the primary image";
+        cleanup();
+        return false;
+    }
+    rgba.resize(static_cast<std::size_t>(width) * height * 4);
+    for (int y = 0; y < height; ++y) {
+        std::memcpy(rgba.data() + static_cast<std::size_t>(y) * width * 4, plane + static_cast<std::size_t>(y) * stride,
+                    static_cast<std::size_t>(width) * 4);
+    }
+    cleanup();
+    return true;
+#else
+    (void)path;
+    (void)threads;
+    (void)width;
+    (void)height;
+    (void)rgba;
+    (void)alpha;
+    error = "HEIF input needs libheif: rebuild with -DCARO_WITH_LIBHEIF and -lheif";
+    return false;
+#endif
+}
+
+} // namespace heif
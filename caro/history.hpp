@@ -0,0 +1,520 @@
+// history.hpp - Versioned gallery history: append-only delta log with checkpoints.
+//
+// Every recorded version of a gallery is written to <gallery>/.gallery-history
+// as a block of tab-separated lines:
+//
+//   V <version> <unix time> <message>    start of a version
+//   N <template>                        naming template after the version (see naming.hpp)
+//   M <from> <to>                       rename (all M lines of a version apply at once)
+//   D <name>                            file removed
+//   A <name> <hash> <size> <mtime>      file added or its content changed
+//   E                                   end of version
+//
+// A block without its closing E (an interrupted write) or with a field that
+// does not parse is ignored, and the next append cuts the log back to the end
+// of the last complete block first, so it never continues a torn line. Every
+// CHECKPOINT_INTERVAL versions the full state is also written to
+// .gallery-history.d/ckpt-<version> together with the log offset that follows
+// it, so reconstructing any version replays at most CHECKPOINT_INTERVAL blocks.
+// File contents referenced by A lines are kept in the object store.
+#pragma once
+
+#include <algorithm>    // For std::max
+#include <charconv>     // For std::from_chars
+#include <chrono>       // For version timestamps
+#include <cstdint>      // For std::int64_t
+#include <cstdlib>      // For std::atoi
+#include <filesystem>   // For file metadata
+#include <fstream>      // For the log and checkpoint files
+#include <map>          // For name -> entry maps
+#include <set>          // For name sets
+#include <sstream>      // For parsing lines
+#include <string>       // For names and hashes
+#include <vector>       // For delta lists
+
+#include "blake3.hpp"
+#include "naming.hpp"
+#include "object_store.hpp"
+#include "planner.hpp"
+
+namespace fs = std::filesystem;
+
+constexpr int CHECKPOINT_INTERVAL = 16;
+
+// What the history knows about one tracked file.
+struct HistoryEntry {
+    std::string hash;         // BLAKE3 content hash
+    std::uintmax_t size = 0;  // Size in bytes
+    std::int64_t mtime = 0;   // Last write time, used to skip rehashing unchanged files
+};
+
+using GalleryState = std::map<std::string, HistoryEntry>;
+
+// Summary of one version, for listings.
+struct VersionInfo {
+    int version = 0;
+    std::int64_t time = 0;
+    std::string message;
+    int moves = 0, removals = 0, additions = 0;
+};
+
+inline fs::path historyLogPath(const fs::path& dir) {
+    return dir / ".gallery-history";
+}
+
+inline fs::path checkpointPath(const fs::path& dir, int version) {
+    return dir / ".gallery-history.d" / ("ckpt-" + std::to_string(version));
+}
+
+inline bool historyExists(const fs::path& dir) {
+    std::error_code ec;
+    return fs::exists(historyLogPath(dir), ec);
+}
+
+inline std::int64_t fileMtime(const fs::path& path) {
+    std::error_code ec;
+    auto time = fs::last_write_time(path, ec);
+    return ec ? 0 : static_cast<std::int64_t>(time.time_since_epoch().count());
+}
+
+// Splits a log line at tabs.
+inline std::vector<std::string> splitTabs(const std::string& line) {
+    std::vector<std::string> fields;
+    std::size_t start = 0;
+    for (;;) {
+        std::size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+        if (tab == std::string::npos) {
+            return fields;
+        }
+        start = tab + 1;
+    }
+}
+
+// Parses a whole decimal field of a log or checkpoint line. Returns false for
+// anything else (a torn or damaged line).
+template <typename T>
+inline bool parseField(const std::string& field, T& value) {
+    const char* end = field.data() + field.size();
+    auto result = std::from_chars(field.data(), end, value);
+    return !field.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+// One parsed version block.
+struct VersionDelta {
+    VersionInfo info;
+    std::string naming; // Template spec after the version ("" in blocks written before it was kept)
+    std::vector<std::pair<std::string, std::string>> moves;
+    std::vector<std::string> removals;
+    std::vector<std::pair<std::string, HistoryEntry>> additions;
+};
+
+// Reads complete version blocks from 'in' (positioned at a block start) and calls
+// visit(delta, offset after the block) for each until visit returns false.
+template <typename Visitor>
+inline void readVersions(std::istream& in, Visitor visit) {
+    std::string line;
+    VersionDelta delta;
+    bool open = false;
+    while (std::getline(in, line)) {
+        std::vector<std::string> f = splitTabs(line);
+        if (f[0] == "V" && f.size() >= 4) {
+            delta = VersionDelta();
+            delta.info.message = f[3];
+            open = parseField(f[1], delta.info.version) && parseField(f[2], delta.info.time);
+        } else if (!open) {
+            continue; // Garbage between blocks: skip until the next V line
+        } else if (f[0] == "N" && f.size() >= 2) {
+            delta.naming = f[1];
+        } else if (f[0] == "M" && f.size() >= 3) {
+            delta.moves.push_back({f[1], f[2]});
+        } else if (f[0] == "D" && f.size() >= 2) {
+            delta.removals.push_back(f[1]);
+        } else if (f[0] == "A" && f.size() >= 5) {
+            HistoryEntry entry{f[2], 0, 0};
+            if (!parseField(f[3], entry.size) || !parseField(f[4], entry.mtime)) {
+                open = false; // Damaged block: skip it like a torn one
+                continue;
+            }
+            delta.additions.push_back({f[1], entry});
+        } else if (f[0] == "E") {
+            open = false;
+            delta.info.moves = static_cast<int>(delta.moves.size());
+            delta.info.removals = static_cast<int>(delta.removals.size());
+            delta.info.additions = static_cast<int>(delta.additions.size());
+            if (!visit(delta, static_cast<std::int64_t>(in.tellg()))) {
+                return;
+            }
+        }
+    }
+}
+
+// Applies a version block to a state: moves at once, then removals, then additions.
+inline void applyDelta(GalleryState& state, const VersionDelta& delta) {
+    std::vector<std::pair<std::string, HistoryEntry>> moved;
+    for (const auto& move : delta.moves) {
+        auto it = state.find(move.first);
+        if (it != state.end()) {
+            moved.push_back({move.second, it->second});
+        }
+    }
+    for (const auto& move : delta.moves) {
+        state.erase(move.first);
+    }
+    for (const auto& entry : moved) {
+        state[entry.first] = entry.second;
+    }
+    for (const auto& name : delta.removals) {
+        state.erase(name);
+    }
+    for (const auto& entry : delta.additions) {
+        state[entry.first] = entry.second;
+    }
+}
+
+// Finds the newest checkpoint at or before 'version' and loads it with its naming template.
+// Returns the log offset to continue replaying from (0 without a checkpoint).
+inline std::int64_t loadCheckpoint(const fs::path& dir, int version, GalleryState& state, int& at_version,
+                                   std::string& naming) {
+    state.clear();
+    at_version = 0;
+    naming = NameTemplate().spec();
+    for (int v = (version / CHECKPOINT_INTERVAL) * CHECKPOINT_INTERVAL; v > 0; v -= CHECKPOINT_INTERVAL) {
+        std::ifstream in(checkpointPath(dir, v));
+        std::string line;
+        if (!in || !std::getline(in, line)) {
+            continue;
+        }
+        std::vector<std::string> head = splitTabs(line);
+        std::int64_t offset = 0;
+        if (head.size() < 3 || head[0] != "K" || !parseField(head[2], offset)) {
+            continue;
+        }
+        GalleryState loaded;
+        std::string loaded_naming = NameTemplate().spec();
+        bool complete = false;
+        bool damaged = false;
+        while (std::getline(in, line)) {
+            std::vector<std::string> f = splitTabs(line);
+            if (f[0] == "N" && f.size() >= 2) {
+                loaded_naming = f[1];
+            } else if (f[0] == "F" && f.size() >= 5) {
+                HistoryEntry& entry = loaded[f[1]];
+                entry.hash = f[2];
+                damaged = damaged || !parseField(f[3], entry.size) || !parseField(f[4], entry.mtime);
+            } else if (f[0] == "E") {
+                complete = true;
+            }
+        }
+        if (!complete || damaged) {
+            continue; // Torn checkpoint: fall back to an older one
+        }
+        state = std::move(loaded);
+        naming = loaded_naming;
+        at_version = v;
+        return offset;
+    }
+    return 0;
+}
+
+// Reconstructs the state at 'version' (or the newest version when version < 0).
+// 'reached' receives the version actually reconstructed, 'naming' (if given) the
+// naming template the gallery had then.
+inline GalleryState stateAt(const fs::path& dir, int version, int& reached, std::string* naming = nullptr) {
+    GalleryState state;
+    std::string spec;
+    std::int64_t offset = 0;
+    reached = 0;
+    if (version >= 0) {
+        offset = loadCheckpoint(dir, version, state, reached, spec);
+    } else {
+        // Newest version: start from the newest checkpoint there is.
+        int newest = 0;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir / ".gallery-history.d", ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.rfind("ckpt-", 0) == 0) {
+                newest = std::max(newest, std::atoi(name.c_str() + 5));
+            }
+        }
+        offset = loadCheckpoint(dir, newest, state, reached, spec);
+    }
+    std::ifstream log(historyLogPath(dir));
+    log.seekg(offset);
+    readVersions(log, [&](const VersionDelta& delta, std::int64_t) {
+        if (version >= 0 && delta.info.version > version) {
+            return false;
+        }
+        applyDelta(state, delta);
+        spec = delta.naming.empty() ? spec : delta.naming;
+        reached = delta.info.version;
+        return true;
+    });
+    if (naming) {
+        *naming = spec;
+    }
+    return state;
+}
+
+// Lists every version in the log.
+inline std::vector<VersionInfo> listVersions(const fs::path& dir) {
+    std::vector<VersionInfo> versions;
+    std::ifstream log(historyLogPath(dir));
+    readVersions(log, [&](const VersionDelta& delta, std::int64_t) {
+        versions.push_back(delta.info);
+        return true;
+    });
+    return versions;
+}
+
+// Offset just past the last complete version block of the log (0 if there is none).
+inline std::int64_t completeLogSize(const fs::path& dir) {
+    std::int64_t end = 0;
+    std::ifstream log(historyLogPath(dir), std::ios::binary);
+    readVersions(log, [&](const VersionDelta&, std::int64_t offset) {
+        end = offset;
+        return true;
+    });
+    if (end < 0) { // The last E ends the file without a newline
+        std::error_code ec;
+        std::uintmax_t size = fs::file_size(historyLogPath(dir), ec);
+        end = ec ? 0 : static_cast<std::int64_t>(size);
+    }
+    return end;
+}
+
+// Appends one version block and writes a checkpoint when the interval is reached.
+// 'state' is the full state after the version and is only used for checkpoints.
+// A torn tail left by an interrupted append is cut off first.
+inline bool appendVersion(const fs::path& dir, VersionDelta delta, const GalleryState& state) {
+    std::int64_t end = completeLogSize(dir);
+    std::error_code ec;
+    if (fs::exists(historyLogPath(dir), ec) &&
+        static_cast<std::int64_t>(fs::file_size(historyLogPath(dir), ec)) != end) {
+        fs::resize_file(historyLogPath(dir), static_cast<std::uintmax_t>(end), ec);
+        if (ec) {
+            return false;
+        }
+    }
+    bool newline = false;
+    if (end > 0) {
+        std::ifstream tail(historyLogPath(dir), std::ios::binary);
+        char last = '\n';
+        tail.seekg(end - 1);
+        newline = tail.get(last) && last != '\n';
+    }
+    std::ofstream log(historyLogPath(dir), std::ios::app | std::ios::binary);
+    if (!log) {
+        return false;
+    }
+    delta.info.time = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string message = delta.info.message;
+    for (char& c : message) {
+        if (c == '\t' || c == '\n' || c == '\r') {
+            c = ' ';
+        }
+    }
+    std::ostringstream block;
+    if (newline) {
+        block << "\n";
+    }
+    block << "V\t" << delta.info.version << "\t" << delta.info.time << "\t" << message << "\n";
+    if (!delta.naming.empty()) {
+        block << "N\t" << delta.naming << "\n";
+    }
+    for (const auto& move : delta.moves) {
+        block << "M\t" << move.first << "\t" << move.second << "\n";
+    }
+    for (const auto& name : delta.removals) {
+        block << "D\t" << name << "\n";
+    }
+    for (const auto& addition : delta.additions) {
+        block << "A\t" << addition.first << "\t" << addition.second.hash << "\t" << addition.second.size
+              << "\t" << addition.second.mtime << "\n";
+    }
+    block << "E\n";
+    std::string text = block.str();
+    log.write(text.data(), static_cast<std::streamsize>(text.size()));
+    log.flush();
+    if (!log) {
+        return false;
+    }
+    std::int64_t offset = static_cast<std::int64_t>(log.tellp());
+    log.close();
+
+    if (delta.info.version % CHECKPOINT_INTERVAL == 0) {
+        fs::create_directories(checkpointPath(dir, delta.info.version).parent_path(), ec);
+        std::ostringstream ckpt;
+        ckpt << "K\t" << delta.info.version << "\t" << offset << "\n";
+        ckpt << "N\t" << (delta.naming.empty() ? NameTemplate().spec() : delta.naming) << "\n";
+        for (const auto& entry : state) {
+            ckpt << "F\t" << entry.first << "\t" << entry.second.hash << "\t" << entry.second.size
+                 << "\t" << entry.second.mtime << "\n";
+        }
+        ckpt << "E\n";
+        return writeFileAtomically(checkpointPath(dir, delta.info.version), ckpt.str());
+    }
+    return true;
+}
+
+// Scans the tracked files, reusing hashes from 'known' when size and mtime are unchanged.
+inline GalleryState scanGallery(const fs::path& dir, const std::vector<std::string>& names, const GalleryState& known) {
+    GalleryState state;
+    for (const auto& name : names) {
+        fs::path path = dir / name;
+        std::error_code ec;
+        HistoryEntry entry;
+        entry.size = fs::file_size(path, ec);
+        if (ec) {
+            continue;
+        }
+        entry.mtime = fileMtime(path);
+        auto it = known.find(name);
+        if (it != known.end() && it->second.size == entry.size && it->second.mtime == entry.mtime) {
+            entry.hash = it->second.hash; // Unchanged since last recorded
+        } else {
+            entry.hash = blake3::hashFile(path);
+            if (entry.hash.empty()) {
+                continue;
+            }
+        }
+        state[name] = entry;
+    }
+    return state;
+}
+
+// Computes the delta that turns 'from' into 'to'. Files whose content reappears under
+// another name become moves; everything else becomes removals and additions.
+inline VersionDelta diffStates(const GalleryState& from, const GalleryState& to) {
+    VersionDelta delta;
+    std::multimap<std::string, std::string> gone_by_hash; // hash -> old name
+    for (const auto& entry : from) {
+        auto it = to.find(entry.first);
+        if (it == to.end() || it->second.hash != entry.second.hash) {
+            gone_by_hash.insert({entry.second.hash, entry.first});
+        }
+    }
+    std::set<std::string> move_sources;
+    for (const auto& entry : to) {
+        auto it = from.find(entry.first);
+        if (it != from.end() && it->second.hash == entry.second.hash) {
+            continue; // Unchanged
+        }
+        auto gone = gone_by_hash.find(entry.second.hash);
+        if (gone != gone_by_hash.end()) {
+            delta.moves.push_back({gone->second, entry.first});
+            move_sources.insert(gone->second);
+            gone_by_hash.erase(gone);
+            // Metadata may differ (e.g. a copy rather than a rename): keep it exact.
+            const HistoryEntry& old_entry = from.at(delta.moves.back().first);
+            if (old_entry.size != entry.second.size || old_entry.mtime != entry.second.mtime) {
+                delta.additions.push_back(entry);
+            }
+        } else {
+            delta.additions.push_back(entry);
+        }
+    }
+    for (const auto& entry : from) {
+        if (!to.count(entry.first) && !move_sources.count(entry.first)) {
+            delta.removals.push_back(entry.first);
+        }
+    }
+    return delta;
+}
+
+// Records the current contents of the tracked files and the naming template as a new
+// version. New content is copied into the object store first so it can always be restored.
+// Returns the new version number, 0 if nothing changed, or -1 on error.
+inline int recordVersion(const fs::path& dir, const std::vector<std::string>& names, const std::string& message) {
+    int head_version = 0;
+    std::string head_naming;
+    GalleryState head = stateAt(dir, -1, head_version, &head_naming);
+    GalleryState current = scanGallery(dir, names, head);
+    VersionDelta delta = diffStates(head, current);
+    delta.naming = galleryNaming(dir).spec();
+    if (delta.moves.empty() && delta.removals.empty() && delta.additions.empty() && head_version > 0 &&
+        delta.naming == head_naming) {
+        return 0;
+    }
+    fs::path store = objectStoreDir(dir);
+    for (const auto& addition : delta.additions) {
+        if (!storeObject(store, addition.second.hash, dir / addition.first)) {
+            return -1;
+        }
+    }
+    delta.info.version = head_version + 1;
+    delta.info.message = message;
+    return appendVersion(dir, delta, current) ? delta.info.version : -1;
+}
+
+// Records a batch of renames that was just applied, without rehashing anything:
+// renamed files keep their content, size and mtime; the naming template is the one the
+// gallery records now. Returns the new version or -1.
+inline int recordMoves(const fs::path& dir, const std::map<std::string, std::string>& moves, const std::string& message) {
+    int head_version = 0;
+    GalleryState state = stateAt(dir, -1, head_version);
+    VersionDelta delta;
+    for (const auto& move : moves) {
+        if (state.count(move.first)) {
+            delta.moves.push_back(move);
+        }
+    }
+    applyDelta(state, delta);
+    delta.naming = galleryNaming(dir).spec();
+    delta.info.version = head_version + 1;
+    delta.info.message = message;
+    return appendVersion(dir, delta, state) ? delta.info.version : -1;
+}
+
+// Builds the single batched plan that turns the newest recorded state into 'target'.
+// Files already in place are untouched; content still present under another name is
+// moved, everything else is restored from the object store. Returns false if some
+// needed content is missing from the store.
+inline bool planCheckout(const fs::path& dir, const GalleryState& head, const GalleryState& target,
+                         RenamePlan& plan, std::string& error) {
+    fs::path store = objectStoreDir(dir);
+    std::multimap<std::string, std::string> available; // hash -> current name that will be vacated
+    for (const auto& entry : head) {
+        auto it = target.find(entry.first);
+        if (it == target.end() || it->second.hash != entry.second.hash) {
+            available.insert({entry.second.hash, entry.first});
+        }
+    }
+
+    std::map<std::string, std::string> moves;
+    std::vector<PlanStep> restores;
+    for (const auto& entry : target) {
+        auto it = head.find(entry.first);
+        if (it != head.end() && it->second.hash == entry.second.hash) {
+            continue; // Already in place
+        }
+        auto source = available.find(entry.second.hash);
+        if (source != available.end()) {
+            moves[source->second] = entry.first;
+            available.erase(source);
+        } else if (hasObject(store, entry.second.hash)) {
+            restores.push_back({StepKind::Restore, "", entry.first, entry.second.hash});
+        } else {
+            error = "content of '" + entry.first + "' (" + entry.second.hash.substr(0, 12) + ") is not in the object store";
+            return false;
+        }
+    }
+
+    // Files that are neither kept nor moved leave the directory (their content stays in the store).
+    std::set<std::string> occupied;
+    for (const auto& entry : head) {
+        occupied.insert(entry.first);
+    }
+    for (const auto& leftover : available) {
+        plan.steps.push_back({StepKind::Stash, leftover.second, "", leftover.first});
+        occupied.erase(leftover.second);
+    }
+    planMoves(moves, occupied, plan);
+    if (!plan.rejected.empty()) {
+        error = plan.reasons.front();
+        return false;
+    }
+    plan.steps.insert(plan.steps.end(), restores.begin(), restores.end());
+    return true;
+}
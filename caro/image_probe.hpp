@@ -0,0 +1,142 @@
+// image_probe.hpp - Cheap image format and dimension detection.
+//
+// Reads only the first bytes of a file (plus the JPEG marker chain up to the
+// frame header) so the scheduler can describe an image in the manifest
+// without decoding any pixels.
+#pragma once
+
+#include <cstdint>      // For fixed-width integer types
+#include <fstream>      // For reading file headers
+#include <string>       // For format names
+#include <filesystem>   // For fs::path
+
+namespace fs = std::filesystem;
+
+// What we know about an image after looking at its header.
+struct ImageInfo {
+    std::string format; // "png", "jpeg", "gif", "webp", "heif" or "unknown"
+    int width = 0;      // Pixel width, 0 if it could not be determined
+    int height = 0;     // Pixel height, 0 if it could not be determined
+    bool progressive = false; // True for progressive JPEGs (SOF2)
+    bool indexed = false;     // True for palette PNGs (color type 3)
+};
+
+// Reads a big-endian 16-bit value from a byte buffer.
+inline int readBE16(const unsigned char* p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Reads a big-endian 32-bit value from a byte buffer.
+inline std::uint32_t readBE32(const unsigned char* p) {
+    return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+}
+
+// Reads a little-endian 16-bit value from a byte buffer.
+inline int readLE16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+// Walks the JPEG marker chain until the first SOFn segment and reads the frame size.
+// Returns false if the stream ends or is malformed before a frame header is found.
+// If 'exif' is given it receives the payload of the first EXIF APP1 segment on the way.
+inline bool probeJpegFrame(std::ifstream& in, ImageInfo& info, std::string* exif = nullptr) {
+    in.seekg(2); // Skip the SOI marker (FF D8)
+    unsigned char marker[4];
+    while (in.read(reinterpret_cast<char*>(marker), 2)) {
+        if (marker[0] != 0xFF) {
+            return false; // Lost sync: every segment must start with 0xFF
+        }
+        if (marker[1] == 0xFF) {
+            in.seekg(-1, std::ios::cur); // Fill byte, re-read the second 0xFF as a marker start
+            continue;
+        }
+        if (!in.read(reinterpret_cast<char*>(marker + 2), 2)) {
+            return false;
+        }
+        int length = readBE16(marker + 2);
+        unsigned char m = marker[1];
+        // SOF0..SOF15 except DHT (C4), JPG (C8) and DAC (CC) carry the frame dimensions.
+        if (m >= 0xC0 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC) {
+            unsigned char sof[5];
+            if (!in.read(reinterpret_cast<char*>(sof), 5)) {
+                return false;
+            }
+            info.height = readBE16(sof + 1);
+            info.width = readBE16(sof + 3);
+            info.progressive = (m == 0xC2 || m == 0xC6 || m == 0xCA || m == 0xCE);
+            return true;
+        }
+        if (m == 0xDA || m == 0xD9) {
+            return false; // Scan data or end of image before any frame header
+        }
+        if (m == 0xE1 && exif && exif->empty() && length > 8) {
+            std::string payload(static_cast<std::size_t>(length - 2), '\0');
+            if (!in.read(&payload[0], length - 2)) {
+                return false;
+            }
+            if (payload.compare(0, 6, std::string("Exif\0\0", 6)) == 0) {
+                exif->swap(payload);
+            }
+            continue;
+        }
+        in.seekg(length - 2, std::ios::cur); // Skip the segment payload
+    }
+    return false;
+}
+
+// Detects the format of an image by its magic bytes and reads its dimensions.
+// Never throws; unreadable files come back with format "unknown".
+inline ImageInfo probeImage(const fs::path& path) {
+    ImageInfo info;
+    info.format = "unknown";
+
+    std::ifstream in(path, std::ios::binary);
+    unsigned char head[32] = {0};
+    if (!in.read(reinterpret_cast<char*>(head), sizeof(head)) && in.gcount() < 12) {
+        return info; // Too short to be any image we understand
+    }
+    in.clear();
+
+    if (head[0] == 0x89 && head[1] == 'P' && head[2] == 'N' && head[3] == 'G') {
+        // PNG: the IHDR chunk always comes first, width and height at offsets 16 and 20.
+        info.format = "png";
+        info.width = static_cast<int>(readBE32(head + 16));
+        info.height = static_cast<int>(readBE32(head + 20));
+        info.indexed = head[25] == 3;
+    } else if (head[0] == 0xFF && head[1] == 0xD8) {
+        info.format = "jpeg";
+        probeJpegFrame(in, info);
+    } else if (head[0] == 'G' && head[1] == 'I' && head[2] == 'F') {
+        // GIF: logical screen size right after the 6-byte signature.
+        info.format = "gif";
+        info.width = readLE16(head + 6);
+        info.height = readLE16(head + 8);
+    } else if (head[0] == 'R' && head[1] == 'I' && head[2] == 'F' && head[3] == 'F' &&
+               head[8] == 'W' && head[9] == 'E' && head[10] == 'B' && head[11] == 'P') {
+        info.format = "webp";
+        if (head[12] == 'V' && head[13] == 'P' && head[14] == '8' && head[15] == ' ') {
+            // Lossy: 14-bit dimensions inside the VP8 key frame header.
+            info.width = readLE16(head + 26) & 0x3FFF;
+            info.height = readLE16(head + 28) & 0x3FFF;
+        } else if (head[12] == 'V' && head[13] == 'P' && head[14] == '8' && head[15] == 'L') {
+            // Lossless: 14-bit width-1 and height-1 packed after the 0x2F signature byte.
+            std::uint32_t bits = head[21] | (head[22] << 8) | (head[23] << 16) | (std::uint32_t(head[24]) << 24);
+            info.width = static_cast<int>(bits & 0x3FFF) + 1;
+            info.height = static_cast<int>((bits >> 14) & 0x3FFF) + 1;
+        } else if (head[12] == 'V' && head[13] == 'P' && head[14] == '8' && head[15] == 'X') {
+            // Extended: 24-bit canvas width-1 and height-1.
+            info.width = (head[24] | (head[25] << 8) | (head[26] << 16)) + 1;
+            info.height = (head[27] | (head[28] << 8) | (head[29] << 16)) + 1;
+        }
+    } else if (head[4] == 'f' && head[5] == 't' && head[6] == 'y' && head[7] == 'p') {
+        // HEIF (iPhone HEIC and friends): an ISO media file whose major brand names an
+        // image format. The size sits deep in the meta box and is left at 0.
+        std::string brand(reinterpret_cast<const char*>(head + 8), 4);
+        for (const char* heif : {"heic", "heix", "hevc", "hevx", "heim", "heis", "mif1", "msf1"}) {
+            if (brand == heif) {
+                info.format = "heif";
+            }
+        }
+    }
+    return info;
+}
@@ -0,0 +1,416 @@
+// imagediff.hpp - Perceptual difference between two versions of an image.
+//
+// Both images are decoded at full size and aligned: equal sizes are compared
+// directly, a re-export at another resolution (same aspect ratio) is scaled to
+// the old size, and a changed canvas is placed at whichever of nine anchors
+// (corners, edge centers, center) matches best, with pixels only one image
+// covers counted as fully changed. Each pixel pair is composited over white and
+// compared in YIQ space with the weights of pixelmatch (Kotsarenko and Ramos,
+// "Measuring perceived color difference using YIQ NTSC transmission color
+// space"): the delta is 0-255, and CHANGED or more is a visible change.
+//
+// The delta kernel has scalar, SSE2 and AVX2 variants, dispatched like the
+// other kernels (simd.hpp). Changed pixels are grouped on a 16x16 tile grid
+// into regions with tight bounding boxes, and rendered as a heatmap over a
+// faded copy of the old image.
+#pragma once
+
+#include <algorithm>    // For std::min, std::max, std::sort
+#include <cmath>        // For std::sqrt, std::lround
+#include <cstdint>      // For pixels
+#include <cstring>      // For std::memcpy
+#include <filesystem>   // For fs::path
+#include <string>       // For errors
+#include <vector>       // For images and maps
+
+#include "image_probe.hpp" // For the source format
+#include "jpeg.hpp"
+#include "mapped_file.hpp"
+#include "png.hpp"
+#include "simd.hpp"
+
+namespace fs = std::filesystem;
+
+namespace imagediff {
+
+constexpr int CHANGED = 26;             // Delta counted as a visible change (0.1 of the range, as pixelmatch)
+constexpr float MAX_YIQ = 35215.0f;     // Squared YIQ distance between black and white
+constexpr int TILE = 16;                // Region grid
+constexpr double SAME_ASPECT = 0.01;    // Aspect ratios this close are treated as a rescale
+
+struct Image {
+    int width = 0, height = 0;
+    std::vector<std::uint8_t> rgba;
+};
+
+// Decodes a PNG or JPEG at full size.
+inline bool load(const fs::path& path, Image& out, std::string& error) {
+    std::string format = probeImage(path).format;
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "cannot read " + path.string();
+        return false;
+    }
+    if (format == "png") {
+        return png::decode(file.data(), file.size(), out.width, out.height, out.rgba, error);
+    }
+    if (format == "jpeg") {
+        jpeg::CoefImage img;
+        return jpeg::decodeCoefficients(file.data(), file.size(), img, error) &&
+               jpeg::decodePixels(img, out.width, out.height, out.rgba, error);
+    }
+    error = format + " images are not supported";
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Delta kernels: out[i] = 255 * sqrt(yiq(a[i], b[i]) / MAX_YIQ), pixels over white
+// ---------------------------------------------------------------------------
+
+inline void deltaRowScalar(const std::uint8_t* a, const std::uint8_t* b, std::size_t n, std::uint8_t* out) {
+    for (std::size_t i = 0; i < n; ++i, a += 4, b += 4) {
+        float d[3];
+        for (int c = 0; c < 3; ++c) {
+            float va = 255.0f + (a[c] - 255.0f) * (a[3] / 255.0f);
+            float vb = 255.0f + (b[c] - 255.0f) * (b[3] / 255.0f);
+            d[c] = va - vb;
+        }
+        float y = 0.29889531f * d[0] + 0.58662247f * d[1] + 0.11448223f * d[2];
+        float iq = 0.59597799f * d[0] - 0.27417610f * d[1] - 0.32180189f * d[2];
+        float q = 0.21147017f * d[0] - 0.52261711f * d[1] + 0.31114694f * d[2];
+        float delta = 0.5053f * y * y + 0.299f * iq * iq + 0.1957f * q * q;
+        out[i] = static_cast<std::uint8_t>(std::min(255.0f, std::sqrt(delta / MAX_YIQ) * 255.0f + 0.5f));
+    }
+}
+
+#if CARO_X86_SIMD
+// Each 32-bit lane holds one pixel as r | g << 8 | b << 16 | a << 24.
+inline __m128 yiqDeltaSse2(__m128i pa, __m128i pb) {
+    const __m128i byte = _mm_set1_epi32(0xFF);
+    const __m128 white = _mm_set1_ps(255.0f);
+    const __m128 inv = _mm_set1_ps(1.0f / 255.0f);
+    __m128 alpha_a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(pa, 24)), inv);
+    __m128 alpha_b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(pb, 24)), inv);
+    __m128 d[3];
+    for (int c = 0; c < 3; ++c) {
+        __m128 ca = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pa, 8 * c), byte));
+        __m128 cb = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pb, 8 * c), byte));
+        ca = _mm_add_ps(white, _mm_mul_ps(_mm_sub_ps(ca, white), alpha_a));
+        cb = _mm_add_ps(white, _mm_mul_ps(_mm_sub_ps(cb, white), alpha_b));
+        d[c] = _mm_sub_ps(ca, cb);
+    }
+    auto mix = [&](float r, float g, float b) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], _mm_set1_ps(r)), _mm_mul_ps(d[1], _mm_set1_ps(g))),
+                          _mm_mul_ps(d[2], _mm_set1_ps(b)));
+    };
+    __m128 y = mix(0.29889531f, 0.58662247f, 0.11448223f);
+    __m128 i = mix(0.59597799f, -0.27417610f, -0.32180189f);
+    __m128 q = mix(0.21147017f, -0.52261711f, 0.31114694f);
+    __m128 delta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, y), _mm_set1_ps(0.5053f)),
+                                         _mm_mul_ps(_mm_mul_ps(i, i), _mm_set1_ps(0.299f))),
+                              _mm_mul_ps(_mm_mul_ps(q, q), _mm_set1_ps(0.1957f)));
+    return _mm_mul_ps(_mm_sqrt_ps(_mm_mul_ps(delta, _mm_set1_ps(1.0f / MAX_YIQ))), white);
+}
+
+inline void deltaRowSse2(const std::uint8_t* a, const std::uint8_t* b, std::size_t n, std::uint8_t* out) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 4 * i));
+        __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 4 * i));
+        __m128i v = _mm_cvtps_epi32(yiqDeltaSse2(pa, pb));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v, v), _mm_setzero_si128());
+        int bytes = _mm_cvtsi128_si32(packed);
+        std::memcpy(out + i, &bytes, 4);
+    }
+    deltaRowScalar(a + 4 * i, b + 4 * i, n - i, out + i);
+}
+
+// r * d[0] + g * d[1] + b * d[2]. No FMA: AVX2 does not imply it, and only AVX2 is checked.
+CARO_TARGET_AVX2 inline __m256 mixAvx2(const __m256* d, float r, float g, float b) {
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], _mm256_set1_ps(r)), _mm256_mul_ps(d[1], _mm256_set1_ps(g))),
+                         _mm256_mul_ps(d[2], _mm256_set1_ps(b)));
+}
+
+CARO_TARGET_AVX2 inline void deltaRowAvx2(const std::uint8_t* a, const std::uint8_t* b, std::size_t n,
+                                          std::uint8_t* out) {
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    const __m256 white = _mm256_set1_ps(255.0f);
+    const __m256 inv = _mm256_set1_ps(1.0f / 255.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i pa = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 4 * i));
+        __m256i pb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 4 * i));
+        __m256 alpha_a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(pa, 24)), inv);
+        __m256 alpha_b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(pb, 24)), inv);
+        __m256 d[3];
+        for (int c = 0; c < 3; ++c) {
+            __m256 ca = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pa, 8 * c), byte));
+            __m256 cb = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pb, 8 * c), byte));
+            ca = _mm256_add_ps(white, _mm256_mul_ps(_mm256_sub_ps(ca, white), alpha_a));
+            cb = _mm256_add_ps(white, _mm256_mul_ps(_mm256_sub_ps(cb, white), alpha_b));
+            d[c] = _mm256_sub_ps(ca, cb);
+        }
+        __m256 y = mixAvx2(d, 0.29889531f, 0.58662247f, 0.11448223f);
+        __m256 iq = mixAvx2(d, 0.59597799f, -0.27417610f, -0.32180189f);
+        __m256 q = mixAvx2(d, 0.21147017f, -0.52261711f, 0.31114694f);
+        __m256 delta = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(y, y), _mm256_set1_ps(0.5053f)),
+                                                   _mm256_mul_ps(_mm256_mul_ps(iq, iq), _mm256_set1_ps(0.299f))),
+                                     _mm256_mul_ps(_mm256_mul_ps(q, q), _mm256_set1_ps(0.1957f)));
+        __m256 scaled = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_mul_ps(delta, _mm256_set1_ps(1.0f / MAX_YIQ))), white);
+        __m256i v = _mm256_cvtps_epi32(scaled);
+        // The packs work per 128-bit lane: pixels 0-3 end up in dword 0, pixels 4-7 in dword 4.
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v, v), _mm256_setzero_si256());
+        packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(packed));
+    }
+    deltaRowSse2(a + 4 * i, b + 4 * i, n - i, out + i);
+}
+#endif
+
+inline void deltaRow(const std::uint8_t* a, const std::uint8_t* b, std::size_t n, std::uint8_t* out) {
+#if CARO_X86_SIMD
+    switch (activeSimdLevel()) {
+    case SimdLevel::Avx2: deltaRowAvx2(a, b, n, out); return;
+    case SimdLevel::Sse2: deltaRowSse2(a, b, n, out); return;
+    default: break;
+    }
+#endif
+    deltaRowScalar(a, b, n, out);
+}
+
+// ---------------------------------------------------------------------------
+// Alignment
+// ---------------------------------------------------------------------------
+
+// Bilinear resample to width x height.
+inline Image resample(const Image& in, int width, int height) {
+    Image out{width, height, std::vector<std::uint8_t>(static_cast<std::size_t>(width) * height * 4)};
+    float sx = static_cast<float>(in.width) / width, sy = static_cast<float>(in.height) / height;
+    for (int y = 0; y < height; ++y) {
+        float fy = std::max(0.0f, (y + 0.5f) * sy - 0.5f);
+        int y0 = std::min(static_cast<int>(fy), in.height - 1), y1 = std::min(y0 + 1, in.height - 1);
+        float wy = fy - y0;
+        for (int x = 0; x < width; ++x) {
+            float fx = std::max(0.0f, (x + 0.5f) * sx - 0.5f);
+            int x0 = std::min(static_cast<int>(fx), in.width - 1), x1 = std::min(x0 + 1, in.width - 1);
+            float wx = fx - x0;
+            auto at = [&](int px, int py) { return in.rgba.data() + (static_cast<std::size_t>(py) * in.width + px) * 4; };
+            const std::uint8_t *p00 = at(x0, y0), *p10 = at(x1, y0), *p01 = at(x0, y1), *p11 = at(x1, y1);
+            std::uint8_t* o = out.rgba.data() + (static_cast<std::size_t>(y) * width + x) * 4;
+            for (int c = 0; c < 4; ++c) {
+                float top = p00[c] + (p10[c] - p00[c]) * wx, bottom = p01[c] + (p11[c] - p01[c]) * wx;
+                o[c] = static_cast<std::uint8_t>(top + (bottom - top) * wy + 0.5f);
+            }
+        }
+    }
+    return out;
+}
+
+// Two images on a common canvas. 'cover' has bit 0 where the old image has pixels
+// and bit 1 where the new one has.
+struct Aligned {
+    int width = 0, height = 0;
+    std::vector<std::uint8_t> a, b, cover;
+    std::string how; // "same size", "scaled 1200x800 to 600x400", "canvas 620x400, anchored center"
+};
+
+inline void place(const Image& img, int width, int x0, int y0, std::vector<std::uint8_t>& canvas,
+                  std::vector<std::uint8_t>& cover, std::uint8_t bit) {
+    for (int y = 0; y < img.height; ++y) {
+        std::copy_n(img.rgba.data() + static_cast<std::size_t>(y) * img.width * 4, static_cast<std::size_t>(img.width) * 4,
+                    canvas.data() + ((static_cast<std::size_t>(y0) + y) * width + x0) * 4);
+        for (int x = 0; x < img.width; ++x) {
+            cover[(static_cast<std::size_t>(y0) + y) * width + x0 + x] |= bit;
+        }
+    }
+}
+
+// Mean delta of the canvas rows y = 0, step, 2 * step, ... (pixels covered once count 255).
+inline double sampledDelta(const Aligned& al, int step) {
+    std::vector<std::uint8_t> row(al.width);
+    std::uint64_t sum = 0, count = 0;
+    for (int y = 0; y < al.height; y += step) {
+        std::size_t base = static_cast<std::size_t>(y) * al.width;
+        deltaRow(al.a.data() + base * 4, al.b.data() + base * 4, al.width, row.data());
+        for (int x = 0; x < al.width; ++x) {
+            std::uint8_t c = al.cover[base + x];
+            sum += c == 3 ? row[x] : c ? 255 : 0;
+        }
+        count += al.width;
+    }
+    return count ? static_cast<double>(sum) / count : 0;
+}
+
+inline Aligned align(const Image& a, const Image& b) {
+    Aligned al;
+    if (a.width == b.width && a.height == b.height) {
+        al = {a.width, a.height, a.rgba, b.rgba, std::vector<std::uint8_t>(a.rgba.size() / 4, 3), "same size"};
+        return al;
+    }
+    double ratio_a = static_cast<double>(a.width) / a.height, ratio_b = static_cast<double>(b.width) / b.height;
+    if (std::abs(ratio_a - ratio_b) <= SAME_ASPECT * ratio_a) {
+        al = {a.width, a.height, a.rgba, resample(b, a.width, a.height).rgba,
+              std::vector<std::uint8_t>(a.rgba.size() / 4, 3),
+              "new scaled from " + std::to_string(b.width) + "x" + std::to_string(b.height)};
+        return al;
+    }
+    static const char* names[3][3] = {{"top left", "top", "top right"},
+                                      {"left", "center", "right"},
+                                      {"bottom left", "bottom", "bottom right"}};
+    int width = std::max(a.width, b.width), height = std::max(a.height, b.height);
+    double best = -1;
+    for (int ay = 0; ay < 3; ++ay) {
+        for (int ax = 0; ax < 3; ++ax) {
+            Aligned trial;
+            trial.width = width;
+            trial.height = height;
+            std::size_t pixels = static_cast<std::size_t>(width) * height;
+            trial.a.assign(pixels * 4, 0);
+            trial.b.assign(pixels * 4, 0);
+            trial.cover.assign(pixels, 0);
+            place(a, width, (width - a.width) * ax / 2, (height - a.height) * ay / 2, trial.a, trial.cover, 1);
+            place(b, width, (width - b.width) * ax / 2, (height - b.height) * ay / 2, trial.b, trial.cover, 2);
+            double score = sampledDelta(trial, 8);
+            if (best < 0 || score < best) {
+                best = score;
+                trial.how = "canvas " + std::to_string(width) + "x" + std::to_string(height) + ", anchored " +
+                            names[ay][ax];
+                al = std::move(trial);
+            }
+        }
+    }
+    return al;
+}
+
+// ---------------------------------------------------------------------------
+// Comparison
+// ---------------------------------------------------------------------------
+
+struct Region {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0; // Inclusive bounds of the changed pixels
+    std::uint64_t pixels = 0;
+};
+
+struct Result {
+    std::vector<std::uint8_t> delta; // Per canvas pixel
+    std::uint64_t changed = 0;       // Pixels with delta >= threshold
+    double mean = 0;                 // Mean delta, 0-1
+    double score = 0;                // Share of changed pixels, 0-1
+    std::vector<Region> regions;     // Largest first
+};
+
+inline Result compare(const Aligned& al, int threshold = CHANGED) {
+    Result r;
+    std::size_t pixels = static_cast<std::size_t>(al.width) * al.height;
+    r.delta.resize(pixels);
+    int tiles_x = (al.width + TILE - 1) / TILE, tiles_y = (al.height + TILE - 1) / TILE;
+    std::vector<Region> tiles(static_cast<std::size_t>(tiles_x) * tiles_y);
+    std::uint64_t sum = 0;
+    for (int y = 0; y < al.height; ++y) {
+        std::size_t base = static_cast<std::size_t>(y) * al.width;
+        std::uint8_t* row = r.delta.data() + base;
+        deltaRow(al.a.data() + base * 4, al.b.data() + base * 4, al.width, row);
+        for (int x = 0; x < al.width; ++x) {
+            std::uint8_t c = al.cover[base + x];
+            row[x] = c == 3 ? row[x] : c ? 255 : 0;
+            sum += row[x];
+            if (row[x] < threshold) {
+                continue;
+            }
+            ++r.changed;
+            Region& t = tiles[static_cast<std::size_t>(y / TILE) * tiles_x + x / TILE];
+            if (t.pixels++ == 0) {
+                t = {x, y, x, y, 1};
+            } else {
+                t.x0 = std::min(t.x0, x);
+                t.x1 = std::max(t.x1, x);
+                t.y1 = y;
+            }
+        }
+    }
+    r.mean = pixels ? static_cast<double>(sum) / pixels / 255.0 : 0;
+    r.score = pixels ? static_cast<double>(r.changed) / pixels : 0;
+
+    // Regions: 8-connected groups of tiles with changes.
+    std::vector<int> stack;
+    std::vector<bool> seen(tiles.size(), false);
+    for (std::size_t start = 0; start < tiles.size(); ++start) {
+        if (seen[start] || tiles[start].pixels == 0) {
+            continue;
+        }
+        Region region = tiles[start];
+        region.pixels = 0;
+        stack.assign(1, static_cast<int>(start));
+        seen[start] = true;
+        while (!stack.empty()) {
+            int t = stack.back();
+            stack.pop_back();
+            const Region& tile = tiles[t];
+            region.x0 = std::min(region.x0, tile.x0);
+            region.y0 = std::min(region.y0, tile.y0);
+            region.x1 = std::max(region.x1, tile.x1);
+            region.y1 = std::max(region.y1, tile.y1);
+            region.pixels += tile.pixels;
+            int tx = t % tiles_x, ty = t / tiles_x;
+            for (int ny = std::max(0, ty - 1); ny <= std::min(tiles_y - 1, ty + 1); ++ny) {
+                for (int nx = std::max(0, tx - 1); nx <= std::min(tiles_x - 1, tx + 1); ++nx) {
+                    int n = ny * tiles_x + nx;
+                    if (!seen[n] && tiles[n].pixels > 0) {
+                        seen[n] = true;
+                        stack.push_back(n);
+                    }
+                }
+            }
+        }
+        r.regions.push_back(region);
+    }
+    std::sort(r.regions.begin(), r.regions.end(),
+              [](const Region& x, const Region& y) { return x.pixels > y.pixels; });
+    return r;
+}
+
+// The old image faded towards white, with changes in red (stronger = redder), small
+// differences below the threshold in light yellow and regions outlined in blue.
+inline std::string heatmapPng(const Aligned& al, const Result& r, int threshold = CHANGED) {
+    std::vector<std::uint8_t> out(static_cast<std::size_t>(al.width) * al.height * 4);
+    for (std::size_t i = 0; i < r.delta.size(); ++i) {
+        const std::uint8_t* p = (al.cover[i] & 1 ? al.a.data() : al.b.data()) + i * 4;
+        float alpha = p[3] / 255.0f;
+        float gray = 255.0f + ((0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]) - 255.0f) * alpha;
+        float faded = 255.0f - (255.0f - gray) * 0.25f;
+        float rgb[3] = {faded, faded, faded};
+        int d = r.delta[i];
+        if (d >= threshold) {
+            float t = 0.5f + 0.5f * (d - threshold) / (256.0f - threshold);
+            rgb[0] = faded + (255.0f - faded) * t;
+            rgb[1] = rgb[2] = faded * (1.0f - t);
+        } else if (d > 0) {
+            rgb[2] = faded * (1.0f - 0.5f * d / threshold);
+        }
+        for (int c = 0; c < 3; ++c) {
+            out[i * 4 + c] = static_cast<std::uint8_t>(rgb[c] + 0.5f);
+        }
+        out[i * 4 + 3] = 255;
+    }
+    for (const Region& region : r.regions) {
+        auto mark = [&](int x, int y) {
+            if (x >= 0 && y >= 0 && x < al.width && y < al.height) {
+                std::uint8_t* o = out.data() + (static_cast<std::size_t>(y) * al.width + x) * 4;
+                o[0] = 0;
+                o[1] = 90;
+                o[2] = 255;
+            }
+        };
+        for (int x = region.x0 - 2; x <= region.x1 + 2; ++x) {
+            mark(x, region.y0 - 2);
+            mark(x, region.y1 + 2);
+        }
+        for (int y = region.y0 - 2; y <= region.y1 + 2; ++y) {
+            mark(region.x0 - 2, y);
+            mark(region.x1 + 2, y);
+        }
+    }
+    return png::encode(al.width, al.height, out.data(), false);
+}
+
+} // namespace imagediff
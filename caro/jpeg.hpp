@@ -0,0 +1,1250 @@
+// jpeg.hpp - JPEG coefficient decoder and baseline coefficient encoder.
+//
+// Decodes baseline and progressive Huffman JPEGs down to their quantized DCT
+// coefficients (no IDCT, no color conversion) and writes coefficients back
+// out as a baseline JPEG with optimized Huffman tables. Together they allow
+// lossless operations on the coefficient blocks (see jpeg_transform.hpp):
+// pixels decoded from the output are exactly those of the input. The same
+// encoder, fed by a forward DCT, writes new JPEGs from pixels (encodePixels).
+//
+// Not supported: arithmetic coding, 12-bit samples, hierarchical and lossless
+// JPEG. Those files are reported and left alone.
+#pragma once
+
+#include <algorithm>    // For std::max, std::sort
+#include <array>        // For the IDCT basis
+#include <cmath>        // For std::cos, std::sqrt
+#include <cstdint>      // For fixed-width integers
+#include <cstdlib>      // For std::abs
+#include <string>       // For output bytes and errors
+#include <utility>      // For std::pair
+#include <vector>       // For coefficient storage
+
+namespace jpeg {
+
+// ZIGZAG[k] is the natural (row-major) index of the k-th coefficient in zigzag order.
+constexpr std::uint8_t ZIGZAG[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+struct Component {
+    int id = 0;          // Component identifier from the frame header
+    int h = 1, v = 1;    // Sampling factors
+    int tq = 0;          // Quantization table index
+    int td = 0, ta = 0;  // Huffman table indices of the current scan
+    int grid_w = 0;      // Blocks per row, padded to whole MCUs
+    int grid_h = 0;      // Block rows, padded to whole MCUs
+    int dc_pred = 0;     // DC predictor while decoding
+    std::vector<std::int16_t> coeffs; // grid_w * grid_h blocks of 64 natural-order coefficients
+
+    std::int16_t* block(int bx, int by) {
+        return coeffs.data() + (static_cast<std::size_t>(by) * grid_w + bx) * 64;
+    }
+    const std::int16_t* block(int bx, int by) const {
+        return coeffs.data() + (static_cast<std::size_t>(by) * grid_w + bx) * 64;
+    }
+};
+
+// A JPEG held as quantized coefficients plus the segments that must survive a rewrite.
+struct CoefImage {
+    int width = 0, height = 0;
+    bool progressive = false;
+    int hmax = 1, vmax = 1;
+    int mcus_x = 0, mcus_y = 0;
+    std::vector<Component> comps;
+    std::uint16_t qt[4][64] = {};  // Quantization tables in natural order
+    bool qt_used[4] = {};
+    // APPn and COM segments in file order: marker byte and payload (without length).
+    std::vector<std::pair<std::uint8_t, std::string>> segments;
+
+    // Blocks of a component that carry image data (the rest is MCU padding).
+    int realBlocksW(const Component& c) const { return ((width * c.h + hmax - 1) / hmax + 7) / 8; }
+    int realBlocksH(const Component& c) const { return ((height * c.v + vmax - 1) / vmax + 7) / 8; }
+
+    // Recomputes the MCU layout after width, height or sampling factors change.
+    void layout() {
+        hmax = vmax = 1;
+        for (const auto& c : comps) {
+            hmax = std::max(hmax, c.h);
+            vmax = std::max(vmax, c.v);
+        }
+        mcus_x = (width + 8 * hmax - 1) / (8 * hmax);
+        mcus_y = (height + 8 * vmax - 1) / (8 * vmax);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Huffman decoding
+// ---------------------------------------------------------------------------
+
+struct HuffmanTable {
+    bool present = false;
+    std::uint8_t counts[17] = {};  // counts[len] = number of codes of that length
+    std::uint8_t symbols[256] = {};
+    int maxcode[18] = {};
+    int valptr[17] = {};
+    int mincode[17] = {};
+    std::uint16_t fast[512] = {};  // 9-bit lookahead: (length << 8) | symbol, 0 if longer
+
+    void build() {
+        int code = 0;
+        int k = 0;
+        std::fill(std::begin(fast), std::end(fast), 0);
+        for (int len = 1; len <= 16; ++len) {
+            valptr[len] = k;
+            mincode[len] = code;
+            for (int i = 0; i < counts[len]; ++i, ++k, ++code) {
+                if (len <= 9) {
+                    int shift = 9 - len;
+                    for (int fill = 0; fill < (1 << shift); ++fill) {
+                        fast[(code << shift) | fill] = static_cast<std::uint16_t>((len << 8) | symbols[k]);
+                    }
+                }
+            }
+            maxcode[len] = counts[len] ? code - 1 : -1;
+            code <<= 1;
+        }
+        maxcode[17] = 0x7FFFFFFF; // Sentinel
+        present = true;
+    }
+};
+
+// Reads entropy-coded bits, undoing 0xFF00 byte stuffing and stopping at markers.
+struct BitReader {
+    const std::uint8_t* data = nullptr;
+    std::size_t pos = 0, end = 0;
+    std::uint32_t acc = 0;
+    int bits = 0;
+    bool at_marker = false;
+
+    void fill() {
+        while (bits <= 24) {
+            std::uint32_t byte = 0;
+            if (!at_marker && pos < end) {
+                byte = data[pos];
+                if (byte == 0xFF) {
+                    std::uint8_t next = pos + 1 < end ? data[pos + 1] : 0;
+                    if (next == 0x00) {
+                        pos += 2; // Stuffed zero
+                    } else {
+                        at_marker = true; // Feed zeros from here on
+                        byte = 0;
+                    }
+                } else {
+                    ++pos;
+                }
+            }
+            acc |= byte << (24 - bits);
+            bits += 8;
+        }
+    }
+
+    int bit() {
+        if (bits < 1) {
+            fill();
+        }
+        int b = static_cast<int>(acc >> 31);
+        acc <<= 1;
+        --bits;
+        return b;
+    }
+
+    int get(int n) {
+        if (n == 0) {
+            return 0;
+        }
+        if (bits < n) {
+            fill();
+        }
+        int v = static_cast<int>(acc >> (32 - n));
+        acc <<= n;
+        bits -= n;
+        return v;
+    }
+
+    // Decodes one Huffman symbol, or returns -1 on an invalid code.
+    int decode(const HuffmanTable& t) {
+        if (bits < 16) {
+            fill();
+        }
+        std::uint16_t f = t.fast[acc >> 23];
+        if (f) {
+            int len = f >> 8;
+            acc <<= len;
+            bits -= len;
+            return f & 0xFF;
+        }
+        int code = static_cast<int>(acc >> 22); // First 10 bits
+        int len = 10;
+        while (len <= 16 && code > t.maxcode[len]) {
+            ++len;
+            code = static_cast<int>(acc >> (32 - len));
+        }
+        if (len > 16) {
+            return -1;
+        }
+        acc <<= len;
+        bits -= len;
+        return t.symbols[t.valptr[len] + code - t.mincode[len]];
+    }
+
+    // Skips to just after the next RSTn marker and resets the bit buffer.
+    void restart() {
+        acc = 0;
+        bits = 0;
+        at_marker = false;
+        while (pos + 1 < end) {
+            if (data[pos] == 0xFF && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7) {
+                pos += 2;
+                return;
+            }
+            ++pos;
+        }
+    }
+};
+
+// Sign-extends a magnitude category value.
+inline int extend(int v, int t) {
+    return v < (1 << (t - 1)) ? v - (1 << t) + 1 : v;
+}
+
+// MCU rows in the first 1/part of an image (at least one).
+inline int topRows(const CoefImage& img, int part) {
+    return std::max(1, img.mcus_y / part);
+}
+
+// ---------------------------------------------------------------------------
+// Decoder
+// ---------------------------------------------------------------------------
+
+class Decoder {
+public:
+    // Decodes a whole file into 'img'. Returns false with 'error' set on failure. With
+    // 'top_part' > 1, decoding stops after the first 1/top_part of the MCU rows (at
+    // least one) of the first scan.
+    bool decode(const std::uint8_t* data, std::size_t len, CoefImage& img, std::string& error, int top_part = 0) {
+        data_ = data;
+        len_ = len;
+        img_ = &img;
+        top_part_ = top_part;
+        if (len < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+            error = "not a JPEG file";
+            return false;
+        }
+        std::size_t pos = 2;
+        bool frame = false;
+        while (pos + 4 <= len) {
+            if (data[pos] != 0xFF) {
+                ++pos; // Tolerate garbage between segments
+                continue;
+            }
+            std::uint8_t marker = data[pos + 1];
+            if (marker == 0xFF) {
+                ++pos; // Fill byte
+                continue;
+            }
+            if (marker == 0xD9) {
+                break; // EOI
+            }
+            if (marker >= 0xD0 && marker <= 0xD7) {
+                pos += 2; // Stray RSTn
+                continue;
+            }
+            std::size_t seg_len = (data[pos + 2] << 8) | data[pos + 3];
+            if (seg_len < 2 || pos + 2 + seg_len > len) {
+                error = "truncated segment";
+                return false;
+            }
+            const std::uint8_t* seg = data + pos + 4;
+            std::size_t n = seg_len - 2;
+            pos += 2 + seg_len;
+
+            if ((marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE) {
+                img.segments.push_back({marker, std::string(reinterpret_cast<const char*>(seg), n)});
+            } else if (marker == 0xDB) {
+                if (!readDqt(seg, n, error)) return false;
+            } else if (marker == 0xC4) {
+                if (!readDht(seg, n, error)) return false;
+            } else if (marker == 0xDD) {
+                restart_interval_ = n >= 2 ? (seg[0] << 8) | seg[1] : 0;
+            } else if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+                if (!readSof(seg, n, marker == 0xC2, error)) return false;
+                frame = true;
+            } else if (marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                error = "unsupported JPEG process (lossless, hierarchical or arithmetic coding)";
+                return false;
+            } else if (marker == 0xDA) {
+                if (!frame) {
+                    error = "scan before frame header";
+                    return false;
+                }
+                if (!readScan(seg, n, pos, error)) return false;
+                if (top_part_ > 1) break; // The rest of the file is not wanted
+            }
+        }
+        if (!frame) {
+            error = "no frame header";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool readDqt(const std::uint8_t* p, std::size_t n, std::string& error) {
+        std::size_t i = 0;
+        while (i < n) {
+            int pq = p[i] >> 4, tq = p[i] & 15;
+            ++i;
+            if (tq > 3 || i + (pq ? 128 : 64) > n) {
+                error = "bad quantization table";
+                return false;
+            }
+            for (int k = 0; k < 64; ++k) {
+                img_->qt[tq][ZIGZAG[k]] = pq ? static_cast<std::uint16_t>((p[i + 2 * k] << 8) | p[i + 2 * k + 1]) : p[i + k];
+            }
+            i += pq ? 128 : 64;
+        }
+        return true;
+    }
+
+    bool readDht(const std::uint8_t* p, std::size_t n, std::string& error) {
+        std::size_t i = 0;
+        while (i < n) {
+            int tc = p[i] >> 4, th = p[i] & 15;
+            if (tc > 1 || th > 3 || i + 17 > n) {
+                error = "bad Huffman table";
+                return false;
+            }
+            HuffmanTable& t = tc == 0 ? dc_[th] : ac_[th];
+            int total = 0;
+            for (int len = 1; len <= 16; ++len) {
+                t.counts[len] = p[i + len];
+                total += t.counts[len];
+            }
+            i += 17;
+            if (total > 256 || i + total > n) {
+                error = "bad Huffman table";
+                return false;
+            }
+            std::copy(p + i, p + i + total, t.symbols);
+            i += total;
+            t.build();
+        }
+        return true;
+    }
+
+    bool readSof(const std::uint8_t* p, std::size_t n, bool progressive, std::string& error) {
+        if (n < 6 || p[0] != 8) {
+            error = n >= 1 && p[0] != 8 ? "only 8-bit JPEGs are supported" : "bad frame header";
+            return false;
+        }
+        CoefImage& img = *img_;
+        img.height = (p[1] << 8) | p[2];
+        img.width = (p[3] << 8) | p[4];
+        int count = p[5];
+        if (img.width == 0 || img.height == 0 || count < 1 || count > 4 || n < 6u + 3u * count) {
+            error = "bad frame header";
+            return false;
+        }
+        img.progressive = progressive;
+        img.comps.resize(count);
+        for (int c = 0; c < count; ++c) {
+            Component& comp = img.comps[c];
+            comp.id = p[6 + 3 * c];
+            comp.h = p[7 + 3 * c] >> 4;
+            comp.v = p[7 + 3 * c] & 15;
+            comp.tq = p[8 + 3 * c] & 3;
+            if (comp.h < 1 || comp.h > 4 || comp.v < 1 || comp.v > 4) {
+                error = "bad sampling factors";
+                return false;
+            }
+            img.qt_used[comp.tq] = true;
+        }
+        img.layout();
+        int rows = top_part_ > 1 ? topRows(img, top_part_) : img.mcus_y;
+        for (auto& comp : img.comps) {
+            comp.grid_w = img.mcus_x * comp.h;
+            comp.grid_h = rows * comp.v; // Only the rows that will be decoded
+            comp.coeffs.assign(static_cast<std::size_t>(comp.grid_w) * comp.grid_h * 64, 0);
+        }
+        return true;
+    }
+
+    // Decodes one scan; 'pos' is advanced past its entropy-coded data.
+    bool readScan(const std::uint8_t* p, std::size_t n, std::size_t& pos, std::string& error) {
+        CoefImage& img = *img_;
+        int count = n >= 1 ? p[0] : 0;
+        if (count < 1 || count > 4 || n < 4u + 2u * count) {
+            error = "bad scan header";
+            return false;
+        }
+        std::vector<Component*> scan;
+        for (int i = 0; i < count; ++i) {
+            int id = p[1 + 2 * i];
+            Component* found = nullptr;
+            for (auto& comp : img.comps) {
+                if (comp.id == id) found = &comp;
+            }
+            if (!found) {
+                error = "scan references an unknown component";
+                return false;
+            }
+            found->td = p[2 + 2 * i] >> 4;
+            found->ta = p[2 + 2 * i] & 15;
+            if (found->td > 3 || found->ta > 3) {
+                error = "bad Huffman table index";
+                return false;
+            }
+            scan.push_back(found);
+        }
+        ss_ = p[1 + 2 * count];
+        se_ = p[2 + 2 * count];
+        ah_ = p[3 + 2 * count] >> 4;
+        al_ = p[3 + 2 * count] & 15;
+        if (!img.progressive) {
+            ss_ = 0;
+            se_ = 63;
+            ah_ = al_ = 0;
+        } else if (ss_ > se_ || se_ > 63 || (ss_ == 0 && se_ != 0) || (ss_ > 0 && count != 1)) {
+            error = "bad progressive scan parameters";
+            return false;
+        }
+
+        BitReader br;
+        br.data = data_;
+        br.pos = pos;
+        br.end = len_;
+        for (auto* comp : scan) {
+            comp->dc_pred = 0;
+        }
+        eobrun_ = 0;
+        bad_ = false;
+
+        int mcu_count = 0;
+        auto handleRestart = [&] {
+            if (restart_interval_ && mcu_count % restart_interval_ == 0) {
+                br.restart();
+                for (auto* comp : scan) {
+                    comp->dc_pred = 0;
+                }
+                eobrun_ = 0;
+            }
+        };
+
+        if (count == 1) {
+            // Non-interleaved: every block of the component's real extent is its own MCU.
+            Component& comp = *scan[0];
+            int bw = img.realBlocksW(comp), bh = img.realBlocksH(comp);
+            if (top_part_ > 1) bh = std::min(bh, topRows(img, top_part_) * comp.v);
+            for (int by = 0; by < bh && !bad_; ++by) {
+                for (int bx = 0; bx < bw && !bad_; ++bx) {
+                    decodeBlock(br, comp, comp.block(bx, by));
+                    ++mcu_count;
+                    if (mcu_count < bw * bh) handleRestart();
+                }
+            }
+        } else {
+            int total = img.mcus_x * img.mcus_y;
+            int rows = top_part_ > 1 ? topRows(img, top_part_) : img.mcus_y;
+            for (int my = 0; my < rows && !bad_; ++my) {
+                for (int mx = 0; mx < img.mcus_x && !bad_; ++mx) {
+                    for (auto* comp : scan) {
+                        for (int y = 0; y < comp->v; ++y) {
+                            for (int x = 0; x < comp->h; ++x) {
+                                decodeBlock(br, *comp, comp->block(mx * comp->h + x, my * comp->v + y));
+                            }
+                        }
+                    }
+                    ++mcu_count;
+                    if (mcu_count < total) handleRestart();
+                }
+            }
+        }
+        if (bad_) {
+            error = "corrupt entropy-coded data";
+            return false;
+        }
+
+        // Continue after the scan data: find the next marker that is not RSTn or stuffing.
+        pos = br.pos;
+        while (pos + 1 < len_) {
+            if (data_[pos] == 0xFF && data_[pos + 1] != 0x00 && data_[pos + 1] != 0xFF &&
+                !(data_[pos + 1] >= 0xD0 && data_[pos + 1] <= 0xD7)) {
+                break;
+            }
+            ++pos;
+        }
+        return true;
+    }
+
+    void decodeBlock(BitReader& br, Component& comp, std::int16_t* coef) {
+        if (!img_->progressive) {
+            decodeBaseline(br, comp, coef);
+        } else if (ss_ == 0) {
+            if (ah_ == 0) {
+                int t = br.decode(dc_[comp.td]);
+                if (t < 0 || t > 11) { bad_ = true; return; }
+                comp.dc_pred += t ? extend(br.get(t), t) : 0;
+                coef[0] = static_cast<std::int16_t>(comp.dc_pred * (1 << al_));
+            } else if (br.bit()) {
+                coef[0] = static_cast<std::int16_t>(coef[0] | (1 << al_));
+            }
+        } else if (ah_ == 0) {
+            decodeAcFirst(br, comp, coef);
+        } else {
+            decodeAcRefine(br, comp, coef);
+        }
+    }
+
+    void decodeBaseline(BitReader& br, Component& comp, std::int16_t* coef) {
+        const HuffmanTable& dc = dc_[comp.td];
+        const HuffmanTable& ac = ac_[comp.ta];
+        if (!dc.present || !ac.present) { bad_ = true; return; }
+        int t = br.decode(dc);
+        if (t < 0 || t > 11) { bad_ = true; return; }
+        comp.dc_pred += t ? extend(br.get(t), t) : 0;
+        coef[0] = static_cast<std::int16_t>(comp.dc_pred);
+        for (int k = 1; k < 64;) {
+            int rs = br.decode(ac);
+            if (rs < 0) { bad_ = true; return; }
+            int r = rs >> 4, s = rs & 15;
+            if (s == 0) {
+                if (r != 15) break; // EOB
+                k += 16;
+                continue;
+            }
+            k += r;
+            if (k > 63) { bad_ = true; return; }
+            coef[ZIGZAG[k]] = static_cast<std::int16_t>(extend(br.get(s), s));
+            ++k;
+        }
+    }
+
+    void decodeAcFirst(BitReader& br, Component& comp, std::int16_t* coef) {
+        if (eobrun_ > 0) {
+            --eobrun_;
+            return;
+        }
+        const HuffmanTable& ac = ac_[comp.ta];
+        if (!ac.present) { bad_ = true; return; }
+        for (int k = ss_; k <= se_;) {
+            int rs = br.decode(ac);
+            if (rs < 0) { bad_ = true; return; }
+            int r = rs >> 4, s = rs & 15;
+            if (s == 0) {
+                if (r < 15) {
+                    eobrun_ = (1 << r) - 1 + br.get(r);
+                    break;
+                }
+                k += 16;
+                continue;
+            }
+            k += r;
+            if (k > 63) { bad_ = true; return; }
+            coef[ZIGZAG[k]] = static_cast<std::int16_t>(extend(br.get(s), s) * (1 << al_));
+            ++k;
+        }
+    }
+
+    // Successive approximation refinement of AC coefficients (ITU T.81 G.1.2.3).
+    void decodeAcRefine(BitReader& br, Component& comp, std::int16_t* coef) {
+        const HuffmanTable& ac = ac_[comp.ta];
+        if (!ac.present) { bad_ = true; return; }
+        int p1 = 1 << al_;
+        int m1 = -1 * (1 << al_);
+        int k = ss_;
+        auto refine = [&](int z) {
+            if (br.bit() && (coef[z] & p1) == 0) {
+                coef[z] = static_cast<std::int16_t>(coef[z] + (coef[z] >= 0 ? p1 : m1));
+            }
+        };
+        if (eobrun_ == 0) {
+            for (; k <= se_; ++k) {
+                int rs = br.decode(ac);
+                if (rs < 0) { bad_ = true; return; }
+                int r = rs >> 4, s = rs & 15;
+                int value = 0;
+                if (s) {
+                    value = br.bit() ? p1 : m1;
+                } else if (r != 15) {
+                    eobrun_ = (1 << r) + br.get(r);
+                    break;
+                }
+                // Skip r zero-history coefficients, refining the non-zero ones passed on the way.
+                while (k <= se_) {
+                    int z = ZIGZAG[k];
+                    if (coef[z] != 0) {
+                        refine(z);
+                    } else {
+                        if (--r < 0) break;
+                    }
+                    ++k;
+                }
+                if (value && k <= 63) {
+                    coef[ZIGZAG[k]] = static_cast<std::int16_t>(value);
+                }
+            }
+        }
+        if (eobrun_ > 0) {
+            for (; k <= se_; ++k) {
+                int z = ZIGZAG[k];
+                if (coef[z] != 0) {
+                    refine(z);
+                }
+            }
+            --eobrun_;
+        }
+    }
+
+    const std::uint8_t* data_ = nullptr;
+    std::size_t len_ = 0;
+    CoefImage* img_ = nullptr;
+    HuffmanTable dc_[4], ac_[4];
+    int restart_interval_ = 0;
+    int top_part_ = 0;
+    int ss_ = 0, se_ = 63, ah_ = 0, al_ = 0;
+    int eobrun_ = 0;
+    bool bad_ = false;
+};
+
+// Convenience wrapper around Decoder.
+inline bool decodeCoefficients(const std::uint8_t* data, std::size_t len, CoefImage& img, std::string& error) {
+    Decoder decoder;
+    return decoder.decode(data, len, img, error);
+}
+
+// Decodes only the first topRows(img, part) MCU rows of the first scan; the component
+// grids hold just those rows. For a baseline image that is the top of the picture; for
+// a progressive one, usually the DC terms of the top.
+inline bool decodeTop(const std::uint8_t* data, std::size_t len, int part, CoefImage& img, std::string& error) {
+    Decoder decoder;
+    return decoder.decode(data, len, img, error, std::max(2, part));
+}
+
+// ---------------------------------------------------------------------------
+// Pixels
+// ---------------------------------------------------------------------------
+
+// Color handling shared by the decoders: grayscale, YCbCr, or RGB marked by an
+// APP14 "Adobe" segment with transform 0. False for CMYK.
+inline bool colorModel(const CoefImage& img, bool& ycc, std::string& error) {
+    int count = static_cast<int>(img.comps.size());
+    if (count != 1 && count != 3) {
+        error = "CMYK JPEGs are not supported";
+        return false;
+    }
+    ycc = count == 3;
+    for (const auto& segment : img.segments) {
+        if (segment.first == 0xEE && segment.second.size() >= 12 && segment.second.compare(0, 5, "Adobe") == 0) {
+            ycc = ycc && segment.second[11] != 0;
+        }
+    }
+    return true;
+}
+
+// Writes one RGBA pixel from 'count' component samples.
+inline void storePixel(int count, bool ycc, const int* sample, std::uint8_t* px) {
+    if (count == 1) {
+        px[0] = px[1] = px[2] = static_cast<std::uint8_t>(sample[0]);
+    } else if (!ycc) {
+        px[0] = static_cast<std::uint8_t>(sample[0]);
+        px[1] = static_cast<std::uint8_t>(sample[1]);
+        px[2] = static_cast<std::uint8_t>(sample[2]);
+    } else {
+        double yv = sample[0], cb = sample[1] - 128.0, cr = sample[2] - 128.0;
+        double rgb[3] = {yv + 1.402 * cr, yv - 0.344136 * cb - 0.714136 * cr, yv + 1.772 * cb};
+        for (int i = 0; i < 3; ++i) {
+            px[i] = static_cast<std::uint8_t>(std::max(0.0, std::min(255.0, rgb[i] + 0.5)));
+        }
+    }
+    px[3] = 255;
+}
+
+// The DC coefficient of a block is its mean sample, so the DC terms alone give a
+// 1/8-scale image without any IDCT. Writes ceil(width / 8) x ceil(height / 8) RGBA
+// pixels. Grayscale and YCbCr (or Adobe RGB) images are supported; CMYK is not.
+inline bool dcThumbnail(const CoefImage& img, int& out_w, int& out_h, std::vector<std::uint8_t>& rgba,
+                        std::string& error) {
+    bool ycc = false;
+    if (!colorModel(img, ycc, error)) {
+        return false;
+    }
+    int count = static_cast<int>(img.comps.size());
+    out_w = (img.width + 7) / 8;
+    out_h = (img.height + 7) / 8;
+    rgba.assign(static_cast<std::size_t>(out_w) * out_h * 4, 255);
+    int sample[3] = {0, 0, 0};
+    for (int y = 0; y < out_h; ++y) {
+        for (int x = 0; x < out_w; ++x) {
+            for (int c = 0; c < count; ++c) {
+                const Component& comp = img.comps[c];
+                int bx = std::min(x * comp.h / img.hmax, comp.grid_w - 1);
+                int by = std::min(y * comp.v / img.vmax, comp.grid_h - 1);
+                int dc = comp.block(bx, by)[0] * img.qt[comp.tq][0];
+                sample[c] = std::max(0, std::min(255, (dc + 4 * (dc >= 0 ? 1 : -1)) / 8 + 128));
+            }
+            storePixel(count, ycc, sample, rgba.data() + (static_cast<std::size_t>(y) * out_w + x) * 4);
+        }
+    }
+    return true;
+}
+
+// Orthonormal 8-point DCT basis: basis[x][u] = C(u) / 2 * cos((2x + 1) u pi / 16).
+inline const std::array<std::array<float, 8>, 8>& dctBasis() {
+    static const auto basis = [] {
+        std::array<std::array<float, 8>, 8> t{};
+        for (int x = 0; x < 8; ++x) {
+            for (int u = 0; u < 8; ++u) {
+                t[x][u] = static_cast<float>((u == 0 ? std::sqrt(0.5) : 1.0) / 2 *
+                                             std::cos((2 * x + 1) * u * 3.14159265358979323846 / 16));
+            }
+        }
+        return t;
+    }();
+    return basis;
+}
+
+// Inverse DCT of one block (dequantized with 'qt') into 8x8 level-shifted samples.
+inline void idctBlock(const std::int16_t* coef, const std::uint16_t* qt, std::uint8_t* out, std::size_t stride) {
+    const auto& basis = dctBasis();
+    auto clamp = [](float v) { return static_cast<std::uint8_t>(std::max(0.0f, std::min(255.0f, v + 128.5f))); };
+    bool flat = true;
+    for (int k = 1; k < 64 && flat; ++k) {
+        flat = coef[k] == 0;
+    }
+    if (flat) { // Only DC: a uniform block, the common case in smooth areas
+        std::uint8_t v = clamp(coef[0] * qt[0] / 8.0f);
+        for (int y = 0; y < 8; ++y) {
+            std::fill(out + y * stride, out + y * stride + 8, v);
+        }
+        return;
+    }
+    float rows[8][8]; // rows[v][x]: horizontal pass
+    for (int v = 0; v < 8; ++v) {
+        for (int x = 0; x < 8; ++x) {
+            float sum = 0;
+            for (int u = 0; u < 8; ++u) {
+                sum += basis[x][u] * coef[v * 8 + u] * qt[v * 8 + u];
+            }
+            rows[v][x] = sum;
+        }
+    }
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            float sum = 0;
+            for (int v = 0; v < 8; ++v) {
+                sum += basis[y][v] * rows[v][x];
+            }
+            out[y * stride + x] = clamp(sum);
+        }
+    }
+}
+
+// Forward DCT of 8x8 samples, quantized with 'qt' (the inverse of idctBlock).
+inline void fdctBlock(const std::uint8_t* in, std::size_t stride, const std::uint16_t* qt, std::int16_t* coef) {
+    const auto& basis = dctBasis();
+    float rows[8][8]; // rows[y][u]: horizontal pass
+    for (int y = 0; y < 8; ++y) {
+        for (int u = 0; u < 8; ++u) {
+            float sum = 0;
+            for (int x = 0; x < 8; ++x) {
+                sum += basis[x][u] * (in[y * stride + x] - 128.0f);
+            }
+            rows[y][u] = sum;
+        }
+    }
+    for (int v = 0; v < 8; ++v) {
+        for (int u = 0; u < 8; ++u) {
+            float sum = 0;
+            for (int y = 0; y < 8; ++y) {
+                sum += basis[y][v] * rows[y][u];
+            }
+            coef[v * 8 + u] = static_cast<std::int16_t>(std::lround(sum / qt[v * 8 + u]));
+        }
+    }
+}
+
+// Decodes the full image into RGBA. Subsampled chroma is replicated (no smoothing),
+// so pixels can differ from libjpeg's by a few levels along color edges.
+inline bool decodePixels(const CoefImage& img, int& out_w, int& out_h, std::vector<std::uint8_t>& rgba,
+                         std::string& error) {
+    bool ycc = false;
+    if (!colorModel(img, ycc, error)) {
+        return false;
+    }
+    int count = static_cast<int>(img.comps.size());
+    std::vector<std::vector<std::uint8_t>> planes(count);
+    for (int c = 0; c < count; ++c) {
+        const Component& comp = img.comps[c];
+        std::size_t stride = static_cast<std::size_t>(comp.grid_w) * 8;
+        planes[c].resize(stride * comp.grid_h * 8);
+        for (int by = 0; by < comp.grid_h; ++by) {
+            for (int bx = 0; bx < comp.grid_w; ++bx) {
+                idctBlock(comp.block(bx, by), img.qt[comp.tq], planes[c].data() + by * 8 * stride + bx * 8, stride);
+            }
+        }
+    }
+    out_w = img.width;
+    out_h = img.height;
+    rgba.assign(static_cast<std::size_t>(out_w) * out_h * 4, 255);
+    int sample[3] = {0, 0, 0};
+    for (int y = 0; y < out_h; ++y) {
+        for (int x = 0; x < out_w; ++x) {
+            for (int c = 0; c < count; ++c) {
+                const Component& comp = img.comps[c];
+                std::size_t sx = static_cast<std::size_t>(x) * comp.h / img.hmax;
+                std::size_t sy = static_cast<std::size_t>(y) * comp.v / img.vmax;
+                sample[c] = planes[c][sy * comp.grid_w * 8 + sx];
+            }
+            storePixel(count, ycc, sample, rgba.data() + (static_cast<std::size_t>(y) * out_w + x) * 4);
+        }
+    }
+    return true;
+}
+
+// One sample (x, y) of idctBlock's output, computed in the same order so it is identical.
+inline std::uint8_t idctSample(const std::int16_t* coef, const std::uint16_t* qt, int x, int y) {
+    const auto& basis = dctBasis();
+    float sum = 0;
+    for (int v = 0; v < 8; ++v) {
+        float row = 0;
+        for (int u = 0; u < 8; ++u) {
+            row += basis[x][u] * coef[v * 8 + u] * qt[v * 8 + u];
+        }
+        sum += basis[y][v] * row;
+    }
+    return static_cast<std::uint8_t>(std::max(0.0f, std::min(255.0f, sum + 128.5f)));
+}
+
+// Decodes every 'step'-th pixel of every 'step'-th row (the pixels decodePixels gives at
+// those places) into ceil(width / step) x ceil(height / step) RGBA. Each sample costs one
+// point of an inverse DCT, so statistics over exact pixels of a large image stay cheap.
+inline bool samplePixels(const CoefImage& img, int step, int& out_w, int& out_h, std::vector<std::uint8_t>& rgba,
+                         std::string& error) {
+    bool ycc = false;
+    if (!colorModel(img, ycc, error)) {
+        return false;
+    }
+    int count = static_cast<int>(img.comps.size());
+    step = std::max(1, step);
+    out_w = (img.width + step - 1) / step;
+    out_h = (img.height + step - 1) / step;
+    rgba.assign(static_cast<std::size_t>(out_w) * out_h * 4, 255);
+    int sample[3] = {0, 0, 0};
+    for (int y = 0; y < out_h; ++y) {
+        for (int x = 0; x < out_w; ++x) {
+            for (int c = 0; c < count; ++c) {
+                const Component& comp = img.comps[c];
+                int sx = x * step * comp.h / img.hmax;
+                int sy = y * step * comp.v / img.vmax;
+                const std::int16_t* coef = comp.block(sx / 8, sy / 8);
+                bool flat = true;
+                for (int k = 1; k < 64 && flat; ++k) {
+                    flat = coef[k] == 0;
+                }
+                const std::uint16_t* qt = img.qt[comp.tq];
+                sample[c] = flat ? static_cast<std::uint8_t>(std::max(0.0f, std::min(255.0f, coef[0] * qt[0] / 8.0f + 128.5f)))
+                                 : idctSample(coef, qt, sx % 8, sy % 8);
+            }
+            storePixel(count, ycc, sample, rgba.data() + (static_cast<std::size_t>(y) * out_w + x) * 4);
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Encoder
+// ---------------------------------------------------------------------------
+
+// Number of bits needed for a magnitude (the JPEG "category").
+inline int magnitudeBits(int v) {
+    v = std::abs(v);
+    int n = 0;
+    while (v) {
+        ++n;
+        v >>= 1;
+    }
+    return n;
+}
+
+// Builds an optimal length-limited Huffman table from symbol frequencies (ITU T.81 K.2).
+inline void buildOptimalTable(const long (&freq_in)[257], std::uint8_t counts[17], std::vector<std::uint8_t>& symbols) {
+    long freq[257];
+    std::copy(std::begin(freq_in), std::end(freq_in), freq);
+    freq[256] = 1; // Reserved so no symbol gets the all-ones code
+    int codesize[257] = {};
+    int others[257];
+    std::fill(std::begin(others), std::end(others), -1);
+    for (;;) {
+        int c1 = -1, c2 = -1;
+        long v1 = 0x7FFFFFFFL, v2 = 0x7FFFFFFFL;
+        for (int i = 0; i <= 256; ++i) {
+            if (freq[i] && freq[i] <= v1) {
+                v1 = freq[i];
+                c1 = i;
+            }
+        }
+        for (int i = 0; i <= 256; ++i) {
+            if (freq[i] && freq[i] <= v2 && i != c1) {
+                v2 = freq[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) {
+            break;
+        }
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+        ++codesize[c1];
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            ++codesize[c1];
+        }
+        others[c1] = c2;
+        ++codesize[c2];
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            ++codesize[c2];
+        }
+    }
+    int bits[33] = {};
+    for (int i = 0; i <= 256; ++i) {
+        if (codesize[i]) {
+            ++bits[std::min(codesize[i], 32)];
+        }
+    }
+    for (int i = 32; i > 16; --i) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) --j;
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+    int i = 16;
+    while (bits[i] == 0) --i;
+    bits[i]--; // Drop the reserved symbol
+    counts[0] = 0;
+    for (int len = 1; len <= 16; ++len) {
+        counts[len] = static_cast<std::uint8_t>(bits[len]);
+    }
+    symbols.clear();
+    for (int len = 1; len <= 32; ++len) {
+        for (int s = 0; s < 256; ++s) {
+            if (codesize[s] == len) {
+                symbols.push_back(static_cast<std::uint8_t>(s));
+            }
+        }
+    }
+}
+
+// Encoding side of a Huffman table: code and length per symbol.
+struct HuffmanCodes {
+    std::uint16_t code[256] = {};
+    std::uint8_t size[256] = {};
+
+    void build(const std::uint8_t counts[17], const std::vector<std::uint8_t>& symbols) {
+        int code_value = 0, k = 0;
+        for (int len = 1; len <= 16; ++len) {
+            for (int i = 0; i < counts[len]; ++i, ++k) {
+                code[symbols[k]] = static_cast<std::uint16_t>(code_value++);
+                size[symbols[k]] = static_cast<std::uint8_t>(len);
+            }
+            code_value <<= 1;
+        }
+    }
+};
+
+// Writes entropy-coded bits with 0xFF byte stuffing.
+struct BitWriter {
+    std::string& out;
+    std::uint32_t acc = 0;
+    int bits = 0;
+
+    explicit BitWriter(std::string& o) : out(o) {}
+
+    void put(std::uint32_t value, int n) {
+        if (n == 0) {
+            return;
+        }
+        acc = (acc << n) | (value & ((1u << n) - 1));
+        bits += n;
+        while (bits >= 8) {
+            std::uint8_t byte = static_cast<std::uint8_t>(acc >> (bits - 8));
+            out += static_cast<char>(byte);
+            if (byte == 0xFF) {
+                out += '\0';
+            }
+            bits -= 8;
+        }
+    }
+
+    void flush() {
+        if (bits > 0) {
+            put(0x7F, 8 - bits); // Pad with one bits
+        }
+    }
+};
+
+// Visits every block of an image in the order of a single baseline scan:
+// fn(component index, block pointer).
+template <typename Fn>
+inline void forEachScanBlock(const CoefImage& img, Fn fn) {
+    if (img.comps.size() == 1) {
+        const Component& comp = img.comps[0];
+        int bw = img.realBlocksW(comp), bh = img.realBlocksH(comp);
+        for (int by = 0; by < bh; ++by) {
+            for (int bx = 0; bx < bw; ++bx) {
+                fn(0, comp.block(bx, by));
+            }
+        }
+        return;
+    }
+    for (int my = 0; my < img.mcus_y; ++my) {
+        for (int mx = 0; mx < img.mcus_x; ++mx) {
+            for (std::size_t c = 0; c < img.comps.size(); ++c) {
+                const Component& comp = img.comps[c];
+                for (int y = 0; y < comp.v; ++y) {
+                    for (int x = 0; x < comp.h; ++x) {
+                        fn(static_cast<int>(c), comp.block(mx * comp.h + x, my * comp.v + y));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Writes the coefficients as a baseline JPEG (one interleaved scan, optimized Huffman
+// tables). APPn/COM segments are kept in their original order.
+inline std::string encodeBaseline(const CoefImage& img) {
+    // Table 0 serves the first component (luma), table 1 all others.
+    auto tableOf = [](int c) { return c == 0 ? 0 : 1; };
+    int tables = img.comps.size() > 1 ? 2 : 1;
+
+    // Pass 1: symbol statistics.
+    long dc_freq[2][257] = {};
+    long ac_freq[2][257] = {};
+    std::vector<int> pred(img.comps.size(), 0);
+    forEachScanBlock(img, [&](int c, const std::int16_t* coef) {
+        int t = tableOf(c);
+        int diff = coef[0] - pred[c];
+        pred[c] = coef[0];
+        dc_freq[t][magnitudeBits(diff)]++;
+        int run = 0;
+        for (int k = 1; k < 64; ++k) {
+            int v = coef[ZIGZAG[k]];
+            if (v == 0) {
+                ++run;
+                continue;
+            }
+            while (run > 15) {
+                ac_freq[t][0xF0]++;
+                run -= 16;
+            }
+            ac_freq[t][(run << 4) | magnitudeBits(v)]++;
+            run = 0;
+        }
+        if (run > 0) {
+            ac_freq[t][0x00]++;
+        }
+    });
+
+    std::uint8_t dc_counts[2][17], ac_counts[2][17];
+    std::vector<std::uint8_t> dc_symbols[2], ac_symbols[2];
+    HuffmanCodes dc_codes[2], ac_codes[2];
+    for (int t = 0; t < tables; ++t) {
+        buildOptimalTable(dc_freq[t], dc_counts[t], dc_symbols[t]);
+        buildOptimalTable(ac_freq[t], ac_counts[t], ac_symbols[t]);
+        dc_codes[t].build(dc_counts[t], dc_symbols[t]);
+        ac_codes[t].build(ac_counts[t], ac_symbols[t]);
+    }
+
+    std::string out;
+    auto marker = [&](std::uint8_t m, std::size_t payload_len) {
+        out += static_cast<char>(0xFF);
+        out += static_cast<char>(m);
+        out += static_cast<char>((payload_len + 2) >> 8);
+        out += static_cast<char>((payload_len + 2) & 0xFF);
+    };
+    out += static_cast<char>(0xFF);
+    out += static_cast<char>(0xD8);
+    for (const auto& segment : img.segments) {
+        marker(segment.first, segment.second.size());
+        out += segment.second;
+    }
+
+    // Quantization tables (16-bit precision only where a value needs it).
+    bool extended = false;
+    for (int t = 0; t < 4; ++t) {
+        if (!img.qt_used[t]) continue;
+        bool wide = false;
+        for (int k = 0; k < 64; ++k) {
+            wide = wide || img.qt[t][k] > 255;
+        }
+        extended = extended || wide;
+        marker(0xDB, 1 + (wide ? 128 : 64));
+        out += static_cast<char>((wide ? 0x10 : 0x00) | t);
+        for (int k = 0; k < 64; ++k) {
+            std::uint16_t q = img.qt[t][ZIGZAG[k]];
+            if (wide) out += static_cast<char>(q >> 8);
+            out += static_cast<char>(q & 0xFF);
+        }
+    }
+
+    // Frame header: SOF1 (extended sequential) is required for 16-bit tables.
+    marker(extended ? 0xC1 : 0xC0, 6 + 3 * img.comps.size());
+    out += static_cast<char>(8);
+    out += static_cast<char>(img.height >> 8);
+    out += static_cast<char>(img.height & 0xFF);
+    out += static_cast<char>(img.width >> 8);
+    out += static_cast<char>(img.width & 0xFF);
+    out += static_cast<char>(img.comps.size());
+    for (const auto& comp : img.comps) {
+        out += static_cast<char>(comp.id);
+        out += static_cast<char>((comp.h << 4) | comp.v);
+        out += static_cast<char>(comp.tq);
+    }
+
+    for (int t = 0; t < tables; ++t) {
+        for (int tc = 0; tc < 2; ++tc) {
+            const std::uint8_t* counts = tc == 0 ? dc_counts[t] : ac_counts[t];
+            const std::vector<std::uint8_t>& symbols = tc == 0 ? dc_symbols[t] : ac_symbols[t];
+            marker(0xC4, 17 + symbols.size());
+            out += static_cast<char>((tc << 4) | t);
+            for (int len = 1; len <= 16; ++len) {
+                out += static_cast<char>(counts[len]);
+            }
+            out.append(symbols.begin(), symbols.end());
+        }
+    }
+
+    marker(0xDA, 4 + 2 * img.comps.size());
+    out += static_cast<char>(img.comps.size());
+    for (std::size_t c = 0; c < img.comps.size(); ++c) {
+        int t = tableOf(static_cast<int>(c));
+        out += static_cast<char>(img.comps[c].id);
+        out += static_cast<char>((t << 4) | t);
+    }
+    out += static_cast<char>(0);
+    out += static_cast<char>(63);
+    out += static_cast<char>(0);
+
+    // Pass 2: entropy-coded data.
+    BitWriter bw(out);
+    std::fill(pred.begin(), pred.end(), 0);
+    forEachScanBlock(img, [&](int c, const std::int16_t* coef) {
+        int t = tableOf(c);
+        int diff = coef[0] - pred[c];
+        pred[c] = coef[0];
+        int nbits = magnitudeBits(diff);
+        bw.put(dc_codes[t].code[nbits], dc_codes[t].size[nbits]);
+        bw.put(static_cast<std::uint32_t>(diff < 0 ? diff - 1 : diff), nbits);
+        int run = 0;
+        for (int k = 1; k < 64; ++k) {
+            int v = coef[ZIGZAG[k]];
+            if (v == 0) {
+                ++run;
+                continue;
+            }
+            while (run > 15) {
+                bw.put(ac_codes[t].code[0xF0], ac_codes[t].size[0xF0]);
+                run -= 16;
+            }
+            int s = magnitudeBits(v);
+            int symbol = (run << 4) | s;
+            bw.put(ac_codes[t].code[symbol], ac_codes[t].size[symbol]);
+            bw.put(static_cast<std::uint32_t>(v < 0 ? v - 1 : v), s);
+            run = 0;
+        }
+        if (run > 0) {
+            bw.put(ac_codes[t].code[0x00], ac_codes[t].size[0x00]);
+        }
+    });
+    bw.flush();
+    out += static_cast<char>(0xFF);
+    out += static_cast<char>(0xD9);
+    return out;
+}
+
+// Annex K quantization tables (natural order) scaled for 'quality' 1-100 the way libjpeg does.
+inline void qualityTables(int quality, std::uint16_t* luma, std::uint16_t* chroma) {
+    static const std::uint8_t LUMA[64] = {
+        16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+    };
+    static const std::uint8_t CHROMA[64] = {
+        17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    };
+    quality = std::max(1, std::min(100, quality));
+    int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    for (int k = 0; k < 64; ++k) {
+        luma[k] = static_cast<std::uint16_t>(std::max(1, std::min(255, (LUMA[k] * scale + 50) / 100)));
+        chroma[k] = static_cast<std::uint16_t>(std::max(1, std::min(255, (CHROMA[k] * scale + 50) / 100)));
+    }
+}
+
+// Encodes RGBA pixels (alpha ignored) as a baseline JFIF with 4:2:0 chroma at 'quality'.
+// Edges are padded by repeating the last row and column.
+inline std::string encodePixels(int width, int height, const std::uint8_t* rgba, int quality) {
+    CoefImage img;
+    img.width = width;
+    img.height = height;
+    img.comps.resize(3);
+    for (int c = 0; c < 3; ++c) {
+        img.comps[c].id = c + 1;
+        img.comps[c].h = img.comps[c].v = c == 0 ? 2 : 1;
+        img.comps[c].tq = c == 0 ? 0 : 1;
+    }
+    img.layout();
+    qualityTables(quality, img.qt[0], img.qt[1]);
+    img.qt_used[0] = img.qt_used[1] = true;
+    img.segments.push_back({0xE0, std::string("JFIF\0\1\1\0\0\1\0\1\0\0", 14)});
+
+    auto pixel = [&](int x, int y) {
+        return rgba + (static_cast<std::size_t>(std::min(y, height - 1)) * width + std::min(x, width - 1)) * 4;
+    };
+    std::vector<std::uint8_t> samples;
+    for (int c = 0; c < 3; ++c) {
+        Component& comp = img.comps[c];
+        comp.grid_w = img.mcus_x * comp.h;
+        comp.grid_h = img.mcus_y * comp.v;
+        comp.coeffs.assign(static_cast<std::size_t>(comp.grid_w) * comp.grid_h * 64, 0);
+        std::size_t stride = static_cast<std::size_t>(comp.grid_w) * 8;
+        int step = 2 / comp.h; // Pixels per sample along each axis
+        samples.resize(stride * comp.grid_h * 8);
+        for (int sy = 0; sy < comp.grid_h * 8; ++sy) {
+            for (int sx = 0; sx < comp.grid_w * 8; ++sx) {
+                float sum = 0;
+                for (int dy = 0; dy < step; ++dy) {
+                    for (int dx = 0; dx < step; ++dx) {
+                        const std::uint8_t* px = pixel(sx * step + dx, sy * step + dy);
+                        float r = px[0], g = px[1], b = px[2];
+                        sum += c == 0 ? 0.299f * r + 0.587f * g + 0.114f * b
+                             : c == 1 ? -0.168736f * r - 0.331264f * g + 0.5f * b + 128.0f
+                                      : 0.5f * r - 0.418688f * g - 0.081312f * b + 128.0f;
+                    }
+                }
+                float value = sum / (step * step) + 0.5f;
+                samples[sy * stride + sx] = static_cast<std::uint8_t>(std::max(0.0f, std::min(255.0f, value)));
+            }
+        }
+        for (int by = 0; by < comp.grid_h; ++by) {
+            for (int bx = 0; bx < comp.grid_w; ++bx) {
+                fdctBlock(samples.data() + by * 8 * stride + bx * 8, stride, img.qt[comp.tq], comp.block(bx, by));
+            }
+        }
+    }
+    return encodeBaseline(img);
+}
+
+} // namespace jpeg
@@ -0,0 +1,228 @@
+// jpeg_transform.hpp - Lossless JPEG rotation and flipping for EXIF orientation.
+//
+// Phone photos are stored sideways with an EXIF Orientation tag telling the
+// viewer how to turn them. Rather than decoding pixels, the transforms here
+// work on the quantized DCT blocks: a block is mirrored by negating its odd
+// horizontal or vertical frequencies and transposed by transposing its
+// coefficient matrix (and its quantization table). Blocks are then moved to
+// their new place in the grid. No coefficient changes value, so nothing is
+// lost and no generation of JPEG noise is added.
+//
+// An edge that is mirrored onto the top or left of the image must end on a
+// whole iMCU (8 pixels times the largest sampling factor), because JPEG only
+// allows partial blocks at the right and bottom. Like jpegtran -trim, a
+// partial iMCU on such an edge is dropped (at most 15 pixels).
+#pragma once
+
+#include <cstdint>      // For fixed-width integers
+#include <filesystem>   // For fs::path
+#include <fstream>      // For reading and writing the image
+#include <iterator>     // For std::istreambuf_iterator
+#include <string>       // For file bytes and errors
+#include <system_error> // For std::error_code
+#include <utility>      // For std::swap
+
+#include "exif.hpp"
+#include "jpeg.hpp"
+
+namespace fs = std::filesystem;
+
+namespace jpeg {
+
+// A transform built from an optional transpose followed by optional mirrors.
+struct Transform {
+    bool transpose = false;
+    bool flip_h = false; // Mirror left-right (after transposing)
+    bool flip_v = false; // Mirror top-bottom (after transposing)
+};
+
+// The transform that displays an image with the given EXIF orientation upright.
+inline Transform transformForOrientation(int orientation) {
+    switch (orientation) {
+        case 2: return {false, true, false};  // Mirrored horizontally
+        case 3: return {false, true, true};   // Rotated 180
+        case 4: return {false, false, true};  // Mirrored vertically
+        case 5: return {true, false, false};  // Transposed
+        case 6: return {true, true, false};   // Rotate 90 clockwise
+        case 7: return {true, true, true};    // Transversed
+        case 8: return {true, false, true};   // Rotate 270 clockwise
+        default: return {};
+    }
+}
+
+// Applies 't' to every block of 'in', writing the result to 'out'. Returns false if the
+// image is too small to keep a whole iMCU on an edge that has to be trimmed.
+inline bool transformImage(const CoefImage& in, const Transform& t, CoefImage& out, std::string& error) {
+    // Input edges that end up on the left or top must be trimmed to whole iMCUs.
+    bool trim_w = t.transpose ? t.flip_v : t.flip_h;
+    bool trim_h = t.transpose ? t.flip_h : t.flip_v;
+    int width = in.width, height = in.height;
+    if (trim_w) width -= width % (8 * in.hmax);
+    if (trim_h) height -= height % (8 * in.vmax);
+    if (width == 0 || height == 0) {
+        error = "image is smaller than one MCU";
+        return false;
+    }
+
+    out = CoefImage();
+    out.progressive = false;
+    out.segments = in.segments;
+    out.width = t.transpose ? height : width;
+    out.height = t.transpose ? width : height;
+    for (int q = 0; q < 4; ++q) {
+        out.qt_used[q] = in.qt_used[q];
+        for (int k = 0; k < 64; ++k) {
+            out.qt[q][k] = t.transpose ? in.qt[q][(k % 8) * 8 + k / 8] : in.qt[q][k];
+        }
+    }
+    out.comps = std::vector<Component>(in.comps.size());
+    for (std::size_t c = 0; c < in.comps.size(); ++c) {
+        out.comps[c].id = in.comps[c].id;
+        out.comps[c].tq = in.comps[c].tq;
+        out.comps[c].h = t.transpose ? in.comps[c].v : in.comps[c].h;
+        out.comps[c].v = t.transpose ? in.comps[c].h : in.comps[c].v;
+    }
+    out.layout();
+
+    for (std::size_t c = 0; c < in.comps.size(); ++c) {
+        const Component& src = in.comps[c];
+        Component& dst = out.comps[c];
+        dst.grid_w = out.mcus_x * dst.h;
+        dst.grid_h = out.mcus_y * dst.v;
+        dst.coeffs.assign(static_cast<std::size_t>(dst.grid_w) * dst.grid_h * 64, 0);
+        // Mirrored axes are trimmed to whole iMCUs, so their block counts are exact.
+        int blocks_w = out.realBlocksW(dst);
+        int blocks_h = out.realBlocksH(dst);
+
+        for (int oy = 0; oy < dst.grid_h; ++oy) {
+            for (int ox = 0; ox < dst.grid_w; ++ox) {
+                int ax = t.flip_h ? blocks_w - 1 - ox : ox;
+                int ay = t.flip_v ? blocks_h - 1 - oy : oy;
+                int ix = t.transpose ? ay : ax;
+                int iy = t.transpose ? ax : ay;
+                if (ax < 0 || ay < 0 || ix >= src.grid_w || iy >= src.grid_h) {
+                    continue; // Padding beyond the mirrored edge stays zero
+                }
+                const std::int16_t* from = src.block(ix, iy);
+                std::int16_t* to = dst.block(ox, oy);
+                for (int v = 0; v < 8; ++v) {
+                    for (int u = 0; u < 8; ++u) {
+                        int value = t.transpose ? from[u * 8 + v] : from[v * 8 + u];
+                        if ((t.flip_h && (u & 1)) != (t.flip_v && (v & 1))) {
+                            value = -value;
+                        }
+                        to[v * 8 + u] = static_cast<std::int16_t>(value);
+                    }
+                }
+            }
+        }
+    }
+
+    // A transposed JFIF header also swaps its pixel aspect ratio.
+    if (t.transpose) {
+        for (auto& segment : out.segments) {
+            std::string& p = segment.second;
+            if (segment.first == 0xE0 && p.size() >= 14 && p.compare(0, 5, std::string("JFIF\0", 5)) == 0) {
+                std::swap(p[8], p[10]);
+                std::swap(p[9], p[11]);
+            }
+        }
+    }
+    return true;
+}
+
+// Returns the EXIF orientation of a decoded image (1 if it has none).
+inline int orientationOf(const CoefImage& img) {
+    for (const auto& segment : img.segments) {
+        if (segment.first == 0xE1) {
+            int orientation = exif::readOrientation(reinterpret_cast<const std::uint8_t*>(segment.second.data()),
+                                                    segment.second.size());
+            if (orientation) {
+                return orientation;
+            }
+        }
+    }
+    return 1;
+}
+
+// Brings an EXIF APP1 payload in line with an image that 't' turned into 'width' x
+// 'height': resets the Orientation tag, records the new pixel size and turns the IFD1
+// thumbnail the same way. A thumbnail that cannot be turned, or no longer fits, is
+// dropped rather than left showing the old orientation.
+inline void transformExif(std::string& payload, const Transform& t, int width, int height) {
+    if (!exif::resetOrientation(payload)) {
+        return; // Not EXIF, or no orientation to apply
+    }
+    exif::setPixelSize(payload, width, height);
+    std::size_t offset = 0, size = 0;
+    const auto* bytes = reinterpret_cast<const std::uint8_t*>(payload.data());
+    if (!exif::findThumbnail(bytes, payload.size(), offset, size)) {
+        exif::dropThumbnail(payload); // An uncompressed or cut-off thumbnail, if any
+        return;
+    }
+    CoefImage thumb, turned;
+    std::string error;
+    if (!decodeCoefficients(bytes + offset, size, thumb, error) || !transformImage(thumb, t, turned, error) ||
+        !exif::replaceThumbnail(payload, encodeBaseline(turned))) {
+        exif::dropThumbnail(payload);
+    }
+}
+
+enum class AutorotateResult { Rotated, Upright, Failed };
+
+// Rotates or flips the JPEG at 'path' in place so that it is upright without its EXIF
+// Orientation tag, then resets the tag to 1 and updates the rest of the EXIF segment to
+// match (see transformExif). Files without a tag (or with tag 1) are left
+// untouched. 'orientation' receives the tag that was found.
+inline AutorotateResult autorotateFile(const fs::path& path, int& orientation, std::string& error) {
+    orientation = 1;
+    std::string bytes;
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            error = "cannot read file";
+            return AutorotateResult::Failed;
+        }
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    CoefImage img;
+    if (!decodeCoefficients(reinterpret_cast<const std::uint8_t*>(bytes.data()), bytes.size(), img, error)) {
+        return AutorotateResult::Failed;
+    }
+    orientation = orientationOf(img);
+    if (orientation == 1) {
+        return AutorotateResult::Upright;
+    }
+
+    CoefImage rotated;
+    if (!transformImage(img, transformForOrientation(orientation), rotated, error)) {
+        return AutorotateResult::Failed;
+    }
+    for (auto& segment : rotated.segments) {
+        if (segment.first == 0xE1) {
+            transformExif(segment.second, transformForOrientation(orientation), rotated.width, rotated.height);
+        }
+    }
+    std::string encoded = encodeBaseline(rotated);
+
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.write(encoded.data(), static_cast<std::streamsize>(encoded.size()))) {
+            error = "cannot write " + tmp.string();
+            return AutorotateResult::Failed;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        error = "cannot replace file";
+        return AutorotateResult::Failed;
+    }
+    return AutorotateResult::Rotated;
+}
+
+} // namespace jpeg
@@ -3,8 +3,40 @@
 #include <vector>       // For dynamic array (vector) of FileInfo
 #include <filesystem>   // For file system operations (listing, renaming) - C++17 feature
 #include <algorithm>    // For sorting (std::sort)
-#include <regex>        // For regular expressions (matching filenames)
 #include <tuple>        // Not strictly needed here as FileInfo struct is used, but useful for generic tuples.
+#include <deque>        // For the job list handed to the pipeline
+#include <thread>       // For std::thread::hardware_concurrency
+#include <atomic>       // For the next font to convert
+
+#include <map>          // For the batch of planned renames
+#include <memory>       // For the optional manifest pager
+#include <set>          // For the names present in the directory
+#include <ctime>        // For formatting version dates
+#include <iomanip>      // For aligned report columns
+#include <cmath>        // For std::isnan
+
+#include "bench.hpp"    // Kernel microbenchmarks
+#include "delta.hpp"    // Content-defined chunking and delta files
+#include "history.hpp"  // Gallery history log and the cycle-safe rename planner
+#include "jpeg_transform.hpp" // Lossless EXIF auto-rotation of JPEGs
+#include "svg_optimizer.hpp" // Streaming SVG minifier
+#include "fontface.hpp" // WOFF2-first @font-face src lists
+#include "woff2.hpp"    // TTF/OTF to WOFF2 conversion
+#include "naming.hpp"   // Output naming templates
+#include "manifest.hpp" // Gallery manifest writer (pulls in the pipeline and image probe)
+#include "pageload.hpp" // Page-load simulator for index.html
+#include "palette.hpp"  // Dominant color and palette from 1/8-scale decodes
+#include "preview.hpp"  // EXIF thumbnail previews with a 1/8-scale fallback
+#include "classify.hpp" // Photo-vs-graphic format choice
+#include "compact.hpp"  // Directory rebuilds after mass renames
+#include "pagecache.hpp" // Read-ahead and eviction of sources
+#include "occupancy.hpp" // Numbers in use as Roaring bitmaps, kept in .gallery-index
+#include "imagediff.hpp" // Perceptual diff of two versions of an image
+#include "watermark.hpp" // Watermarked variants for publish
+#include "heif.hpp"     // HEIC decoding for ingest (with libheif)
+#include "corpus.hpp"   // Synthetic image corpora
+#include "dirscan.hpp"  // Overlapped directory listing into a sorted columnar index
+#include "heapprof.hpp" // Allocation-site heap profiler (with -DCARO_HEAP_PROFILE)
 
 // Alias for std::filesystem for brevity
 namespace fs = std::filesystem;
@@ -16,6 +48,33 @@ struct FileInfo {
     std::string extension;  // The file extension (e.g., "txt" from 5.txt)
 };
 
+// Scans 'dir' for regular files named like "NUMBER.EXTENSION" (or by 'naming', if the
+// gallery uses another template) and appends them to 'files' in ascending number order.
+// Files whose number is out of range are reported and skipped.
+// Returns false if the directory itself could not be read.
+bool collectNumberedFiles(const fs::path& dir, std::vector<FileInfo>& files, const NameTemplate& naming) {
+    // Listing and parsing overlap; the index comes back already sorted (see dirscan.hpp).
+    dirscan::Index index;
+    std::string error;
+    if (!dirscan::scan(dir, naming, index, error)) {
+        std::cerr << "Error accessing directory: " << error << std::endl;
+        return false; // Report the failure to the caller
+    }
+    for (const auto& warning : index.warnings) {
+        std::cerr << "Warning: " << warning << std::endl;
+    }
+    files.reserve(files.size() + index.size());
+    for (std::uint32_t i : index.order) {
+        files.push_back({index.numbers[i], dir / index.name(i), index.extension(i)});
+    }
+    return true;
+}
+
+// Scans 'dir' with the naming template the gallery in 'dir' records.
+bool collectNumberedFiles(const fs::path& dir, std::vector<FileInfo>& files) {
+    return collectNumberedFiles(dir, files, galleryNaming(dir));
+}
+
 // Comparison function for sorting FileInfo objects in descending order by their number
 // Used when 'a' is positive to rename highest numbers first, preventing conflicts.
 bool compareFilesDesc(const FileInfo& a, const FileInfo& b) {
@@ -28,7 +87,256 @@ bool compareFilesAsc(const FileInfo& a, const FileInfo& b) {
     return a.number < b.number;
 }
 
-int main() {
+// Names of all 'NUMBER.EXTENSION' files in 'dir' (the files tracked by the gallery history).
+std::vector<std::string> numberedNames(const fs::path& dir) {
+    std::vector<FileInfo> files;
+    collectNumberedFiles(dir, files);
+    std::vector<std::string> names;
+    for (const auto& file_info : files) {
+        names.push_back(file_info.original_path.filename().string());
+    }
+    return names;
+}
+
+// Scans 'section_dir' into a fresh index section (stamp 0 if it cannot be read).
+IndexSection scanSection(const fs::path& section_dir, const NameTemplate& naming) {
+    IndexSection section;
+    section.stamp = directoryStamp(section_dir); // Before the scan: a change during it rescans next time
+    section.naming = naming.spec();
+    dirscan::Index files;
+    std::string error;
+    if (!dirscan::scan(section_dir, naming, files, error, true)) {
+        std::cerr << "Error accessing directory: " << error << std::endl;
+        section.stamp = 0;
+    }
+    for (const auto& warning : files.warnings) {
+        std::cerr << "Warning: " << warning << std::endl;
+    }
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        section.numbers.add(files.numbers[i], files.extension(i), files.sizes[i]);
+    }
+    section.numbers.optimize();
+    section.sized = true;
+    return section;
+}
+
+// Numbers in use in the gallery 'dir' and its not-good/ archive. Sections of .gallery-index
+// whose directory or naming template changed since are rescanned, and the index rewritten.
+GalleryIndex galleryOccupancy(const fs::path& dir) {
+    GalleryIndex index;
+    loadIndex(dir, index);
+    NameTemplate naming = galleryNaming(dir);
+    bool changed = false;
+    for (const std::string name : {"", "not-good"}) {
+        fs::path section_dir = name.empty() ? dir : dir / name;
+        std::error_code ec;
+        if (!fs::is_directory(section_dir, ec)) {
+            changed = index.erase(name) > 0 || changed;
+            continue;
+        }
+        IndexSection& section = index[name];
+        if (sectionFresh(section, section_dir, naming.spec())) {
+            continue;
+        }
+        section = scanSection(section_dir, naming);
+        changed = true;
+    }
+    if (changed && !saveIndex(dir, index)) {
+        std::cerr << "Warning: Could not write " << indexPath(dir).string() << std::endl;
+    }
+    return index;
+}
+
+// True if the live section of .gallery-index describes 'dir' as it is now. A command that
+// is about to rename or add files asks first, and if so calls indexMoves() afterwards.
+// Commands that have put files of their own into 'dir' pass its listing ('names'), which
+// must then hold exactly the numbered files of the index.
+bool liveIndexCurrent(const fs::path& dir, const std::set<std::string>* names = nullptr) {
+    GalleryIndex index;
+    if (!loadIndex(dir, index)) {
+        return false;
+    }
+    auto live = index.find("");
+    NameTemplate naming = galleryNaming(dir);
+    if (live == index.end() || !live->second.sized || live->second.naming != naming.spec()) {
+        return false;
+    }
+    if (!names) {
+        return sectionFresh(live->second, dir, naming.spec());
+    }
+    std::uint64_t numbered = 0;
+    int number = 0;
+    std::string ext;
+    bool out_of_range = false;
+    for (const auto& name : *names) {
+        if (!dirscan::parseName(naming, name, number, ext, out_of_range)) {
+            continue;
+        }
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        auto numbers = live->second.numbers.by_extension.find(ext);
+        if (numbers == live->second.numbers.by_extension.end() || !numbers->second.contains(static_cast<std::uint32_t>(number))) {
+            return false;
+        }
+        ++numbered;
+    }
+    return numbered == sectionStats(live->second).files;
+}
+
+// Applies 'moves' (old name -> new name, already made in 'dir') to the live section of
+// .gallery-index, so that the numbers, gaps and sizes stay current without a rescan.
+// Old names that are not numbered (temporary files) only add their new name. All old
+// names go before any new one is added: in a shift one move's target is the next one's
+// source.
+void indexMoves(const fs::path& dir, const std::map<std::string, std::string>& moves) {
+    GalleryIndex index;
+    if (!loadIndex(dir, index) || !index.count("")) {
+        return;
+    }
+    NameTemplate naming = galleryNaming(dir);
+    IndexSection& live = index[""];
+    int number = 0;
+    std::string ext;
+    bool out_of_range = false;
+    std::vector<std::uint64_t> sizes;
+    for (const auto& move : moves) {
+        std::error_code ec;
+        std::uint64_t size = fs::file_size(dir / move.second, ec);
+        sizes.push_back(ec ? 0 : size);
+        if (dirscan::parseName(naming, move.first, number, ext, out_of_range)) {
+            live.numbers.remove(number, ext, sizes.back());
+        }
+    }
+    auto size = sizes.begin();
+    for (const auto& move : moves) {
+        if (dirscan::parseName(naming, move.second, number, ext, out_of_range)) {
+            live.numbers.add(number, ext, *size);
+        }
+        ++size;
+    }
+    live.numbers.optimize();
+    live.stamp = settledStamp(dir);
+    if (!saveIndex(dir, index, true)) {
+        std::cerr << "Warning: Could not write " << indexPath(dir).string() << std::endl;
+    }
+}
+
+// Warns about numbers 'moves' would give to more than one file (e.g. 7.jpg renamed to
+// 8.jpg next to a staying 8.png): not an overwrite, but the gallery shows one of them.
+void warnNumberCollisions(const fs::path& dir, const std::map<std::string, std::string>& moves) {
+    NameTemplate naming = galleryNaming(dir);
+    GalleryIndex index = galleryOccupancy(dir);
+    Occupancy staying = index[""].numbers;
+    roaring::Bitmap targets, collisions;
+    for (const auto& move : moves) {
+        int number = 0;
+        std::string ext;
+        if (naming.match(move.first, number, ext)) {
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            staying.by_extension[ext].remove(static_cast<std::uint32_t>(number));
+        }
+        if (naming.match(move.second, number, ext)) {
+            if (targets.contains(static_cast<std::uint32_t>(number))) {
+                collisions.add(static_cast<std::uint32_t>(number));
+            }
+            targets.add(static_cast<std::uint32_t>(number));
+        }
+    }
+    roaring::Bitmap remaining;
+    for (const auto& entry : staying.by_extension) {
+        remaining = remaining | entry.second;
+    }
+    collisions = collisions | (remaining & targets);
+    if (!collisions.empty()) {
+        std::cerr << "Warning: These numbers would belong to more than one file: " << formatRanges(collisions) << std::endl;
+    }
+}
+
+// Plans and applies 'moves' (original name -> new name) in 'dir' as one batch.
+// The planner orders chains so no file is overwritten, breaks cycles through a temporary
+// name and rejects renames onto an existing file that is not itself being renamed; those
+// are reported and dropped from 'moves'. If the gallery keeps a history, the state before
+// is recorded first and the renames are recorded as 'message' afterwards.
+// 'rename_order' lists the original names in the order they are reported. With
+// 'all_or_nothing' a single rejected rename cancels the whole batch. A new 'naming'
+// template is recorded right before the plan runs and put back if it fails, so the
+// files and .gallery-naming always agree.
+// Returns false if the directory could not be read or nothing was renamed because of errors.
+bool applyRenames(const fs::path& dir, std::map<std::string, std::string>& moves,
+                  const std::vector<std::string>& rename_order, const std::string& command,
+                  const std::string& message, bool all_or_nothing = false,
+                  const NameTemplate* naming = nullptr) {
+    std::set<std::string> occupied; // Every name currently in the directory
+    try {
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            occupied.insert(entry.path().filename().string());
+        }
+    } catch (const fs::filesystem_error& e) {
+        std::cerr << "Error accessing directory: " << e.what() << std::endl;
+        return false;
+    }
+    RenamePlan plan;
+    planMoves(moves, occupied, plan);
+    for (std::size_t i = 0; i < plan.rejected.size(); ++i) {
+        std::cerr << "Error renaming '" << plan.rejected[i].first << "' to '" << plan.rejected[i].second
+                  << "': " << plan.reasons[i] << std::endl;
+        moves.erase(plan.rejected[i].first);
+    }
+    if (all_or_nothing && !plan.rejected.empty()) {
+        std::cerr << "No files were renamed." << std::endl;
+        moves.clear();
+        return false;
+    }
+    warnNumberCollisions(dir, moves);
+
+    // If the gallery keeps a history, make sure the state before the renames is recorded.
+    bool keep_history = historyExists(dir);
+    if (keep_history && !moves.empty()) {
+        int version = recordVersion(dir, numberedNames(dir), "unrecorded changes before " + command);
+        if (version > 0) {
+            std::cout << "Recorded unrecorded changes as version " << version << "." << std::endl;
+        }
+    }
+
+    std::string plan_error;
+    bool index_current = liveIndexCurrent(dir) && !naming; // The index is kept per template
+    NameTemplate previous = galleryNaming(dir);
+    if (naming && !saveGalleryNaming(dir, *naming)) {
+        std::cerr << "Error: Could not record the naming template in " << namingPath(dir).string() << std::endl;
+        std::cerr << "No files were renamed." << std::endl;
+        moves.clear();
+        return false;
+    }
+    if (!executePlan(dir, plan, objectStoreDir(dir), plan_error)) {
+        // Report the failure; every rename already applied has been undone.
+        std::cerr << "Error renaming files: " << plan_error << std::endl;
+        std::cerr << "All renames were rolled back; no files were changed." << std::endl;
+        if (naming && !saveGalleryNaming(dir, previous)) {
+            std::cerr << "Error: Could not restore " << namingPath(dir).string() << " to " << previous.spec() << std::endl;
+        }
+        moves.clear();
+        return false;
+    }
+    if (index_current) {
+        indexMoves(dir, moves);
+    }
+    for (const auto& name : rename_order) {
+        if (moves.count(name)) {
+            std::cout << "Renamed '" << name << "' to '" << moves[name] << "'" << std::endl;
+        }
+    }
+
+    if (keep_history && !moves.empty()) {
+        int version = recordMoves(dir, moves, message);
+        if (version > 0) {
+            std::cout << "Recorded the new order as version " << version << "." << std::endl;
+        } else {
+            std::cerr << "Warning: Could not append to the gallery history." << std::endl;
+        }
+    }
+    return true;
+}
+
+int runInteractiveShift() {
     // Provide a brief introduction to the user about what the program does.
     std::cout << "This program renames files in the current directory." << std::endl;
     std::cout << "It targets files named like 'NUMBER.EXTENSION' (e.g., 5.txt, 33.jpg)." << std::endl;
@@ -62,48 +370,10 @@ int main() {
     fs::path current_dir = fs::current_path();
     std::cout << "Searching for files in: " << current_dir << std::endl;
 
-    // Define the regular expression to find files named "NUMBER.EXTENSION".
-    // ^        - Asserts position at the start of the string.
-    // (\d+)    - Captures one or more digits (the number part). This is the first capturing group.
-    // \.       - Matches a literal dot (escaped because '.' is a special regex character).
-    // (.+)     - Captures one or more of any characters (the extension part). This is the second capturing group.
-    // $        - Asserts position at the end of the string.
-    std::regex filename_regex("^(\\d+)\\.(.+)$");
-    std::smatch matches; // Object to store the results of the regex match
-
     std::vector<FileInfo> files_to_rename; // Vector to store information about files that match our pattern
 
-    try {
-        // Iterate through all entries (files and directories) in the current directory.
-        for (const auto& entry : fs::directory_iterator(current_dir)) {
-            // Check if the current entry is a regular file (not a directory, symlink, etc.).
-            if (entry.is_regular_file()) {
-                // Get the filename as a string (e.g., "5.txt")
-                std::string filename = entry.path().filename().string();
-
-                // Attempt to match the filename against our regex pattern.
-                if (std::regex_match(filename, matches, filename_regex)) {
-                    // If a match is found:
-                    try {
-                        // Extract the number part (first capturing group) and convert to int.
-                        int number = std::stoi(matches[1].str());
-                        // Extract the extension part (second capturing group).
-                        std::string extension = matches[2].str();
-                        // Add the file's information to our vector.
-                        files_to_rename.push_back({number, entry.path(), extension});
-                    } catch (const std::invalid_argument& e) {
-                        // Handle error if the captured number string cannot be converted to an integer.
-                        std::cerr << "Warning: Could not convert number part of '" << filename << "': " << e.what() << std::endl;
-                    } catch (const std::out_of_range& e) {
-                        // Handle error if the number is too large to fit in an int.
-                        std::cerr << "Warning: Number part of '" << filename << "' is out of range: " << e.what() << std::endl;
-                    }
-                }
-            }
-        }
-    } catch (const fs::filesystem_error& e) {
-        // Catch any errors that occur during directory iteration (e.g., permissions issues).
-        std::cerr << "Error accessing directory: " << e.what() << std::endl;
+    // Collect every 'NUMBER.EXTENSION' file in the directory.
+    if (!collectNumberedFiles(current_dir, files_to_rename)) {
         return 1; // Return with an error code
     }
 
@@ -114,7 +384,7 @@ int main() {
     }
 
     // Sort the list of files based on the value of 'a'.
-    // This is a crucial step to prevent renaming conflicts.
+    // The planner below orders the actual renames; sorting keeps the report in processing order.
     if (a >= 0) {
         // If 'a' is positive or zero, we want to rename files from the highest original number
         // down to the lowest. This ensures that a file like '5.txt' changing to '7.txt'
@@ -130,7 +400,11 @@ int main() {
     }
 
     std::cout << "\nAttempting to rename files:\n";
-    // Iterate through the sorted list of files and perform the renaming.
+    std::map<std::string, std::string> moves; // Original filename -> new filename
+    std::vector<std::string> rename_order;     // Original filenames in processing order, for the report
+    NameTemplate naming = galleryNaming(current_dir); // "{n}" unless the gallery records another template
+    std::string new_filename_str;                     // Reused for every new name
+    // Iterate through the sorted list of files and decide each new name.
     for (const auto& file_info : files_to_rename) {
         int old_number = file_info.number; // Original number of the file
         int new_number = old_number + a;   // Calculate the new number
@@ -155,9 +429,9 @@ int main() {
             continue; // Move to the next file
         }
 
-        // Construct the new filename string (e.g., "7.txt")
-        std::string new_filename_str = std::to_string(new_number) + "." + file_info.extension;
-        
+        // Construct the new filename string (e.g., "7.txt") in the gallery's naming template
+        naming.render(new_number, file_info.extension, new_filename_str);
+
         // Check if the new filename is identical to the original filename.
         // This can happen if 'a' is 0. If so, there's no need to rename.
         if (original_filename_str == new_filename_str) {
@@ -166,19 +440,16 @@ int main() {
             continue; // Move to the next file
         }
 
-        // Construct the full new path for the file. It's in the same directory as the original.
-        fs::path new_path = file_info.original_path.parent_path() / new_filename_str;
-
-        try {
-            // Attempt to rename the file.
-            fs::rename(file_info.original_path, new_path);
-            std::cout << "Renamed '" << original_filename_str << "' to '" << new_filename_str << "'" << std::endl;
-        } catch (const fs::filesystem_error& e) {
-            // Catch and report any errors during the renaming process (e.g., permissions, file in use).
-            std::cerr << "Error renaming '" << original_filename_str << "' to '" << new_filename_str << "': " << e.what() << std::endl;
-        }
+        // Queue the rename; all renames are planned and applied together below.
+        moves[original_filename_str] = new_filename_str;
+        rename_order.push_back(original_filename_str);
     }
 
+    // Plan and apply every rename as one batch (e.g. 5.txt -> 3.txt is rejected while
+    // 3.txt is below 'b' and stays where it is).
+    applyRenames(current_dir, moves, rename_order, "shift",
+                 "shift a=" + std::to_string(a) + " b=" + std::to_string(b));
+
     std::cout << "\nRenaming process complete." << std::endl;
 
     // Keep the console window open on Windows until the user presses Enter,
@@ -189,3 +460,1766 @@ int main() {
 
     return 0; // Exit successfully
 }
+
+// Reads the value following a "--flag" option as an integer, or returns 'fallback'.
+int intOption(int argc, char* argv[], const std::string& flag, int fallback) {
+    for (int i = 2; i + 1 < argc; ++i) {
+        if (flag == argv[i]) {
+            try {
+                return std::stoi(argv[i + 1]);
+            } catch (const std::exception&) {
+                std::cerr << "Warning: Ignoring non-numeric value for " << flag << std::endl;
+            }
+        }
+    }
+    return fallback;
+}
+
+// Reads the value following a "--flag" option as a string, or returns 'fallback'.
+std::string stringOption(int argc, char* argv[], const std::string& flag, const std::string& fallback) {
+    for (int i = 2; i + 1 < argc; ++i) {
+        if (flag == argv[i]) {
+            return argv[i + 1];
+        }
+    }
+    return fallback;
+}
+
+// True if the bare option "--flag" is present.
+bool hasFlag(int argc, char* argv[], const std::string& flag) {
+    for (int i = 2; i < argc; ++i) {
+        if (flag == argv[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Classifier verdict for one image file.
+struct Classified {
+    ImageInfo info;             // Actual content format
+    classify::Features features;
+    std::string choice;         // Best format ("png8", "png", "jpeg", "webp"), empty on error
+    std::string error;
+};
+
+// Classifies images in parallel from their 1/8-scale decodes.
+std::vector<Classified> classifyFiles(const std::vector<fs::path>& paths) {
+    std::vector<Classified> results(paths.size());
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < paths.size(); i = next++) {
+            Classified& r = results[i];
+            r.info = probeImage(paths[i]);
+            if (classify::measureFile(paths[i], r.info.format, r.features, r.error)) {
+                r.choice = classify::formatName(classify::choose(r.features));
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    unsigned workers = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), static_cast<unsigned>(paths.size())));
+    for (unsigned t = 0; t < workers; ++t) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
+
+// 'rename' subcommand: renumbers and/or renames the gallery in the current directory to a
+// naming template in one conflict-checked batch, e.g. migrating 5.jpeg to design-007.jpg
+// while shifting by 2. The template is recorded in .gallery-naming so later scans
+// recognise the new names.
+//
+// Options:
+//   --template T   Naming template, e.g. "design-{n:3}" (default: the gallery's current one)
+//   --ext LIST     Extension renames, e.g. "jpeg=jpg,JPG=jpg" (the files are not converted)
+//   --by A         Number added to every number >= the --from value (default 0)
+//   --from B       Minimum original number to shift (default 0)
+//   --formats      Give each image the extension of its content, and list the images the
+//                  classifier wants in another format (they keep their name until converted)
+//   --dry-run      Print the renames without applying them
+int runRename(int argc, char* argv[]) {
+    fs::path dir = fs::current_path();
+    NameTemplate current = galleryNaming(dir);
+    NameTemplate target = current;
+    std::string error;
+    std::string spec = stringOption(argc, argv, "--template", "");
+    if (!spec.empty() && !parseNameTemplate(spec, target, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    if (!parseExtensionMap(stringOption(argc, argv, "--ext", ""), target, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    int by = intOption(argc, argv, "--by", 0);
+    int from = intOption(argc, argv, "--from", 0);
+    bool formats = hasFlag(argc, argv, "--formats");
+    bool dry_run = hasFlag(argc, argv, "--dry-run");
+
+    std::vector<FileInfo> files;
+    if (!collectNumberedFiles(dir, files, current)) {
+        return 1;
+    }
+    std::sort(files.begin(), files.end(), compareFilesAsc);
+    heapprof::phase("rename: scan");
+
+    std::vector<Classified> classified;
+    if (formats) {
+        std::vector<fs::path> paths;
+        for (const auto& file_info : files) {
+            paths.push_back(file_info.original_path);
+        }
+        classified = classifyFiles(paths);
+    }
+    std::vector<std::string> conversions; // "5.png -> jpeg", still to be converted
+
+    std::map<std::string, std::string> moves;
+    std::vector<std::string> rename_order;
+    std::string new_name; // Reused for every file
+    for (const auto& file_info : files) {
+        int number = file_info.number >= from ? file_info.number + by : file_info.number;
+        if (number < 0) {
+            std::cerr << "Error: '" << file_info.original_path.filename().string() << "' would get the negative number "
+                      << number << "." << std::endl;
+            return 1;
+        }
+        std::string name = file_info.original_path.filename().string();
+        std::string ext = file_info.extension;
+        if (formats) {
+            const Classified& c = classified[&file_info - files.data()];
+            if (c.info.format != "unknown") {
+                ext = classify::formatExtension(c.info.format, ext); // Mislabelled or already converted
+            }
+            if (!c.choice.empty() && (classify::formatExtension(c.choice, ext) != ext ||
+                                      (c.choice == "png8" && !c.info.indexed))) {
+                conversions.push_back(name + " -> " + c.choice);
+            }
+        }
+        target.render(number, ext, new_name);
+        if (new_name != name) {
+            if (moves.count(name) == 0) {
+                rename_order.push_back(name);
+            }
+            moves[name] = new_name;
+        }
+    }
+
+    if (!conversions.empty()) {
+        std::cout << conversions.size() << " images would be cheaper in another format (convert them, then rename again):"
+                  << std::endl;
+        for (const auto& line : conversions) {
+            std::cout << "  " << line << std::endl;
+        }
+    }
+
+    bool naming_changed = target.spec() != current.spec();
+    if (dry_run) {
+        for (const auto& name : rename_order) {
+            std::cout << "'" << name << "' -> '" << moves[name] << "'" << std::endl;
+        }
+        warnNumberCollisions(dir, moves);
+        std::cout << moves.size() << " of " << files.size() << " files would be renamed." << std::endl;
+        return 0;
+    }
+    if (!moves.empty()) {
+        // A template change is all or nothing: files left in the old naming would no
+        // longer be recognised.
+        std::string message = "rename to " + target.spec();
+        if (by != 0) {
+            message += " by=" + std::to_string(by) + " from=" + std::to_string(from);
+        }
+        if (!applyRenames(dir, moves, rename_order, "rename", message, naming_changed,
+                          naming_changed ? &target : nullptr)) {
+            return 1;
+        }
+    } else if (naming_changed && !saveGalleryNaming(dir, target)) {
+        std::cerr << "Error: Could not record the naming template in " << namingPath(dir).string() << std::endl;
+        return 1;
+    }
+    std::cout << moves.size() << " of " << files.size() << " files renamed." << std::endl;
+    return 0;
+}
+
+// 'ingest' subcommand: adds the images of an upload folder (or the given files) to the
+// gallery in the current directory under the next free numbers, in name order. Formats are
+// recognised by content, not extension: PNG, JPEG, GIF and WebP are copied with the
+// extension of their content, HEIF/HEIC photos are decoded with libheif and transcoded to
+// JPEG (PNG if they have transparency). Everything is written under temporary names first
+// and numbered in one batched plan, so either all images are added or none.
+//
+// Options:
+//   --workers N   Files converted at once (default: number of cores; the cores left over
+//                 decode the tiles of each HEIF in parallel)
+//   --quality Q   JPEG quality of transcoded photos (default 90)
+//   --move        Delete the sources once they are in the gallery
+//   --dry-run     Print the names the images would get
+int runIngest(int argc, char* argv[]) {
+    std::vector<fs::path> sources;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--workers" || arg == "--quality") {
+            ++i;
+        } else if (arg.rfind("--", 0) != 0) {
+            std::error_code ec;
+            if (!fs::is_directory(arg, ec)) {
+                sources.push_back(arg);
+                continue;
+            }
+            for (const auto& entry : fs::directory_iterator(arg, ec)) {
+                if (entry.is_regular_file() && entry.path().filename().string()[0] != '.') {
+                    sources.push_back(entry.path());
+                }
+            }
+        }
+    }
+    if (sources.empty()) {
+        std::cerr << "Usage: caro ingest FOLDER|FILE... [--workers N] [--quality Q] [--move] [--dry-run]" << std::endl;
+        return 1;
+    }
+    std::sort(sources.begin(), sources.end());
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    int quality = std::max(1, std::min(100, intOption(argc, argv, "--quality", 90)));
+    bool move = hasFlag(argc, argv, "--move");
+
+    fs::path dir = fs::current_path();
+    NameTemplate naming = galleryNaming(dir);
+    std::uint32_t last = 0;
+    galleryOccupancy(dir)[""].numbers.all.maximum(last);
+
+    struct Incoming {
+        fs::path source;
+        ImageInfo info;
+        int number = 0;
+        std::string extension; // Of the gallery file
+        std::string bytes;     // Transcoded image; empty for copies
+        std::string error;
+    };
+    std::vector<Incoming> incoming;
+    for (const auto& source : sources) {
+        Incoming in;
+        in.source = source;
+        in.info = probeImage(source);
+        if (in.info.format == "unknown") {
+            std::cerr << "Warning: Skipping '" << source.string() << "': not an image browsers can show" << std::endl;
+            continue;
+        }
+        in.number = static_cast<int>(last + 1 + incoming.size());
+        std::string ext = source.extension().string();
+        in.extension = in.info.format == "heif" ? "jpg" : classify::formatExtension(in.info.format, ext.empty() ? ext : ext.substr(1));
+        incoming.push_back(in);
+    }
+
+    std::string name; // Reused for every file
+    if (hasFlag(argc, argv, "--dry-run")) {
+        for (const auto& in : incoming) {
+            naming.render(in.number, in.extension, name);
+            std::cout << "'" << in.source.string() << "' -> '" << name << "'"
+                      << (in.info.format == "heif" ? " (transcoded from HEIF)" : "") << std::endl;
+        }
+        std::cout << incoming.size() << " of " << sources.size() << " files would be added." << std::endl;
+        return 0;
+    }
+
+    // Convert in parallel into temporary files next to the gallery.
+    unsigned workers = std::max(1u, std::min<unsigned>(
+        static_cast<unsigned>(std::max(1, intOption(argc, argv, "--workers", static_cast<int>(cores)))),
+        static_cast<unsigned>(incoming.size())));
+    int tile_threads = static_cast<int>(std::max(1u, cores / workers));
+    auto tempPath = [&dir](std::size_t i) { return dir / (".ingest-" + std::to_string(i) + ".tmp"); };
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < incoming.size(); i = next++) {
+            Incoming& in = incoming[i];
+            std::error_code ec;
+            if (in.info.format != "heif") {
+                if (!fs::copy_file(in.source, tempPath(i), fs::copy_options::overwrite_existing, ec)) {
+                    in.error = ec ? ec.message() : "cannot copy file";
+                }
+                continue;
+            }
+            int width = 0, height = 0;
+            bool alpha = false;
+            std::vector<std::uint8_t> rgba;
+            if (!heif::decode(in.source, tile_threads, width, height, rgba, alpha, in.error)) {
+                continue;
+            }
+            in.extension = alpha ? "png" : "jpg";
+            in.bytes = alpha ? png::encode(width, height, rgba.data(), true)
+                             : jpeg::encodePixels(width, height, rgba.data(), quality);
+            if (!writeFileAtomically(tempPath(i), in.bytes)) {
+                in.error = "cannot write " + tempPath(i).string();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < workers; ++t) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto discard = [&]() {
+        for (std::size_t i = 0; i < incoming.size(); ++i) {
+            std::error_code ec;
+            fs::remove(tempPath(i), ec);
+        }
+    };
+    bool failed = false;
+    for (const auto& in : incoming) {
+        if (!in.error.empty()) {
+            std::cerr << "Error: " << in.source.string() << ": " << in.error << std::endl;
+            failed = true;
+        }
+    }
+    if (failed) {
+        discard();
+        std::cerr << "No files were added." << std::endl;
+        return 1;
+    }
+
+    // One plan puts every temporary file under its number.
+    std::map<std::string, std::string> moves;
+    std::set<std::string> occupied;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        occupied.insert(entry.path().filename().string());
+    }
+    for (std::size_t i = 0; i < incoming.size(); ++i) {
+        naming.render(incoming[i].number, incoming[i].extension, name);
+        moves[tempPath(i).filename().string()] = name;
+    }
+    RenamePlan plan;
+    planMoves(moves, occupied, plan);
+    std::string plan_error = plan.rejected.empty() ? "" : plan.rejected[0].second + ": " + plan.reasons[0];
+    bool keep_history = historyExists(dir);
+    if (plan_error.empty() && keep_history) {
+        int version = recordVersion(dir, numberedNames(dir), "unrecorded changes before ingest");
+        if (version > 0) {
+            std::cout << "Recorded unrecorded changes as version " << version << "." << std::endl;
+        }
+    }
+    bool index_current = liveIndexCurrent(dir, &occupied); // The temporary files changed the directory time
+    if (!plan_error.empty() || !executePlan(dir, plan, objectStoreDir(dir), plan_error)) {
+        discard();
+        std::cerr << "Error adding files: " << plan_error << std::endl << "No files were added." << std::endl;
+        return 1;
+    }
+    if (index_current) {
+        indexMoves(dir, moves);
+    }
+    for (std::size_t i = 0; i < incoming.size(); ++i) {
+        const Incoming& in = incoming[i];
+        std::cout << "Added '" << in.source.string() << "' as '" << moves[tempPath(i).filename().string()] << "'"
+                  << (in.info.format == "heif" ? " (transcoded from HEIF)" : "") << std::endl;
+        if (move && !fs::remove(in.source, ec)) {
+            std::cerr << "Warning: Could not delete '" << in.source.string() << "'" << std::endl;
+        }
+    }
+    if (keep_history && !incoming.empty()) {
+        int version = recordVersion(dir, numberedNames(dir), "ingest " + std::to_string(incoming.size()) + " images");
+        if (version > 0) {
+            std::cout << "Recorded the new images as version " << version << "." << std::endl;
+        }
+    }
+    std::cout << incoming.size() << " of " << sources.size() << " files added." << std::endl;
+    return 0;
+}
+
+// Lossless auto-rotation of one job's JPEG; non-JPEG jobs pass through.
+void autorotateJob(Job& job) {
+    std::string ext = job.extension;
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext != "jpg" && ext != "jpeg") {
+        return;
+    }
+    int orientation = 1;
+    std::string error;
+    if (jpeg::autorotateFile(job.path, orientation, error) == jpeg::AutorotateResult::Failed) {
+        // Leave the file as it is; the browser still honours its EXIF tag.
+        std::cerr << "Warning: Could not auto-rotate '" << job.path.filename().string() << "': " << error << std::endl;
+    }
+}
+
+// Adds the dominant color, average color and palette of a PNG or JPEG to its manifest entry,
+// from the EXIF thumbnail where it is usable ('from_thumbnails' counts those).
+// Archived images and images that cannot be analyzed are published without them.
+void colorsJob(Job& job, std::atomic<int>& from_thumbnails) {
+    if (job.tier == TIER_ARCHIVE || (job.info.format != "png" && job.info.format != "jpeg")) {
+        return;
+    }
+    int w = 0, h = 0;
+    std::vector<std::uint8_t> rgba;
+    preview::Source source = preview::Source::ScaledDecode;
+    palette::Colors found;
+    std::string error;
+    if (!preview::load(job.path, job.info.format, w, h, rgba, source, error) ||
+        !palette::pixelColors(rgba, w, h, found, error)) {
+        std::cerr << "Warning: No colors for '" << job.path.filename().string() << "': " << error << std::endl;
+        return;
+    }
+    if (source == preview::Source::ExifThumbnail) {
+        ++from_thumbnails;
+    }
+    std::string list;
+    for (const auto& rgb : found.palette) {
+        list += (list.empty() ? "[\"" : ", \"") + palette::hexColor(rgb) + "\"";
+    }
+    job.fields.push_back({"color", "\"" + palette::hexColor(found.dominant) + "\""});
+    job.fields.push_back({"average", "\"" + palette::hexColor(found.average) + "\""});
+    job.fields.push_back({"palette", list + "]"});
+}
+
+// Writes the watermarked variant of a carousel PNG or JPEG to 'out_dir' unless the one
+// there is newer than both the source and the watermark ('refresh' forces a rewrite).
+// The variant's site path goes into the manifest; failures leave the job published without it.
+void watermarkJob(Job& job, watermark::Watermarker& marker, const fs::path& out_dir,
+                  fs::file_time_type mark_time, bool refresh) {
+    if (job.tier == TIER_ARCHIVE || (job.info.format != "png" && job.info.format != "jpeg")) {
+        return;
+    }
+    std::string name = job.path.filename().string();
+    fs::path out_path = out_dir / name;
+    std::error_code ec;
+    fs::file_time_type out_time = fs::last_write_time(out_path, ec);
+    bool current = !refresh && !ec && out_time >= mark_time && out_time >= fs::last_write_time(job.path, ec) && !ec;
+    if (!current) {
+        std::string bytes, error;
+        if (!marker.render(job.path, job.info.format, bytes, error)) {
+            std::cerr << "Warning: No watermark for '" << name << "': " << error << std::endl;
+            return;
+        }
+        if (!writeFileAtomically(out_path, bytes)) {
+            std::cerr << "Warning: Cannot write " << out_path << std::endl;
+            return;
+        }
+    }
+    job.fields.push_back({"watermarked", "\"" + job.section + "/watermarked/" + name + "\""});
+}
+
+// 'classify' subcommand: tells photos from graphics and reports the cheapest adequate
+// format of every image of the gallery in the current directory (or of the given files).
+// 'rename --formats' applies the extensions once the images are converted.
+int runClassify(int argc, char* argv[]) {
+    std::vector<fs::path> paths;
+    for (int i = 2; i < argc; ++i) {
+        paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        std::vector<FileInfo> files;
+        if (!collectNumberedFiles(fs::current_path(), files)) {
+            return 1;
+        }
+        std::sort(files.begin(), files.end(), compareFilesAsc);
+        for (const auto& file_info : files) {
+            paths.push_back(file_info.original_path);
+        }
+    }
+    std::vector<Classified> results = classifyFiles(paths);
+
+    std::cout << std::left << std::setw(12) << "file" << std::setw(8) << "format" << std::right << std::setw(7) << "flat"
+              << std::setw(8) << "smooth" << std::setw(7) << "edges" << std::setw(8) << "256col" << "  "
+              << std::left << std::setw(8) << "best" << "action" << std::endl;
+    int changes = 0;
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        const Classified& r = results[i];
+        std::string name = paths[i].filename().string();
+        if (r.choice.empty()) {
+            std::cerr << "Warning: Cannot classify '" << name << "': " << r.error << std::endl;
+            continue;
+        }
+        std::string format = r.info.format == "png" && r.info.indexed ? "png8" : r.info.format;
+        std::string ext = paths[i].extension().string();
+        ext = ext.empty() ? ext : ext.substr(1);
+        std::string action;
+        if (classify::formatExtension(r.choice, ext) != ext || (r.choice == "png8" && format == "png")) {
+            action = r.choice == "png8" && format == "png" ? "quantize" : "convert";
+        } else if (classify::formatExtension(r.info.format, ext) != ext) {
+            action = "rename"; // Content and extension disagree
+        }
+        changes += action.empty() ? 0 : 1;
+        std::cout << std::left << std::setw(12) << name << std::setw(8) << format << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(7) << r.features.flat << std::setw(8) << r.features.smooth
+                  << std::setw(7) << r.features.edges << std::setw(8);
+        if (r.features.palette_share < 0) {
+            std::cout << "-";
+        } else {
+            std::cout << r.features.palette_share;
+        }
+        std::cout << "  " << std::left
+                  << std::setw(8) << r.choice << action << std::defaultfloat << std::endl;
+    }
+    std::cout << changes << " of " << paths.size() << " images would be cheaper in another format or name." << std::endl;
+    return 0;
+}
+
+// 'compact' subcommand: rebuilds a gallery directory (default: the current one) whose
+// index grew through many renames, and reports its size and listing and lookup speed
+// before and after.
+//
+// Options:
+//   --dry-run   Only measure the directory
+int runCompact(int argc, char* argv[]) {
+    fs::path dir = fs::current_path();
+    for (int i = 2; i < argc; ++i) {
+        if (std::string(argv[i]).rfind("--", 0) != 0) {
+            dir = argv[i];
+        }
+    }
+    auto report = [](const char* label, const compact::DirStats& stats) {
+        std::cout << std::left << std::setw(8) << label << std::right << std::setw(10) << stats.bytes << " bytes"
+                  << std::setw(8) << stats.blocks / 2 << " KiB" << std::setw(8) << stats.entries << " entries"
+                  << std::fixed << std::setprecision(1) << std::setw(9) << stats.list_ns << " ns/entry listing"
+                  << std::setw(9) << stats.lookup_ns << " ns/entry lookup" << std::defaultfloat << std::endl;
+    };
+    compact::DirStats before, after;
+    std::string error;
+    if (!compact::measure(dir, before, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    report("before", before);
+    if (hasFlag(argc, argv, "--dry-run")) {
+        return 0;
+    }
+
+    // Gallery files go in numeric order, everything else after them.
+    std::vector<FileInfo> files;
+    if (!collectNumberedFiles(dir, files)) {
+        return 1;
+    }
+    std::sort(files.begin(), files.end(), compareFilesAsc);
+    std::error_code ec;
+    bool inside = fs::equivalent(dir, ".", ec); // Our working directory is about to be swapped out
+    std::vector<std::string> order;
+    for (const auto& file_info : files) {
+        order.push_back(file_info.original_path.filename().string());
+    }
+    if (!compact::rebuild(dir, order, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    if (!compact::measure(dir, after, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    report("after", after);
+    if (inside) {
+        std::cout << "The directory was replaced; run 'cd .' to see the rebuilt one." << std::endl;
+    }
+    return 0;
+}
+
+// 'numbers' subcommand: which numbers the gallery in the current directory uses, from
+// .gallery-index (rescanned where out of date).
+//
+//   numbers              Per section: count, ranges, gaps and extensions
+//   numbers EXPR         The numbers in a set expression, e.g. "live - archive",
+//                        "~(live | archive)" or "live.jpg & 1..50" (see occupancy.hpp)
+//
+// Options (with EXPR, default "live"):
+//   --gaps       Print the missing stretches between the lowest and highest number instead
+//   --rank N     How many numbers of the set are <= N
+//   --select K   The K-th number of the set (1 = lowest)
+int runNumbers(int argc, char* argv[]) {
+    fs::path dir = fs::current_path();
+    GalleryIndex index = galleryOccupancy(dir);
+    std::string expression;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--rank" || arg == "--select") {
+            ++i;
+        } else if (arg.rfind("--", 0) != 0) {
+            expression += (expression.empty() ? "" : " ") + arg;
+        }
+    }
+    int rank = intOption(argc, argv, "--rank", -1);
+    int select = intOption(argc, argv, "--select", 0);
+    bool gaps = hasFlag(argc, argv, "--gaps");
+
+    if (expression.empty() && rank < 0 && select <= 0 && !gaps) {
+        for (const auto& [name, section] : index) {
+            const roaring::Bitmap& all = section.numbers.all;
+            std::uint32_t lo = 0, hi = 0;
+            std::cout << (name.empty() ? "live" : "archive") << ": " << all.cardinality() << " numbers";
+            if (all.minimum(lo) && all.maximum(hi)) {
+                std::cout << ", " << formatRanges(all) << std::endl;
+                std::cout << "  gaps: " << formatRanges(roaring::Bitmap::range(lo, hi) - all) << std::endl;
+            } else {
+                std::cout << std::endl;
+            }
+            for (const auto& [ext, numbers] : section.numbers.by_extension) {
+                std::cout << "  ." << ext << ": " << numbers.cardinality() << std::endl;
+            }
+        }
+        return 0;
+    }
+
+    roaring::Bitmap result;
+    std::string error;
+    Expression parsed(index, expression.empty() ? "live" : expression);
+    if (!parsed.evaluate(result, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    if (rank >= 0) {
+        std::cout << result.rank(static_cast<std::uint32_t>(rank)) << std::endl;
+    } else if (select > 0) {
+        std::uint32_t value = 0;
+        if (!result.select(static_cast<std::uint64_t>(select) - 1, value)) {
+            std::cerr << "Error: The set has only " << result.cardinality() << " numbers." << std::endl;
+            return 1;
+        }
+        std::cout << value << std::endl;
+    } else if (gaps) {
+        std::uint32_t lo = 0, hi = 0;
+        if (result.minimum(lo) && result.maximum(hi)) {
+            std::cout << formatRanges(roaring::Bitmap::range(lo, hi) - result) << std::endl;
+        } else {
+            std::cout << formatRanges(result) << std::endl;
+        }
+    } else {
+        std::cout << formatRanges(result) << " (" << result.cardinality() << " numbers)" << std::endl;
+    }
+    return 0;
+}
+
+// 'stats' subcommand: how many images the gallery in the current directory holds, its
+// lowest and highest numbers, the gaps between them, the total size and the extension
+// mix, for the carousel and for not-good/. Everything is read from .gallery-index, which
+// rename and ingest keep current; only a section whose directory changed some other way
+// (or was written by an older caro) is rescanned first.
+//
+// Options:
+//   --check           Also rescan every section and report where the index disagrees
+//                     with the directory (exit status 1 if it does)
+int runStats(int argc, char* argv[]) {
+    fs::path dir = fs::current_path();
+    GalleryIndex index = galleryOccupancy(dir);
+    if (hasFlag(argc, argv, "--check")) {
+        NameTemplate naming = galleryNaming(dir);
+        bool stale = false;
+        for (const auto& [name, section] : index) {
+            Occupancy scanned = scanSection(name.empty() ? dir : dir / name, naming).numbers;
+            const Occupancy& indexed = section.numbers;
+            if (!(indexed.all == scanned.all) || indexed.by_extension != scanned.by_extension ||
+                indexed.bytes != scanned.bytes) {
+                std::cerr << "Error: The index of " << (name.empty() ? "live" : name)
+                          << " does not match the directory; delete " << indexPath(dir).string()
+                          << " to rebuild it" << std::endl;
+                stale = true;
+            }
+        }
+        if (stale) {
+            return 1;
+        }
+    }
+    for (const auto& [name, section] : index) {
+        SectionStats stats = sectionStats(section);
+        std::cout << (name.empty() ? "live" : "archive") << ": " << stats.files << " files, "
+                  << stats.bytes / 1024 << " KiB";
+        if (stats.numbers > 0) {
+            std::cout << ", numbers " << stats.lowest << "-" << stats.highest << " (next free " << stats.highest + 1
+                      << "), " << stats.missing << " missing in " << stats.stretches << " gaps";
+        }
+        std::cout << std::endl;
+        for (const auto& [ext, numbers] : section.numbers.by_extension) {
+            auto bytes = section.numbers.bytes.find(ext);
+            std::cout << "  ." << ext << ": " << numbers.cardinality() << " files, "
+                      << (bytes == section.numbers.bytes.end() ? 0 : bytes->second) / 1024 << " KiB" << std::endl;
+        }
+    }
+    return 0;
+}
+
+// 'diff' subcommand: perceptual difference between two versions of an image.
+//
+//   diff OLD NEW      Two image files (PNG or JPEG)
+//   diff NAME         A gallery image against its newest recorded version (see 'history')
+//
+// Options:
+//   --version V       Compare NAME against version V instead
+//   --heatmap FILE    Write the changes over a faded copy of the old image as a PNG
+//   --threshold N     Delta (0-255) from which a pixel counts as changed (default 26)
+//   --tolerance P     Percentage of changed pixels still reported as unchanged (default 0)
+//
+// The exit status follows diff(1): 0 unchanged, 1 changed, 2 trouble. A deploy step can
+// skip re-exports that only changed metadata or encoding noise. Images of different sizes
+// are always changed (the manifest and markup carry the size); the score and --tolerance
+// only judge images of the same size.
+int runDiff(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--version" || arg == "--heatmap" || arg == "--threshold" || arg == "--tolerance") {
+            ++i;
+        } else if (arg.rfind("--", 0) != 0) {
+            args.push_back(arg);
+        }
+    }
+    if (args.empty() || args.size() > 2) {
+        std::cerr << "Usage: main diff OLD NEW | diff NAME [--version V] [--heatmap FILE] [--threshold N] [--tolerance P]"
+                  << std::endl;
+        return 2;
+    }
+    fs::path old_path = args[0], new_path = args.back();
+    std::string old_label = old_path.string();
+    if (args.size() == 1) {
+        fs::path dir = fs::current_path();
+        int version = intOption(argc, argv, "--version", -1);
+        int reached = 0;
+        GalleryState state = historyExists(dir) ? stateAt(dir, version, reached) : GalleryState();
+        auto entry = state.find(args[0]);
+        if (entry == state.end()) {
+            std::cerr << "Error: '" << args[0] << "' is not in " << (reached ? "version " + std::to_string(reached) : "the history")
+                      << "." << std::endl;
+            return 2;
+        }
+        old_path = objectPath(objectStoreDir(dir), entry->second.hash);
+        old_label = args[0] + "@" + std::to_string(reached);
+    }
+    int threshold = std::max(1, std::min(255, intOption(argc, argv, "--threshold", imagediff::CHANGED)));
+    double tolerance = std::atof(stringOption(argc, argv, "--tolerance", "0").c_str()) / 100.0;
+
+    imagediff::Image old_image, new_image;
+    std::string error;
+    if (!imagediff::load(old_path, old_image, error) || !imagediff::load(new_path, new_image, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 2;
+    }
+    imagediff::Aligned aligned = imagediff::align(old_image, new_image);
+    imagediff::Result result = imagediff::compare(aligned, threshold);
+
+    std::cout << old_label << " (" << old_image.width << "x" << old_image.height << ") -> " << new_path.string() << " ("
+              << new_image.width << "x" << new_image.height << "), " << aligned.how << std::endl;
+    std::cout << std::fixed << std::setprecision(3) << "score " << 100.0 * result.score << "% changed pixels ("
+              << result.changed << "), mean difference " << 100.0 * result.mean << "%" << std::defaultfloat << std::endl;
+    std::size_t shown = std::min<std::size_t>(result.regions.size(), 20);
+    for (std::size_t i = 0; i < shown; ++i) {
+        const imagediff::Region& r = result.regions[i];
+        std::cout << "  region " << r.x0 << "," << r.y0 << " " << r.x1 - r.x0 + 1 << "x" << r.y1 - r.y0 + 1 << " ("
+                  << r.pixels << " pixels)" << std::endl;
+    }
+    if (result.regions.size() > shown) {
+        std::cout << "  ... and " << result.regions.size() - shown << " smaller regions" << std::endl;
+    }
+
+    std::string heatmap = stringOption(argc, argv, "--heatmap", "");
+    if (!heatmap.empty() && !writeFileAtomically(heatmap, imagediff::heatmapPng(aligned, result, threshold))) {
+        std::cerr << "Error: Cannot write " << heatmap << std::endl;
+        return 2;
+    }
+    bool resized = old_image.width != new_image.width || old_image.height != new_image.height;
+    bool unchanged = !resized && result.score <= tolerance;
+    std::cout << (unchanged ? "unchanged" : resized ? "changed (size)" : "changed") << std::endl;
+    return unchanged ? 0 : 1;
+}
+
+// 'publish' subcommand: processes every image of the gallery in the current directory
+// (and its not-good/ archive) through the pipeline, most visible slides first, and
+// rewrites manifest.json after every finished batch.
+//
+// Options:
+//   --visible N   Number of leading slides treated as above the fold (default 3)
+//   --workers N   Fixed worker threads per stage (default: start at the number of cores and
+//                 let the pipeline resize each stage while it runs)
+//   --max-threads N   Limit for the resized stages together (default: 4 per core)
+//   --max-memory MIB  Resident memory above which resized stages shed workers (default: half of RAM)
+//   --autorotate  Losslessly apply EXIF orientation to JPEGs before probing them
+//   --no-colors   Skip the dominant color and palette of each image
+//   --markup FILE Also write the carousel items (sized, painted in the dominant color) to FILE
+//   --prefetch N  Start reading sources N jobs before they are needed (default: 2 per worker, 0 = off)
+//   --keep-cache  Leave processed sources in the page cache (default: drop those read by this run)
+//   --page-size N Carousel images per manifest page (default 24, 0 = one manifest with every image)
+//   --watermark FILE.png        Also write watermarked copies of carousel images to watermarked/
+//   --watermark-opacity P       Opacity of the watermark in percent (default 60)
+//   --watermark-rules SPEC      Placement per shape, e.g. "landscape=bottom-right:20,portrait=bottom:40"
+//                               (anchor and width in percent of the image; square images are "square")
+int runPublish(int argc, char* argv[]) {
+    int visible = intOption(argc, argv, "--visible", 3);
+    bool autorotate = hasFlag(argc, argv, "--autorotate");
+    bool colors = !hasFlag(argc, argv, "--no-colors");
+    std::string markup_path = stringOption(argc, argv, "--markup", "");
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int workers = intOption(argc, argv, "--workers", 0);
+    bool adaptive = workers <= 0;
+    workers = adaptive ? cores : workers;
+    int prefetch = std::max(0, intOption(argc, argv, "--prefetch", 2 * workers));
+    bool keep_cache = hasFlag(argc, argv, "--keep-cache");
+    std::string watermark_path = stringOption(argc, argv, "--watermark", "");
+    int page_size = std::max(0, intOption(argc, argv, "--page-size", 24));
+
+    fs::path gallery_dir = fs::current_path();
+    std::string gallery = gallery_dir.filename().string(); // e.g. "caro", used in site paths
+
+    // The watermark is loaded once; its settings are kept next to the variants so that
+    // changing them rewrites every variant instead of only those with newer sources.
+    watermark::Watermarker marker;
+    fs::path watermarked_dir = gallery_dir / "watermarked";
+    fs::file_time_type mark_time;
+    bool refresh_marks = false;
+    if (!watermark_path.empty()) {
+        std::string opacity = stringOption(argc, argv, "--watermark-opacity", "60");
+        std::string rules_spec = stringOption(argc, argv, "--watermark-rules", "");
+        watermark::Rules rules = watermark::defaultRules();
+        std::string error;
+        if (!watermark::parseRules(rules_spec, rules, error) ||
+            !marker.load(watermark_path, std::atof(opacity.c_str()) / 100.0, rules, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        std::error_code ec;
+        mark_time = fs::last_write_time(watermark_path, ec);
+        fs::create_directories(watermarked_dir, ec);
+        std::string settings = fs::absolute(watermark_path).string() + "\n" + opacity + "\n" + rules_spec + "\n";
+        std::ifstream in(watermarked_dir / ".settings", std::ios::binary);
+        std::string previous((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        refresh_marks = previous != settings;
+        if (refresh_marks && !writeFileAtomically(watermarked_dir / ".settings", settings)) {
+            std::cerr << "Error: Cannot write " << watermarked_dir << std::endl;
+            return 1;
+        }
+    }
+
+    // Gather the live carousel and the archive.
+    std::vector<FileInfo> live;
+    std::vector<FileInfo> archived;
+    if (!collectNumberedFiles(gallery_dir, live)) {
+        return 1;
+    }
+    if (fs::is_directory(gallery_dir / "not-good")) {
+        if (!collectNumberedFiles(gallery_dir / "not-good", archived, galleryNaming(gallery_dir))) {
+            return 1;
+        }
+    }
+
+    // The visible tier is the first 'visible' carousel positions, not numbers 1..visible,
+    // so galleries that start at 5 or have gaps still get their first slides early.
+    std::sort(live.begin(), live.end(), compareFilesAsc);
+
+    std::deque<Job> jobs;
+    for (std::size_t i = 0; i < live.size(); ++i) {
+        Job job;
+        job.number = live[i].number;
+        job.path = live[i].original_path;
+        job.extension = live[i].extension;
+        job.section = gallery;
+        job.tier = (static_cast<int>(i) < visible) ? TIER_VISIBLE : TIER_CAROUSEL;
+        jobs.push_back(job);
+    }
+    for (const auto& file_info : archived) {
+        Job job;
+        job.number = file_info.number;
+        job.path = file_info.original_path;
+        job.extension = file_info.extension;
+        job.section = gallery + "/not-good";
+        job.tier = TIER_ARCHIVE;
+        jobs.push_back(job);
+    }
+
+    heapprof::phase("publish: scan");
+    std::cout << "Publishing " << live.size() << " carousel images and " << archived.size()
+              << " archived images from " << gallery_dir << std::endl;
+
+    Pipeline pipeline;
+    if (adaptive) {
+        concurrency::Limits limits;
+        limits.max_threads = std::max(1, intOption(argc, argv, "--max-threads", 4 * cores));
+        limits.max_rss = static_cast<std::uint64_t>(std::max(0, intOption(argc, argv, "--max-memory", 0))) << 20;
+        if (limits.max_rss == 0) {
+            limits.max_rss = concurrency::physicalMemory() / 2;
+        }
+        pipeline.setAdaptive(limits, [](const std::string& decision) {
+            std::cout << "Workers: " << decision << std::endl;
+        });
+    }
+    if (autorotate) {
+        pipeline.addStage("autorotate", autorotateJob, workers);
+    }
+    pipeline.addStage("probe", [](Job& job) {
+        std::error_code ec;
+        job.bytes = fs::file_size(job.path, ec);
+        job.info = probeImage(job.path);
+        if (job.info.format == "unknown") {
+            job.failed = true;
+            job.error = "not a recognised image";
+        } else if (job.info.format == "heif") {
+            job.failed = true;
+            job.error = "HEIF images do not display in browsers (add them with 'caro ingest')";
+        }
+    }, workers);
+    std::atomic<int> color_thumbnails{0};
+    if (colors) {
+        pipeline.addStage("colors", [&](Job& job) { colorsJob(job, color_thumbnails); }, workers);
+    }
+    if (!watermark_path.empty()) {
+        pipeline.addStage("watermark", [&](Job& job) {
+            watermarkJob(job, marker, watermarked_dir, mark_time, refresh_marks);
+        }, workers);
+    }
+
+    // Page cache: read sources ahead of the first stage, and afterwards drop the ones
+    // this run brought in so the web server's working set stays cached.
+    std::atomic<std::uint64_t> released_bytes{0};
+    std::atomic<int> kept{0};
+    if (!keep_cache) {
+        for (auto& job : jobs) {
+            job.cached = pagecache::resident(job.path);
+        }
+        pipeline.setRelease([&](Job& job) {
+            if (job.cached) {
+                ++kept;
+                return;
+            }
+            std::uint64_t size = 0;
+            std::uint64_t resident = pagecache::residentBytes(job.path, size);
+            if (pagecache::release(job.path)) {
+                released_bytes += resident;
+            }
+        });
+    }
+    // Only the autorotate, colors and watermark stages read whole files; the probe reads headers.
+    bool marks = !watermark_path.empty();
+    pipeline.setPrefetch(static_cast<std::size_t>(prefetch), [autorotate, colors, marks](Job& job) {
+        if (autorotate || ((colors || marks) && job.tier != TIER_ARCHIVE)) {
+            pagecache::prefetch(job.path);
+        }
+    });
+
+    // Pages follow the carousel order, the order of the live jobs.
+    std::unique_ptr<ManifestPager> pager;
+    if (page_size > 0) {
+        std::vector<const Job*> carousel;
+        for (std::size_t i = 0; i < live.size(); ++i) {
+            carousel.push_back(&jobs[i]);
+        }
+        pager.reset(new ManifestPager(gallery_dir / "pages", gallery + "/pages", carousel, static_cast<std::size_t>(page_size)));
+    }
+
+    fs::path manifest_path = gallery_dir / "manifest.json";
+    std::size_t total = jobs.size();
+    bool ok = true;
+    pipeline.run(jobs, static_cast<std::size_t>(std::max(1, visible)),
+                 [&](const std::vector<const Job*>& finished, bool complete) {
+        const Paging* paging = pager ? &pager->update(finished) : nullptr;
+        if ((pager && !pager->ok()) || !writeFileAtomically(manifest_path, renderManifest(finished, total, complete, paging))) {
+            std::cerr << "Error writing " << manifest_path << std::endl;
+            ok = false;
+            return;
+        }
+        std::cout << (complete ? "Published final manifest: " : "Published batch: ")
+                  << finished.size() << "/" << total << " images" << std::endl;
+        if (!complete) {
+            return;
+        }
+        // With pages the markup holds the first page; js/main.js fetches the rest.
+        std::vector<const Job*> shown;
+        for (const Job* job : finished) {
+            if (!paging || paging->first_page.count(job)) {
+                shown.push_back(job);
+            }
+        }
+        std::string paged = paging && !paging->pages.empty() ? gallery + "/manifest.json" : "";
+        if (!markup_path.empty() && !writeFileAtomically(markup_path, renderCarouselMarkup(shown, paged))) {
+            std::cerr << "Error writing " << markup_path << std::endl;
+            ok = false;
+        }
+        if (pager) {
+            pager->prune();
+            std::cout << "Pages: " << paging->pages.size() + 1 << " of up to " << page_size << " images ("
+                      << pager->written() << " fragments written, " << pager->unchanged() << " unchanged, "
+                      << pager->removed() << " removed)" << std::endl;
+        }
+    });
+
+    heapprof::phase("publish: pipeline");
+
+    if (adaptive) {
+        std::cout << "Workers:";
+        const char* separator = " ";
+        for (const auto& stage : pipeline.workers()) {
+            std::cout << separator << stage.first << " " << stage.second;
+            separator = ", ";
+        }
+        std::cout << std::endl;
+    }
+
+    if (color_thumbnails > 0) {
+        std::cout << "Colors: " << color_thumbnails << " images analyzed from their EXIF thumbnail" << std::endl;
+    }
+    if (!keep_cache) {
+        std::cout << "Page cache: released " << released_bytes / 1024 << " KiB of sources, kept " << kept
+                  << " that were cached before the run" << std::endl;
+    }
+
+    for (const auto& job : jobs) {
+        if (job.failed) {
+            std::cerr << "Warning: '" << job.path.filename().string() << "': " << job.error << std::endl;
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+// 'history' subcommand: versioned history of the gallery in the current directory.
+//   history init            Start tracking and record the current state as version 1
+//   history record [msg]    Record the current state as a new version (if anything changed)
+//   history log             List all versions
+//   history checkout N      Restore the gallery as it was at version N in one batched plan
+int runHistory(int argc, char* argv[]) {
+    fs::path dir = fs::current_path();
+    std::string action = argc > 2 ? argv[2] : "log";
+
+    if (action == "init") {
+        if (historyExists(dir)) {
+            std::cerr << "This gallery already has a history." << std::endl;
+            return 1;
+        }
+        int version = recordVersion(dir, numberedNames(dir), "initial state");
+        if (version < 0) {
+            std::cerr << "Error: Could not write the gallery history." << std::endl;
+            return 1;
+        }
+        std::cout << "Recorded the current gallery as version " << version << "." << std::endl;
+        return 0;
+    }
+
+    if (!historyExists(dir)) {
+        std::cerr << "This gallery has no history yet; run 'history init' first." << std::endl;
+        return 1;
+    }
+
+    if (action == "record") {
+        std::string message = argc > 3 ? argv[3] : "manual record";
+        int version = recordVersion(dir, numberedNames(dir), message);
+        if (version < 0) {
+            std::cerr << "Error: Could not write the gallery history." << std::endl;
+            return 1;
+        }
+        if (version == 0) {
+            std::cout << "Nothing changed since the last recorded version." << std::endl;
+        } else {
+            std::cout << "Recorded version " << version << "." << std::endl;
+        }
+        return 0;
+    }
+
+    if (action == "log") {
+        for (const auto& info : listVersions(dir)) {
+            std::time_t when = static_cast<std::time_t>(info.time);
+            char date[32];
+            std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M", std::localtime(&when));
+            std::cout << info.version << "  " << date << "  " << info.message
+                      << "  (" << info.moves << " moved, " << info.additions << " added/changed, "
+                      << info.removals << " removed)" << std::endl;
+        }
+        return 0;
+    }
+
+    if (action == "checkout" && argc > 3) {
+        int wanted = std::atoi(argv[3]);
+        // Unrecorded changes are recorded first so checking out never loses content.
+        int recorded = recordVersion(dir, numberedNames(dir), "unrecorded changes before checkout");
+        if (recorded < 0) {
+            std::cerr << "Error: Could not write the gallery history." << std::endl;
+            return 1;
+        }
+        int head_version = 0;
+        int target_version = 0;
+        GalleryState head = stateAt(dir, -1, head_version);
+        if (wanted < 1 || wanted > head_version) {
+            std::cerr << "No version " << wanted << " (versions 1.." << head_version << " exist)." << std::endl;
+            return 1;
+        }
+        std::string spec;
+        GalleryState target = stateAt(dir, wanted, target_version, &spec);
+        NameTemplate previous = galleryNaming(dir);
+        NameTemplate naming;
+        std::string error;
+        if (!parseNameTemplate(spec, naming, error)) {
+            std::cerr << "Cannot check out version " << wanted << ": naming template '" << spec << "': " << error << std::endl;
+            return 1;
+        }
+
+        RenamePlan plan;
+        if (!planCheckout(dir, head, target, plan, error)) {
+            std::cerr << "Cannot check out version " << wanted << ": " << error << std::endl;
+            return 1;
+        }
+        // The version's naming template goes with its files: recorded before the plan
+        // runs, put back if it fails.
+        bool naming_changed = naming.spec() != previous.spec();
+        if (naming_changed && !saveGalleryNaming(dir, naming)) {
+            std::cerr << "Error: Could not record the naming template in " << namingPath(dir).string() << std::endl;
+            return 1;
+        }
+        std::cout << "Checking out version " << wanted << ": " << plan.steps.size() << " steps." << std::endl;
+        if (!executePlan(dir, plan, objectStoreDir(dir), error)) {
+            std::cerr << "Error: " << error << std::endl;
+            std::cerr << "All steps were rolled back; no files were changed." << std::endl;
+            if (naming_changed && !saveGalleryNaming(dir, previous)) {
+                std::cerr << "Error: Could not restore " << namingPath(dir).string() << " to " << previous.spec() << std::endl;
+            }
+            return 1;
+        }
+        int version = recordVersion(dir, numberedNames(dir), "checkout of version " + std::to_string(wanted));
+        if (version > 0) {
+            std::cout << "The gallery now matches version " << wanted << " (recorded as version " << version << ")." << std::endl;
+        } else {
+            std::cout << "The gallery already matched version " << wanted << "." << std::endl;
+        }
+        return 0;
+    }
+
+    std::cerr << "Usage: main history [init | record [message] | log | checkout VERSION]" << std::endl;
+    return 1;
+}
+
+// 'delta' subcommand: ship edited files as content-defined chunk deltas.
+//   delta make FILE OUT.delta [--store DIR]     Write a delta with only the chunks the store lacks
+//   delta confirm OUT.delta [--store DIR]       Record a deployed delta's chunks in the store
+//   delta apply IN.delta TARGET [--store DIR]   Rebuild TARGET from a delta and the local store
+// The store defaults to .gallery-objects/chunks in the current directory. The sender
+// confirms a delta only once it has been applied, so a lost delta is made again in full.
+int runDelta(int argc, char* argv[]) {
+    std::string action = argc > 2 ? argv[2] : "";
+    if (argc < (action == "confirm" ? 4 : 5)) {
+        std::cerr << "Usage: main delta make FILE OUT.delta [--store DIR] | delta confirm OUT.delta [--store DIR]"
+                     " | delta apply IN.delta TARGET [--store DIR]" << std::endl;
+        return 1;
+    }
+    fs::path store = stringOption(argc, argv, "--store", chunkStoreDir(fs::current_path()).string());
+    delta::DeltaStats stats;
+    std::string error;
+
+    if (action == "make") {
+        if (!delta::makeDelta(argv[3], store, argv[4], stats, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << argv[4] << ": " << stats.new_chunks << " of " << stats.chunks << " chunks, "
+                  << stats.sent_bytes << " of " << stats.file_bytes << " bytes ("
+                  << (stats.file_bytes ? 100.0 * stats.delta_bytes / stats.file_bytes : 0.0)
+                  << "% of the file on the wire)." << std::endl;
+        return 0;
+    }
+    if (action == "confirm") {
+        if (!delta::confirmDelta(argv[3], store, stats, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        std::cout << "Recorded " << stats.new_chunks << " chunks (" << stats.sent_bytes << " bytes) of "
+                  << argv[3] << " in " << store.string() << "." << std::endl;
+        return 0;
+    }
+    if (action == "apply") {
+        if (!delta::applyDelta(argv[3], store, argv[4], stats, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        std::cout << "Rebuilt " << argv[4] << " (" << stats.file_bytes << " bytes) from " << stats.chunks
+                  << " chunks, " << stats.new_chunks << " of them new." << std::endl;
+        return 0;
+    }
+    std::cerr << "Unknown delta action '" << action << "'." << std::endl;
+    return 1;
+}
+
+// 'autorotate' subcommand: losslessly turns JPEGs upright according to their EXIF
+// Orientation tag and resets the tag. Without file arguments it processes every
+// numbered JPEG of the gallery in the current directory.
+int runAutorotate(int argc, char* argv[]) {
+    std::vector<fs::path> paths;
+    for (int i = 2; i < argc; ++i) {
+        paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        std::vector<FileInfo> files;
+        if (!collectNumberedFiles(fs::current_path(), files)) {
+            return 1;
+        }
+        std::sort(files.begin(), files.end(), compareFilesAsc);
+        for (const auto& file_info : files) {
+            std::string ext = file_info.extension;
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            if (ext == "jpg" || ext == "jpeg") {
+                paths.push_back(file_info.original_path);
+            }
+        }
+    }
+
+    int rotated = 0;
+    int failed = 0;
+    for (const auto& path : paths) {
+        int orientation = 1;
+        std::string error;
+        switch (jpeg::autorotateFile(path, orientation, error)) {
+            case jpeg::AutorotateResult::Rotated:
+                std::cout << "Rotated '" << path.filename().string() << "' (orientation " << orientation << ")" << std::endl;
+                ++rotated;
+                break;
+            case jpeg::AutorotateResult::Upright:
+                break;
+            case jpeg::AutorotateResult::Failed:
+                std::cerr << "Error: '" << path.filename().string() << "': " << error << std::endl;
+                ++failed;
+                break;
+        }
+    }
+    std::cout << rotated << " of " << paths.size() << " JPEGs rotated." << std::endl;
+    return failed ? 1 : 0;
+}
+
+// 'svgmin' subcommand: minifies SVG files in place (icon fonts, logos, vector assets).
+// Directory arguments are searched recursively for *.svg files.
+//
+// Options:
+//   --precision N   Decimal places kept in path coordinates (default 2)
+//   --dry-run       Report the savings without writing anything
+int runSvgmin(int argc, char* argv[]) {
+    svgmin::Options options;
+    options.precision = intOption(argc, argv, "--precision", options.precision);
+    bool dry_run = hasFlag(argc, argv, "--dry-run");
+
+    std::vector<fs::path> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--precision") {
+            ++i; // Skip its value
+            continue;
+        }
+        if (arg.rfind("--", 0) == 0) {
+            continue;
+        }
+        std::error_code ec;
+        if (fs::is_directory(arg, ec)) {
+            for (const auto& entry : fs::recursive_directory_iterator(arg, ec)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".svg") {
+                    paths.push_back(entry.path());
+                }
+            }
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty()) {
+        std::cerr << "Usage: main svgmin [--precision N] [--dry-run] FILE_OR_DIR..." << std::endl;
+        return 1;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    svgmin::Minifier minifier(options);
+    std::string input;
+    std::string output;
+    std::uintmax_t total_before = 0;
+    std::uintmax_t total_after = 0;
+    int failed = 0;
+    for (const auto& path : paths) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            std::cerr << "Error: Cannot read " << path << std::endl;
+            ++failed;
+            continue;
+        }
+        input.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        in.close();
+
+        svgmin::Stats stats;
+        std::string error;
+        if (!minifier.run(input.data(), input.size(), output, stats, error)) {
+            std::cerr << "Error: " << path.string() << ": " << error << " (left unchanged)" << std::endl;
+            ++failed;
+            continue;
+        }
+        if (output.size() >= input.size()) {
+            output = input; // Never make a file bigger
+        }
+        total_before += input.size();
+        total_after += output.size();
+        std::cout << path.string() << ": " << input.size() << " -> " << output.size() << " bytes ("
+                  << (input.empty() ? 0 : 100 - 100 * static_cast<long long>(output.size()) / static_cast<long long>(input.size()))
+                  << "% smaller, " << stats.paths << " paths, " << stats.removed_nodes << " nodes removed)" << std::endl;
+        if (!dry_run && output.size() < input.size() && !writeFileAtomically(path, output)) {
+            std::cerr << "Error: Cannot write " << path << std::endl;
+            ++failed;
+        }
+    }
+    if (paths.size() > 1) {
+        std::cout << "Total: " << total_before << " -> " << total_after << " bytes" << std::endl;
+    }
+    return failed ? 1 : 0;
+}
+
+// 'fonts' subcommand: converts every TTF/OTF under the fonts directory to WOFF2
+// (glyf/loca transform plus brotli, one font per thread), then rewrites the
+// @font-face rules of the stylesheets so browsers pick the WOFF2 first. An
+// existing .woff2 is only replaced by a smaller one.
+//
+// Options:
+//   --fonts DIR   Font directory (default: fonts, or ../fonts)
+//   --css DIR     Stylesheet directory (default: css, or ../css)
+//   --dry-run     Report what would change without writing anything
+int runFonts(int argc, char* argv[]) {
+    auto defaultDir = [](const std::string& name) {
+        std::error_code ec;
+        return fs::is_directory(name, ec) ? name : "../" + name;
+    };
+    fs::path font_dir = stringOption(argc, argv, "--fonts", defaultDir("fonts"));
+    fs::path css_dir = stringOption(argc, argv, "--css", defaultDir("css"));
+    bool dry_run = hasFlag(argc, argv, "--dry-run");
+
+    std::vector<fs::path> sources;
+    std::error_code ec;
+    for (const auto& entry : fs::recursive_directory_iterator(font_dir, ec)) {
+        std::string ext = entry.path().extension().string();
+        if (entry.is_regular_file() && (ext == ".ttf" || ext == ".otf")) {
+            sources.push_back(entry.path());
+        }
+    }
+    if (ec) {
+        std::cerr << "Error: Cannot read " << font_dir << std::endl;
+        return 1;
+    }
+    std::sort(sources.begin(), sources.end());
+
+    struct Converted {
+        std::string woff2;
+        std::string error;
+    };
+    std::vector<Converted> converted(sources.size());
+    std::atomic<std::size_t> next{0};
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < sources.size(); i = next++) {
+            MappedFile file;
+            if (!file.open(sources[i])) {
+                converted[i].error = "cannot read file";
+                continue;
+            }
+            woff2::encode(file.data(), file.size(), converted[i].woff2, converted[i].error);
+        }
+    };
+    std::vector<std::thread> threads;
+    unsigned workers = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), static_cast<unsigned>(sources.size())));
+    for (unsigned t = 0; t < workers; ++t) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // A family shipped as both TTF and OTF gets the smaller of the two WOFF2s.
+    std::map<fs::path, std::size_t> best;
+    int failed = 0;
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+        if (!converted[i].error.empty()) {
+            std::cerr << "Error: " << sources[i].string() << ": " << converted[i].error << std::endl;
+            ++failed;
+            continue;
+        }
+        fs::path target = fs::path(sources[i]).replace_extension(".woff2");
+        auto it = best.find(target);
+        if (it == best.end() || converted[i].woff2.size() < converted[it->second].woff2.size()) {
+            best[target] = i;
+        }
+    }
+    for (const auto& [target, i] : best) {
+        const std::string& woff2 = converted[i].woff2;
+        std::uintmax_t source_size = fs::file_size(sources[i], ec);
+        std::uintmax_t woff_size = fs::file_size(fs::path(target).replace_extension(".woff"), ec);
+        bool has_woff = !ec;
+        std::uintmax_t existing = fs::file_size(target, ec);
+        bool keep = !ec && existing <= woff2.size();
+        std::cout << sources[i].string() << ": " << source_size << " -> " << woff2.size() << " bytes";
+        if (has_woff) {
+            std::cout << " (WOFF " << woff_size << ")";
+        }
+        if (keep) {
+            std::cout << ", kept existing " << target.filename().string() << " (" << existing << " bytes)";
+        }
+        std::cout << std::endl;
+        if (!dry_run && !keep && !writeFileAtomically(target, woff2)) {
+            std::cerr << "Error: Cannot write " << target << std::endl;
+            ++failed;
+        }
+    }
+
+    // Stylesheets: URLs resolve against each file's own directory. In a dry run only
+    // the WOFF2 files already on disk can be listed.
+    std::vector<fs::path> stylesheets;
+    for (const auto& entry : fs::directory_iterator(css_dir, ec)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".css") {
+            stylesheets.push_back(entry.path());
+        }
+    }
+    std::sort(stylesheets.begin(), stylesheets.end());
+    for (const auto& path : stylesheets) {
+        std::string css = pageload::readText(path);
+        std::string rewritten;
+        int changed = fontface::rewriteStylesheet(css, path.parent_path(), rewritten);
+        if (changed == 0) {
+            continue;
+        }
+        std::cout << path.string() << ": " << changed << " @font-face src list" << (changed == 1 ? "" : "s")
+                  << " now start with WOFF2" << std::endl;
+        if (!dry_run && !writeFileAtomically(path, rewritten)) {
+            std::cerr << "Error: Cannot write " << path << std::endl;
+            ++failed;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+// 'pageload' subcommand: estimates how fast index.html paints and fills its carousel
+// over a throttled network, using the real file sizes.
+//
+// Options:
+//   --page PATH        Page to simulate (default: index.html, else ../index.html)
+//   --profile NAME     slow-3g, fast-3g (default), 4g or cable
+//   --kbps N, --rtt MS, --connections N   Override the profile
+//   --save FILE        Write the report as JSON (the "before" of a change)
+//   --compare FILE     Show the change against a report saved earlier
+//   --verbose          Print the request waterfall
+int runPageload(int argc, char* argv[]) {
+    pageload::NetworkProfile net;
+    std::string profile = stringOption(argc, argv, "--profile", net.name);
+    if (!pageload::profileByName(profile, net)) {
+        std::cerr << "Unknown profile '" << profile << "' (use slow-3g, fast-3g, 4g or cable)." << std::endl;
+        return 1;
+    }
+    net.kbps = intOption(argc, argv, "--kbps", static_cast<int>(net.kbps));
+    net.rtt_ms = intOption(argc, argv, "--rtt", static_cast<int>(net.rtt_ms));
+    net.connections = std::max(1, intOption(argc, argv, "--connections", net.connections));
+
+    fs::path page = stringOption(argc, argv, "--page", fs::exists("index.html") ? "index.html" : "../index.html");
+    // Carousel images live in the gallery directory; when run from inside it, that is this one.
+    std::string gallery = page.parent_path().filename() == ".." || page.string().rfind("../", 0) == 0
+                              ? fs::current_path().filename().string() + "/"
+                              : std::string("caro/");
+
+    pageload::Page graph;
+    std::string error;
+    if (!graph.load(page, gallery, net, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    pageload::Metrics metrics = pageload::simulate(graph.resources, net);
+
+    if (hasFlag(argc, argv, "--verbose")) {
+        for (const auto& r : graph.resources) {
+            if (r.started < 0) continue;
+            std::cout << "  " << std::setw(7) << static_cast<long>(r.started) << " - " << std::setw(7)
+                      << static_cast<long>(r.done) << " ms  " << std::setw(9) << r.bytes << " B  "
+                      << (r.missing ? "404 " : "    ") << r.url << std::endl;
+        }
+    }
+
+    std::cout << "Page: " << page.string() << " (" << metrics.requests << " requests, " << metrics.bytes / 1024
+              << " KiB, " << metrics.failed_requests << " failed)" << std::endl;
+    std::cout << "Network: " << net.name << ", " << net.kbps << " kbps, " << net.rtt_ms << " ms RTT, "
+              << net.connections << " connections per origin" << std::endl;
+
+    struct Row { const char* label; const char* key; double value; };
+    const Row rows[] = {
+        {"first paint", "first_paint_ms", metrics.first_paint},
+        {"content visible", "content_visible_ms", metrics.content_visible},
+        {"first slide", "first_slide_ms", metrics.first_slide},
+        {"carousel complete", "carousel_complete_ms", metrics.carousel_complete},
+        {"load", "load_ms", metrics.load},
+    };
+    std::string baseline;
+    std::string compare = stringOption(argc, argv, "--compare", "");
+    if (!compare.empty()) {
+        baseline = pageload::readText(compare);
+        if (baseline.empty()) {
+            std::cerr << "Error: Cannot read " << compare << std::endl;
+            return 1;
+        }
+        bool any = false;
+        for (const auto& row : rows) {
+            any = any || !std::isnan(pageload::reportNumber(baseline, row.key));
+        }
+        if (!any) {
+            std::cerr << "Error: " << compare << " is not a pageload report (see --save)" << std::endl;
+            return 1;
+        }
+        std::cout << std::left << std::setw(20) << "" << std::right << std::setw(10) << "before" << std::setw(10)
+                  << "after" << std::setw(10) << "change" << std::endl;
+    }
+    for (const auto& row : rows) {
+        std::cout << "  " << std::left << std::setw(18) << row.label << std::right;
+        if (baseline.empty()) {
+            std::cout << std::setw(8) << static_cast<long>(row.value) << " ms" << std::endl;
+            continue;
+        }
+        double before = pageload::reportNumber(baseline, row.key);
+        if (std::isnan(before)) {
+            // Reports from older versions may lack a metric.
+            std::cout << std::setw(10) << "n/a" << std::setw(10) << static_cast<long>(row.value) << std::setw(9)
+                      << "n/a" << std::endl;
+            continue;
+        }
+        double change = row.value - before;
+        std::cout << std::setw(10) << static_cast<long>(before) << std::setw(10) << static_cast<long>(row.value)
+                  << std::setw(9) << std::showpos << static_cast<long>(change) << std::noshowpos << "  ("
+                  << std::fixed << std::setprecision(1) << (before > 0 ? 100.0 * change / before : 0.0) << "%)"
+                  << std::defaultfloat << std::endl;
+    }
+
+    std::string save = stringOption(argc, argv, "--save", "");
+    if (!save.empty() && !writeFileAtomically(save, pageload::renderReport(graph.resources, metrics, net))) {
+        std::cerr << "Error: Cannot write " << save << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 'corpus' subcommand: writes a reproducible synthetic gallery (1.jpg, 2.png, ...) to DIR
+// for benchmarking publish and the other image stages, and a corpus.txt describing it.
+// Images are rendered in parallel; each depends only on the seed and its number.
+//
+// Options:
+//   --count N      Number of images (default 100)
+//   --seed S       Corpus seed (default 1)
+//   --mix SPEC     Relative shares, e.g. "photo=50,graphic=20,icon=30"
+//                  (kinds: photo, graphic, gradient, alpha, poster, icon)
+//   --sizes SPEC   Longer-side ranges, e.g. "photo=1000-3000,poster=6000-8000"
+//   --quality Q    JPEG quality (default 85)
+int runCorpus(int argc, char* argv[]) {
+    if (argc < 3 || argv[2][0] == '-') {
+        std::cerr << "Usage: caro corpus DIR [--count N] [--seed S] [--mix SPEC] [--sizes SPEC] [--quality Q]" << std::endl;
+        return 1;
+    }
+    fs::path dir = argv[2];
+    corpus::Spec spec;
+    spec.count = std::max(0, intOption(argc, argv, "--count", spec.count));
+    spec.seed = std::strtoull(stringOption(argc, argv, "--seed", "1").c_str(), nullptr, 10);
+    spec.quality = std::max(1, std::min(100, intOption(argc, argv, "--quality", spec.quality)));
+    std::string mix = stringOption(argc, argv, "--mix", "");
+    std::string sizes = stringOption(argc, argv, "--sizes", "");
+    std::string error;
+    if ((!mix.empty() && !corpus::parseMix(mix, spec.kinds, error)) ||
+        (!sizes.empty() && !corpus::parseSizes(sizes, spec.kinds, error))) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir)) {
+        std::cerr << "Error: Cannot create " << dir << std::endl;
+        return 1;
+    }
+
+    std::vector<corpus::Item> items = corpus::plan(spec);
+    std::vector<std::string> hashes(items.size());
+    std::vector<std::uintmax_t> sizes_written(items.size(), 0);
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> ok{true};
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < items.size(); i = next++) {
+            std::string bytes = corpus::render(spec, items[i]);
+            std::string name = std::to_string(items[i].number) + (items[i].format == "jpeg" ? ".jpg" : ".png");
+            if (!writeFileAtomically(dir / name, bytes)) {
+                std::cerr << "Error: Cannot write " << (dir / name).string() << std::endl;
+                ok = false;
+            }
+            hashes[i] = blake3::hashBytes(bytes.data(), bytes.size());
+            sizes_written[i] = bytes.size();
+        }
+    };
+    std::vector<std::thread> threads;
+    unsigned workers = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), static_cast<unsigned>(items.size())));
+    for (unsigned t = 0; t < workers; ++t) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // corpus.txt: how to make the corpus again, what is in it and its fingerprint.
+    std::ostringstream text;
+    text << "caro corpus " << dir.filename().string() << " --count " << spec.count << " --seed " << spec.seed
+         << " --quality " << spec.quality << " --mix ";
+    std::string all_sizes;
+    for (int k = 0; k < corpus::KIND_COUNT; ++k) {
+        text << (k ? "," : "") << corpus::KIND_NAMES[k] << "=" << spec.kinds[k].weight;
+        all_sizes += std::string(k ? "," : "") + corpus::KIND_NAMES[k] + "=" + std::to_string(spec.kinds[k].min_side) +
+                     "-" + std::to_string(spec.kinds[k].max_side);
+    }
+    text << " --sizes " << all_sizes << "\n";
+    std::uintmax_t total = 0;
+    int per_kind[corpus::KIND_COUNT] = {};
+    for (std::size_t i = 0; i < items.size(); ++i) {
+        text << items[i].number << (items[i].format == "jpeg" ? ".jpg" : ".png") << "\t" << corpus::KIND_NAMES[items[i].kind]
+             << "\t" << items[i].width << "x" << items[i].height << "\t" << sizes_written[i] << "\t" << hashes[i] << "\n";
+        total += sizes_written[i];
+        ++per_kind[items[i].kind];
+    }
+    std::string all_hashes;
+    for (const auto& hash : hashes) {
+        all_hashes += hash;
+    }
+    std::string fingerprint = blake3::hashBytes(all_hashes.data(), all_hashes.size()).substr(0, 32);
+    text << "fingerprint\t" << fingerprint << "\n";
+    if (!writeFileAtomically(dir / "corpus.txt", text.str())) {
+        std::cerr << "Error: Cannot write " << (dir / "corpus.txt").string() << std::endl;
+        ok = false;
+    }
+
+    std::cout << "Wrote " << items.size() << " images (" << total / 1024 << " KiB) to " << dir.string() << ":";
+    for (int k = 0; k < corpus::KIND_COUNT; ++k) {
+        if (per_kind[k] > 0) {
+            std::cout << " " << per_kind[k] << " " << corpus::KIND_NAMES[k];
+        }
+    }
+    std::cout << std::endl << "Fingerprint " << fingerprint << std::endl;
+    return ok ? 0 : 1;
+}
+
+// 'bench' subcommand: microbenchmarks of the individual kernels on a pinned thread.
+//
+// Options:
+//   --filter TEXT     Only kernels whose name contains TEXT
+//   --samples N       Samples per measurement (default 15)
+//   --cpu N           CPU to pin to (default: the current one)
+//   --quick           Smallest input size only
+//   --json FILE       Write the results as JSON
+//   --compare FILE    Show the change against results saved with --json
+int runBench(int argc, char* argv[]) {
+    std::string filter = stringOption(argc, argv, "--filter", "");
+    int samples = std::max(3, intOption(argc, argv, "--samples", 15));
+    int cpu = bench::pinThread(intOption(argc, argv, "--cpu", -1));
+    bench::CycleCounter counter;
+
+    std::string baseline;
+    std::string compare = stringOption(argc, argv, "--compare", "");
+    if (!compare.empty()) {
+        baseline = pageload::readText(compare);
+        if (baseline.empty()) {
+            std::cerr << "Error: Cannot read " << compare << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "Counter: " << counter.source() << ", pinned to CPU " << cpu << ", SIMD up to "
+              << simdLevelName(detectSimdLevel()) << std::endl;
+    std::cout << std::left << std::setw(16) << "kernel" << std::setw(8) << "variant" << std::right << std::setw(10)
+              << "size" << std::setw(12) << "cyc/item" << std::setw(10) << "+/-" << std::setw(14) << "throughput";
+    if (!baseline.empty()) {
+        std::cout << std::setw(12) << "vs base";
+    }
+    std::cout << std::endl;
+
+    auto report = [&](const bench::Result& r) {
+        bool bytes = r.unit == bench::Unit::Byte;
+        std::ostringstream throughput;
+        throughput << std::fixed << std::setprecision(1) << r.items_per_second / 1e6 << (bytes ? " MB/s" : " Mpx/s");
+        std::cout << std::left << std::setw(16) << r.kernel << std::setw(8) << r.variant << std::right << std::setw(10)
+                  << r.size << std::fixed << std::setprecision(3) << std::setw(12) << r.cycles_per_item << std::setw(10)
+                  << r.cycles_stddev << std::setw(14) << throughput.str();
+        if (!baseline.empty()) {
+            double before = bench::baselineCycles(baseline, r);
+            if (before > 0) {
+                std::cout << std::setw(11) << std::showpos << std::setprecision(1)
+                          << 100.0 * (r.cycles_per_item - before) / before << "%" << std::noshowpos;
+            } else {
+                std::cout << std::setw(12) << "new";
+            }
+        }
+        std::cout << std::defaultfloat << std::endl;
+    };
+    std::vector<bench::Result> results = bench::runAll(filter, samples, hasFlag(argc, argv, "--quick"), counter, report);
+    if (results.empty()) {
+        std::cerr << "No kernel matches '" << filter << "'." << std::endl;
+        return 1;
+    }
+
+    std::string json = stringOption(argc, argv, "--json", "");
+    if (!json.empty() && !writeFileAtomically(json, bench::renderJson(results, counter.source(), cpu))) {
+        std::cerr << "Error: Cannot write " << json << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Prints the list of subcommands.
+void printUsage() {
+    std::cout << "Usage: main [command] [options]" << std::endl;
+    std::cout << "  (no command)   Interactive renumbering of NUMBER.EXTENSION files" << std::endl;
+    std::cout << "  rename         Renumber or rename the gallery to a naming template in one batch" << std::endl;
+    std::cout << "  ingest         Add uploaded images (HEIC transcoded) under the next free numbers" << std::endl;
+    std::cout << "  classify       Tell photos from graphics and pick the cheapest format per image" << std::endl;
+    std::cout << "  publish        Process the gallery and publish manifest.json incrementally" << std::endl;
+    std::cout << "  compact        Rebuild a directory whose index grew through mass renames" << std::endl;
+    std::cout << "  numbers        Query the numbers in use: ranges, gaps, set expressions, rank/select" << std::endl;
+    std::cout << "  stats          Count, number range, gaps, size and extension mix from the gallery index" << std::endl;
+    std::cout << "  diff           Perceptual diff of two image versions: score, regions, heatmap" << std::endl;
+    std::cout << "  history        Record, list and check out versions of the gallery" << std::endl;
+    std::cout << "  delta          Make, confirm or apply chunk deltas of edited images" << std::endl;
+    std::cout << "  autorotate     Losslessly apply EXIF orientation to JPEGs" << std::endl;
+    std::cout << "  svgmin         Minify SVG fonts and vector assets in place" << std::endl;
+    std::cout << "  fonts          Convert web fonts to WOFF2 and list WOFF2 first in @font-face" << std::endl;
+    std::cout << "  pageload       Simulate loading index.html over a throttled network" << std::endl;
+    std::cout << "  corpus         Generate a reproducible synthetic gallery for benchmarks" << std::endl;
+    std::cout << "  bench          Microbenchmark the hashing, chunking, JPEG and SVG kernels" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    // Without arguments the program keeps its original interactive behaviour.
+    if (argc < 2) {
+        return runInteractiveShift();
+    }
+
+    std::string command = argv[1];
+    if (command == "rename") {
+        return runRename(argc, argv);
+    }
+    if (command == "ingest") {
+        return runIngest(argc, argv);
+    }
+    if (command == "classify") {
+        return runClassify(argc, argv);
+    }
+    if (command == "publish") {
+        return runPublish(argc, argv);
+    }
+    if (command == "compact") {
+        return runCompact(argc, argv);
+    }
+    if (command == "numbers") {
+        return runNumbers(argc, argv);
+    }
+    if (command == "stats") {
+        return runStats(argc, argv);
+    }
+    if (command == "diff") {
+        return runDiff(argc, argv);
+    }
+    if (command == "history") {
+        return runHistory(argc, argv);
+    }
+    if (command == "delta") {
+        return runDelta(argc, argv);
+    }
+    if (command == "autorotate") {
+        return runAutorotate(argc, argv);
+    }
+    if (command == "svgmin") {
+        return runSvgmin(argc, argv);
+    }
+    if (command == "fonts") {
+        return runFonts(argc, argv);
+    }
+    if (command == "pageload") {
+        return runPageload(argc, argv);
+    }
+    if (command == "corpus") {
+        return runCorpus(argc, argv);
+    }
+    if (command == "bench") {
+        return runBench(argc, argv);
+    }
+
+    printUsage();
+    return (command == "help" || command == "--help") ? 0 : 1;
+}
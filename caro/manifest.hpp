@@ -0,0 +1,264 @@
+// manifest.hpp - Gallery manifest (manifest.json) writer.
+//
+// The manifest describes every published image: carousel position, site path,
+// format, dimensions and whatever extra fields pipeline stages attach. It is
+// always replaced atomically (write to a temporary file, then rename) so the
+// page never reads a half-written manifest while a long run is in progress.
+//
+// Large galleries are paged: the manifest carries the first page of the
+// carousel inline and lists the others, each as a JSON and an HTML fragment
+// in pages/ named by the hash of its content. A page whose items did not
+// change keeps its name, so a new manifest (after a renumber, say) writes
+// only the pages that did, and browsers keep the rest cached.
+#pragma once
+
+#include <algorithm>    // For std::all_of, std::min
+#include <cstdio>       // For std::snprintf
+#include <filesystem>   // For fs::rename
+#include <fstream>      // For writing the manifest
+#include <set>          // For the finished jobs and referenced fragments
+#include <sstream>      // For building the JSON text
+#include <string>       // For std::string
+#include <vector>       // For the job list
+
+#include "blake3.hpp"
+#include "object_store.hpp" // For writeFileAtomically
+#include "pipeline.hpp"
+
+namespace fs = std::filesystem;
+
+// Escapes a string for use inside a JSON string literal.
+inline std::string jsonEscape(const std::string& text) {
+    std::string out;
+    out.reserve(text.size() + 2);
+    for (char c : text) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out;
+}
+
+// Renders one job as a JSON object.
+inline void writeManifestItem(std::ostringstream& json, const Job& job) {
+    json << "    {\"n\": " << job.number
+         << ", \"src\": \"" << jsonEscape(job.section + "/" + job.path.filename().string()) << "\""
+         << ", \"format\": \"" << job.info.format << "\""
+         << ", \"w\": " << job.info.width
+         << ", \"h\": " << job.info.height
+         << ", \"bytes\": " << job.bytes;
+    for (const auto& field : job.fields) {
+        json << ", \"" << jsonEscape(field.first) << "\": " << field.second;
+    }
+    if (job.failed) {
+        json << ", \"error\": \"" << jsonEscape(job.error) << "\"";
+    }
+    json << "}";
+}
+
+// A carousel page after the first: its first carousel position, its size, and the site
+// paths of its fragments (empty while some of its images are still being processed).
+struct PageRef {
+    int first = 0;
+    std::size_t count = 0;
+    std::string json, html;
+};
+
+// What a paged manifest lists: the jobs of the inline first page and the other pages.
+struct Paging {
+    std::size_t page_size = 0;
+    std::set<const Job*> first_page;
+    std::vector<PageRef> pages;
+};
+
+// Builds the manifest text for the jobs finished so far. Live carousel images go to
+// "items", images from not-good/ go to "archive". "complete" tells the page whether
+// more entries are still on their way. With 'paging', "items" holds the first page only
+// and "pages" lists the rest.
+inline std::string renderManifest(const std::vector<const Job*>& jobs, std::size_t total, bool complete,
+                                  const Paging* paging = nullptr) {
+    std::ostringstream json;
+    json << "{\n  \"complete\": " << (complete ? "true" : "false")
+         << ",\n  \"published\": " << jobs.size()
+         << ",\n  \"total\": " << total;
+    if (paging) {
+        json << ",\n  \"page_size\": " << paging->page_size;
+    }
+    json << ",\n  \"items\": [\n";
+    bool first = true;
+    for (const Job* job : jobs) {
+        if (job->tier == TIER_ARCHIVE || (paging && paging->first_page.count(job) == 0)) {
+            continue;
+        }
+        if (!first) {
+            json << ",\n";
+        }
+        writeManifestItem(json, *job);
+        first = false;
+    }
+    json << "\n  ],\n";
+    if (paging) {
+        json << "  \"pages\": [";
+        for (std::size_t i = 0; i < paging->pages.size(); ++i) {
+            const PageRef& page = paging->pages[i];
+            json << (i ? ",\n" : "\n") << "    {\"first\": " << page.first << ", \"count\": " << page.count;
+            if (page.json.empty()) {
+                json << ", \"pending\": true}";
+            } else {
+                json << ", \"json\": \"" << jsonEscape(page.json) << "\", \"html\": \"" << jsonEscape(page.html) << "\"}";
+            }
+        }
+        json << (paging->pages.empty() ? "],\n" : "\n  ],\n");
+    }
+    json << "  \"archive\": [\n";
+    first = true;
+    for (const Job* job : jobs) {
+        if (job->tier != TIER_ARCHIVE) {
+            continue;
+        }
+        if (!first) {
+            json << ",\n";
+        }
+        writeManifestItem(json, *job);
+        first = false;
+    }
+    json << "\n  ]\n}\n";
+    return json.str();
+}
+
+// Raw JSON value of a job field, or an empty string.
+inline std::string jobField(const Job& job, const std::string& key) {
+    for (const auto& field : job.fields) {
+        if (field.first == key) {
+            return field.second;
+        }
+    }
+    return "";
+}
+
+// Builds the carousel items for index.html's .caro-carousel: every live image with its
+// real path and dimensions, on a slot painted in the image's dominant color so the
+// frame is never empty while the image loads. 'manifest' (the manifest's site path) is set
+// when the markup holds the first page only: the first item then names the manifest, which
+// is how js/main.js knows there are more pages to fetch.
+inline std::string renderCarouselMarkup(const std::vector<const Job*>& jobs, const std::string& manifest = "") {
+    std::ostringstream html;
+    bool first = true;
+    for (const Job* job : jobs) {
+        if (job->tier == TIER_ARCHIVE || job->failed) {
+            continue;
+        }
+        std::string color = jobField(*job, "color"); // "\"#rrggbb\"" when known
+        html << "<div class=\"item\"";
+        if (first && !manifest.empty()) {
+            html << " data-manifest=\"" << manifest << "\"";
+        }
+        first = false;
+        if (color.size() == 9) {
+            html << " style=\"background-color:" << color.substr(1, 7) << "\"";
+        }
+        html << ">\n    <img src=\"" << job->section << "/" << job->path.filename().string() << "\"";
+        if (job->info.width > 0 && job->info.height > 0) {
+            html << " width=\"" << job->info.width << "\" height=\"" << job->info.height << "\"";
+        }
+        html << " alt=\"Image " << job->number << "\" class=\"img-fluid\"";
+        if (job->tier != TIER_VISIBLE) {
+            html << " loading=\"lazy\"";
+        }
+        html << ">\n</div>\n";
+    }
+    return html.str();
+}
+
+// Splits the carousel into pages of 'page_size' images in carousel order and keeps their
+// fragments in 'pages_dir' (site path 'site_dir'). A page gets its fragments once all its
+// images are done; as finished jobs do not change, it is rendered only once per run.
+class ManifestPager {
+public:
+    ManifestPager(const fs::path& pages_dir, const std::string& site_dir, std::vector<const Job*> live,
+                  std::size_t page_size)
+        : dir_(pages_dir), site_(site_dir), live_(std::move(live)) {
+        paging_.page_size = std::max<std::size_t>(1, page_size);
+    }
+
+    // Writes the fragments of the pages completed by 'finished' and returns what the manifest lists.
+    const Paging& update(const std::vector<const Job*>& finished) {
+        std::set<const Job*> done(finished.begin(), finished.end());
+        std::size_t size = paging_.page_size;
+        paging_.first_page.insert(live_.begin(), live_.begin() + std::min(size, live_.size()));
+        for (std::size_t start = size, i = 0; start < live_.size(); start += size, ++i) {
+            std::vector<const Job*> page(live_.begin() + start, live_.begin() + std::min(start + size, live_.size()));
+            if (i < paging_.pages.size() && !paging_.pages[i].json.empty()) {
+                continue;
+            }
+            PageRef ref{page.front()->number, page.size(), "", ""};
+            if (std::all_of(page.begin(), page.end(), [&done](const Job* job) { return done.count(job) > 0; })) {
+                std::ostringstream json;
+                json << "{\"first\": " << ref.first << ", \"items\": [\n";
+                for (const Job* job : page) {
+                    writeManifestItem(json, *job);
+                    json << (job == page.back() ? "\n" : ",\n");
+                }
+                json << "]}\n";
+                ref.json = fragment(json.str(), ".json");
+                ref.html = fragment(renderCarouselMarkup(page), ".html");
+            }
+            if (i < paging_.pages.size()) {
+                paging_.pages[i] = ref;
+            } else {
+                paging_.pages.push_back(ref);
+            }
+        }
+        return paging_;
+    }
+
+    // Deletes fragments that no page refers to any more; call once every page is written.
+    void prune() {
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+            if (referenced_.count(entry.path().filename().string()) == 0) {
+                fs::remove(entry.path(), ec);
+                ++removed_;
+            }
+        }
+    }
+
+    bool ok() const { return ok_; }
+    int written() const { return written_; }
+    int unchanged() const { return static_cast<int>(referenced_.size()) - written_; }
+    int removed() const { return removed_; }
+
+private:
+    fs::path dir_;
+    std::string site_;
+    std::vector<const Job*> live_;
+    Paging paging_;
+    std::set<std::string> referenced_;
+    int written_ = 0, removed_ = 0;
+    bool ok_ = true;
+
+    // Stores 'text' under its hash unless an earlier run already did; returns its site path.
+    std::string fragment(const std::string& text, const std::string& ext) {
+        std::string name = blake3::hashBytes(text.data(), text.size()).substr(0, 16) + ext;
+        std::error_code ec;
+        if (!fs::exists(dir_ / name, ec)) {
+            fs::create_directories(dir_, ec);
+            ok_ = writeFileAtomically(dir_ / name, text) && ok_;
+            ++written_;
+        }
+        referenced_.insert(name);
+        return site_ + "/" + name;
+    }
+};
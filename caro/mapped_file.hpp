@@ -0,0 +1,121 @@
+// mapped_file.hpp - Read-only memory mapping of whole files.
+//
+// Large sources are hashed and scanned straight from the page cache instead of
+// being copied through stream buffers. Platforms without a mapping API fall
+// back to reading the file into memory.
+#pragma once
+
+#include <cstdint>      // For std::uint8_t
+#include <filesystem>   // For fs::path
+#include <fstream>      // For the read fallback
+#include <iterator>     // For std::istreambuf_iterator
+#include <vector>       // For the read fallback buffer
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>      // For open
+#include <sys/mman.h>   // For mmap, madvise
+#include <sys/stat.h>   // For fstat
+#include <unistd.h>     // For close
+#endif
+
+namespace fs = std::filesystem;
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // Maps 'path' read-only. Returns false if the file cannot be opened.
+    // 'sequential' hints that the file will be read front to back once.
+    bool open(const fs::path& path, bool sequential = true) {
+        close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            return false;
+        }
+        size_ = static_cast<std::size_t>(size.QuadPart);
+        if (size_ > 0) {
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                view_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+        if (view_) {
+            data_ = static_cast<const std::uint8_t*>(view_);
+            return true;
+        }
+#elif defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0) {
+            void* view = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                view_ = view;
+                madvise(view_, size_, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+            }
+        }
+        ::close(fd);
+        if (view_) {
+            data_ = static_cast<const std::uint8_t*>(view_);
+            return true;
+        }
+#endif
+        // No mapping (empty file, unsupported platform or mapping failure): read it instead.
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data_ = reinterpret_cast<const std::uint8_t*>(buffer_.data());
+        size_ = buffer_.size();
+        return true;
+    }
+
+    void close() {
+        if (view_) {
+#if defined(_WIN32)
+            UnmapViewOfFile(view_);
+#elif defined(__unix__) || defined(__APPLE__)
+            munmap(view_, size_);
+#endif
+        }
+        view_ = nullptr;
+        data_ = nullptr;
+        size_ = 0;
+        buffer_.clear();
+        buffer_.shrink_to_fit();
+    }
+
+    const std::uint8_t* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    void* view_ = nullptr;              // Mapped view, if any
+    const std::uint8_t* data_ = nullptr; // Start of the contents (view or buffer)
+    std::size_t size_ = 0;
+    std::vector<char> buffer_;          // Fallback copy of the contents
+};
@@ -0,0 +1,174 @@
+// naming.hpp - Output naming templates for gallery files.
+//
+// A template is a prefix, the number (optionally zero-padded) and a suffix,
+// followed by the file's extension, which can be mapped to another spelling:
+//   "{n}"              5.jpg           (the default, the original naming)
+//   "design-{n:3}"     design-042.webp
+//   "tes_2026_{n:3}"   tes_2026_042.jpg
+// Extension mapping renames only (e.g. jpeg=jpg, JPG=jpg); it does not
+// convert the image.
+//
+// A gallery that uses a template other than the default records it in
+// .gallery-naming, so scans (renumbering, publishing, history) recognise its
+// files. The gallery history records it with every version, so a checkout
+// brings back the naming along with the files. render() writes into a
+// caller-owned buffer and does not allocate once the buffer has grown to the
+// longest name.
+#pragma once
+
+#include <charconv>     // For std::to_chars
+#include <filesystem>   // For the .gallery-naming file
+#include <fstream>      // For reading and writing it
+#include <string>       // For names
+#include <utility>      // For std::pair
+#include <vector>       // For the extension map
+
+#include "object_store.hpp" // For writeFileAtomically
+
+namespace fs = std::filesystem;
+
+struct NameTemplate {
+    std::string prefix;
+    std::string suffix;
+    int width = 0; // Minimum digits; shorter numbers are zero-padded
+    std::vector<std::pair<std::string, std::string>> extensions; // From -> to
+
+    bool isDefault() const { return prefix.empty() && suffix.empty() && width == 0; }
+
+    // The template in the "{n}" syntax it was parsed from.
+    std::string spec() const {
+        return prefix + (width ? "{n:" + std::to_string(width) + "}" : std::string("{n}")) + suffix;
+    }
+
+    const std::string& mapExtension(const std::string& ext) const {
+        for (const auto& mapping : extensions) {
+            if (mapping.first == ext) {
+                return mapping.second;
+            }
+        }
+        return ext;
+    }
+
+    // Writes the name for 'number' and 'ext' into 'out', reusing its storage.
+    void render(int number, const std::string& ext, std::string& out) const {
+        char digits[16];
+        auto result = std::to_chars(digits, digits + sizeof digits, number);
+        std::size_t len = static_cast<std::size_t>(result.ptr - digits);
+        out.clear();
+        out.append(prefix);
+        for (std::size_t pad = len; pad < static_cast<std::size_t>(width); ++pad) {
+            out += '0';
+        }
+        out.append(digits, len);
+        out.append(suffix);
+        out += '.';
+        out.append(mapExtension(ext));
+    }
+
+    // Recognises a file name made by this template (with any extension).
+    bool match(const std::string& name, int& number, std::string& ext) const {
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            return false;
+        }
+        std::size_t pos = prefix.size();
+        std::size_t start = pos;
+        long value = 0;
+        while (pos < name.size() && name[pos] >= '0' && name[pos] <= '9') {
+            value = value * 10 + (name[pos] - '0');
+            if (value > 999999999) {
+                return false;
+            }
+            ++pos;
+        }
+        if (pos == start || name.compare(pos, suffix.size(), suffix) != 0) {
+            return false;
+        }
+        pos += suffix.size();
+        if (pos + 1 >= name.size() || name[pos] != '.') {
+            return false;
+        }
+        number = static_cast<int>(value);
+        ext.assign(name, pos + 1, std::string::npos);
+        return true;
+    }
+};
+
+// Parses "PREFIX{n}SUFFIX" or "PREFIX{n:WIDTH}SUFFIX".
+inline bool parseNameTemplate(const std::string& spec, NameTemplate& out, std::string& error) {
+    std::size_t open = spec.find("{n");
+    std::size_t close = spec.find('}', open == std::string::npos ? 0 : open);
+    if (open == std::string::npos || close == std::string::npos) {
+        error = "template must contain {n} or {n:WIDTH}";
+        return false;
+    }
+    out = NameTemplate();
+    out.prefix = spec.substr(0, open);
+    out.suffix = spec.substr(close + 1);
+    std::string field = spec.substr(open + 2, close - open - 2);
+    if (!field.empty()) {
+        if (field[0] != ':' || field.size() < 2 || field.find_first_not_of("0123456789", 1) != std::string::npos) {
+            error = "bad number field '{n" + field + "}'";
+            return false;
+        }
+        out.width = std::stoi(field.substr(1));
+        if (out.width > 9) {
+            error = "number width must be at most 9";
+            return false;
+        }
+    }
+    for (const std::string& part : {out.prefix, out.suffix}) {
+        if (part.find_first_of("/\\{}") != std::string::npos) {
+            error = "prefix and suffix may not contain '/', '\\\\', '{' or '}'";
+            return false;
+        }
+    }
+    if (!out.suffix.empty() && out.suffix[0] >= '0' && out.suffix[0] <= '9') {
+        error = "suffix may not start with a digit";
+        return false;
+    }
+    return true;
+}
+
+// Parses "from=to,from=to" extension mappings into 'out'.
+inline bool parseExtensionMap(const std::string& list, NameTemplate& out, std::string& error) {
+    std::size_t pos = 0;
+    while (pos < list.size()) {
+        std::size_t comma = list.find(',', pos);
+        std::string item = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        pos = comma == std::string::npos ? list.size() : comma + 1;
+        std::size_t eq = item.find('=');
+        if (eq == std::string::npos || eq == 0 || eq + 1 == item.size()) {
+            error = "bad extension mapping '" + item + "' (expected FROM=TO)";
+            return false;
+        }
+        out.extensions.push_back({item.substr(0, eq), item.substr(eq + 1)});
+    }
+    return true;
+}
+
+inline fs::path namingPath(const fs::path& gallery_dir) {
+    return gallery_dir / ".gallery-naming";
+}
+
+// The template the gallery's files are named with (the default if none is recorded).
+inline NameTemplate galleryNaming(const fs::path& gallery_dir) {
+    NameTemplate naming;
+    std::ifstream in(namingPath(gallery_dir));
+    std::string spec;
+    std::string error;
+    if (in && std::getline(in, spec) && !parseNameTemplate(spec, naming, error)) {
+        naming = NameTemplate();
+    }
+    return naming;
+}
+
+// Records the gallery's template (removing the file for the default one). The file is
+// replaced atomically: a scan never sees half a template.
+inline bool saveGalleryNaming(const fs::path& gallery_dir, const NameTemplate& naming) {
+    std::error_code ec;
+    if (naming.isDefault()) {
+        fs::remove(namingPath(gallery_dir), ec);
+        return !ec;
+    }
+    return writeFileAtomically(namingPath(gallery_dir), naming.spec() + "\n");
+}
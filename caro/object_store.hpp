@@ -0,0 +1,119 @@
+// object_store.hpp - Content-addressed storage for gallery file versions.
+//
+// Objects live under <gallery>/.gallery-objects/<first two hex digits>/<hash>
+// and are never modified once written, so any version recorded in the gallery
+// history can be restored even after the working file was replaced. The
+// chunks/ subdirectory uses the same layout for the content-defined chunks
+// of deployed files (see delta.hpp).
+#pragma once
+
+#include <filesystem>   // For paths, copies and renames
+#include <fstream>      // For reading and writing object bytes
+#include <iterator>     // For std::istreambuf_iterator
+#include <string>       // For hashes
+#include <system_error> // For std::error_code
+#include <vector>       // For object contents
+
+namespace fs = std::filesystem;
+
+// Directory holding the objects of a gallery.
+inline fs::path objectStoreDir(const fs::path& gallery_dir) {
+    return gallery_dir / ".gallery-objects";
+}
+
+// Directory holding the content-defined chunks of deployed files.
+inline fs::path chunkStoreDir(const fs::path& gallery_dir) {
+    return objectStoreDir(gallery_dir) / "chunks";
+}
+
+// Location of one object inside the store.
+inline fs::path objectPath(const fs::path& store_dir, const std::string& hash) {
+    return store_dir / hash.substr(0, 2) / hash;
+}
+
+// True if the store already has the object.
+inline bool hasObject(const fs::path& store_dir, const std::string& hash) {
+    std::error_code ec;
+    return fs::exists(objectPath(store_dir, hash), ec);
+}
+
+// Writes text to path through a temporary sibling file and an atomic rename.
+// Returns false (after cleaning up the temporary file) if anything fails.
+inline bool writeFileAtomically(const fs::path& path, const std::string& text) {
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(text.data(), static_cast<std::streamsize>(text.size()));
+        out.close(); // Flushes: a full disk shows here
+        if (!out) {
+            std::error_code ignored;
+            fs::remove(tmp, ignored);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec); // Replaces the previous file in one step
+    if (ec) {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+// Copies 'source' into the store under 'hash' unless it is already there.
+// The copy goes through a temporary name so a crash never leaves a truncated object.
+inline bool storeObject(const fs::path& store_dir, const std::string& hash, const fs::path& source) {
+    if (hasObject(store_dir, hash)) {
+        return true;
+    }
+    fs::path target = objectPath(store_dir, hash);
+    std::error_code ec;
+    fs::create_directories(target.parent_path(), ec);
+    fs::path tmp = target;
+    tmp += ".tmp";
+    fs::copy_file(source, tmp, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+        return false;
+    }
+    fs::rename(tmp, target, ec);
+    return !ec;
+}
+
+// Copies an object out of the store to 'target'. Fails if 'target' already exists.
+inline bool restoreObject(const fs::path& store_dir, const std::string& hash, const fs::path& target) {
+    std::error_code ec;
+    fs::copy_file(objectPath(store_dir, hash), target, fs::copy_options::none, ec);
+    return !ec;
+}
+
+// Writes an object from memory unless it is already there.
+inline bool storeObjectBytes(const fs::path& store_dir, const std::string& hash, const void* data, std::size_t len) {
+    if (hasObject(store_dir, hash)) {
+        return true;
+    }
+    fs::path target = objectPath(store_dir, hash);
+    std::error_code ec;
+    fs::create_directories(target.parent_path(), ec);
+    fs::path tmp = target;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.write(static_cast<const char*>(data), static_cast<std::streamsize>(len))) {
+            fs::remove(tmp, ec);
+            return false;
+        }
+    }
+    fs::rename(tmp, target, ec);
+    return !ec;
+}
+
+// Reads an object into memory. Returns false if it is missing.
+inline bool readObject(const fs::path& store_dir, const std::string& hash, std::vector<char>& out) {
+    std::ifstream in(objectPath(store_dir, hash), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
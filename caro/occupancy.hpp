@@ -0,0 +1,410 @@
+// occupancy.hpp - Numbers in use per gallery directory, kept as Roaring bitmaps.
+//
+// The scanner records, for the carousel directory and for not-good/, which
+// numbers are taken (overall and per extension). With the numbers as bitmaps,
+// "in the carousel but not archived", "free in both" or "where are the gaps"
+// are single set operations instead of list comparisons. The bitmaps are kept
+// in .gallery-index next to the images together with each directory's
+// modification time, the naming template and the bytes per extension, and
+// are rebuilt by the next scan when either changes. Commands that rename or
+// add files update the index themselves (see indexMoves in main.cpp), so the
+// counts, gaps and sizes behind 'caro stats' stay current without a rescan.
+#pragma once
+
+#include <algorithm>    // For std::transform
+#include <cctype>       // For std::isdigit, std::isalnum
+#include <chrono>       // For the staleness margin
+#include <cstdint>      // For stamps
+#include <filesystem>   // For paths and modification times
+#include <fstream>      // For reading and writing the index
+#include <iterator>     // For std::istreambuf_iterator
+#include <map>          // For sections and extensions
+#include <sstream>      // For parsing header lines
+#include <string>       // For names
+#include <thread>       // For std::this_thread::sleep_until
+#include <vector>       // For section lists
+
+#include "roaring.hpp"
+
+namespace fs = std::filesystem;
+
+// Numbers used in one directory.
+struct Occupancy {
+    roaring::Bitmap all;
+    std::map<std::string, roaring::Bitmap> by_extension; // Lower-case extension -> numbers
+    std::map<std::string, std::uint64_t> bytes;          // Lower-case extension -> size of its files
+
+    // Records the file NUMBER.EXT of 'size' bytes; adding a file already recorded changes nothing.
+    void add(int number, std::string ext, std::uint64_t size = 0) {
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        roaring::Bitmap& numbers = by_extension[ext];
+        if (numbers.contains(static_cast<std::uint32_t>(number))) {
+            return;
+        }
+        all.add(static_cast<std::uint32_t>(number));
+        numbers.add(static_cast<std::uint32_t>(number));
+        bytes[ext] += size;
+    }
+
+    // Takes out the file NUMBER.EXT of 'size' bytes; the number stays in 'all' while
+    // a file with another extension has it.
+    void remove(int number, std::string ext, std::uint64_t size) {
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        auto numbers = by_extension.find(ext);
+        if (numbers == by_extension.end() || !numbers->second.remove(static_cast<std::uint32_t>(number))) {
+            return;
+        }
+        std::uint64_t& total = bytes[ext];
+        total -= std::min(total, size);
+        if (numbers->second.empty()) {
+            by_extension.erase(numbers);
+            bytes.erase(ext);
+        }
+        for (const auto& other : by_extension) {
+            if (other.second.contains(static_cast<std::uint32_t>(number))) {
+                return;
+            }
+        }
+        all.remove(static_cast<std::uint32_t>(number));
+    }
+
+    void optimize() {
+        all.optimize();
+        for (auto& entry : by_extension) {
+            entry.second.optimize();
+        }
+    }
+};
+
+struct IndexSection {
+    std::int64_t stamp = 0; // Directory modification time when scanned (0: always rescan)
+    std::string naming;     // Naming template the scan used
+    bool sized = false;     // numbers.bytes is known (indexes written before sizes were kept lack it)
+    Occupancy numbers;
+};
+
+// What 'caro stats' reports for a section, all read from the index.
+struct SectionStats {
+    std::uint64_t files = 0;    // Numbered files (a number with two extensions counts twice)
+    std::uint64_t numbers = 0;  // Distinct numbers
+    std::uint32_t lowest = 0, highest = 0;
+    std::uint64_t missing = 0;  // Numbers between lowest and highest without a file
+    std::uint64_t stretches = 0; // Runs of missing numbers
+    std::uint64_t bytes = 0;
+};
+
+inline SectionStats sectionStats(const IndexSection& section) {
+    SectionStats stats;
+    const Occupancy& occupancy = section.numbers;
+    for (const auto& entry : occupancy.by_extension) {
+        stats.files += entry.second.cardinality();
+    }
+    for (const auto& entry : occupancy.bytes) {
+        stats.bytes += entry.second;
+    }
+    stats.numbers = occupancy.all.cardinality();
+    if (occupancy.all.minimum(stats.lowest) && occupancy.all.maximum(stats.highest)) {
+        stats.missing = stats.highest - stats.lowest + 1 - stats.numbers;
+        occupancy.all.forEachRun([&stats](std::uint32_t, std::uint32_t) { ++stats.stretches; });
+        --stats.stretches; // Runs of files, less one: the gaps between them
+    }
+    return stats;
+}
+
+// Sections by directory relative to the gallery: "" (the carousel) and "not-good".
+using GalleryIndex = std::map<std::string, IndexSection>;
+
+inline fs::path indexPath(const fs::path& gallery_dir) {
+    return gallery_dir / ".gallery-index";
+}
+
+// Modification time of a directory in nanoseconds, 0 if it cannot be read.
+inline std::int64_t directoryStamp(const fs::path& dir) {
+    std::error_code ec;
+    auto time = fs::last_write_time(dir, ec);
+    return ec ? 0 : static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+}
+
+// True if 'section' still describes 'dir' scanned with 'naming'.
+inline bool sectionFresh(const IndexSection& section, const fs::path& dir, const std::string& naming) {
+    return section.stamp != 0 && section.sized && section.stamp == directoryStamp(dir) && section.naming == naming;
+}
+
+// Text header lines, each bitmap in the portable Roaring format after its "bitmap" line.
+inline std::string renderIndex(const GalleryIndex& index) {
+    std::string out = "caro-index 1\n";
+    for (const auto& [name, section] : index) {
+        out += "section\t" + name + "\t" + std::to_string(section.stamp) + "\t" + section.naming + "\n";
+        if (section.sized) {
+            std::uint64_t total = 0;
+            for (const auto& [ext, size] : section.numbers.bytes) {
+                out += "bytes\t" + ext + "\t" + std::to_string(size) + "\n";
+                total += size;
+            }
+            out += "bytes\t*\t" + std::to_string(total) + "\n";
+        }
+        auto bitmap = [&out](const std::string& ext, const roaring::Bitmap& numbers) {
+            std::string bytes = numbers.serialize();
+            out += "bitmap\t" + ext + "\t" + std::to_string(bytes.size()) + "\n" + bytes + "\n";
+        };
+        bitmap("*", section.numbers.all);
+        for (const auto& [ext, numbers] : section.numbers.by_extension) {
+            bitmap(ext, numbers);
+        }
+    }
+    return out + "end\n";
+}
+
+inline bool parseIndex(const std::string& text, GalleryIndex& index, std::string& error) {
+    index.clear();
+    std::size_t pos = 0;
+    auto line = [&](std::string& out) {
+        std::size_t end = text.find('\n', pos);
+        if (end == std::string::npos) {
+            return false;
+        }
+        out = text.substr(pos, end - pos);
+        pos = end + 1;
+        return true;
+    };
+    std::string current;
+    if (!line(current) || current != "caro-index 1") {
+        error = "not a gallery index";
+        return false;
+    }
+    IndexSection* section = nullptr;
+    while (line(current)) {
+        std::vector<std::string> fields;
+        std::stringstream split(current);
+        for (std::string field; std::getline(split, field, '\t');) {
+            fields.push_back(field);
+        }
+        if (current == "end") {
+            return true;
+        }
+        if (fields.size() >= 3 && fields[0] == "section") {
+            section = &index[fields[1]];
+            section->stamp = std::stoll(fields[2]);
+            section->naming = fields.size() > 3 ? fields[3] : "";
+        } else if (fields.size() == 3 && fields[0] == "bytes" && section) {
+            if (fields[1] == "*") {
+                section->sized = true; // The per-extension lines come first; the total marks them complete
+            } else {
+                section->numbers.bytes[fields[1]] = std::stoull(fields[2]);
+            }
+        } else if (fields.size() == 3 && fields[0] == "bitmap" && section) {
+            std::size_t size = std::stoul(fields[2]);
+            if (pos + size + 1 > text.size()) {
+                break;
+            }
+            roaring::Bitmap numbers;
+            if (!roaring::Bitmap::deserialize(text.substr(pos, size), numbers, error)) {
+                return false;
+            }
+            pos += size + 1;
+            (fields[1] == "*" ? section->numbers.all : section->numbers.by_extension[fields[1]]) = std::move(numbers);
+        } else {
+            error = "bad index line '" + current + "'";
+            return false;
+        }
+    }
+    error = "truncated gallery index";
+    return false;
+}
+
+inline bool loadIndex(const fs::path& gallery_dir, GalleryIndex& index) {
+    std::ifstream in(indexPath(gallery_dir), std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string error;
+    try {
+        return in && parseIndex(text, index, error);
+    } catch (const std::exception&) {
+        index.clear(); // Unreadable numbers: rescan
+        return false;
+    }
+}
+
+// The time of 'dir' as the stamp of changes this process has just finished making, or 0.
+// On file systems with sub-second times this waits until the clock is 20 ms past it and
+// checks that nothing changed the directory since; only another process changing it in
+// the very same clock tick could then go unnoticed. Whole-second times give 0 (rescan).
+inline std::int64_t settledStamp(const fs::path& dir) {
+    std::int64_t stamp = directoryStamp(dir);
+    if (stamp % 1000000000LL == 0) {
+        return 0;
+    }
+    auto settled = fs::file_time_type(std::chrono::duration_cast<fs::file_time_type::duration>(
+        std::chrono::nanoseconds(stamp + 20000000LL)));
+    std::this_thread::sleep_until(settled);
+    return directoryStamp(dir) == stamp ? stamp : 0;
+}
+
+// Writes the index in place. Creating the file changes the gallery directory's time,
+// so a first save takes the new time as its stamp if nothing else changed meanwhile.
+// Stamps younger than two seconds are stored as 0, since a change within the file
+// system's time granularity could go unnoticed; 'settled' keeps stamps that came from
+// settledStamp().
+inline bool saveIndex(const fs::path& gallery_dir, GalleryIndex index, bool settled = false) {
+    fs::path path = indexPath(gallery_dir);
+    std::error_code ec;
+    if (!fs::exists(path, ec)) {
+        std::int64_t before = directoryStamp(gallery_dir);
+        std::ofstream(path, std::ios::binary);
+        auto it = index.find("");
+        if (it != index.end() && it->second.stamp == before) {
+            it->second.stamp = directoryStamp(gallery_dir);
+        }
+    }
+    std::int64_t now = static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        fs::file_time_type::clock::now().time_since_epoch()).count());
+    for (auto& entry : index) {
+        if (now - entry.second.stamp < 2000000000LL && !settled) {
+            entry.second.stamp = 0;
+        }
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc); // In place: the directory time stays
+    out << renderIndex(index);
+    return static_cast<bool>(out);
+}
+
+// "1-35, 40, 42-44"
+inline std::string formatRanges(const roaring::Bitmap& numbers) {
+    std::string out;
+    numbers.forEachRun([&](std::uint32_t lo, std::uint32_t hi) {
+        out += (out.empty() ? "" : ", ") + std::to_string(lo) + (hi > lo ? "-" + std::to_string(hi) : "");
+    });
+    return out.empty() ? "(none)" : out;
+}
+
+// Evaluates a set expression over the index:
+//   live, archive            numbers in the carousel / in not-good/
+//   live.jpg, archive.png    the same, one extension only
+//   12, 3..40                literal numbers and ranges
+//   a | b, a & b, a - b      union, intersection, difference ('&' binds tighter)
+//   ~a                       numbers from the lowest to the highest in use that are not in a
+//   ( ... )
+class Expression {
+public:
+    Expression(const GalleryIndex& index, const std::string& text) : index_(index), text_(text) {
+        for (const auto& entry : index) {
+            universe_ = universe_ | entry.second.numbers.all;
+        }
+    }
+
+    bool evaluate(roaring::Bitmap& out, std::string& error) {
+        out = parseUnion();
+        skipSpaces();
+        if (error_.empty() && pos_ < text_.size()) {
+            error_ = "unexpected '" + text_.substr(pos_) + "'";
+        }
+        error = error_;
+        return error_.empty();
+    }
+
+private:
+    const GalleryIndex& index_;
+    std::string text_;
+    std::size_t pos_ = 0;
+    std::string error_;
+    roaring::Bitmap universe_;
+
+    void skipSpaces() {
+        while (pos_ < text_.size() && text_[pos_] == ' ') {
+            ++pos_;
+        }
+    }
+
+    bool accept(char c) {
+        skipSpaces();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    roaring::Bitmap parseUnion() {
+        roaring::Bitmap value = parseIntersection();
+        while (error_.empty()) {
+            if (accept('|')) {
+                value = value | parseIntersection();
+            } else if (accept('-')) {
+                value = value - parseIntersection();
+            } else {
+                break;
+            }
+        }
+        return value;
+    }
+
+    roaring::Bitmap parseIntersection() {
+        roaring::Bitmap value = parseFactor();
+        while (error_.empty() && accept('&')) {
+            value = value & parseFactor();
+        }
+        return value;
+    }
+
+    roaring::Bitmap parseFactor() {
+        if (accept('~')) {
+            std::uint32_t lo = 0, hi = 0;
+            roaring::Bitmap inner = parseFactor();
+            if (!universe_.minimum(lo) || !universe_.maximum(hi)) {
+                return {};
+            }
+            return roaring::Bitmap::range(lo, hi) - inner;
+        }
+        if (accept('(')) {
+            roaring::Bitmap value = parseUnion();
+            if (error_.empty() && !accept(')')) {
+                error_ = "missing ')'";
+            }
+            return value;
+        }
+        skipSpaces();
+        std::size_t start = pos_;
+        while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '.')) {
+            ++pos_;
+        }
+        std::string word = text_.substr(start, pos_ - start);
+        if (word.empty()) {
+            error_ = pos_ < text_.size() ? "unexpected '" + text_.substr(pos_) + "'" : "expression ends early";
+            return {};
+        }
+        if (std::isdigit(static_cast<unsigned char>(word[0]))) {
+            return numbers(word);
+        }
+        std::size_t dot = word.find('.');
+        std::string name = word.substr(0, dot);
+        auto section = index_.find(name == "live" ? "" : name == "archive" ? "not-good" : "?");
+        if (name != "live" && name != "archive") {
+            error_ = "unknown set '" + word + "' (use live, archive, live.EXT, archive.EXT)";
+            return {};
+        }
+        if (section == index_.end()) {
+            return {};
+        }
+        if (dot == std::string::npos) {
+            return section->second.numbers.all;
+        }
+        std::string ext = word.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        auto numbers = section->second.numbers.by_extension.find(ext);
+        return numbers == section->second.numbers.by_extension.end() ? roaring::Bitmap() : numbers->second;
+    }
+
+    // "12" or "3..40".
+    roaring::Bitmap numbers(const std::string& word) {
+        std::size_t dots = word.find("..");
+        try {
+            std::uint32_t lo = static_cast<std::uint32_t>(std::stoul(word.substr(0, dots)));
+            std::uint32_t hi = dots == std::string::npos ? lo : static_cast<std::uint32_t>(std::stoul(word.substr(dots + 2)));
+            if (hi >= lo) {
+                return roaring::Bitmap::range(lo, hi);
+            }
+        } catch (const std::exception&) {
+        }
+        error_ = "bad number or range '" + word + "'";
+        return {};
+    }
+};
@@ -0,0 +1,103 @@
+// pagecache.hpp - Read-ahead and eviction hints for gallery sources.
+//
+// A publish run reads every image once. Read cold, each decode waits for the
+// disk; read warm, the sources stay in the page cache afterwards and push out
+// the pages the web server serves. prefetch() asks the kernel to start reading
+// a file in the background (POSIX_FADV_WILLNEED) a few jobs before it is
+// needed, and release() drops its clean pages (POSIX_FADV_DONTNEED) once it
+// has been processed. Files that were already fully cached when the run
+// started are left cached: someone else is using them.
+//
+// Linux only; elsewhere the hints do nothing and resident() reports false.
+#pragma once
+
+#include <cstdint>      // For byte counts
+#include <filesystem>   // For fs::path
+#include <vector>       // For the mincore vector
+
+#if defined(__linux__)
+#include <fcntl.h>      // For open, posix_fadvise
+#include <sys/mman.h>   // For mmap, mincore
+#include <sys/stat.h>   // For fstat
+#include <unistd.h>     // For close, sysconf
+#endif
+
+namespace fs = std::filesystem;
+
+namespace pagecache {
+
+#if defined(__linux__)
+
+// Bytes of 'path' currently in the page cache (rounded to pages); 'size' receives the file size.
+inline std::uint64_t residentBytes(const fs::path& path, std::uint64_t& size) {
+    size = 0;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    std::uint64_t resident = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = static_cast<std::uint64_t>(st.st_size);
+        // Mapping without touching the pages does not read anything.
+        void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (view != MAP_FAILED) {
+            std::uint64_t page = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+            std::vector<unsigned char> pages((size + page - 1) / page);
+            if (mincore(view, size, pages.data()) == 0) {
+                for (unsigned char p : pages) {
+                    resident += (p & 1) ? page : 0;
+                }
+            }
+            munmap(view, size);
+        }
+    }
+    ::close(fd);
+    return resident < size ? resident : size;
+}
+
+inline bool advise(const fs::path& path, int advice) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = posix_fadvise(fd, 0, 0, advice) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// Starts reading the whole file into the page cache without waiting for it.
+inline bool prefetch(const fs::path& path) {
+    return advise(path, POSIX_FADV_WILLNEED);
+}
+
+// Drops the file's clean pages from the page cache.
+inline bool release(const fs::path& path) {
+    return advise(path, POSIX_FADV_DONTNEED);
+}
+
+#else
+
+inline std::uint64_t residentBytes(const fs::path&, std::uint64_t& size) {
+    size = 0;
+    return 0;
+}
+
+inline bool prefetch(const fs::path&) {
+    return false;
+}
+
+inline bool release(const fs::path&) {
+    return false;
+}
+
+#endif
+
+// True if the whole file is in the page cache.
+inline bool resident(const fs::path& path) {
+    std::uint64_t size = 0;
+    std::uint64_t bytes = residentBytes(path, size);
+    return size > 0 && bytes >= size;
+}
+
+} // namespace pagecache
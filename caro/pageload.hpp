@@ -0,0 +1,581 @@
+// pageload.hpp - Page-load simulator for the site's index.html.
+//
+// Extracts the resource graph of the page and replays it over a modelled
+// network to estimate when the page paints and when the carousel is complete.
+// The point is comparing changes (a renumber, a manifest or image
+// optimization) with the same model, not predicting a real browser exactly.
+//
+// Resource graph:
+//   - <link rel=stylesheet>, <script src> and <img src> in document order,
+//     discovered when the HTML bytes containing the tag have arrived
+//     (the preload scanner),
+//   - an <img> whose src does not exist costs a 404 round trip before the
+//     onerror handler's fallback src is requested,
+//   - web fonts (first usable src of each @font-face of local stylesheets)
+//     and url() backgrounds of inline styles are discovered at first paint,
+//     when the browser first computes styles.
+// Network model: per-origin connection limit (HTTP/1.1), connection setup of
+// a few round trips, one round trip to the first byte of each response, TCP
+// slow start per connection (initial window of 10 segments, doubling every
+// round trip) and a shared downlink divided fairly between the connections
+// that are receiving. The simulation steps in 1 ms increments.
+//
+// Milestones:
+//   first_paint       HTML and every stylesheet in <head> have arrived
+//   content_visible   every synchronous script has run (the template hides its
+//                     full-screen loader from main.js)
+//   first_slide       the first gallery image is loaded and visible
+//   carousel_complete every gallery image (after fallbacks) has arrived
+//   load              everything has arrived
+#pragma once
+
+#include <algorithm>    // For std::min, std::max, std::sort
+#include <cctype>       // For std::isalnum, std::tolower
+#include <cmath>        // For std::isfinite
+#include <cstdint>      // For std::uint64_t
+#include <cstdlib>      // For std::strtod
+#include <filesystem>   // For resolving and sizing local files
+#include <fstream>      // For reading the page and stylesheets
+#include <iterator>     // For std::istreambuf_iterator
+#include <limits>       // For quiet_NaN
+#include <map>          // For de-duplicating URLs
+#include <sstream>      // For the JSON report
+#include <string>       // For URLs
+#include <vector>       // For the resource list
+
+namespace fs = std::filesystem;
+
+namespace pageload {
+
+struct NetworkProfile {
+    std::string name = "fast-3g";
+    double kbps = 1600;          // Downlink in kilobits per second
+    double rtt_ms = 150;         // Round-trip time
+    int connections = 6;         // Parallel connections per origin
+    int handshake_rtts = 3;      // DNS + TCP + TLS before the first request on a connection
+    double text_ratio = 0.3;     // Wire size of HTML/CSS/JS relative to the file (gzip)
+    double external_kb = 20;     // Assumed size of resources on other origins
+};
+
+// Built-in profiles, roughly those of browser developer tools.
+inline bool profileByName(const std::string& name, NetworkProfile& profile) {
+    struct Preset { const char* name; double kbps; double rtt; };
+    static const Preset presets[] = {
+        {"slow-3g", 400, 400},
+        {"fast-3g", 1600, 150},
+        {"4g", 9000, 85},
+        {"cable", 50000, 20},
+    };
+    for (const auto& preset : presets) {
+        if (name == preset.name) {
+            profile.name = preset.name;
+            profile.kbps = preset.kbps;
+            profile.rtt_ms = preset.rtt;
+            return true;
+        }
+    }
+    return false;
+}
+
+enum class Kind { Document, Stylesheet, Script, Font, Image };
+
+inline const char* kindName(Kind kind) {
+    switch (kind) {
+        case Kind::Document: return "document";
+        case Kind::Stylesheet: return "css";
+        case Kind::Script: return "script";
+        case Kind::Font: return "font";
+        case Kind::Image: return "image";
+    }
+    return "?";
+}
+
+// How a resource becomes known to the browser.
+enum class Trigger { Navigation, HtmlOffset, FirstPaint, AfterFailure };
+
+struct Resource {
+    std::string url;            // As written in the page
+    std::string origin;         // "" for the page's own origin
+    fs::path path;              // Local file (same-origin only)
+    Kind kind = Kind::Image;
+    int priority = 3;           // 0 = highest
+    bool render_blocking = false;
+    bool sync_script = false;
+    bool gallery = false;       // Part of the carousel
+    bool missing = false;       // Answered with a 404
+    std::uint64_t bytes = 0;    // Response size on the wire
+    Trigger trigger = Trigger::HtmlOffset;
+    std::size_t html_offset = 0;
+    int fallback = -1;          // Resource requested when this one fails
+    int fallback_of = -1;       // Resource whose failure requests this one
+
+    // Results, in milliseconds (-1 = not reached).
+    double discovered = -1, started = -1, first_byte = -1, done = -1;
+};
+
+struct Metrics {
+    double first_paint = 0;
+    double content_visible = 0;
+    double first_slide = 0;
+    double carousel_complete = 0;
+    double load = 0;
+    std::uint64_t bytes = 0;
+    int requests = 0;
+    int failed_requests = 0;
+};
+
+inline std::string readText(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+inline bool isExternal(const std::string& url) {
+    return url.rfind("http://", 0) == 0 || url.rfind("https://", 0) == 0 || url.rfind("//", 0) == 0;
+}
+
+inline std::string originOf(const std::string& url) {
+    std::size_t start = url.find("//") + 2;
+    std::size_t end = url.find('/', start);
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+// Strips the query and fragment of a local URL.
+inline std::string stripQuery(const std::string& url) {
+    return url.substr(0, url.find_first_of("?#"));
+}
+
+// Reads an attribute value from the text of a start tag ("" if absent).
+inline std::string attribute(const std::string& tag, const std::string& name, bool* present = nullptr) {
+    std::size_t pos = 0;
+    if (present) *present = false;
+    while ((pos = tag.find(name, pos)) != std::string::npos) {
+        bool boundary = pos > 0 && (tag[pos - 1] == ' ' || tag[pos - 1] == '\t' || tag[pos - 1] == '\n' || tag[pos - 1] == '\r');
+        std::size_t after = pos + name.size();
+        if (!boundary || (after < tag.size() && tag[after] != '=' && tag[after] != ' ' && tag[after] != '>' && tag[after] != '/')) {
+            pos = after;
+            continue;
+        }
+        if (present) *present = true;
+        while (after < tag.size() && tag[after] == ' ') ++after;
+        if (after >= tag.size() || tag[after] != '=') {
+            return "";
+        }
+        ++after;
+        while (after < tag.size() && tag[after] == ' ') ++after;
+        if (after < tag.size() && (tag[after] == '"' || tag[after] == '\'')) {
+            std::size_t end = tag.find(tag[after], after + 1);
+            return tag.substr(after + 1, end == std::string::npos ? std::string::npos : end - after - 1);
+        }
+        std::size_t end = tag.find_first_of(" >", after);
+        return tag.substr(after, end == std::string::npos ? std::string::npos : end - after);
+    }
+    return "";
+}
+
+// Every url(...) target in a piece of CSS, skipping data: URIs.
+inline std::vector<std::string> cssUrls(const std::string& css) {
+    std::vector<std::string> urls;
+    std::size_t pos = 0;
+    while ((pos = css.find("url(", pos)) != std::string::npos) {
+        pos += 4;
+        std::size_t end = css.find(')', pos);
+        if (end == std::string::npos) break;
+        std::string url = css.substr(pos, end - pos);
+        while (!url.empty() && (url.front() == ' ' || url.front() == '"' || url.front() == '\'')) url.erase(0, 1);
+        while (!url.empty() && (url.back() == ' ' || url.back() == '"' || url.back() == '\'')) url.pop_back();
+        if (!url.empty() && url.rfind("data:", 0) != 0) {
+            urls.push_back(url);
+        }
+        pos = end;
+    }
+    return urls;
+}
+
+// The font file a current browser would fetch for each @font-face: the first
+// src entry in a format it supports (WOFF2, WOFF, TrueType, OpenType).
+inline std::vector<std::string> fontFaceUrls(const std::string& css) {
+    std::vector<std::string> urls;
+    std::size_t pos = 0;
+    while ((pos = css.find("@font-face", pos)) != std::string::npos) {
+        std::size_t end = css.find('}', pos);
+        if (end == std::string::npos) break;
+        std::string block = css.substr(pos, end - pos);
+        pos = end;
+        // Only the last src declaration counts.
+        std::size_t src = block.rfind("src:");
+        if (src == std::string::npos) continue;
+        std::string list = block.substr(src);
+        std::size_t item = 0;
+        while ((item = list.find("url(", item)) != std::string::npos) {
+            std::size_t close = list.find(')', item);
+            std::size_t next = list.find("url(", item + 4);
+            std::string entry = list.substr(item, (next == std::string::npos ? list.size() : next) - item);
+            std::vector<std::string> found = cssUrls(entry);
+            item = close == std::string::npos ? list.size() : close;
+            if (found.empty()) continue;
+            std::string file = stripQuery(found[0]);
+            std::string ext = fs::path(file).extension().string();
+            bool usable = entry.find("woff2") != std::string::npos || entry.find("'woff'") != std::string::npos ||
+                          entry.find("\"woff\"") != std::string::npos || entry.find("truetype") != std::string::npos ||
+                          entry.find("opentype") != std::string::npos;
+            if (entry.find("format(") == std::string::npos) {
+                usable = ext == ".woff2" || ext == ".woff" || ext == ".ttf" || ext == ".otf";
+            }
+            if (usable) {
+                urls.push_back(found[0]);
+                break;
+            }
+        }
+    }
+    return urls;
+}
+
+// The resource graph of one page.
+class Page {
+public:
+    std::vector<Resource> resources;
+
+    // Parses 'page' and every local stylesheet it links. 'gallery' is the directory
+    // prefix of carousel images (e.g. "caro/").
+    bool load(const fs::path& page, const std::string& gallery, const NetworkProfile& net, std::string& error) {
+        std::string html = readText(page);
+        if (html.empty()) {
+            error = "cannot read " + page.string();
+            return false;
+        }
+        root_ = page.parent_path();
+        net_ = net;
+
+        Resource doc;
+        doc.url = page.filename().string();
+        doc.path = page;
+        doc.kind = Kind::Document;
+        doc.priority = 0;
+        doc.trigger = Trigger::Navigation;
+        resources.push_back(doc);
+        size(resources.back());
+
+        bool in_head = true;
+        std::size_t pos = 0;
+        while ((pos = html.find('<', pos)) != std::string::npos) {
+            if (html.compare(pos, 4, "<!--") == 0) {
+                std::size_t end = html.find("-->", pos);
+                pos = end == std::string::npos ? html.size() : end + 3;
+                continue;
+            }
+            std::size_t end = html.find('>', pos);
+            if (end == std::string::npos) break;
+            std::string tag = html.substr(pos, end - pos + 1);
+            std::size_t offset = pos;
+            pos = end + 1;
+
+            std::string name;
+            for (std::size_t i = 1; i < tag.size() && std::isalnum(static_cast<unsigned char>(tag[i])); ++i) {
+                name += static_cast<char>(std::tolower(static_cast<unsigned char>(tag[i])));
+            }
+            if (name == "body") {
+                in_head = false;
+            } else if (name == "link" && attribute(tag, "rel") == "stylesheet") {
+                int index = add(attribute(tag, "href"), Kind::Stylesheet, 0, Trigger::HtmlOffset, offset);
+                if (index >= 0) {
+                    resources[index].render_blocking = in_head;
+                    stylesheet(index);
+                }
+            } else if (name == "script") {
+                bool async = false, defer = false;
+                attribute(tag, "async", &async);
+                attribute(tag, "defer", &defer);
+                std::string src = attribute(tag, "src");
+                if (!src.empty()) {
+                    int index = add(src, Kind::Script, async ? 3 : 1, Trigger::HtmlOffset, offset);
+                    if (index >= 0) resources[index].sync_script = !async && !defer;
+                }
+                std::size_t close = html.find("</script>", pos);
+                pos = close == std::string::npos ? html.size() : close; // Script bodies hold no tags
+            } else if (name == "style") {
+                std::size_t close = html.find("</style>", pos);
+                std::string css = html.substr(pos, (close == std::string::npos ? html.size() : close) - pos);
+                for (const auto& url : cssUrls(css)) {
+                    add(url, Kind::Image, 3, Trigger::FirstPaint, offset);
+                }
+                pos = close == std::string::npos ? html.size() : close;
+            } else if (name == "img") {
+                int index = add(attribute(tag, "src"), Kind::Image, 3, Trigger::HtmlOffset, offset);
+                if (index >= 0) {
+                    resources[index].gallery = stripQuery(resources[index].url).rfind(gallery, 0) == 0;
+                    fallback(index, attribute(tag, "onerror"));
+                }
+            }
+            // Backgrounds set in style attributes load once styles are computed.
+            bool has_style = false;
+            std::string style = attribute(tag, "style", &has_style);
+            if (has_style) {
+                for (const auto& url : cssUrls(style)) {
+                    add(url, Kind::Image, 3, Trigger::FirstPaint, offset);
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    // Sets the wire size of a resource from its file (or the external assumption).
+    void size(Resource& r) {
+        const std::uint64_t headers = 300; // Response status line and headers
+        if (!r.origin.empty()) {
+            r.bytes = static_cast<std::uint64_t>(net_.external_kb * 1024) + headers;
+            return;
+        }
+        std::error_code ec;
+        std::uintmax_t file = fs::file_size(r.path, ec);
+        if (ec || !fs::is_regular_file(r.path, ec)) {
+            r.missing = true;
+            r.bytes = headers;
+            return;
+        }
+        bool text = r.kind == Kind::Document || r.kind == Kind::Stylesheet || r.kind == Kind::Script;
+        r.bytes = static_cast<std::uint64_t>(text ? file * net_.text_ratio : file) + headers;
+    }
+
+    // Adds a resource (once per URL), resolving it against 'base'. Returns its index or -1.
+    int add(const std::string& url, Kind kind, int priority, Trigger trigger, std::size_t offset,
+            const fs::path& base = fs::path()) {
+        if (url.empty() || url.rfind("data:", 0) == 0) {
+            return -1;
+        }
+        Resource r;
+        r.url = url;
+        r.kind = kind;
+        r.priority = priority;
+        r.trigger = trigger;
+        r.html_offset = offset;
+        if (isExternal(url)) {
+            r.origin = originOf(url);
+        } else {
+            r.path = (base.empty() ? root_ : base) / stripQuery(url);
+            r.path = r.path.lexically_normal();
+        }
+        std::string key = r.origin.empty() ? r.path.string() : url;
+        auto seen = keys_.find(key);
+        if (seen != keys_.end()) {
+            return -1; // The browser's memory cache serves repeats
+        }
+        size(r);
+        resources.push_back(r);
+        keys_[key] = static_cast<int>(resources.size()) - 1;
+        return static_cast<int>(resources.size()) - 1;
+    }
+
+    // Web fonts of a local stylesheet.
+    void stylesheet(int index) {
+        if (!resources[index].origin.empty() || resources[index].missing) {
+            return;
+        }
+        fs::path path = resources[index].path;
+        std::string css = readText(path);
+        for (const auto& url : fontFaceUrls(css)) {
+            add(url, Kind::Font, 1, Trigger::FirstPaint, resources[index].html_offset, path.parent_path());
+        }
+    }
+
+    // Links the src named by "this.src='...'" in an onerror handler.
+    void fallback(int index, const std::string& onerror) {
+        std::size_t pos = onerror.find("this.src=");
+        if (pos == std::string::npos) {
+            return;
+        }
+        pos += 9;
+        if (pos >= onerror.size()) return;
+        char quote = onerror[pos];
+        std::size_t end = onerror.find(quote, pos + 1);
+        if (end == std::string::npos) return;
+        int alt = add(onerror.substr(pos + 1, end - pos - 1), Kind::Image, 3, Trigger::AfterFailure,
+                      resources[index].html_offset);
+        if (alt >= 0) {
+            resources[index].fallback = alt;
+            resources[alt].fallback_of = index;
+            resources[alt].gallery = resources[index].gallery;
+        }
+    }
+
+    fs::path root_;
+    NetworkProfile net_;
+    std::map<std::string, int> keys_;
+};
+
+// Runs the page's resources over the network model and fills in their timings.
+inline Metrics simulate(std::vector<Resource>& res, const NetworkProfile& net) {
+    struct Connection {
+        std::string origin;
+        int resource = -1;        // In flight, or -1 when idle
+        double ready_at = 0;      // End of the handshake or of the request round trip
+        bool receiving = false;
+        double remaining = 0;     // Bytes still to arrive
+        double cwnd = 14600;      // Congestion window in bytes (10 segments)
+    };
+    const double link = net.kbps * 1000 / 8 / 1000; // Bytes per millisecond
+    const double rtt = net.rtt_ms;
+    std::vector<Connection> conns;
+    std::vector<bool> queued(res.size(), false);
+    double first_paint = -1;
+    double html_received = 0; // Bytes of the page received so far (for discovery)
+    Metrics m;
+
+    for (double t = 0; t < 30 * 60 * 1000; t += 1) {
+        // Discovery.
+        for (std::size_t i = 0; i < res.size(); ++i) {
+            Resource& r = res[i];
+            if (r.discovered >= 0) continue;
+            bool now = false;
+            switch (r.trigger) {
+                case Trigger::Navigation: now = true; break;
+                case Trigger::HtmlOffset: now = html_received >= static_cast<double>(r.html_offset) * net.text_ratio; break;
+                case Trigger::FirstPaint: now = first_paint >= 0; break;
+                case Trigger::AfterFailure:
+                    now = r.fallback_of >= 0 && res[r.fallback_of].missing && res[r.fallback_of].done >= 0;
+                    break;
+            }
+            if (now) {
+                r.discovered = t;
+                queued[i] = true;
+            }
+        }
+
+        // Hand waiting requests to connections, most important first.
+        std::vector<int> waiting;
+        for (std::size_t i = 0; i < res.size(); ++i) {
+            if (queued[i] && res[i].started < 0) waiting.push_back(static_cast<int>(i));
+        }
+        std::stable_sort(waiting.begin(), waiting.end(), [&](int a, int b) { return res[a].priority < res[b].priority; });
+        for (int i : waiting) {
+            Resource& r = res[i];
+            Connection* idle = nullptr;
+            int open = 0;
+            for (auto& c : conns) {
+                if (c.origin != r.origin) continue;
+                ++open;
+                if (c.resource < 0 && !idle) idle = &c;
+            }
+            if (!idle && open >= net.connections) continue;
+            if (!idle) {
+                conns.push_back(Connection());
+                idle = &conns.back();
+                idle->origin = r.origin;
+                idle->ready_at = t + net.handshake_rtts * rtt;
+            } else {
+                idle->ready_at = t;
+            }
+            idle->resource = i;
+            idle->ready_at += rtt; // Request out, first byte back
+            idle->receiving = false;
+            idle->remaining = static_cast<double>(r.bytes);
+            r.started = t;
+        }
+
+        // Share the downlink between receiving connections, each capped by its window.
+        std::vector<Connection*> active;
+        for (auto& c : conns) {
+            if (c.resource < 0) continue;
+            if (!c.receiving && t >= c.ready_at) {
+                c.receiving = true;
+                res[c.resource].first_byte = t;
+            }
+            if (c.receiving) active.push_back(&c);
+        }
+        std::sort(active.begin(), active.end(), [](const Connection* a, const Connection* b) { return a->cwnd < b->cwnd; });
+        double capacity = link;
+        for (std::size_t k = 0; k < active.size(); ++k) {
+            Connection& c = *active[k];
+            double fair = capacity / static_cast<double>(active.size() - k);
+            double share = std::min({fair, c.cwnd / rtt, c.remaining});
+            capacity -= share;
+            c.remaining -= share;
+            c.cwnd += share; // Slow start: the window grows by what was acknowledged
+            Resource& r = res[c.resource];
+            if (r.kind == Kind::Document) html_received += share;
+            if (c.remaining <= 1e-9) {
+                r.done = t + 1;
+                c.resource = -1;
+                c.receiving = false;
+            }
+        }
+
+        // First paint: the page and the stylesheets in <head> are in.
+        if (first_paint < 0) {
+            bool ready = res[0].done >= 0;
+            for (const auto& r : res) {
+                if (r.render_blocking && r.done < 0) ready = false;
+            }
+            if (ready) first_paint = t + 1;
+        }
+
+        // Done when everything has arrived, except fallbacks whose primary loaded.
+        bool all_done = true;
+        for (const auto& r : res) {
+            bool unused = r.fallback_of >= 0 && !res[r.fallback_of].missing;
+            if (r.done < 0 && !unused) all_done = false;
+        }
+        if (all_done) break;
+    }
+
+    // Milestones.
+    m.first_paint = first_paint;
+    double scripts = first_paint;
+    for (const auto& r : res) {
+        if (r.sync_script) scripts = std::max(scripts, r.done); // Scripts run in order once all are in
+    }
+    m.content_visible = scripts;
+    m.first_slide = -1;
+    m.carousel_complete = 0;
+    for (const auto& r : res) {
+        if (r.started >= 0) {
+            ++m.requests;
+            m.bytes += r.bytes;
+            if (r.missing) ++m.failed_requests;
+        }
+        if (r.done >= 0) m.load = std::max(m.load, r.done);
+        if (!r.gallery || r.done < 0 || r.missing) continue;
+        m.carousel_complete = std::max(m.carousel_complete, r.done);
+        if (m.first_slide < 0) m.first_slide = std::max(r.done, m.content_visible);
+    }
+    if (m.first_slide < 0) m.first_slide = m.content_visible;
+    if (m.carousel_complete == 0) m.carousel_complete = m.content_visible;
+    return m;
+}
+
+// The report that 'pageload --save' writes and '--compare' reads back.
+inline std::string renderReport(const std::vector<Resource>& res, const Metrics& m, const NetworkProfile& net) {
+    std::ostringstream out;
+    out << "{\n  \"profile\": {\"name\": \"" << net.name << "\", \"kbps\": " << net.kbps << ", \"rtt_ms\": " << net.rtt_ms
+        << ", \"connections\": " << net.connections << "},\n";
+    out << "  \"metrics\": {\"first_paint_ms\": " << m.first_paint << ", \"content_visible_ms\": " << m.content_visible
+        << ", \"first_slide_ms\": " << m.first_slide << ", \"carousel_complete_ms\": " << m.carousel_complete
+        << ", \"load_ms\": " << m.load << ", \"bytes\": " << m.bytes << ", \"requests\": " << m.requests
+        << ", \"failed_requests\": " << m.failed_requests << "},\n";
+    out << "  \"resources\": [";
+    bool first = true;
+    for (const auto& r : res) {
+        if (r.started < 0) continue;
+        out << (first ? "\n" : ",\n") << "    {\"url\": \"" << r.url << "\", \"kind\": \"" << kindName(r.kind)
+            << "\", \"bytes\": " << r.bytes << ", \"status\": " << (r.missing ? 404 : 200) << ", \"start_ms\": " << r.started
+            << ", \"end_ms\": " << r.done << "}";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+// Reads a number stored as "key": value in a saved report (NaN if absent, not a number
+// or not finite).
+inline double reportNumber(const std::string& text, const std::string& key) {
+    std::size_t pos = text.find("\"" + key + "\":");
+    if (pos == std::string::npos) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    const char* start = text.c_str() + pos + key.size() + 3;
+    char* end = nullptr;
+    double value = std::strtod(start, &end);
+    return end != start && std::isfinite(value) ? value : std::numeric_limits<double>::quiet_NaN();
+}
+
+} // namespace pageload
@@ -0,0 +1,247 @@
+// palette.hpp - Dominant color, average color and palette of an image.
+//
+// Works on a 1/8-scale decode (JPEG DC terms, PNG 8x8 box means), which keeps
+// the colors of every region while touching 1/64 of the pixels. Pixels are
+// binned into a 4096-entry histogram (4 bits per channel; the bin indices are
+// computed 4 or 8 pixels at a time with SSE2/AVX2), then the busiest bins are
+// merged greedily into clusters of similar color. The largest cluster is the
+// dominant color; the first few make the palette. Mostly transparent pixels
+// are ignored.
+#pragma once
+
+#include <algorithm>    // For std::sort, std::min
+#include <array>        // For RGB triples
+#include <cstdint>      // For fixed-width integers
+#include <cstdio>       // For std::snprintf
+#include <filesystem>   // For fs::path
+#include <string>       // For hex colors and errors
+#include <vector>       // For the histogram and clusters
+
+#include "jpeg.hpp"
+#include "mapped_file.hpp"
+#include "png.hpp"
+#include "simd.hpp"
+
+namespace palette {
+
+constexpr int BINS = 4096;
+constexpr std::uint16_t SKIPPED = BINS; // Bin index of transparent pixels
+
+// ---------------------------------------------------------------------------
+// Bin indices: (r >> 4) << 8 | (g >> 4) << 4 | (b >> 4), or SKIPPED if alpha < 128.
+// ---------------------------------------------------------------------------
+
+inline void binPixelsScalar(const std::uint8_t* rgba, std::size_t n, std::uint16_t* bins) {
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::uint8_t* p = rgba + 4 * i;
+        bins[i] = p[3] < 128 ? SKIPPED : static_cast<std::uint16_t>(((p[0] >> 4) << 8) | ((p[1] >> 4) << 4) | (p[2] >> 4));
+    }
+}
+
+#if CARO_X86_SIMD
+// Each 32-bit lane holds one pixel as r | g << 8 | b << 16 | a << 24.
+inline void binPixelsSse2(const std::uint8_t* rgba, std::size_t n, std::uint16_t* bins) {
+    const __m128i nibble = _mm_set1_epi32(0xF);
+    const __m128i half = _mm_set1_epi32(128);
+    const __m128i skipped = _mm_set1_epi32(SKIPPED);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i out[2];
+        for (int h = 0; h < 2; ++h) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + 4 * (i + 4 * h)));
+            __m128i r = _mm_and_si128(_mm_srli_epi32(v, 4), nibble);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(v, 12), nibble);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(v, 20), nibble);
+            __m128i bin = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 8), _mm_slli_epi32(g, 4)), b);
+            __m128i clear = _mm_cmplt_epi32(_mm_srli_epi32(v, 24), half);
+            out[h] = _mm_or_si128(_mm_and_si128(clear, skipped), _mm_andnot_si128(clear, bin));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bins + i), _mm_packs_epi32(out[0], out[1]));
+    }
+    binPixelsScalar(rgba + 4 * i, n - i, bins + i);
+}
+
+CARO_TARGET_AVX2 inline void binPixelsAvx2(const std::uint8_t* rgba, std::size_t n, std::uint16_t* bins) {
+    const __m256i nibble = _mm256_set1_epi32(0xF);
+    const __m256i half = _mm256_set1_epi32(128);
+    const __m256i skipped = _mm256_set1_epi32(SKIPPED);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i out[2];
+        for (int h = 0; h < 2; ++h) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + 4 * (i + 8 * h)));
+            __m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 4), nibble);
+            __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 12), nibble);
+            __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 20), nibble);
+            __m256i bin = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 8), _mm256_slli_epi32(g, 4)), b);
+            __m256i clear = _mm256_cmpgt_epi32(half, _mm256_srli_epi32(v, 24));
+            out[h] = _mm256_blendv_epi8(bin, skipped, clear);
+        }
+        // packs works per 128-bit lane; the permute restores pixel order.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(out[0], out[1]), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(bins + i), packed);
+    }
+    binPixelsSse2(rgba + 4 * i, n - i, bins + i);
+}
+#endif
+
+inline void binPixels(const std::uint8_t* rgba, std::size_t n, std::uint16_t* bins) {
+#if CARO_X86_SIMD
+    switch (activeSimdLevel()) {
+    case SimdLevel::Avx2: binPixelsAvx2(rgba, n, bins); return;
+    case SimdLevel::Sse2: binPixelsSse2(rgba, n, bins); return;
+    default: break;
+    }
+#endif
+    binPixelsScalar(rgba, n, bins);
+}
+
+// ---------------------------------------------------------------------------
+// Histogram and clusters
+// ---------------------------------------------------------------------------
+
+struct Histogram {
+    std::vector<std::uint32_t> count = std::vector<std::uint32_t>(BINS + 1, 0); // Last entry: skipped pixels
+    std::vector<std::uint32_t> sum = std::vector<std::uint32_t>(BINS * 3, 0);   // R, G, B sums per bin
+
+    void add(const std::uint8_t* rgba, std::size_t n) {
+        std::uint16_t bins[1024];
+        for (std::size_t start = 0; start < n; start += 1024) {
+            std::size_t len = std::min<std::size_t>(1024, n - start);
+            const std::uint8_t* px = rgba + 4 * start;
+            binPixels(px, len, bins);
+            for (std::size_t i = 0; i < len; ++i, px += 4) {
+                std::uint16_t bin = bins[i];
+                ++count[bin];
+                if (bin != SKIPPED) {
+                    std::uint32_t* s = sum.data() + 3 * bin;
+                    s[0] += px[0];
+                    s[1] += px[1];
+                    s[2] += px[2];
+                }
+            }
+        }
+    }
+};
+
+using Rgb = std::array<std::uint8_t, 3>;
+
+struct Colors {
+    Rgb dominant = {};
+    Rgb average = {};
+    std::vector<Rgb> palette; // Most common first, dominant included
+};
+
+// Clusters a histogram. Returns false if every pixel was transparent.
+inline bool analyze(const Histogram& hist, Colors& out, std::size_t max_colors = 5) {
+    struct Cluster {
+        double r, g, b;
+        std::uint64_t count;
+    };
+    std::vector<int> order;
+    std::uint64_t total = 0;
+    double avg[3] = {0, 0, 0};
+    for (int bin = 0; bin < BINS; ++bin) {
+        if (hist.count[bin]) {
+            order.push_back(bin);
+            total += hist.count[bin];
+            for (int c = 0; c < 3; ++c) {
+                avg[c] += hist.sum[3 * bin + c];
+            }
+        }
+    }
+    if (total == 0) {
+        return false;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return hist.count[a] > hist.count[b]; });
+
+    // Merge each bin into the nearest cluster within reach, busiest bins first.
+    const double reach = 40.0 * 40.0;
+    std::vector<Cluster> clusters;
+    for (int bin : order) {
+        double n = hist.count[bin];
+        double r = hist.sum[3 * bin] / n, g = hist.sum[3 * bin + 1] / n, b = hist.sum[3 * bin + 2] / n;
+        Cluster* nearest = nullptr;
+        double best = reach;
+        for (auto& cluster : clusters) {
+            double d = (cluster.r - r) * (cluster.r - r) + (cluster.g - g) * (cluster.g - g) + (cluster.b - b) * (cluster.b - b);
+            if (d < best) {
+                best = d;
+                nearest = &cluster;
+            }
+        }
+        if (!nearest) {
+            clusters.push_back({r, g, b, hist.count[bin]});
+            continue;
+        }
+        double w = n / static_cast<double>(nearest->count + hist.count[bin]);
+        nearest->r += (r - nearest->r) * w;
+        nearest->g += (g - nearest->g) * w;
+        nearest->b += (b - nearest->b) * w;
+        nearest->count += hist.count[bin];
+    }
+    std::sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.count > b.count; });
+
+    auto rgb = [](double r, double g, double b) {
+        return Rgb{static_cast<std::uint8_t>(r + 0.5), static_cast<std::uint8_t>(g + 0.5), static_cast<std::uint8_t>(b + 0.5)};
+    };
+    out.dominant = rgb(clusters[0].r, clusters[0].g, clusters[0].b);
+    out.average = rgb(avg[0] / total, avg[1] / total, avg[2] / total);
+    out.palette.clear();
+    for (const auto& cluster : clusters) {
+        // Colors covering less than 2% of the image are noise, not palette.
+        if (out.palette.size() == max_colors || cluster.count * 50 < total) {
+            break;
+        }
+        out.palette.push_back(rgb(cluster.r, cluster.g, cluster.b));
+    }
+    return true;
+}
+
+inline std::string hexColor(const Rgb& rgb) {
+    char buf[8];
+    std::snprintf(buf, sizeof buf, "#%02x%02x%02x", rgb[0], rgb[1], rgb[2]);
+    return buf;
+}
+
+// Decodes a PNG or JPEG at 1/8 scale into RGBA.
+inline bool thumbnail(const fs::path& path, const std::string& format, int& w, int& h, std::vector<std::uint8_t>& rgba,
+                      std::string& error) {
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "cannot read file";
+        return false;
+    }
+    if (format == "png") {
+        return png::decodeScaled(file.data(), file.size(), w, h, rgba, error);
+    }
+    if (format == "jpeg") {
+        jpeg::CoefImage img;
+        return jpeg::decodeCoefficients(file.data(), file.size(), img, error) && jpeg::dcThumbnail(img, w, h, rgba, error);
+    }
+    error = format + " images are not supported";
+    return false;
+}
+
+// Analyzes the colors of w x h RGBA pixels.
+inline bool pixelColors(const std::vector<std::uint8_t>& rgba, int w, int h, Colors& out, std::string& error) {
+    Histogram hist;
+    hist.add(rgba.data(), static_cast<std::size_t>(w) * h);
+    if (!analyze(hist, out)) {
+        error = "image is fully transparent";
+        return false;
+    }
+    return true;
+}
+
+// Decodes a PNG or JPEG at 1/8 scale and analyzes its colors.
+inline bool imageColors(const fs::path& path, const std::string& format, Colors& out, std::string& error) {
+    int w = 0, h = 0;
+    std::vector<std::uint8_t> rgba;
+    if (!thumbnail(path, format, w, h, rgba, error)) {
+        return false;
+    }
+    return pixelColors(rgba, w, h, out, error);
+}
+
+} // namespace palette
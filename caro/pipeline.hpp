@@ -0,0 +1,359 @@
+// pipeline.hpp - Priority-aware staged job scheduler for gallery processing.
+//
+// Every image in the gallery becomes a Job. Jobs flow through a list of
+// stages (probe, analysis, re-encoding, ...) and each stage always picks the
+// most important job it has waiting, so the first carousel slides are finished
+// long before the archive in not-good/. Finished jobs are handed back to the
+// caller in growing batches so the manifest can be republished while the long
+// tail is still running. Optional hooks let the caller read sources ahead of
+// the first stage and release them after the last. With setAdaptive() a
+// controller thread resizes the stages while they run (see concurrency.hpp).
+#pragma once
+
+#include <algorithm>          // For std::sort, std::max
+#include <atomic>             // For per-stage counters
+#include <chrono>             // For busy time and the controller interval
+#include <condition_variable> // For waking idle workers
+#include <cstdint>            // For std::uintmax_t
+#include <deque>              // For stable job storage
+#include <filesystem>         // For fs::path
+#include <functional>         // For stage callbacks
+#include <memory>             // For std::unique_ptr
+#include <mutex>              // For queue protection
+#include <queue>              // For std::priority_queue
+#include <string>             // For names and errors
+#include <thread>             // For worker threads
+#include <utility>            // For std::pair
+#include <vector>             // For stage and batch lists
+
+#include "concurrency.hpp"
+#include "image_probe.hpp"
+
+namespace fs = std::filesystem;
+
+// Visibility tiers, in scheduling order.
+enum JobTier {
+    TIER_VISIBLE = 0,  // Slides the visitor sees (or that are preloaded) right away
+    TIER_CAROUSEL = 1, // The rest of the live carousel
+    TIER_ARCHIVE = 2   // Images parked in not-good/, never shown on the page
+};
+
+// One image travelling through the pipeline.
+struct Job {
+    int number = 0;            // Carousel position taken from the filename
+    fs::path path;             // Full path to the source image
+    std::string extension;     // Extension without the dot
+    std::string section;       // Site-relative directory, e.g. "caro" or "caro/not-good"
+    int tier = TIER_CAROUSEL;  // Visibility tier, see JobTier
+    std::uintmax_t bytes = 0;  // File size on disk
+    ImageInfo info;            // Header information filled in by the probe stage
+    // Extra manifest fields contributed by later stages: key and raw JSON value.
+    std::vector<std::pair<std::string, std::string>> fields;
+    bool cached = false;       // Source was fully in the page cache before the run
+    bool failed = false;       // Set by a stage that could not process the job
+    std::string error;         // Why the job failed
+};
+
+// Ordering used by every stage queue: lower tier first, then lower carousel position.
+inline bool jobBefore(const Job& a, const Job& b) {
+    if (a.tier != b.tier) {
+        return a.tier < b.tier;
+    }
+    return a.number < b.number;
+}
+
+// A processing step applied to every job.
+struct Stage {
+    std::string name;               // Shown in logs
+    std::function<void(Job&)> run;  // Work to do; may set job.failed
+    int workers = 1;                // Number of threads serving this stage (the starting count when adaptive)
+};
+
+class Pipeline {
+public:
+    // Adds a stage to the end of the pipeline.
+    void addStage(const std::string& name, std::function<void(Job&)> run, int workers = 1) {
+        stages_.push_back({name, std::move(run), std::max(1, workers)});
+    }
+
+    // Calls 'prefetch' (from a separate thread) for each job 'depth' jobs before the
+    // first stage takes it, in the order the first stage will take them.
+    void setPrefetch(std::size_t depth, std::function<void(Job&)> prefetch) {
+        prefetch_depth_ = depth;
+        prefetch_ = std::move(prefetch);
+    }
+
+    // Calls 'release' for each job once it has left the last stage.
+    void setRelease(std::function<void(Job&)> release) {
+        release_ = std::move(release);
+    }
+
+    // Lets a controller change the worker count of every stage while run() is in progress,
+    // starting from the counts given to addStage(). Decisions are passed to 'log'.
+    void setAdaptive(concurrency::Limits limits, std::function<void(const std::string&)> log) {
+        adaptive_ = true;
+        limits_ = limits;
+        log_ = std::move(log);
+    }
+
+    // Worker count of every stage at the end of the last run (or as configured before it).
+    std::vector<std::pair<std::string, int>> workers() const {
+        std::vector<std::pair<std::string, int>> counts;
+        for (std::size_t s = 0; s < stages_.size(); ++s) {
+            counts.emplace_back(stages_[s].name, s < queues_.size() ? queues_[s]->active : stages_[s].workers);
+        }
+        return counts;
+    }
+
+    // Runs every job through every stage. on_batch is called from the calling thread
+    // with all jobs finished so far (in carousel order) whenever a batch completes:
+    // first after first_batch jobs, then after twice as many more, and so on, and
+    // once more when everything is done.
+    void run(std::deque<Job>& jobs, std::size_t first_batch,
+             const std::function<void(const std::vector<const Job*>&, bool)>& on_batch) {
+        if (jobs.empty()) {
+            on_batch({}, true);
+            return;
+        }
+
+        queues_.clear();
+        for (std::size_t s = 0; s <= stages_.size(); ++s) { // The extra queue collects finished jobs
+            queues_.push_back(std::make_unique<StageQueue>());
+            queues_.back()->active = s < stages_.size() ? stages_[s].workers : 0;
+        }
+        for (auto& job : jobs) {
+            queues_[0]->items.push(&job);
+        }
+        total_ = jobs.size();
+        first_taken_ = 0;
+
+        // With every job queued up front, the first stage takes them in priority order.
+        std::thread prefetcher;
+        if (prefetch_ && prefetch_depth_ > 0) {
+            std::vector<Job*> order;
+            for (auto& job : jobs) {
+                order.push_back(&job);
+            }
+            std::sort(order.begin(), order.end(), [](const Job* a, const Job* b) { return jobBefore(*a, *b); });
+            prefetcher = std::thread([this, order] {
+                for (std::size_t issued = 0; issued < order.size(); ++issued) {
+                    {
+                        std::unique_lock<std::mutex> lock(prefetch_mutex_);
+                        prefetch_ready_.wait(lock, [&] { return issued < first_taken_ + prefetch_depth_; });
+                    }
+                    prefetch_(*order[issued]);
+                }
+            });
+        }
+
+        threads_.clear();
+        for (std::size_t s = 0; s < stages_.size(); ++s) {
+            spawnWorkers(s, stages_[s].workers);
+        }
+        std::thread controller;
+        stop_controller_ = false;
+        if (adaptive_) {
+            controller = std::thread([this] { controllerLoop(); });
+        }
+
+        // Publisher: wait for finished jobs and hand them out in growing batches.
+        std::vector<const Job*> finished;
+        std::size_t next_batch = std::max<std::size_t>(1, first_batch);
+        std::size_t batch_size = next_batch;
+        StageQueue& done = *queues_[stages_.size()];
+        while (finished.size() < total_) {
+            {
+                std::unique_lock<std::mutex> lock(done.mutex);
+                done.ready.wait(lock, [&] { return !done.items.empty(); });
+                while (!done.items.empty()) {
+                    finished.push_back(done.items.top());
+                    done.items.pop();
+                }
+            }
+            if (finished.size() >= next_batch && finished.size() < total_) {
+                std::vector<const Job*> snapshot = finished;
+                std::sort(snapshot.begin(), snapshot.end(),
+                          [](const Job* a, const Job* b) { return jobBefore(*a, *b); });
+                on_batch(snapshot, false);
+                batch_size *= 2; // Later batches are larger: fewer rewrites for the long tail
+                next_batch = finished.size() + batch_size;
+            }
+        }
+
+        if (controller.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(controller_mutex_);
+                stop_controller_ = true;
+            }
+            controller_wake_.notify_one();
+            controller.join(); // Only the controller adds threads, so threads_ is stable from here on
+        }
+        for (auto& t : threads_) {
+            t.join();
+        }
+        if (prefetcher.joinable()) {
+            prefetcher.join();
+        }
+
+        std::sort(finished.begin(), finished.end(),
+                  [](const Job* a, const Job* b) { return jobBefore(*a, *b); });
+        on_batch(finished, true);
+    }
+
+private:
+    // Orders the priority queue so that top() is the most important job.
+    struct JobAfter {
+        bool operator()(const Job* a, const Job* b) const { return jobBefore(*b, *a); }
+    };
+
+    struct StageQueue {
+        std::priority_queue<Job*, std::vector<Job*>, JobAfter> items;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::size_t taken = 0; // Jobs already popped by this stage's workers
+        int active = 0;        // Workers allowed to take jobs; the others wait
+        int spawned = 0;       // Worker threads started for this stage
+        std::atomic<std::uint64_t> completed{0}; // Jobs this stage has finished
+        std::atomic<std::uint64_t> bytes{0};     // Their source bytes
+        std::atomic<std::uint64_t> busy_ns{0};   // Time its workers spent running jobs
+    };
+
+    // Starts workers for stage 's' until it has 'count' threads.
+    void spawnWorkers(std::size_t s, int count) {
+        StageQueue& in = *queues_[s];
+        int first = 0;
+        {
+            std::lock_guard<std::mutex> lock(in.mutex);
+            first = in.spawned;
+            in.spawned = std::max(in.spawned, count);
+        }
+        for (int w = first; w < count; ++w) {
+            threads_.emplace_back([this, s, w] { workerLoop(s, w); });
+        }
+    }
+
+    // Samples the stages every 100 ms and applies the controller's worker counts.
+    void controllerLoop() {
+        concurrency::Controller control(limits_, log_);
+        std::vector<std::uint64_t> completed(stages_.size(), 0);
+        std::vector<std::uint64_t> bytes(stages_.size(), 0);
+        std::vector<std::uint64_t> busy_ns(stages_.size(), 0);
+        auto last = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> wait_lock(controller_mutex_);
+        while (!controller_wake_.wait_for(wait_lock, std::chrono::milliseconds(100), [this] { return stop_controller_; })) {
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - last).count();
+            last = now;
+            std::vector<concurrency::StageSample> samples(stages_.size());
+            for (std::size_t s = 0; s < stages_.size(); ++s) {
+                StageQueue& in = *queues_[s];
+                concurrency::StageSample& sample = samples[s];
+                sample.name = stages_[s].name;
+                {
+                    std::lock_guard<std::mutex> lock(in.mutex);
+                    sample.workers = in.active;
+                    sample.queued = in.items.size();
+                    sample.drained = in.taken == total_;
+                }
+                std::uint64_t done = in.completed.load();
+                std::uint64_t done_bytes = in.bytes.load();
+                std::uint64_t busy = in.busy_ns.load();
+                sample.completed = done - completed[s];
+                sample.busy = static_cast<double>(busy - busy_ns[s]) / 1e9;
+                sample.bytes = done_bytes - bytes[s];
+                completed[s] = done;
+                bytes[s] = done_bytes;
+                busy_ns[s] = busy;
+            }
+            std::vector<int> counts = control.update(samples, seconds, concurrency::residentMemory());
+            for (std::size_t s = 0; s < stages_.size(); ++s) {
+                if (counts[s] == samples[s].workers) {
+                    continue;
+                }
+                spawnWorkers(s, counts[s]);
+                {
+                    std::lock_guard<std::mutex> lock(queues_[s]->mutex);
+                    queues_[s]->active = counts[s];
+                }
+                queues_[s]->ready.notify_all();
+            }
+        }
+    }
+
+    // Serves one stage as its worker 'w' until all jobs have passed through it.
+    void workerLoop(std::size_t s, int w) {
+        StageQueue& in = *queues_[s];
+        StageQueue& out = *queues_[s + 1];
+        for (;;) {
+            Job* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(in.mutex);
+                in.ready.wait(lock, [&] { return (w < in.active && !in.items.empty()) || in.taken == total_; });
+                if (in.taken == total_) {
+                    return; // Every job has been taken by this stage
+                }
+                job = in.items.top();
+                in.items.pop();
+                ++in.taken;
+                if (in.taken == total_) {
+                    in.ready.notify_all(); // Let idle siblings exit
+                }
+            }
+            if (s == 0 && prefetch_) {
+                {
+                    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+                    ++first_taken_;
+                }
+                prefetch_ready_.notify_one();
+            }
+
+            if (!job->failed) {
+                auto start = std::chrono::steady_clock::now();
+                try {
+                    stages_[s].run(*job);
+                } catch (const std::exception& e) {
+                    job->failed = true;
+                    job->error = stages_[s].name + ": " + e.what();
+                }
+                in.busy_ns += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+            }
+            in.bytes += job->bytes;
+            ++in.completed;
+            if (s + 1 == stages_.size() && release_) {
+                release_(*job);
+            }
+
+            bool parked = false;
+            {
+                std::lock_guard<std::mutex> lock(out.mutex);
+                out.items.push(job);
+                parked = out.spawned > out.active;
+            }
+            if (parked) {
+                out.ready.notify_all(); // A parked worker could swallow a single wake-up
+            } else {
+                out.ready.notify_one();
+            }
+        }
+    }
+
+    std::vector<Stage> stages_;
+    std::vector<std::unique_ptr<StageQueue>> queues_; // StageQueue holds a mutex and cannot move
+    std::size_t total_ = 0;
+    std::vector<std::thread> threads_;
+
+    bool adaptive_ = false;
+    concurrency::Limits limits_;
+    std::function<void(const std::string&)> log_;
+    std::mutex controller_mutex_;
+    std::condition_variable controller_wake_;
+    bool stop_controller_ = false; // Guarded by controller_mutex_
+
+    std::size_t prefetch_depth_ = 0;
+    std::function<void(Job&)> prefetch_;
+    std::function<void(Job&)> release_;
+    std::mutex prefetch_mutex_;
+    std::condition_variable prefetch_ready_;
+    std::size_t first_taken_ = 0; // Jobs taken by the first stage, guarded by prefetch_mutex_
+};
@@ -0,0 +1,199 @@
+// planner.hpp - Cycle-safe batched rename planning and execution.
+//
+// Turns a set of wanted renames inside one directory into an ordered list of
+// filesystem steps that never overwrites a file: chains are executed from
+// their free end, cycles (1->2, 2->1) are broken through a temporary name,
+// and moves whose target is held by a file that stays put are rejected up
+// front. Files that must leave the directory are stashed in the object store
+// first and restored files are copied in last. A failed step rolls back every
+// step already taken, so a plan is applied completely or not at all.
+#pragma once
+
+#include <filesystem>   // For renames and removals
+#include <map>          // For ordered move maps
+#include <set>          // For name sets
+#include <string>       // For file names
+#include <utility>      // For std::pair
+#include <vector>       // For step lists
+
+#include "object_store.hpp"
+
+namespace fs = std::filesystem;
+
+enum class StepKind {
+    Move,    // Rename 'from' to 'to' inside the directory
+    Stash,   // Make sure 'from' is in the object store under 'hash', then remove it
+    Restore  // Copy object 'hash' from the store to 'to'
+};
+
+struct PlanStep {
+    StepKind kind;
+    std::string from; // Source name (Move, Stash)
+    std::string to;   // Target name (Move, Restore)
+    std::string hash; // Object hash (Stash, Restore)
+};
+
+struct RenamePlan {
+    std::vector<PlanStep> steps;          // Steps in execution order
+    std::vector<std::pair<std::string, std::string>> rejected; // Moves dropped because of conflicts
+    std::vector<std::string> reasons;     // Why each rejected move was dropped
+};
+
+// Orders 'moves' (source name -> target name) so that no step overwrites a file.
+// 'occupied' holds every name present in the directory when the moves start
+// (after any stashes). Moves onto a name that is occupied by a file which is
+// not itself moving, or onto a name claimed by another move, are rejected.
+inline void planMoves(const std::map<std::string, std::string>& moves, const std::set<std::string>& occupied,
+                      RenamePlan& plan) {
+    // Validate: every target must be unique and either free or vacated by another move.
+    std::map<std::string, std::string> pending; // source -> target
+    std::map<std::string, std::string> claimed; // target -> source
+    for (const auto& move : moves) {
+        if (move.first == move.second) {
+            continue; // Nothing to do
+        }
+        if (claimed.count(move.second)) {
+            plan.rejected.push_back(move);
+            plan.reasons.push_back("target '" + move.second + "' is already claimed by '" + claimed[move.second] + "'");
+            continue;
+        }
+        claimed[move.second] = move.first;
+        pending[move.first] = move.second;
+    }
+    // A target held by a file that does not move would be overwritten: reject the move.
+    // Rejecting one move can keep its source in place and so block another, hence the loop.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = pending.begin(); it != pending.end();) {
+            const std::string& target = it->second;
+            if (occupied.count(target) && !pending.count(target)) {
+                plan.rejected.push_back(*it);
+                plan.reasons.push_back("target '" + target + "' exists and is not being moved");
+                claimed.erase(target);
+                it = pending.erase(it);
+                changed = true;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Emit chains from their free end: a move is ready once nothing pending still sits on its target.
+    std::set<std::string> taken = occupied;
+    auto emitChainEndingAt = [&](std::string source) {
+        // Walk backwards: after 'source' moves away, the move targeting 'source' becomes ready.
+        while (pending.count(source)) {
+            std::string target = pending[source];
+            plan.steps.push_back({StepKind::Move, source, target, ""});
+            taken.erase(source);
+            taken.insert(target);
+            pending.erase(source);
+            auto previous = claimed.find(source);
+            if (previous == claimed.end()) {
+                break;
+            }
+            std::string next = previous->second;
+            claimed.erase(previous);
+            source = next;
+        }
+    };
+
+    std::vector<std::string> heads;
+    for (const auto& move : pending) {
+        if (!pending.count(move.second)) {
+            heads.push_back(move.first); // Target is free: this move starts a chain
+        }
+    }
+    for (const auto& head : heads) {
+        if (!pending.count(head)) {
+            continue;
+        }
+        claimed.erase(pending[head]);
+        emitChainEndingAt(head);
+    }
+
+    // Whatever is left forms cycles. Break each one by parking one file under a temporary name.
+    int temp_counter = 0;
+    while (!pending.empty()) {
+        std::string source = pending.begin()->first;
+        std::string target = pending[source];
+        std::string temp;
+        do {
+            temp = ".caro-tmp-" + std::to_string(temp_counter++) + "-" + source;
+        } while (taken.count(temp));
+        plan.steps.push_back({StepKind::Move, source, temp, ""});
+        taken.erase(source);
+        taken.insert(temp);
+        pending.erase(source);
+        claimed.erase(target);
+        // 'source' is free now, so the rest of the cycle unwinds as a chain.
+        auto previous = claimed.find(source);
+        if (previous != claimed.end()) {
+            std::string next = previous->second;
+            claimed.erase(previous);
+            emitChainEndingAt(next);
+        }
+        plan.steps.push_back({StepKind::Move, temp, target, ""});
+        taken.erase(temp);
+        taken.insert(target);
+    }
+}
+
+// Applies a plan inside 'dir'. Returns false and undoes every completed step if any
+// step fails; 'error' then describes the failing step.
+inline bool executePlan(const fs::path& dir, const RenamePlan& plan, const fs::path& store_dir, std::string& error) {
+    std::size_t done = 0;
+    for (; done < plan.steps.size(); ++done) {
+        const PlanStep& step = plan.steps[done];
+        std::error_code ec;
+        switch (step.kind) {
+        case StepKind::Move:
+            // Never clobber: the planner guarantees the target is free, double-check anyway.
+            if (fs::exists(dir / step.to, ec)) {
+                ec = std::make_error_code(std::errc::file_exists);
+                break;
+            }
+            fs::rename(dir / step.from, dir / step.to, ec);
+            break;
+        case StepKind::Stash:
+            if (!storeObject(store_dir, step.hash, dir / step.from)) {
+                ec = std::make_error_code(std::errc::io_error);
+                break;
+            }
+            fs::remove(dir / step.from, ec);
+            break;
+        case StepKind::Restore:
+            if (!restoreObject(store_dir, step.hash, dir / step.to)) {
+                ec = std::make_error_code(std::errc::no_such_file_or_directory);
+            }
+            break;
+        }
+        if (ec) {
+            error = "step " + std::to_string(done + 1) + " ('" + (step.from.empty() ? step.hash : step.from) +
+                    "' -> '" + step.to + "'): " + ec.message();
+            break;
+        }
+    }
+    if (done == plan.steps.size()) {
+        return true;
+    }
+
+    // Roll back in reverse order.
+    while (done-- > 0) {
+        const PlanStep& step = plan.steps[done];
+        std::error_code ec;
+        switch (step.kind) {
+        case StepKind::Move:
+            fs::rename(dir / step.to, dir / step.from, ec);
+            break;
+        case StepKind::Stash:
+            restoreObject(store_dir, step.hash, dir / step.from);
+            break;
+        case StepKind::Restore:
+            fs::remove(dir / step.to, ec);
+            break;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,891 @@
+// png.hpp - PNG decoder producing a 1/8-scale or full RGBA image, and a small encoder.
+//
+// Inflates the IDAT stream (RFC 1950/1951), undoes the row filters and averages
+// every 8x8 box of pixels into one output pixel, weighted by alpha so fully
+// transparent areas do not darken the result. All color types, bit depths and
+// Adam7 interlacing are handled; ancillary chunks other than tRNS are ignored
+// and checksums are not verified. decode() keeps every pixel instead.
+//
+// encode() writes 8-bit RGB or RGBA with per-row filters and fixed-code deflate:
+// enough for generated images such as diff heatmaps, not a replacement for an
+// optimizing encoder.
+#pragma once
+
+#include <algorithm>    // For std::min, std::upper_bound
+#include <array>        // For the CRC table
+#include <cstdint>      // For fixed-width integers
+#include <cstdlib>      // For std::abs
+#include <cstring>      // For std::memcmp, std::memcpy
+#include <string>       // For errors
+#include <vector>       // For the inflated data and the output image
+
+#include "simd.hpp"
+
+namespace png {
+
+// ---------------------------------------------------------------------------
+// Inflate
+// ---------------------------------------------------------------------------
+
+// Length and distance codes of deflate (RFC 1951, 3.2.5).
+constexpr std::uint16_t LEN_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::uint8_t LEN_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                        2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::uint16_t DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                         193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                         6145, 8193, 12289, 16385, 24577};
+constexpr std::uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                         6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+struct Huffman {
+    std::uint16_t count[16] = {};   // count[len] = number of codes of that length
+    std::uint16_t symbol[288] = {}; // Symbols ordered by code
+    std::uint16_t fast[512] = {};   // 9-bit lookahead (bit-reversed): (length << 9) | symbol, 0 if longer
+
+    // Builds the canonical code for 'n' code lengths. Incomplete codes are allowed
+    // (a lone distance code is legal); over-subscribed ones are not.
+    bool build(const std::uint8_t* lengths, int n) {
+        std::fill(std::begin(count), std::end(count), 0);
+        std::fill(std::begin(fast), std::end(fast), 0);
+        for (int i = 0; i < n; ++i) {
+            ++count[lengths[i]];
+        }
+        count[0] = 0;
+        int left = 1;
+        for (int len = 1; len < 16; ++len) {
+            left = (left << 1) - count[len];
+            if (left < 0) {
+                return false;
+            }
+        }
+        std::uint16_t offset[16] = {};
+        int next_code[16] = {};
+        int code = 0;
+        for (int len = 1; len < 16; ++len) {
+            offset[len] = static_cast<std::uint16_t>(offset[len - 1] + count[len - 1]);
+            code = (code + count[len - 1]) << 1;
+            next_code[len] = code;
+        }
+        for (int s = 0; s < n; ++s) {
+            int len = lengths[s];
+            if (len == 0) {
+                continue;
+            }
+            symbol[offset[len]++] = static_cast<std::uint16_t>(s);
+            int c = next_code[len]++;
+            if (len <= 9) {
+                int reversed = 0;
+                for (int i = 0; i < len; ++i) {
+                    reversed |= ((c >> i) & 1) << (len - 1 - i);
+                }
+                for (int fill = reversed; fill < 512; fill += 1 << len) {
+                    fast[fill] = static_cast<std::uint16_t>((len << 9) | s);
+                }
+            }
+        }
+        return true;
+    }
+};
+
+class Inflater {
+public:
+    // Inflates a zlib stream into 'out', refusing to produce more than 'limit' bytes.
+    bool inflate(const std::uint8_t* data, std::size_t len, std::size_t limit, std::vector<std::uint8_t>& out,
+                 std::string& error) {
+        if (len < 2 || (data[0] & 15) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20)) {
+            error = "bad zlib header";
+            return false;
+        }
+        data_ = data;
+        len_ = len;
+        pos_ = 2;
+        bits_ = 0;
+        nbits_ = 0;
+        out.resize(limit);
+        out_ = out.data();
+        limit_ = limit;
+        size_ = 0;
+        bool last = false;
+        while (!last) {
+            last = get(1) != 0;
+            int type = static_cast<int>(get(2));
+            bool ok = false;
+            if (type == 0) {
+                ok = stored();
+            } else if (type == 1) {
+                ok = fixedBlock();
+            } else if (type == 2) {
+                ok = dynamicBlock();
+            }
+            if (!ok || overrun_) {
+                error = overrun_ ? "truncated image data" : (error_ ? error_ : "bad deflate block");
+                return false;
+            }
+        }
+        out.resize(size_);
+        return true;
+    }
+
+private:
+    const std::uint8_t* data_ = nullptr;
+    std::size_t len_ = 0;
+    std::size_t pos_ = 0;
+    std::uint64_t bits_ = 0;
+    int nbits_ = 0;
+    bool overrun_ = false;
+    const char* error_ = nullptr;
+    std::uint8_t* out_ = nullptr; // Output buffer of 'limit_' bytes, 'size_' of them written
+    std::size_t limit_ = 0;
+    std::size_t size_ = 0;
+
+    void refill() {
+        while (nbits_ <= 56 && pos_ < len_) {
+            bits_ |= static_cast<std::uint64_t>(data_[pos_++]) << nbits_;
+            nbits_ += 8;
+        }
+    }
+
+    std::uint32_t get(int n) {
+        if (nbits_ < n) {
+            refill();
+            if (nbits_ < n) {
+                overrun_ = true;
+                return 0;
+            }
+        }
+        std::uint32_t v = static_cast<std::uint32_t>(bits_ & ((1ull << n) - 1));
+        bits_ >>= n;
+        nbits_ -= n;
+        return v;
+    }
+
+    int decode(const Huffman& h) {
+        if (nbits_ < 15) {
+            refill();
+        }
+        std::uint16_t entry = h.fast[bits_ & 511];
+        if (entry && (entry >> 9) <= nbits_) {
+            bits_ >>= entry >> 9;
+            nbits_ -= entry >> 9;
+            return entry & 511;
+        }
+        // Codes longer than 9 bits, bit by bit (canonical decoding as in zlib's puff.c).
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; ++len) {
+            code |= static_cast<int>(get(1));
+            int count = h.count[len];
+            if (code - count < first) {
+                return h.symbol[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        error_ = "bad Huffman code";
+        return -1;
+    }
+
+    bool stored() {
+        // Drop the partial byte, then hand the buffered whole bytes back to the input.
+        bits_ >>= nbits_ & 7;
+        nbits_ -= nbits_ & 7;
+        pos_ -= static_cast<std::size_t>(nbits_ / 8);
+        bits_ = 0;
+        nbits_ = 0;
+        if (pos_ + 4 > len_) {
+            overrun_ = true;
+            return false;
+        }
+        std::size_t n = data_[pos_] | (data_[pos_ + 1] << 8);
+        std::size_t check = data_[pos_ + 2] | (data_[pos_ + 3] << 8);
+        pos_ += 4;
+        if ((n ^ 0xFFFF) != check) {
+            error_ = "bad stored block length";
+            return false;
+        }
+        if (pos_ + n > len_) {
+            overrun_ = true;
+            return false;
+        }
+        if (size_ + n > limit_) {
+            error_ = "image data larger than the header says";
+            return false;
+        }
+        std::memcpy(out_ + size_, data_ + pos_, n);
+        size_ += n;
+        pos_ += n;
+        return true;
+    }
+
+    bool fixedBlock() {
+        static Huffman lit, dist;
+        static bool built = [] {
+            std::uint8_t lengths[288];
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            lit.build(lengths, 288);
+            std::fill(lengths, lengths + 30, 5);
+            dist.build(lengths, 30);
+            return true;
+        }();
+        (void)built;
+        return codes(lit, dist);
+    }
+
+    bool dynamicBlock() {
+        static const std::uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        int nlen = static_cast<int>(get(5)) + 257;
+        int ndist = static_cast<int>(get(5)) + 1;
+        int ncode = static_cast<int>(get(4)) + 4;
+        if (nlen > 286 || ndist > 30) {
+            return false;
+        }
+        std::uint8_t lengths[320] = {};
+        for (int i = 0; i < ncode; ++i) {
+            lengths[order[i]] = static_cast<std::uint8_t>(get(3));
+        }
+        Huffman lencode;
+        if (!lencode.build(lengths, 19)) {
+            return false;
+        }
+        int index = 0;
+        while (index < nlen + ndist) {
+            int symbol = decode(lencode);
+            if (symbol < 0 || overrun_) {
+                return false;
+            }
+            if (symbol < 16) {
+                lengths[index++] = static_cast<std::uint8_t>(symbol);
+                continue;
+            }
+            std::uint8_t value = 0;
+            int repeat;
+            if (symbol == 16) {
+                if (index == 0) {
+                    return false;
+                }
+                value = lengths[index - 1];
+                repeat = 3 + static_cast<int>(get(2));
+            } else if (symbol == 17) {
+                repeat = 3 + static_cast<int>(get(3));
+            } else {
+                repeat = 11 + static_cast<int>(get(7));
+            }
+            if (index + repeat > nlen + ndist) {
+                return false;
+            }
+            std::fill(lengths + index, lengths + index + repeat, value);
+            index += repeat;
+        }
+        if (lengths[256] == 0) {
+            return false; // No end-of-block code
+        }
+        Huffman lit, dist;
+        if (!lit.build(lengths, nlen) || !dist.build(lengths + nlen, ndist)) {
+            return false;
+        }
+        return codes(lit, dist);
+    }
+
+    bool codes(const Huffman& lit, const Huffman& dist) {
+        for (;;) {
+            int symbol = decode(lit);
+            if (symbol < 0 || overrun_) {
+                return false;
+            }
+            if (symbol < 256) {
+                if (size_ >= limit_) {
+                    error_ = "image data larger than the header says";
+                    return false;
+                }
+                out_[size_++] = static_cast<std::uint8_t>(symbol);
+                continue;
+            }
+            if (symbol == 256) {
+                return true;
+            }
+            symbol -= 257;
+            if (symbol >= 29) {
+                return false;
+            }
+            std::size_t length = LEN_BASE[symbol] + get(LEN_EXTRA[symbol]);
+            int d = decode(dist);
+            if (d < 0 || d >= 30) {
+                return false;
+            }
+            std::size_t distance = DIST_BASE[d] + get(DIST_EXTRA[d]);
+            if (distance > size_) {
+                error_ = "distance too far back";
+                return false;
+            }
+            if (size_ + length > limit_) {
+                error_ = "image data larger than the header says";
+                return false;
+            }
+            std::uint8_t* to = out_ + size_;
+            const std::uint8_t* from = to - distance;
+            // A distance shorter than the length repeats the last 'distance' bytes; the copy
+            // doubles the repeated span each round.
+            std::size_t done = std::min(distance, length);
+            std::memcpy(to, from, done);
+            while (done < length) {
+                std::size_t n = std::min(done, length - done);
+                std::memcpy(to + done, to, n);
+                done += n;
+            }
+            size_ += length;
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// PNG
+// ---------------------------------------------------------------------------
+
+inline std::uint32_t be32(const std::uint8_t* p) {
+    return (static_cast<std::uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Branch-free Paeth predictor: p - a = b - c, p - b = a - c, p - c = a + b - 2c.
+inline int paeth(int a, int b, int c) {
+    int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+    int ab = pb < pa ? b : a;
+    return pc < std::min(pa, pb) ? c : ab;
+}
+
+// Average and Paeth filters with the pixel size known at compile time, so the
+// loop carries 'BPP' independent bytes instead of testing i >= bpp each time.
+template <std::size_t BPP>
+inline void unfilterNeighbours(int type, std::uint8_t* row, const std::uint8_t* prev, std::size_t stride) {
+    for (std::size_t i = 0; i < BPP && i < stride; ++i) {
+        row[i] = static_cast<std::uint8_t>(row[i] + (type == 3 ? prev[i] >> 1 : prev[i]));
+    }
+    if (type == 3) {
+        for (std::size_t i = BPP; i < stride; ++i) {
+            row[i] = static_cast<std::uint8_t>(row[i] + ((row[i - BPP] + prev[i]) >> 1));
+        }
+        return;
+    }
+    for (std::size_t i = BPP; i < stride; ++i) {
+        row[i] = static_cast<std::uint8_t>(row[i] + paeth(row[i - BPP], prev[i], prev[i - BPP]));
+    }
+}
+
+#if CARO_X86_SIMD
+// Paeth for 3- and 4-byte pixels, one pixel per step with the channels in 16-bit
+// lanes (the approach of libpng's SSE2 filters). Bytes are serially dependent
+// across pixels, so this is as wide as the filter allows.
+template <std::size_t BPP>
+inline void unfilterPaethSse2(std::uint8_t* row, const std::uint8_t* prev, std::size_t stride) {
+    const __m128i zero = _mm_setzero_si128();
+    auto load = [&](const std::uint8_t* p) {
+        std::uint32_t v = 0;
+        std::memcpy(&v, p, BPP);
+        return _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(v)), zero);
+    };
+    auto abs16 = [&](__m128i v) { return _mm_max_epi16(v, _mm_sub_epi16(zero, v)); };
+    auto select = [](__m128i mask, __m128i yes, __m128i no) {
+        return _mm_or_si128(_mm_and_si128(mask, yes), _mm_andnot_si128(mask, no));
+    };
+    __m128i a = zero, c = zero;
+    for (std::size_t i = 0; i + BPP <= stride; i += BPP) {
+        __m128i b = load(prev + i);
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = abs16(_mm_add_epi16(pa, pb));
+        pa = abs16(pa);
+        pb = abs16(pb);
+        __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        __m128i nearest = select(_mm_cmpeq_epi16(smallest, pa), a, select(_mm_cmpeq_epi16(smallest, pb), b, c));
+        a = _mm_and_si128(_mm_add_epi16(load(row + i), nearest), _mm_set1_epi16(0xFF));
+        std::uint32_t out = static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(a, a)));
+        std::memcpy(row + i, &out, BPP);
+        c = b;
+    }
+}
+#endif
+
+// Undoes the filter of one row in place; 'prev' is the unfiltered previous row
+// (all zeros for the first row of a pass).
+inline bool unfilter(int type, std::uint8_t* row, const std::uint8_t* prev, std::size_t stride, std::size_t bpp) {
+    switch (type) {
+    case 0:
+        return true;
+    case 1:
+        for (std::size_t i = bpp; i < stride; ++i) {
+            row[i] = static_cast<std::uint8_t>(row[i] + row[i - bpp]);
+        }
+        return true;
+    case 2:
+        for (std::size_t i = 0; i < stride; ++i) {
+            row[i] = static_cast<std::uint8_t>(row[i] + prev[i]);
+        }
+        return true;
+    case 3:
+    case 4:
+#if CARO_X86_SIMD
+        if (type == 4 && (bpp == 3 || bpp == 4)) {
+            bpp == 3 ? unfilterPaethSse2<3>(row, prev, stride) : unfilterPaethSse2<4>(row, prev, stride);
+            return true;
+        }
+#endif
+        switch (bpp) {
+        case 1: unfilterNeighbours<1>(type, row, prev, stride); break;
+        case 2: unfilterNeighbours<2>(type, row, prev, stride); break;
+        case 3: unfilterNeighbours<3>(type, row, prev, stride); break;
+        case 4: unfilterNeighbours<4>(type, row, prev, stride); break;
+        case 6: unfilterNeighbours<6>(type, row, prev, stride); break;
+        default: unfilterNeighbours<8>(type, row, prev, stride); break;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// How the samples of a row are stored.
+struct RowFormat {
+    int type;                        // PNG color type
+    int depth;                       // Bits per sample
+    int channels;                    // Samples per pixel
+    const int* trns_key;             // Transparent gray or RGB value, -1 if none
+    const std::uint8_t (*palette)[4]; // RGBA palette entries
+};
+
+// Converts 'count' pixels of an unfiltered row to 8-bit RGBA.
+inline void expandRow(const std::uint8_t* row, std::size_t count, const RowFormat& f, std::uint8_t* out) {
+    if (f.depth == 8 && f.type == 6) {
+        std::memcpy(out, row, count * 4);
+        return;
+    }
+    if (f.depth == 8 && f.type == 2 && f.trns_key[0] < 0) {
+        for (std::size_t i = 0; i < count; ++i, row += 3, out += 4) {
+            out[0] = row[0];
+            out[1] = row[1];
+            out[2] = row[2];
+            out[3] = 255;
+        }
+        return;
+    }
+    int max_sample = (1 << f.depth) - 1;
+    for (std::size_t i = 0; i < count; ++i, out += 4) {
+        int sample[4] = {0, 0, 0, 255};
+        int raw[3] = {0, 0, 0}; // Full-precision samples, for tRNS
+        for (int c = 0; c < f.channels; ++c) {
+            int v;
+            if (f.depth == 16) {
+                const std::uint8_t* s = row + (i * f.channels + c) * 2;
+                v = (s[0] << 8) | s[1];
+                if (c < 3) {
+                    raw[c] = v;
+                }
+                v >>= 8;
+            } else if (f.depth == 8) {
+                v = row[i * f.channels + c];
+                if (c < 3) {
+                    raw[c] = v;
+                }
+            } else {
+                std::size_t bit = i * f.depth;
+                v = (row[bit / 8] >> (8 - f.depth - bit % 8)) & max_sample;
+                raw[0] = v;
+                if (f.type == 0) {
+                    v = v * 255 / max_sample;
+                }
+            }
+            sample[c] = v;
+        }
+        if (f.type == 3) {
+            const std::uint8_t* entry = f.palette[sample[0]];
+            std::memcpy(out, entry, 4);
+            continue;
+        }
+        if (f.type == 0 || f.type == 4) {
+            if (f.type == 4) {
+                sample[3] = sample[1];
+            } else if (raw[0] == f.trns_key[0]) {
+                sample[3] = 0;
+            }
+            sample[1] = sample[2] = sample[0];
+        } else if (f.type == 2 && raw[0] == f.trns_key[0] && raw[1] == f.trns_key[1] && raw[2] == f.trns_key[2]) {
+            sample[3] = 0;
+        }
+        for (int c = 0; c < 4; ++c) {
+            out[c] = static_cast<std::uint8_t>(sample[c]);
+        }
+    }
+}
+
+// Decodes a PNG row by row. start(width, height) is called once the header is read,
+// then row(y, x0, dx, pixels, count) for every row of every pass with 'count' RGBA
+// pixels that belong at x0, x0 + dx, ... of image row y.
+template <typename Start, typename Row>
+inline bool decodeRows(const std::uint8_t* data, std::size_t len, Start start, Row row_sink, std::string& error) {
+    static const std::uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (len < 8 || std::memcmp(data, signature, 8) != 0) {
+        error = "not a PNG file";
+        return false;
+    }
+    std::uint32_t width = 0, height = 0;
+    int depth = 0, type = -1, interlace = 0;
+    std::uint8_t palette[256][4] = {};
+    int trns_key[3] = {-1, -1, -1}; // Transparent gray or RGB sample values
+    std::vector<std::uint8_t> idat;
+    for (std::size_t pos = 8; pos + 12 <= len;) {
+        std::uint32_t n = be32(data + pos);
+        const std::uint8_t* tag = data + pos + 4;
+        const std::uint8_t* body = data + pos + 8;
+        if (n > len - pos - 12) {
+            error = "truncated chunk";
+            return false;
+        }
+        if (std::memcmp(tag, "IHDR", 4) == 0 && n >= 13) {
+            width = be32(body);
+            height = be32(body + 4);
+            depth = body[8];
+            type = body[9];
+            interlace = body[12];
+            for (int i = 0; i < 256; ++i) {
+                palette[i][3] = 255;
+            }
+        } else if (std::memcmp(tag, "PLTE", 4) == 0) {
+            for (std::uint32_t i = 0; i < n / 3 && i < 256; ++i) {
+                std::memcpy(palette[i], body + 3 * i, 3);
+            }
+        } else if (std::memcmp(tag, "tRNS", 4) == 0) {
+            if (type == 3) {
+                for (std::uint32_t i = 0; i < n && i < 256; ++i) {
+                    palette[i][3] = body[i];
+                }
+            } else if (type == 0 && n >= 2) {
+                trns_key[0] = (body[0] << 8) | body[1];
+            } else if (type == 2 && n >= 6) {
+                for (int c = 0; c < 3; ++c) {
+                    trns_key[c] = (body[2 * c] << 8) | body[2 * c + 1];
+                }
+            }
+        } else if (std::memcmp(tag, "IDAT", 4) == 0) {
+            idat.insert(idat.end(), body, body + n);
+        } else if (std::memcmp(tag, "IEND", 4) == 0) {
+            break;
+        }
+        pos += 12 + n;
+    }
+
+    int channels = 0;
+    switch (type) {
+    case 0: channels = 1; break;
+    case 2: channels = 3; break;
+    case 3: channels = 1; break;
+    case 4: channels = 2; break;
+    case 6: channels = 4; break;
+    }
+    bool depth_ok = depth == 8 || (depth == 16 && type != 3) ||
+                    ((depth == 1 || depth == 2 || depth == 4) && (type == 0 || type == 3));
+    if (width == 0 || height == 0 || width > 1u << 16 || height > 1u << 16 || channels == 0 || !depth_ok ||
+        interlace > 1) {
+        error = "unsupported PNG header";
+        return false;
+    }
+
+    // The passes of Adam7 (or the single pass of a plain image): start and step in x and y.
+    static const int adam7[7][4] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4},
+                                    {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2}};
+    static const int single[1][4] = {{0, 0, 1, 1}};
+    const int (*passes)[4] = interlace ? adam7 : single;
+    int pass_count = interlace ? 7 : 1;
+
+    std::size_t bits_per_pixel = static_cast<std::size_t>(channels) * depth;
+    std::size_t bpp = std::max<std::size_t>(1, bits_per_pixel / 8);
+    std::size_t expected = 0;
+    for (int p = 0; p < pass_count; ++p) {
+        std::size_t pw = (width - passes[p][0] + passes[p][2] - 1) / passes[p][2];
+        std::size_t ph = (height - passes[p][1] + passes[p][3] - 1) / passes[p][3];
+        if (passes[p][0] < static_cast<int>(width) && passes[p][1] < static_cast<int>(height)) {
+            expected += ph * (1 + (pw * bits_per_pixel + 7) / 8);
+        }
+    }
+    std::vector<std::uint8_t> raw;
+    Inflater inflater;
+    if (!inflater.inflate(idat.data(), idat.size(), expected, raw, error)) {
+        return false;
+    }
+    if (raw.size() < expected) {
+        error = "truncated image data";
+        return false;
+    }
+
+    start(static_cast<int>(width), static_cast<int>(height));
+    RowFormat format{type, depth, channels, trns_key, palette};
+    std::vector<std::uint8_t> pixels(static_cast<std::size_t>(width) * 4);
+    std::vector<std::uint8_t> zero_row((static_cast<std::size_t>(width) * bits_per_pixel + 7) / 8);
+    std::size_t pos = 0;
+    for (int p = 0; p < pass_count; ++p) {
+        int x0 = passes[p][0], y0 = passes[p][1], dx = passes[p][2], dy = passes[p][3];
+        if (x0 >= static_cast<int>(width) || y0 >= static_cast<int>(height)) {
+            continue;
+        }
+        std::size_t pw = (width - x0 + dx - 1) / dx;
+        std::size_t stride = (pw * bits_per_pixel + 7) / 8;
+        const std::uint8_t* prev = zero_row.data();
+        for (std::uint32_t y = y0; y < height; y += dy) {
+            std::uint8_t* row = raw.data() + pos + 1;
+            if (!unfilter(raw[pos], row, prev, stride, bpp)) {
+                error = "bad row filter";
+                return false;
+            }
+            prev = row;
+            pos += stride + 1;
+            expandRow(row, pw, format, pixels.data());
+            row_sink(static_cast<int>(y), x0, dx, pixels.data(), pw);
+        }
+    }
+    return true;
+}
+
+// Decodes a PNG into 'rgba': ceil(width / 8) x ceil(height / 8) pixels, each the
+// alpha-weighted mean of its 8x8 box (alpha is the box's mean alpha).
+inline bool decodeScaled(const std::uint8_t* data, std::size_t len, int& out_w, int& out_h,
+                         std::vector<std::uint8_t>& rgba, std::string& error) {
+    // Per box: alpha-weighted R, G, B sums, alpha sum and pixel count.
+    std::vector<std::uint32_t> sums;
+    auto start = [&](int width, int height) {
+        out_w = (width + 7) / 8;
+        out_h = (height + 7) / 8;
+        sums.assign(static_cast<std::size_t>(out_w) * out_h * 5, 0);
+    };
+    auto row = [&](int y, int x0, int dx, const std::uint8_t* px, std::size_t count) {
+        std::uint32_t* box_row = sums.data() + static_cast<std::size_t>(y / 8) * out_w * 5;
+        for (std::size_t i = 0; i < count; ++i, px += 4) {
+            std::uint32_t* box = box_row + ((x0 + i * dx) / 8) * 5;
+            std::uint32_t a = px[3];
+            box[0] += px[0] * a;
+            box[1] += px[1] * a;
+            box[2] += px[2] * a;
+            box[3] += a;
+            box[4] += 1;
+        }
+    };
+    if (!decodeRows(data, len, start, row, error)) {
+        return false;
+    }
+
+    rgba.assign(static_cast<std::size_t>(out_w) * out_h * 4, 0);
+    for (std::size_t b = 0; b < static_cast<std::size_t>(out_w) * out_h; ++b) {
+        const std::uint32_t* box = sums.data() + b * 5;
+        if (box[3] > 0) {
+            rgba[b * 4] = static_cast<std::uint8_t>((box[0] + box[3] / 2) / box[3]);
+            rgba[b * 4 + 1] = static_cast<std::uint8_t>((box[1] + box[3] / 2) / box[3]);
+            rgba[b * 4 + 2] = static_cast<std::uint8_t>((box[2] + box[3] / 2) / box[3]);
+        }
+        rgba[b * 4 + 3] = static_cast<std::uint8_t>(box[4] ? (box[3] + box[4] / 2) / box[4] : 0);
+    }
+    return true;
+}
+
+// Decodes a PNG into 'rgba' at full size.
+inline bool decode(const std::uint8_t* data, std::size_t len, int& out_w, int& out_h, std::vector<std::uint8_t>& rgba,
+                   std::string& error) {
+    auto start = [&](int width, int height) {
+        out_w = width;
+        out_h = height;
+        rgba.assign(static_cast<std::size_t>(width) * height * 4, 0);
+    };
+    auto row = [&](int y, int x0, int dx, const std::uint8_t* px, std::size_t count) {
+        std::uint8_t* out = rgba.data() + (static_cast<std::size_t>(y) * out_w + x0) * 4;
+        if (dx == 1) {
+            std::memcpy(out, px, count * 4);
+            return;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            std::memcpy(out + i * dx * 4, px + i * 4, 4);
+        }
+    };
+    return decodeRows(data, len, start, row, error);
+}
+
+// ---------------------------------------------------------------------------
+// Encoder
+// ---------------------------------------------------------------------------
+
+inline std::uint32_t crc32(const std::uint8_t* p, std::size_t n, std::uint32_t crc = 0) {
+    static const std::array<std::uint32_t, 256> table = [] {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (std::size_t i = 0; i < n; ++i) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// zlib stream of one fixed-Huffman deflate block with greedy LZ77 matching (one hash
+// candidate per position, like zlib's fastest level).
+class Deflater {
+public:
+    std::string compress(const std::uint8_t* data, std::size_t n) {
+        out_ = "\x78\x01";
+        put(1, 1); // Final block
+        put(1, 2); // Fixed codes
+        std::vector<std::int32_t> head(1 << 15, -1);
+        auto hash = [data](std::size_t i) {
+            return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & 0x7FFF;
+        };
+        for (std::size_t i = 0; i < n;) {
+            std::size_t length = 0, distance = 0;
+            if (i + 3 <= n) {
+                int h = hash(i);
+                std::int32_t candidate = head[h];
+                head[h] = static_cast<std::int32_t>(i);
+                if (candidate >= 0 && i - candidate <= 32768) {
+                    std::size_t limit = std::min<std::size_t>(258, n - i);
+                    while (length < limit && data[candidate + length] == data[i + length]) {
+                        ++length;
+                    }
+                    distance = i - candidate;
+                }
+            }
+            if (length < 3) {
+                literal(data[i++]);
+                continue;
+            }
+            match(length, distance);
+            for (std::size_t j = i + 1; j < i + length && j + 3 <= n; ++j) {
+                head[hash(j)] = static_cast<std::int32_t>(j);
+            }
+            i += length;
+        }
+        literal(256);
+        if (count_ > 0) {
+            out_ += static_cast<char>(bits_ & 0xFF);
+        }
+        std::uint32_t a = 1, b = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            a = (a + data[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        std::uint32_t adler = (b << 16) | a;
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out_ += static_cast<char>((adler >> shift) & 0xFF);
+        }
+        return std::move(out_);
+    }
+
+private:
+    std::string out_;
+    std::uint32_t bits_ = 0;
+    int count_ = 0;
+
+    void put(std::uint32_t value, int n) {
+        bits_ |= value << count_;
+        count_ += n;
+        while (count_ >= 8) {
+            out_ += static_cast<char>(bits_ & 0xFF);
+            bits_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    // Huffman codes go out most significant bit first.
+    void code(std::uint32_t value, int n) {
+        std::uint32_t reversed = 0;
+        for (int i = 0; i < n; ++i) {
+            reversed |= ((value >> i) & 1) << (n - 1 - i);
+        }
+        put(reversed, n);
+    }
+
+    void literal(int v) {
+        if (v < 144) {
+            code(0x30 + v, 8);
+        } else if (v < 256) {
+            code(0x190 + v - 144, 9);
+        } else if (v < 280) {
+            code(v - 256, 7);
+        } else {
+            code(0xC0 + v - 280, 8);
+        }
+    }
+
+    void match(std::size_t length, std::size_t distance) {
+        int l = static_cast<int>(std::upper_bound(LEN_BASE, LEN_BASE + 29, length) - LEN_BASE) - 1;
+        literal(257 + l);
+        put(static_cast<std::uint32_t>(length - LEN_BASE[l]), LEN_EXTRA[l]);
+        int d = static_cast<int>(std::upper_bound(DIST_BASE, DIST_BASE + 30, distance) - DIST_BASE) - 1;
+        code(static_cast<std::uint32_t>(d), 5);
+        put(static_cast<std::uint32_t>(distance - DIST_BASE[d]), DIST_EXTRA[d]);
+    }
+};
+
+// Encodes 8-bit RGBA pixels as an RGBA PNG, or as RGB if 'alpha' is false. Each row
+// gets the filter with the smallest sum of absolute residuals.
+inline std::string encode(int width, int height, const std::uint8_t* rgba, bool alpha) {
+    std::size_t bpp = alpha ? 4 : 3;
+    std::size_t stride = static_cast<std::size_t>(width) * bpp;
+    std::vector<std::uint8_t> raw, prev(stride, 0), cur(stride), best(stride + 1), trial(stride + 1);
+    raw.reserve((stride + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        const std::uint8_t* src = rgba + static_cast<std::size_t>(y) * width * 4;
+        for (int x = 0; x < width; ++x) {
+            std::memcpy(cur.data() + x * bpp, src + x * 4, bpp);
+        }
+        long best_cost = -1;
+        for (int type = 0; type < 5; ++type) {
+            trial[0] = static_cast<std::uint8_t>(type);
+            long cost = 0;
+            for (std::size_t i = 0; i < stride; ++i) {
+                int a = i >= bpp ? cur[i - bpp] : 0, b = prev[i], c = i >= bpp ? prev[i - bpp] : 0;
+                int predictor = type == 0 ? 0 : type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) / 2 : paeth(a, b, c);
+                std::uint8_t residual = static_cast<std::uint8_t>(cur[i] - predictor);
+                trial[i + 1] = residual;
+                cost += residual < 128 ? residual : 256 - residual;
+            }
+            if (best_cost < 0 || cost < best_cost) {
+                best_cost = cost;
+                best.swap(trial);
+            }
+        }
+        raw.insert(raw.end(), best.begin(), best.end());
+        prev.swap(cur);
+    }
+
+    auto chunk = [](std::string& out, const char* tag, const std::string& body) {
+        std::uint32_t n = static_cast<std::uint32_t>(body.size());
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out += static_cast<char>((n >> shift) & 0xFF);
+        }
+        std::string tagged = tag + body;
+        out += tagged;
+        std::uint32_t crc = crc32(reinterpret_cast<const std::uint8_t*>(tagged.data()), tagged.size());
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out += static_cast<char>((crc >> shift) & 0xFF);
+        }
+    };
+    std::string ihdr;
+    for (int v : {width, height}) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            ihdr += static_cast<char>((v >> shift) & 0xFF);
+        }
+    }
+    ihdr += static_cast<char>(8);
+    ihdr += static_cast<char>(alpha ? 6 : 2);
+    ihdr += std::string(3, '\0');
+    std::string out("\x89PNG\r\n\x1a\n", 8);
+    chunk(out, "IHDR", ihdr);
+    chunk(out, "IDAT", Deflater().compress(raw.data(), raw.size()));
+    chunk(out, "IEND", "");
+    return out;
+}
+
+} // namespace png
@@ -0,0 +1,155 @@
+// preview.hpp - Small previews of gallery images, from EXIF thumbnails when possible.
+//
+// Most camera JPEGs carry a ~160 px JPEG thumbnail in their EXIF segment
+// (IFD1). It lives in the first few kilobytes of the file, so reading the
+// marker chain up to the frame header and decoding those bytes costs far less
+// than entropy-decoding the main image, and is plenty for dominant colors.
+// The thumbnail is only trusted while it still matches the image: if the EXIF
+// pixel size disagrees with the frame header, or the thumbnail's aspect ratio
+// does not match the frame's (an editor resized, cropped or rotated the
+// pixels without refreshing the thumbnail), the preview falls back to the
+// 1/8-scale decode of palette.hpp (JPEG DC terms, PNG box means).
+//
+// A 180 degree turn or a mirror keeps the aspect ratio, so the thumbnail is
+// also compared with the DC terms of the top quarter of the main image. Only
+// those MCU rows are entropy-decoded, which keeps most of the saving.
+#pragma once
+
+#include <algorithm>    // For std::min, std::max
+#include <cstdint>      // For fixed-width integers
+#include <cstdlib>      // For std::abs
+#include <filesystem>   // For fs::path
+#include <fstream>      // For reading the header segments
+#include <string>       // For errors and reasons
+#include <vector>       // For pixels
+
+#include "exif.hpp"
+#include "image_probe.hpp"
+#include "jpeg.hpp"
+#include "mapped_file.hpp"
+#include "palette.hpp"  // For the 1/8-scale fallback
+
+namespace fs = std::filesystem;
+
+namespace preview {
+
+enum class Source { ExifThumbnail, ScaledDecode };
+
+// Mean luma difference per block (0-255) below which a thumbnail is taken to match
+// whatever the alternatives score.
+constexpr int MIN_STALE_DIFFERENCE = 2;
+
+// Compares a w x h RGBA thumbnail with the DC luma of the top quarter of the JPEG 'data'.
+// Returns false with 'reason' if the thumbnail matches at least twice as well once
+// mirrored or turned (the pixels were turned since it was made). Images whose first
+// component is not luma are not checked.
+inline bool matchesTop(const std::uint8_t* data, std::size_t len, int w, int h, const std::vector<std::uint8_t>& rgba,
+                       std::string& reason) {
+    jpeg::CoefImage img;
+    if (!jpeg::decodeTop(data, len, 4, img, reason)) {
+        return false;
+    }
+    bool ycc = false;
+    std::string ignored;
+    if (!jpeg::colorModel(img, ycc, ignored) || (!ycc && img.comps.size() > 1)) {
+        return true;
+    }
+    const jpeg::Component& luma = img.comps[0];
+    int px_w = 8 * img.hmax / luma.h, px_h = 8 * img.vmax / luma.v; // Image pixels per block
+    int blocks_w = img.realBlocksW(luma);
+    int blocks_h = std::min(img.realBlocksH(luma), luma.grid_h);
+    // Difference as stored, mirrored left-right, top-bottom, and turned 180 degrees.
+    long long diff[4] = {0, 0, 0, 0};
+    for (int by = 0; by < blocks_h; ++by) {
+        for (int bx = 0; bx < blocks_w; ++bx) {
+            int dc = luma.block(bx, by)[0] * img.qt[luma.tq][0];
+            int block_y = std::max(0, std::min(255, (dc + 4 * (dc >= 0 ? 1 : -1)) / 8 + 128));
+            int tx = std::min(w - 1, static_cast<int>((bx * px_w + px_w / 2) * static_cast<long long>(w) / img.width));
+            int ty = std::min(h - 1, static_cast<int>((by * px_h + px_h / 2) * static_cast<long long>(h) / img.height));
+            for (int t = 0; t < 4; ++t) {
+                int x = t & 1 ? w - 1 - tx : tx;
+                int y = t & 2 ? h - 1 - ty : ty;
+                const std::uint8_t* p = rgba.data() + (static_cast<std::size_t>(y) * w + x) * 4;
+                diff[t] += std::abs(block_y - ((77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8));
+            }
+        }
+    }
+    // A matching thumbnail differs by a level or two per block. Symmetric pictures match
+    // several ways, and then the stale direction does not change the colors anyway.
+    long long blocks = static_cast<long long>(blocks_w) * blocks_h;
+    long long best = std::min({diff[1], diff[2], diff[3]});
+    if (diff[0] > MIN_STALE_DIFFERENCE * blocks && 2 * best < diff[0]) {
+        reason = "thumbnail is turned or mirrored against the image (mean difference " +
+                 std::to_string(diff[0] / blocks) + ", " + std::to_string(best / blocks) + " turned)";
+        return false;
+    }
+    return true;
+}
+
+// Decodes the EXIF thumbnail of the JPEG at 'path' into RGBA, reading only the segments
+// before the frame header and the top quarter of the image data. Returns false with
+// 'reason' if there is none or it is stale.
+inline bool exifThumbnail(const fs::path& path, int& w, int& h, std::vector<std::uint8_t>& rgba, std::string& reason) {
+    std::ifstream in(path, std::ios::binary);
+    unsigned char soi[2] = {0, 0};
+    if (!in.read(reinterpret_cast<char*>(soi), 2) || soi[0] != 0xFF || soi[1] != 0xD8) {
+        reason = "not a JPEG";
+        return false;
+    }
+    ImageInfo info;
+    std::string exif;
+    if (!probeJpegFrame(in, info, &exif) || info.width <= 0 || info.height <= 0) {
+        reason = "no frame header";
+        return false;
+    }
+    const auto* payload = reinterpret_cast<const std::uint8_t*>(exif.data());
+    std::size_t offset = 0;
+    std::size_t size = 0;
+    if (!exif::findThumbnail(payload, exif.size(), offset, size)) {
+        reason = "no EXIF thumbnail";
+        return false;
+    }
+    int exif_w = 0;
+    int exif_h = 0;
+    if (exif::readPixelSize(payload, exif.size(), exif_w, exif_h) &&
+        (exif_w != info.width || exif_h != info.height)) {
+        reason = "EXIF size " + std::to_string(exif_w) + "x" + std::to_string(exif_h) + " is not the frame size " +
+                 std::to_string(info.width) + "x" + std::to_string(info.height);
+        return false;
+    }
+
+    jpeg::CoefImage img;
+    if (!jpeg::decodeCoefficients(payload + offset, size, img, reason) || !jpeg::decodePixels(img, w, h, rgba, reason)) {
+        reason = "thumbnail: " + reason;
+        return false;
+    }
+    // Allow a pixel of rounding (and 2%) in the thumbnail's height for the frame's aspect ratio.
+    long long expected = static_cast<long long>(w) * info.height;
+    long long actual = static_cast<long long>(h) * info.width;
+    if (std::abs(expected - actual) > (1 + h / 50) * static_cast<long long>(info.width)) {
+        reason = "thumbnail is " + std::to_string(w) + "x" + std::to_string(h) + ", frame is " +
+                 std::to_string(info.width) + "x" + std::to_string(info.height);
+        return false;
+    }
+    MappedFile file;
+    if (!file.open(path)) {
+        reason = "cannot read file";
+        return false;
+    }
+    return matchesTop(file.data(), file.size(), w, h, rgba, reason);
+}
+
+// Produces a small RGBA preview of a PNG or JPEG: the EXIF thumbnail if it is usable,
+// otherwise a 1/8-scale decode. 'source' tells which one it is.
+inline bool load(const fs::path& path, const std::string& format, int& w, int& h, std::vector<std::uint8_t>& rgba,
+                 Source& source, std::string& error) {
+    std::string reason;
+    if (format == "jpeg" && exifThumbnail(path, w, h, rgba, reason)) {
+        source = Source::ExifThumbnail;
+        return true;
+    }
+    source = Source::ScaledDecode;
+    return palette::thumbnail(path, format, w, h, rgba, error);
+}
+
+} // namespace preview
@@ -0,0 +1,669 @@
+// roaring.hpp - Compressed bitmaps of 32-bit integers (Roaring bitmaps).
+//
+// The value space is split into chunks of 65536 by the high 16 bits. Each
+// non-empty chunk is one container holding the low 16 bits in whichever of
+// three forms is smallest: a sorted array (sparse chunks), a 65536-bit bitmap
+// (dense, scattered chunks) or a list of runs (long consecutive stretches, the
+// usual shape of a gallery's numbering). Set operations work container by
+// container: array/array pairs are merged directly, everything else goes
+// through 1024-word bitmaps and is recompressed.
+//
+// serialize()/deserialize() use the portable Roaring format, so the bytes can
+// be read by the other Roaring implementations.
+#pragma once
+
+#include <algorithm>    // For std::lower_bound, std::set_union, ...
+#include <array>        // For scratch bitmaps
+#include <cstdint>      // For fixed-width integers
+#include <iterator>     // For std::back_inserter
+#include <string>       // For serialized bytes and errors
+#include <utility>      // For std::pair
+#include <vector>       // For keys, containers and values
+
+namespace roaring {
+
+namespace detail {
+
+constexpr std::uint32_t ARRAY_MAX = 4096; // Larger arrays would exceed a bitmap's 8 KiB
+constexpr std::size_t WORDS = 1024;       // 65536 bits
+constexpr std::uint32_t COOKIE_NO_RUNS = 12346;
+constexpr std::uint32_t COOKIE_RUNS = 12347;
+
+using Words = std::array<std::uint64_t, WORDS>;
+
+inline int popcount(std::uint64_t w) {
+    return __builtin_popcountll(w);
+}
+
+inline int trailingZeros(std::uint64_t w) {
+    return __builtin_ctzll(w);
+}
+
+// Sets bits lo..hi (inclusive) of a chunk bitmap.
+inline void setRange(Words& words, std::uint32_t lo, std::uint32_t hi) {
+    for (std::uint32_t w = lo / 64; w <= hi / 64; ++w) {
+        std::uint32_t first = w == lo / 64 ? lo % 64 : 0;
+        std::uint32_t last = w == hi / 64 ? hi % 64 : 63;
+        std::uint64_t mask = (last == 63 ? ~0ull : ((1ull << (last + 1)) - 1)) & ~((1ull << first) - 1);
+        words[w] |= mask;
+    }
+}
+
+// Calls fn(lo, hi) for every run of set bits in a chunk bitmap, skipping whole words.
+template <typename Fn>
+inline void forEachRunInWords(const Words& in, Fn fn) {
+    for (std::uint32_t v = 0; v < 65536;) {
+        std::uint64_t word = in[v / 64] >> (v % 64);
+        if (!(word & 1)) {
+            v += word ? static_cast<std::uint32_t>(trailingZeros(word)) : 64 - v % 64;
+            continue;
+        }
+        std::uint32_t start = v;
+        while (v < 65536 && ((in[v / 64] >> (v % 64)) & 1)) {
+            std::uint64_t ones = ~(in[v / 64] >> (v % 64));
+            v += ones ? static_cast<std::uint32_t>(trailingZeros(ones)) : 64 - v % 64;
+        }
+        fn(start, v - 1);
+    }
+}
+
+// One chunk of 65536 values.
+struct Container {
+    enum Kind : std::uint8_t { ARRAY, BITMAP, RUN };
+    Kind kind = ARRAY;
+    std::uint32_t card = 0;
+    std::vector<std::uint16_t> data;  // ARRAY: sorted values; RUN: (start, length - 1) pairs
+    std::vector<std::uint64_t> words; // BITMAP: WORDS words
+
+    std::size_t runs() const { return data.size() / 2; }
+
+    void toWords(Words& out) const {
+        out.fill(0);
+        if (kind == BITMAP) {
+            std::copy(words.begin(), words.end(), out.begin());
+        } else if (kind == ARRAY) {
+            for (std::uint16_t v : data) {
+                out[v / 64] |= 1ull << (v % 64);
+            }
+        } else {
+            for (std::size_t r = 0; r < runs(); ++r) {
+                setRange(out, data[2 * r], data[2 * r] + static_cast<std::uint32_t>(data[2 * r + 1]));
+            }
+        }
+    }
+
+    // The smallest representation of a chunk bitmap. Arrays win ties, which keeps every
+    // bitmap container above ARRAY_MAX values as the portable format expects.
+    static Container fromWords(const Words& in) {
+        Container c;
+        std::size_t runs = 0;
+        bool previous = false;
+        for (std::size_t w = 0; w < WORDS; ++w) {
+            c.card += static_cast<std::uint32_t>(popcount(in[w]));
+            // Runs start where a set bit follows a clear one.
+            std::uint64_t starts = in[w] & ~((in[w] << 1) | (previous ? 1ull : 0ull));
+            runs += static_cast<std::size_t>(popcount(starts));
+            previous = (in[w] >> 63) != 0;
+        }
+        std::size_t array_bytes = 2 * static_cast<std::size_t>(c.card);
+        std::size_t run_bytes = 2 + 4 * runs;
+        if (run_bytes < array_bytes && run_bytes < 8192) {
+            c.kind = RUN;
+            c.data.reserve(2 * runs);
+            forEachRunInWords(in, [&](std::uint32_t lo, std::uint32_t hi) {
+                c.data.push_back(static_cast<std::uint16_t>(lo));
+                c.data.push_back(static_cast<std::uint16_t>(hi - lo));
+            });
+        } else if (c.card <= ARRAY_MAX) {
+            c.kind = ARRAY;
+            c.data.reserve(c.card);
+            for (std::size_t w = 0; w < WORDS; ++w) {
+                for (std::uint64_t word = in[w]; word; word &= word - 1) {
+                    c.data.push_back(static_cast<std::uint16_t>(w * 64 + static_cast<std::size_t>(trailingZeros(word))));
+                }
+            }
+        } else {
+            c.kind = BITMAP;
+            c.words.assign(in.begin(), in.end());
+        }
+        return c;
+    }
+
+    bool contains(std::uint16_t v) const {
+        if (kind == ARRAY) {
+            return std::binary_search(data.begin(), data.end(), v);
+        }
+        if (kind == BITMAP) {
+            return (words[v / 64] >> (v % 64)) & 1;
+        }
+        std::size_t lo = 0, hi = runs();
+        while (lo < hi) { // First run starting after v
+            std::size_t mid = (lo + hi) / 2;
+            if (data[2 * mid] <= v) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo > 0 && v <= data[2 * (lo - 1)] + static_cast<std::uint32_t>(data[2 * (lo - 1) + 1]);
+    }
+
+    // Values <= v.
+    std::uint32_t rank(std::uint16_t v) const {
+        if (kind == ARRAY) {
+            return static_cast<std::uint32_t>(std::upper_bound(data.begin(), data.end(), v) - data.begin());
+        }
+        std::uint32_t count = 0;
+        if (kind == BITMAP) {
+            for (std::size_t w = 0; w < v / 64u; ++w) {
+                count += static_cast<std::uint32_t>(popcount(words[w]));
+            }
+            std::uint32_t bit = v % 64;
+            std::uint64_t mask = bit == 63 ? ~0ull : (1ull << (bit + 1)) - 1;
+            return count + static_cast<std::uint32_t>(popcount(words[v / 64] & mask));
+        }
+        for (std::size_t r = 0; r < runs() && data[2 * r] <= v; ++r) {
+            std::uint32_t end = data[2 * r] + static_cast<std::uint32_t>(data[2 * r + 1]);
+            count += std::min<std::uint32_t>(end, v) - data[2 * r] + 1;
+        }
+        return count;
+    }
+
+    // The i-th smallest value (i < card).
+    std::uint16_t select(std::uint32_t i) const {
+        if (kind == ARRAY) {
+            return data[i];
+        }
+        if (kind == BITMAP) {
+            for (std::size_t w = 0;; ++w) {
+                std::uint32_t n = static_cast<std::uint32_t>(popcount(words[w]));
+                if (i < n) {
+                    std::uint64_t word = words[w];
+                    for (; i > 0; --i) {
+                        word &= word - 1;
+                    }
+                    return static_cast<std::uint16_t>(w * 64 + static_cast<std::size_t>(trailingZeros(word)));
+                }
+                i -= n;
+            }
+        }
+        for (std::size_t r = 0;; ++r) {
+            std::uint32_t length = data[2 * r + 1] + 1u;
+            if (i < length) {
+                return static_cast<std::uint16_t>(data[2 * r] + i);
+            }
+            i -= length;
+        }
+    }
+
+    // Calls fn(lo, hi) for every maximal run of values, in order.
+    template <typename Fn>
+    void forEachRun(Fn fn) const {
+        if (kind == RUN) {
+            for (std::size_t r = 0; r < runs(); ++r) {
+                fn(static_cast<std::uint32_t>(data[2 * r]), data[2 * r] + static_cast<std::uint32_t>(data[2 * r + 1]));
+            }
+            return;
+        }
+        if (kind == ARRAY) {
+            for (std::size_t i = 0; i < data.size();) {
+                std::size_t j = i;
+                while (j + 1 < data.size() && data[j + 1] == data[j] + 1) {
+                    ++j;
+                }
+                fn(static_cast<std::uint32_t>(data[i]), static_cast<std::uint32_t>(data[j]));
+                i = j + 1;
+            }
+            return;
+        }
+        Words all;
+        toWords(all);
+        forEachRunInWords(all, fn);
+    }
+};
+
+enum class Op { Or, And, AndNot };
+
+inline Container combine(const Container& a, const Container& b, Op op) {
+    if (a.kind == Container::ARRAY && b.kind == Container::ARRAY) {
+        Container c;
+        if (op == Op::Or) {
+            std::set_union(a.data.begin(), a.data.end(), b.data.begin(), b.data.end(), std::back_inserter(c.data));
+        } else if (op == Op::And) {
+            std::set_intersection(a.data.begin(), a.data.end(), b.data.begin(), b.data.end(), std::back_inserter(c.data));
+        } else {
+            std::set_difference(a.data.begin(), a.data.end(), b.data.begin(), b.data.end(), std::back_inserter(c.data));
+        }
+        c.card = static_cast<std::uint32_t>(c.data.size());
+        if (c.card <= ARRAY_MAX && c.card < 64) {
+            return c; // Too small for runs to matter
+        }
+        Words words;
+        c.toWords(words);
+        return Container::fromWords(words);
+    }
+    Words x, y;
+    a.toWords(x);
+    b.toWords(y);
+    for (std::size_t w = 0; w < WORDS; ++w) {
+        x[w] = op == Op::Or ? (x[w] | y[w]) : op == Op::And ? (x[w] & y[w]) : (x[w] & ~y[w]);
+    }
+    return Container::fromWords(x);
+}
+
+inline void put16(std::string& out, std::uint32_t v) {
+    out += static_cast<char>(v & 0xFF);
+    out += static_cast<char>((v >> 8) & 0xFF);
+}
+
+inline void put32(std::string& out, std::uint32_t v) {
+    put16(out, v & 0xFFFF);
+    put16(out, v >> 16);
+}
+
+inline std::uint32_t get16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+inline std::uint32_t get32(const unsigned char* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+} // namespace detail
+
+class Bitmap {
+public:
+    Bitmap() = default;
+
+    // Every value in lo..hi (inclusive).
+    static Bitmap range(std::uint32_t lo, std::uint32_t hi) {
+        Bitmap b;
+        for (std::uint64_t key = lo >> 16; key <= (hi >> 16); ++key) {
+            std::uint32_t first = key == (lo >> 16) ? lo & 0xFFFF : 0;
+            std::uint32_t last = key == (hi >> 16) ? hi & 0xFFFF : 0xFFFF;
+            detail::Container c;
+            c.kind = detail::Container::RUN;
+            c.card = last - first + 1;
+            c.data = {static_cast<std::uint16_t>(first), static_cast<std::uint16_t>(last - first)};
+            b.keys_.push_back(static_cast<std::uint16_t>(key));
+            b.containers_.push_back(std::move(c));
+        }
+        return lo <= hi ? b : Bitmap();
+    }
+
+    void add(std::uint32_t x) {
+        detail::Container& c = containerFor(static_cast<std::uint16_t>(x >> 16));
+        std::uint16_t low = static_cast<std::uint16_t>(x & 0xFFFF);
+        if (c.kind == detail::Container::ARRAY) {
+            if (c.data.empty() || c.data.back() < low) {
+                c.data.push_back(low); // Scans add in increasing order
+            } else {
+                auto it = std::lower_bound(c.data.begin(), c.data.end(), low);
+                if (*it == low) {
+                    return;
+                }
+                c.data.insert(it, low);
+            }
+            if (++c.card > detail::ARRAY_MAX) {
+                detail::Words words;
+                c.toWords(words);
+                c.kind = detail::Container::BITMAP;
+                c.words.assign(words.begin(), words.end());
+                c.data.clear();
+            }
+        } else if (c.kind == detail::Container::BITMAP) {
+            std::uint64_t bit = 1ull << (low % 64);
+            c.card += (c.words[low / 64] & bit) ? 0 : 1;
+            c.words[low / 64] |= bit;
+        } else if (!c.contains(low)) {
+            detail::Words words;
+            c.toWords(words);
+            words[low / 64] |= 1ull << (low % 64);
+            c = detail::Container::fromWords(words);
+        }
+    }
+
+    bool remove(std::uint32_t x) {
+        std::size_t i = find(static_cast<std::uint16_t>(x >> 16));
+        std::uint16_t low = static_cast<std::uint16_t>(x & 0xFFFF);
+        if (i == npos || !containers_[i].contains(low)) {
+            return false;
+        }
+        detail::Container& c = containers_[i];
+        if (c.kind == detail::Container::ARRAY) {
+            c.data.erase(std::lower_bound(c.data.begin(), c.data.end(), low));
+            --c.card;
+        } else if (c.kind == detail::Container::BITMAP) {
+            c.words[low / 64] &= ~(1ull << (low % 64));
+            if (--c.card <= detail::ARRAY_MAX) {
+                detail::Words words;
+                c.toWords(words);
+                c = detail::Container::fromWords(words);
+            }
+        } else {
+            detail::Words words;
+            c.toWords(words);
+            words[low / 64] &= ~(1ull << (low % 64));
+            c = detail::Container::fromWords(words);
+        }
+        if (c.card == 0) {
+            keys_.erase(keys_.begin() + static_cast<std::ptrdiff_t>(i));
+            containers_.erase(containers_.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+        return true;
+    }
+
+    bool contains(std::uint32_t x) const {
+        std::size_t i = find(static_cast<std::uint16_t>(x >> 16));
+        return i != npos && containers_[i].contains(static_cast<std::uint16_t>(x & 0xFFFF));
+    }
+
+    std::uint64_t cardinality() const {
+        std::uint64_t n = 0;
+        for (const auto& c : containers_) {
+            n += c.card;
+        }
+        return n;
+    }
+
+    bool empty() const { return containers_.empty(); }
+
+    // Number of values <= x.
+    std::uint64_t rank(std::uint32_t x) const {
+        std::uint64_t n = 0;
+        std::uint16_t key = static_cast<std::uint16_t>(x >> 16);
+        for (std::size_t i = 0; i < keys_.size() && keys_[i] <= key; ++i) {
+            n += keys_[i] < key ? containers_[i].card : containers_[i].rank(static_cast<std::uint16_t>(x & 0xFFFF));
+        }
+        return n;
+    }
+
+    // The i-th smallest value (0-based); false if there are not that many.
+    bool select(std::uint64_t i, std::uint32_t& out) const {
+        for (std::size_t k = 0; k < keys_.size(); ++k) {
+            if (i < containers_[k].card) {
+                out = static_cast<std::uint32_t>(keys_[k]) << 16 | containers_[k].select(static_cast<std::uint32_t>(i));
+                return true;
+            }
+            i -= containers_[k].card;
+        }
+        return false;
+    }
+
+    bool minimum(std::uint32_t& out) const { return select(0, out); }
+
+    bool maximum(std::uint32_t& out) const {
+        std::uint64_t n = cardinality();
+        return n > 0 && select(n - 1, out);
+    }
+
+    // Calls fn(lo, hi) for every maximal run of consecutive values, in order.
+    template <typename Fn>
+    void forEachRun(Fn fn) const {
+        bool open = false;
+        std::uint32_t start = 0, end = 0;
+        for (std::size_t k = 0; k < keys_.size(); ++k) {
+            std::uint32_t base = static_cast<std::uint32_t>(keys_[k]) << 16;
+            containers_[k].forEachRun([&](std::uint32_t lo, std::uint32_t hi) {
+                if (open && base + lo == end + 1) {
+                    end = base + hi; // Continues across the chunk boundary
+                    return;
+                }
+                if (open) {
+                    fn(start, end);
+                }
+                open = true;
+                start = base + lo;
+                end = base + hi;
+            });
+        }
+        if (open) {
+            fn(start, end);
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        forEachRun([&](std::uint32_t lo, std::uint32_t hi) {
+            for (std::uint64_t v = lo; v <= hi; ++v) {
+                fn(static_cast<std::uint32_t>(v));
+            }
+        });
+    }
+
+    // Missing stretches within lo..hi (inclusive), as (first, last) pairs.
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> gaps(std::uint32_t lo, std::uint32_t hi) const {
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> out;
+        std::uint64_t next = lo; // First value not yet accounted for
+        forEachRun([&](std::uint32_t a, std::uint32_t b) {
+            if (b < next || a > hi || next > hi) {
+                return;
+            }
+            if (a > next) {
+                out.push_back({static_cast<std::uint32_t>(next), a - 1});
+            }
+            next = static_cast<std::uint64_t>(b) + 1;
+        });
+        if (next <= hi) {
+            out.push_back({static_cast<std::uint32_t>(next), hi});
+        }
+        return out;
+    }
+
+    Bitmap operator|(const Bitmap& other) const { return combine(other, detail::Op::Or); }
+    Bitmap operator&(const Bitmap& other) const { return combine(other, detail::Op::And); }
+    Bitmap operator-(const Bitmap& other) const { return combine(other, detail::Op::AndNot); }
+
+    bool operator==(const Bitmap& other) const {
+        if (keys_ != other.keys_) {
+            return false;
+        }
+        for (std::size_t k = 0; k < keys_.size(); ++k) {
+            if (containers_[k].card != other.containers_[k].card ||
+                detail::combine(containers_[k], other.containers_[k], detail::Op::AndNot).card != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Recompresses every container into its smallest form (e.g. runs after a scan).
+    void optimize() {
+        for (auto& c : containers_) {
+            detail::Words words;
+            c.toWords(words);
+            c = detail::Container::fromWords(words);
+        }
+    }
+
+    // Portable Roaring serialization (little-endian).
+    std::string serialize() const {
+        std::string out;
+        std::size_t n = keys_.size();
+        bool has_runs = false;
+        for (const auto& c : containers_) {
+            has_runs = has_runs || c.kind == detail::Container::RUN;
+        }
+        if (has_runs) {
+            detail::put32(out, detail::COOKIE_RUNS | static_cast<std::uint32_t>((n ? n - 1 : 0) << 16));
+            std::string flags((n + 7) / 8, '\0');
+            for (std::size_t k = 0; k < n; ++k) {
+                if (containers_[k].kind == detail::Container::RUN) {
+                    flags[k / 8] = static_cast<char>(flags[k / 8] | (1 << (k % 8)));
+                }
+            }
+            out += flags;
+        } else {
+            detail::put32(out, detail::COOKIE_NO_RUNS);
+            detail::put32(out, static_cast<std::uint32_t>(n));
+        }
+        for (std::size_t k = 0; k < n; ++k) {
+            detail::put16(out, keys_[k]);
+            detail::put16(out, containers_[k].card - 1);
+        }
+        std::string body;
+        std::vector<std::uint32_t> offsets;
+        std::size_t header = out.size() + ((!has_runs || n >= 4) ? 4 * n : 0);
+        for (const auto& c : containers_) {
+            offsets.push_back(static_cast<std::uint32_t>(header + body.size()));
+            if (c.kind == detail::Container::RUN) {
+                detail::put16(body, static_cast<std::uint32_t>(c.runs()));
+                for (std::uint16_t v : c.data) {
+                    detail::put16(body, v);
+                }
+            } else if (c.card <= detail::ARRAY_MAX) {
+                c.forEachRun([&](std::uint32_t lo, std::uint32_t hi) {
+                    for (std::uint32_t v = lo; v <= hi; ++v) {
+                        detail::put16(body, v);
+                    }
+                });
+            } else {
+                for (std::uint64_t w : c.words) {
+                    detail::put32(body, static_cast<std::uint32_t>(w));
+                    detail::put32(body, static_cast<std::uint32_t>(w >> 32));
+                }
+            }
+        }
+        if (!has_runs || n >= 4) {
+            for (std::uint32_t offset : offsets) {
+                detail::put32(out, offset);
+            }
+        }
+        return out + body;
+    }
+
+    static bool deserialize(const std::string& bytes, Bitmap& out, std::string& error) {
+        const auto* p = reinterpret_cast<const unsigned char*>(bytes.data());
+        std::size_t len = bytes.size();
+        out = Bitmap();
+        error = "truncated bitmap";
+        if (len < 4) {
+            return false;
+        }
+        std::uint32_t cookie = detail::get32(p);
+        std::size_t n = 0, pos = 4;
+        const unsigned char* run_flags = nullptr;
+        if ((cookie & 0xFFFF) == detail::COOKIE_RUNS) {
+            n = (cookie >> 16) + 1;
+            run_flags = p + pos;
+            pos += (n + 7) / 8;
+        } else if (cookie == detail::COOKIE_NO_RUNS) {
+            if (len < 8) {
+                return false;
+            }
+            n = detail::get32(p + 4);
+            pos = 8;
+        } else {
+            error = "not a Roaring bitmap";
+            return false;
+        }
+        if (pos + 4 * n > len) {
+            return false;
+        }
+        const unsigned char* header = p + pos;
+        pos += 4 * n;
+        if (!run_flags || n >= 4) {
+            pos += 4 * n; // Offsets: the containers follow each other anyway
+        }
+        for (std::size_t k = 0; k < n; ++k) {
+            detail::Container c;
+            std::uint16_t key = static_cast<std::uint16_t>(detail::get16(header + 4 * k));
+            std::uint32_t card = detail::get16(header + 4 * k + 2) + 1;
+            if (!out.keys_.empty() && key <= out.keys_.back()) {
+                error = "bitmap keys out of order";
+                return false;
+            }
+            if (run_flags && (run_flags[k / 8] >> (k % 8)) & 1) {
+                if (pos + 2 > len) {
+                    return false;
+                }
+                std::size_t runs = detail::get16(p + pos);
+                pos += 2;
+                if (pos + 4 * runs > len) {
+                    return false;
+                }
+                c.kind = detail::Container::RUN;
+                for (std::size_t r = 0; r < 2 * runs; ++r) {
+                    c.data.push_back(static_cast<std::uint16_t>(detail::get16(p + pos + 2 * r)));
+                }
+                pos += 4 * runs;
+            } else if (card <= detail::ARRAY_MAX) {
+                if (pos + 2 * card > len) {
+                    return false;
+                }
+                for (std::size_t i = 0; i < card; ++i) {
+                    c.data.push_back(static_cast<std::uint16_t>(detail::get16(p + pos + 2 * i)));
+                }
+                pos += 2 * card;
+            } else {
+                if (pos + 8 * detail::WORDS > len) {
+                    return false;
+                }
+                c.kind = detail::Container::BITMAP;
+                for (std::size_t w = 0; w < detail::WORDS; ++w) {
+                    c.words.push_back(detail::get32(p + pos + 8 * w) | static_cast<std::uint64_t>(detail::get32(p + pos + 8 * w + 4)) << 32);
+                }
+                pos += 8 * detail::WORDS;
+            }
+            // Recount rather than trust the header; rebuild to the canonical form.
+            detail::Words words;
+            c.toWords(words);
+            c = detail::Container::fromWords(words);
+            if (c.card != card) {
+                error = "bitmap cardinality mismatch";
+                return false;
+            }
+            out.keys_.push_back(key);
+            out.containers_.push_back(std::move(c));
+        }
+        error.clear();
+        return true;
+    }
+
+private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    std::size_t find(std::uint16_t key) const {
+        auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+        return it != keys_.end() && *it == key ? static_cast<std::size_t>(it - keys_.begin()) : npos;
+    }
+
+    detail::Container& containerFor(std::uint16_t key) {
+        auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+        std::size_t i = static_cast<std::size_t>(it - keys_.begin());
+        if (it == keys_.end() || *it != key) {
+            keys_.insert(it, key);
+            containers_.insert(containers_.begin() + static_cast<std::ptrdiff_t>(i), detail::Container());
+        }
+        return containers_[i];
+    }
+
+    Bitmap combine(const Bitmap& other, detail::Op op) const {
+        Bitmap out;
+        std::size_t i = 0, j = 0;
+        const detail::Container empty;
+        while (i < keys_.size() || j < other.keys_.size()) {
+            bool take_a = i < keys_.size() && (j == other.keys_.size() || keys_[i] <= other.keys_[j]);
+            bool take_b = j < other.keys_.size() && (i == keys_.size() || other.keys_[j] <= keys_[i]);
+            std::uint16_t key = take_a ? keys_[i] : other.keys_[j];
+            const detail::Container& a = take_a ? containers_[i] : empty;
+            const detail::Container& b = take_b ? other.containers_[j] : empty;
+            i += take_a ? 1 : 0;
+            j += take_b ? 1 : 0;
+            if ((op == detail::Op::And && !(take_a && take_b)) || (op == detail::Op::AndNot && !take_a)) {
+                continue;
+            }
+            detail::Container c = (take_a && take_b) ? detail::combine(a, b, op) : (take_a ? a : b);
+            if (c.card > 0) {
+                out.keys_.push_back(key);
+                out.containers_.push_back(std::move(c));
+            }
+        }
+        return out;
+    }
+
+    std::vector<std::uint16_t> keys_;
+    std::vector<detail::Container> containers_;
+};
+
+} // namespace roaring
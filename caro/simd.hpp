@@ -0,0 +1,52 @@
+// simd.hpp - Compile-time and run-time selection of SIMD kernels.
+//
+// The tool is built with a plain "g++ -std=c++17 main.cpp" (no -mavx2), so
+// wider kernels are compiled per function with a target attribute and only
+// called after checking the CPU at run time. SSE2 is part of x86-64 itself
+// and needs no check. Other compilers and CPUs use the scalar kernels.
+#pragma once
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CARO_X86_SIMD 1
+#include <immintrin.h>
+#define CARO_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CARO_X86_SIMD 0
+#define CARO_TARGET_AVX2
+#endif
+
+// Lets benchmarks and tests force the scalar or SSE2 kernels.
+enum class SimdLevel { Scalar = 0, Sse2 = 1, Avx2 = 2 };
+
+// Highest level the running CPU supports.
+inline SimdLevel detectSimdLevel() {
+#if CARO_X86_SIMD
+    static const SimdLevel level = __builtin_cpu_supports("avx2") ? SimdLevel::Avx2 : SimdLevel::Sse2;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+// Level kernels should use: the detected one, optionally capped with simdLevelCap().
+inline SimdLevel& simdLevelCapRef() {
+    static SimdLevel cap = SimdLevel::Avx2;
+    return cap;
+}
+
+inline void simdLevelCap(SimdLevel cap) {
+    simdLevelCapRef() = cap;
+}
+
+inline SimdLevel activeSimdLevel() {
+    SimdLevel detected = detectSimdLevel();
+    return static_cast<int>(detected) < static_cast<int>(simdLevelCapRef()) ? detected : simdLevelCapRef();
+}
+
+inline const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Sse2: return "sse2";
+    default: return "scalar";
+    }
+}
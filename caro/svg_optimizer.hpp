@@ -0,0 +1,692 @@
+// svg_optimizer.hpp - Streaming SVG minifier for icon fonts and vector assets.
+//
+// One forward pass over the file, writing the result as it goes. No element
+// tree is built: the only state kept is a byte per open element (whether its
+// text must be preserved) and a depth counter while skipping editor
+// metadata. Path data ("d" attributes of <path>, <glyph> and friends) is
+// re-encoded on the fly:
+//   - every coordinate is snapped to a grid of 10^-precision units,
+//   - each segment is written in whichever of absolute or relative form is
+//     shorter (relative offsets are taken from the already rounded previous
+//     point, so rounding never accumulates along a path),
+//   - lines become H/V where possible, and curves become S/T when their first
+//     control point is the reflection of the previous one,
+//   - repeated command letters and unneeded separators are dropped.
+// Comments, <metadata>, editor namespaces (Inkscape, Sodipodi, Sketch),
+// a plain DOCTYPE and whitespace between tags are removed.
+#pragma once
+
+#include <cmath>        // For std::llround, std::fabs
+#include <cstdint>      // For std::int64_t
+#include <cstdlib>      // For std::strtod
+#include <cstring>      // For std::strchr, std::memchr
+#include <string>       // For the output buffer
+#include <vector>       // For the open-element stack
+
+namespace svgmin {
+
+struct Options {
+    int precision = 2; // Decimal places kept in path coordinates
+};
+
+struct Stats {
+    std::size_t paths = 0;          // Path data attributes rewritten
+    std::size_t removed_nodes = 0;  // Comments, metadata and editor elements dropped
+};
+
+// Writes path tokens with the fewest separators the SVG path grammar allows.
+class PathWriter {
+public:
+    explicit PathWriter(int precision) : scale_(1) {
+        decimals_ = precision < 0 ? 0 : (precision > 8 ? 8 : precision);
+        for (int i = 0; i < decimals_; ++i) {
+            scale_ *= 10;
+        }
+    }
+
+    std::int64_t snap(double v) const { return static_cast<std::int64_t>(std::llround(v * static_cast<double>(scale_))); }
+
+    // Starts a new output string (keeps the buffer's capacity).
+    void reset(std::string& out) {
+        out_ = &out;
+        last_ = 0;
+        need_sep_ = false;
+        number_has_dot_ = false;
+    }
+
+    void command(char c) {
+        // A repeated letter is implicit, and so is "l" after "m" (and "L" after "M").
+        char implied = last_ == 'm' ? 'l' : (last_ == 'M' ? 'L' : last_);
+        if (c == implied && c != 'm' && c != 'M' && c != 'z' && c != 'Z') {
+            return;
+        }
+        *out_ += c;
+        last_ = c;
+        need_sep_ = false;
+        number_has_dot_ = false;
+    }
+
+    void number(std::int64_t q) {
+        char buf[32];
+        int n = 0;
+        bool negative = q < 0;
+        std::uint64_t mag = negative ? static_cast<std::uint64_t>(-q) : static_cast<std::uint64_t>(q);
+        std::uint64_t whole = mag / static_cast<std::uint64_t>(scale_);
+        std::uint64_t frac = mag % static_cast<std::uint64_t>(scale_);
+        int frac_digits = decimals_;
+        while (frac_digits > 0 && frac % 10 == 0) {
+            frac /= 10;
+            --frac_digits;
+        }
+        if (negative && (whole || frac)) {
+            buf[n++] = '-';
+        }
+        if (whole || frac_digits == 0) {
+            char digits[24];
+            int d = 0;
+            do {
+                digits[d++] = static_cast<char>('0' + whole % 10);
+                whole /= 10;
+            } while (whole);
+            while (d) {
+                buf[n++] = digits[--d];
+            }
+        }
+        if (frac_digits) {
+            buf[n++] = '.';
+            for (int i = frac_digits - 1; i >= 0; --i) {
+                buf[n + i] = static_cast<char>('0' + frac % 10);
+                frac /= 10;
+            }
+            n += frac_digits;
+        }
+        // A separator is only needed when the number would otherwise merge with the previous one.
+        if (need_sep_ && buf[0] != '-' && !(buf[0] == '.' && number_has_dot_)) {
+            *out_ += ' ';
+        }
+        out_->append(buf, static_cast<std::size_t>(n));
+        need_sep_ = true;
+        number_has_dot_ = std::memchr(buf, '.', static_cast<std::size_t>(n)) != nullptr;
+    }
+
+    // Arc flags are written as plain digits, always separated.
+    void flag(bool f) {
+        if (need_sep_) {
+            *out_ += ' ';
+        }
+        *out_ += f ? '1' : '0';
+        need_sep_ = true;
+        number_has_dot_ = false;
+    }
+
+    // Writer state, so candidates can be rendered from the same starting point.
+    struct State {
+        char last;
+        bool need_sep;
+        bool number_has_dot;
+    };
+    State state() const { return {last_, need_sep_, number_has_dot_}; }
+    void restore(const State& s) {
+        last_ = s.last;
+        need_sep_ = s.need_sep;
+        number_has_dot_ = s.number_has_dot;
+    }
+
+private:
+    std::string* out_ = nullptr;
+    std::int64_t scale_;
+    int decimals_ = 2;
+    char last_ = 0;
+    bool need_sep_ = false;
+    bool number_has_dot_ = false;
+};
+
+// Re-encodes one path data string. Returns false (leaving 'out' unspecified) if the
+// data does not parse, in which case the caller keeps the original.
+class PathOptimizer {
+public:
+    explicit PathOptimizer(int precision) : w_(precision) {}
+
+    bool optimize(const std::string& d, std::string& out) {
+        out.clear();
+        out_ = &out;
+        w_.reset(out);
+        p_ = d.c_str();
+        end_ = p_ + d.size();
+        // Positions are tracked in grid units as the renderer will see them.
+        cx_ = cy_ = sx_ = sy_ = 0;
+        ix_ = iy_ = isx_ = isy_ = 0;
+        prev_ = emitted_ = 0;
+        char cmd = 0;
+        bool first = true;
+        while (skipSeparators(), p_ < end_) {
+            char c = *p_;
+            if (c && std::strchr("MmLlHhVvCcSsQqTtAaZz", c)) {
+                cmd = c;
+                ++p_;
+            } else if (cmd == 0 || cmd == 'z' || cmd == 'Z') {
+                return false; // Numbers without a command
+            } else if (cmd == 'M') {
+                cmd = 'L'; // Extra pairs after a moveto are linetos
+            } else if (cmd == 'm') {
+                cmd = 'l';
+            }
+            if (first && cmd != 'M' && cmd != 'm') {
+                return false;
+            }
+            first = false;
+            if (!segment(cmd)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    void skipSeparators() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == ',' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) {
+            ++p_;
+        }
+    }
+
+    bool readNumber(double& v) {
+        skipSeparators();
+        if (p_ >= end_) {
+            return false;
+        }
+        char c = *p_;
+        if (!(c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9'))) {
+            return false;
+        }
+        char* stop = nullptr;
+        v = std::strtod(p_, &stop);
+        if (stop == p_ || stop > end_) {
+            return false;
+        }
+        p_ = stop;
+        return true;
+    }
+
+    bool readFlag(bool& f) {
+        skipSeparators();
+        if (p_ >= end_ || (*p_ != '0' && *p_ != '1')) {
+            return false;
+        }
+        f = *p_++ == '1';
+        return true;
+    }
+
+    // Renders a candidate from 'start', returning its end state.
+    template <typename Fn>
+    PathWriter::State render(std::string& buf, const PathWriter::State& start, Fn fn) {
+        buf.clear();
+        w_.reset(buf);
+        w_.restore(start);
+        fn();
+        return w_.state();
+    }
+
+    // Emits whichever of the absolute and relative renderings is shorter. 'fn' writes
+    // one rendering given whether it is absolute and the origin to subtract.
+    template <typename Fn>
+    void emitShorter(std::string& out, Fn fn) {
+        PathWriter::State start = w_.state();
+        PathWriter::State abs_end = render(abs_, start, [&] { fn(true, 0, 0); });
+        PathWriter::State rel_end = render(rel_, start, [&] { fn(false, cx_, cy_); });
+        w_.reset(out);
+        if (rel_.size() <= abs_.size()) {
+            out += rel_;
+            w_.restore(rel_end);
+        } else {
+            out += abs_;
+            w_.restore(abs_end);
+        }
+    }
+
+    bool segment(char cmd) {
+        std::string& out = *out_;
+        bool rel = cmd >= 'a' && cmd <= 'z';
+        char upper = static_cast<char>(rel ? cmd - 32 : cmd);
+        // Exact input-space current point, used to resolve relative input coordinates.
+        double bx = rel ? ix_ : 0, by = rel ? iy_ : 0;
+        double v[7];
+
+        switch (upper) {
+        case 'Z': {
+            w_.command('z');
+            cx_ = sx_;
+            cy_ = sy_;
+            ix_ = isx_;
+            iy_ = isy_;
+            prev_ = emitted_ = 'Z';
+            return true;
+        }
+        case 'M': {
+            if (!readNumber(v[0]) || !readNumber(v[1])) return false;
+            ix_ = isx_ = bx + v[0];
+            iy_ = isy_ = by + v[1];
+            std::int64_t x = w_.snap(ix_), y = w_.snap(iy_);
+            emitShorter(out, [&](bool abs, std::int64_t ox, std::int64_t oy) {
+                w_.command(abs ? 'M' : 'm');
+                w_.number(x - ox);
+                w_.number(y - oy);
+            });
+            cx_ = sx_ = x;
+            cy_ = sy_ = y;
+            prev_ = emitted_ = 'M';
+            return true;
+        }
+        case 'L':
+        case 'H':
+        case 'V': {
+            double tx = ix_, ty = iy_;
+            if (upper == 'L') {
+                if (!readNumber(v[0]) || !readNumber(v[1])) return false;
+                tx = bx + v[0];
+                ty = by + v[1];
+            } else if (upper == 'H') {
+                if (!readNumber(v[0])) return false;
+                tx = (rel ? ix_ : 0) + v[0];
+            } else {
+                if (!readNumber(v[0])) return false;
+                ty = (rel ? iy_ : 0) + v[0];
+            }
+            ix_ = tx;
+            iy_ = ty;
+            std::int64_t x = w_.snap(tx), y = w_.snap(ty);
+            if (x == cx_ && y == cy_ && emitted_ != 'M') {
+                prev_ = 'L';
+                return true; // Zero-length after rounding; the output keeps its previous segment
+            }
+            emitShorter(out, [&](bool abs, std::int64_t ox, std::int64_t oy) {
+                if (y == cy_) {
+                    w_.command(abs ? 'H' : 'h');
+                    w_.number(x - ox);
+                } else if (x == cx_) {
+                    w_.command(abs ? 'V' : 'v');
+                    w_.number(y - oy);
+                } else {
+                    w_.command(abs ? 'L' : 'l');
+                    w_.number(x - ox);
+                    w_.number(y - oy);
+                }
+            });
+            cx_ = x;
+            cy_ = y;
+            prev_ = emitted_ = 'L';
+            return true;
+        }
+        case 'C':
+        case 'S': {
+            double c1x, c1y;
+            if (upper == 'C') {
+                if (!readNumber(v[0]) || !readNumber(v[1])) return false;
+                c1x = bx + v[0];
+                c1y = by + v[1];
+            } else {
+                // Reflection of the previous second control point (input space).
+                bool smooth = prev_ == 'C';
+                c1x = smooth ? 2 * ix_ - ic2x_ : ix_;
+                c1y = smooth ? 2 * iy_ - ic2y_ : iy_;
+            }
+            for (int i = 0; i < 4; ++i) {
+                if (!readNumber(v[2 + i])) return false;
+            }
+            double c2x = bx + v[2], c2y = by + v[3], ex = bx + v[4], ey = by + v[5];
+            std::int64_t q1x = w_.snap(c1x), q1y = w_.snap(c1y);
+            std::int64_t q2x = w_.snap(c2x), q2y = w_.snap(c2y);
+            std::int64_t qx = w_.snap(ex), qy = w_.snap(ey);
+            // The renderer reflects the control point it saw, so compare on the grid.
+            std::int64_t rx = emitted_ == 'C' ? 2 * cx_ - oc2x_ : cx_;
+            std::int64_t ry = emitted_ == 'C' ? 2 * cy_ - oc2y_ : cy_;
+            bool shorthand = q1x == rx && q1y == ry;
+            emitShorter(out, [&](bool abs, std::int64_t ox, std::int64_t oy) {
+                if (shorthand) {
+                    w_.command(abs ? 'S' : 's');
+                } else {
+                    w_.command(abs ? 'C' : 'c');
+                    w_.number(q1x - ox);
+                    w_.number(q1y - oy);
+                }
+                w_.number(q2x - ox);
+                w_.number(q2y - oy);
+                w_.number(qx - ox);
+                w_.number(qy - oy);
+            });
+            ic2x_ = c2x;
+            ic2y_ = c2y;
+            oc2x_ = q2x;
+            oc2y_ = q2y;
+            ix_ = ex;
+            iy_ = ey;
+            cx_ = qx;
+            cy_ = qy;
+            prev_ = emitted_ = 'C';
+            return true;
+        }
+        case 'Q':
+        case 'T': {
+            double c1x, c1y;
+            if (upper == 'Q') {
+                if (!readNumber(v[0]) || !readNumber(v[1])) return false;
+                c1x = bx + v[0];
+                c1y = by + v[1];
+            } else {
+                bool smooth = prev_ == 'Q';
+                c1x = smooth ? 2 * ix_ - ic2x_ : ix_;
+                c1y = smooth ? 2 * iy_ - ic2y_ : iy_;
+            }
+            if (!readNumber(v[2]) || !readNumber(v[3])) return false;
+            double ex = bx + v[2], ey = by + v[3];
+            std::int64_t q1x = w_.snap(c1x), q1y = w_.snap(c1y);
+            std::int64_t qx = w_.snap(ex), qy = w_.snap(ey);
+            std::int64_t rx = emitted_ == 'Q' ? 2 * cx_ - oc2x_ : cx_;
+            std::int64_t ry = emitted_ == 'Q' ? 2 * cy_ - oc2y_ : cy_;
+            bool shorthand = q1x == rx && q1y == ry;
+            emitShorter(out, [&](bool abs, std::int64_t ox, std::int64_t oy) {
+                if (shorthand) {
+                    w_.command(abs ? 'T' : 't');
+                } else {
+                    w_.command(abs ? 'Q' : 'q');
+                    w_.number(q1x - ox);
+                    w_.number(q1y - oy);
+                }
+                w_.number(qx - ox);
+                w_.number(qy - oy);
+            });
+            ic2x_ = c1x;
+            ic2y_ = c1y;
+            oc2x_ = shorthand ? rx : q1x;
+            oc2y_ = shorthand ? ry : q1y;
+            ix_ = ex;
+            iy_ = ey;
+            cx_ = qx;
+            cy_ = qy;
+            prev_ = emitted_ = 'Q';
+            return true;
+        }
+        case 'A': {
+            bool large = false, sweep = false;
+            if (!readNumber(v[0]) || !readNumber(v[1]) || !readNumber(v[2]) || !readFlag(large) ||
+                !readFlag(sweep) || !readNumber(v[3]) || !readNumber(v[4])) {
+                return false;
+            }
+            double ex = bx + v[3], ey = by + v[4];
+            std::int64_t rx = w_.snap(std::fabs(v[0])), ry = w_.snap(std::fabs(v[1])), rot = w_.snap(v[2]);
+            std::int64_t qx = w_.snap(ex), qy = w_.snap(ey);
+            emitShorter(out, [&](bool abs, std::int64_t ox, std::int64_t oy) {
+                w_.command(abs ? 'A' : 'a');
+                w_.number(rx);
+                w_.number(ry);
+                w_.number(rot);
+                w_.flag(large);
+                w_.flag(sweep);
+                w_.number(qx - ox);
+                w_.number(qy - oy);
+            });
+            ix_ = ex;
+            iy_ = ey;
+            cx_ = qx;
+            cy_ = qy;
+            prev_ = emitted_ = 'A';
+            return true;
+        }
+        }
+        return false;
+    }
+
+    PathWriter w_;
+    std::string* out_ = nullptr;  // The string being written by optimize()
+    std::string abs_, rel_;       // Candidate buffers, reused across segments
+    const char* p_ = nullptr;
+    const char* end_ = nullptr;
+    double ix_ = 0, iy_ = 0, isx_ = 0, isy_ = 0;   // Exact current point and subpath start
+    double ic2x_ = 0, ic2y_ = 0;                   // Exact last control point (for S/T)
+    std::int64_t cx_ = 0, cy_ = 0, sx_ = 0, sy_ = 0; // Emitted current point and subpath start
+    std::int64_t oc2x_ = 0, oc2y_ = 0;             // Emitted last control point
+    char prev_ = 0;                                // Kind of the previous input segment: M, L, C, Q, A or Z
+    char emitted_ = 0;                             // Kind of the previous segment written out
+};
+
+// True for elements that only carry editor state.
+inline bool isEditorElement(const char* name, std::size_t len) {
+    auto is = [&](const char* s) { return std::strlen(s) == len && std::strncmp(name, s, len) == 0; };
+    auto prefixed = [&](const char* s) { return len > std::strlen(s) && std::strncmp(name, s, std::strlen(s)) == 0; };
+    return is("metadata") || prefixed("sodipodi:") || prefixed("inkscape:") || prefixed("sketch:");
+}
+
+// True for attributes that only carry editor state (and their namespace declarations).
+inline bool isEditorAttribute(const char* name, std::size_t len) {
+    for (const char* prefix : {"sodipodi:", "inkscape:", "sketch:", "xmlns:sodipodi", "xmlns:inkscape", "xmlns:sketch"}) {
+        std::size_t n = std::strlen(prefix);
+        if (len >= n && std::strncmp(name, prefix, n) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Elements whose text content is significant, whitespace included.
+inline bool keepsText(const char* name, std::size_t len) {
+    for (const char* keep : {"text", "tspan", "textPath", "title", "desc", "style", "script"}) {
+        if (std::strlen(keep) == len && std::strncmp(name, keep, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Elements whose "d" attribute is path data.
+inline bool hasPathData(const char* name, std::size_t len) {
+    for (const char* el : {"path", "glyph", "missing-glyph"}) {
+        if (std::strlen(el) == len && std::strncmp(name, el, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Streams 'in' to 'out' with the optimizations listed at the top of this file.
+// Returns false with 'error' set if the markup is malformed ('out' is then unusable).
+class Minifier {
+public:
+    explicit Minifier(const Options& options) : paths_(options.precision) {}
+
+    bool run(const char* data, std::size_t len, std::string& out, Stats& stats, std::string& error) {
+        data_ = data;
+        len_ = len;
+        pos_ = 0;
+        out.clear();
+        out.reserve(len);
+        keep_text_.clear();
+        std::size_t skip_depth = 0; // >0 while inside a removed element
+
+        while (pos_ < len_) {
+            if (data_[pos_] != '<') {
+                std::size_t end = find("<", pos_);
+                bool blank = true;
+                for (std::size_t i = pos_; i < end && blank; ++i) {
+                    blank = data_[i] == ' ' || data_[i] == '\n' || data_[i] == '\r' || data_[i] == '\t';
+                }
+                bool keep = !keep_text_.empty() && keep_text_.back();
+                if (skip_depth == 0 && (!blank || keep)) {
+                    out.append(data_ + pos_, end - pos_);
+                }
+                pos_ = end;
+                continue;
+            }
+
+            if (startsWith("<!--")) {
+                std::size_t end = find("-->", pos_ + 4);
+                if (end == len_) return fail(error, "unterminated comment");
+                pos_ = end + 3;
+                ++stats.removed_nodes;
+                continue;
+            }
+            if (startsWith("<![CDATA[")) {
+                std::size_t end = find("]]>", pos_);
+                if (end == len_) return fail(error, "unterminated CDATA section");
+                if (skip_depth == 0) out.append(data_ + pos_, end + 3 - pos_);
+                pos_ = end + 3;
+                continue;
+            }
+            if (startsWith("<!")) {
+                // DOCTYPE: an internal subset may declare entities, so only a plain one is dropped.
+                std::size_t gt = find(">", pos_);
+                std::size_t bracket = find("[", pos_);
+                std::size_t end = bracket < gt ? find("]>", bracket) + 1 : gt;
+                if (end >= len_) return fail(error, "unterminated declaration");
+                if (bracket < gt && skip_depth == 0) {
+                    out.append(data_ + pos_, end + 1 - pos_);
+                } else {
+                    ++stats.removed_nodes;
+                }
+                pos_ = end + 1;
+                continue;
+            }
+            if (startsWith("<?")) {
+                std::size_t end = find("?>", pos_);
+                if (end == len_) return fail(error, "unterminated processing instruction");
+                // The XML declaration is optional for UTF-8 documents.
+                std::string pi(data_ + pos_, end - pos_);
+                bool declaration = pi.compare(0, 6, "<?xml ") == 0;
+                bool utf8 = pi.find("encoding") == std::string::npos || pi.find("UTF-8") != std::string::npos ||
+                            pi.find("utf-8") != std::string::npos;
+                if (skip_depth == 0 && !(declaration && utf8)) {
+                    out.append(data_ + pos_, end + 2 - pos_);
+                }
+                pos_ = end + 2;
+                continue;
+            }
+            if (startsWith("</")) {
+                std::size_t end = find(">", pos_);
+                if (end == len_) return fail(error, "unterminated end tag");
+                if (skip_depth > 0) {
+                    --skip_depth;
+                } else {
+                    std::size_t name_end = pos_ + 2;
+                    while (name_end < end && !isSpace(data_[name_end])) ++name_end;
+                    out.append(data_ + pos_, name_end - pos_);
+                    out += '>';
+                    if (!keep_text_.empty()) keep_text_.pop_back();
+                }
+                pos_ = end + 1;
+                continue;
+            }
+            if (!startTag(out, skip_depth, stats, error)) {
+                return false;
+            }
+        }
+        if (skip_depth != 0) {
+            return fail(error, "unterminated element");
+        }
+        return true;
+    }
+
+private:
+    static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+    bool startsWith(const char* s) const {
+        std::size_t n = std::strlen(s);
+        return pos_ + n <= len_ && std::strncmp(data_ + pos_, s, n) == 0;
+    }
+
+    // Offset of the next 'needle' at or after 'from', or len_ if there is none.
+    std::size_t find(const char* needle, std::size_t from) const {
+        std::size_t n = std::strlen(needle);
+        for (std::size_t i = from; i + n <= len_; ++i) {
+            if (data_[i] == needle[0] && std::strncmp(data_ + i, needle, n) == 0) {
+                return i;
+            }
+        }
+        return len_;
+    }
+
+    static bool fail(std::string& error, const char* what) {
+        error = what;
+        return false;
+    }
+
+    bool startTag(std::string& out, std::size_t& skip_depth, Stats& stats, std::string& error) {
+        std::size_t i = pos_ + 1;
+        const char* name = data_ + i;
+        while (i < len_ && !isSpace(data_[i]) && data_[i] != '>' && data_[i] != '/') ++i;
+        std::size_t name_len = static_cast<std::size_t>(data_ + i - name);
+        if (name_len == 0) return fail(error, "malformed tag");
+
+        bool dropped = skip_depth > 0 || isEditorElement(name, name_len);
+        bool path_data = hasPathData(name, name_len);
+        if (!dropped) {
+            out += '<';
+            out.append(name, name_len);
+        }
+
+        // Attributes, one at a time.
+        for (;;) {
+            while (i < len_ && isSpace(data_[i])) ++i;
+            if (i >= len_) return fail(error, "unterminated tag");
+            if (data_[i] == '>' || data_[i] == '/') break;
+            const char* attr = data_ + i;
+            while (i < len_ && data_[i] != '=' && !isSpace(data_[i]) && data_[i] != '>') ++i;
+            std::size_t attr_len = static_cast<std::size_t>(data_ + i - attr);
+            while (i < len_ && isSpace(data_[i])) ++i;
+            if (i >= len_ || data_[i] != '=') return fail(error, "attribute without a value");
+            ++i;
+            while (i < len_ && isSpace(data_[i])) ++i;
+            if (i >= len_ || (data_[i] != '"' && data_[i] != '\'')) return fail(error, "unquoted attribute value");
+            char quote = data_[i++];
+            std::size_t value_start = i;
+            while (i < len_ && data_[i] != quote) ++i;
+            if (i >= len_) return fail(error, "unterminated attribute value");
+            std::size_t value_len = i - value_start;
+            ++i;
+
+            if (dropped || isEditorAttribute(attr, attr_len)) {
+                continue;
+            }
+            out += ' ';
+            out.append(attr, attr_len);
+            out += '=';
+            out += quote;
+            path_in_.assign(data_ + value_start, value_len);
+            if (path_data && attr_len == 1 && attr[0] == 'd' && path_in_.find('&') == std::string::npos &&
+                paths_.optimize(path_in_, path_out_)) {
+                out += path_out_;
+                ++stats.paths;
+            } else {
+                out += path_in_;
+            }
+            out += quote;
+        }
+
+        bool self_closing = data_[i] == '/';
+        if (self_closing) {
+            ++i;
+            if (i >= len_ || data_[i] != '>') return fail(error, "malformed empty-element tag");
+        }
+        pos_ = i + 1;
+
+        if (dropped) {
+            if (skip_depth == 0) ++stats.removed_nodes;
+            if (!self_closing) ++skip_depth;
+            return true;
+        }
+        if (self_closing) {
+            out += "/>";
+        } else {
+            out += '>';
+            bool parent_keeps = !keep_text_.empty() && keep_text_.back();
+            keep_text_.push_back(parent_keeps || keepsText(name, name_len));
+        }
+        return true;
+    }
+
+    PathOptimizer paths_;
+    std::string path_in_, path_out_; // Reused for every path attribute
+    std::vector<bool> keep_text_;    // Per open element: is its text significant?
+    const char* data_ = nullptr;
+    std::size_t len_ = 0;
+    std::size_t pos_ = 0;
+};
+
+} // namespace svgmin
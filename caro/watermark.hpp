@@ -0,0 +1,463 @@
+// watermark.hpp - Watermarked variants of gallery images.
+//
+// The watermark PNG is loaded once, multiplied by the opacity and premultiplied
+// by its alpha; each size it is drawn at is scaled once (area averaging on the
+// premultiplied pixels) and cached. Where it goes depends on the image's shape:
+// a rule per landscape, portrait and square image names an anchor and the mark's
+// width as a share of the image width.
+//
+// Drawing is a premultiplied "over": out = mark + dst * (255 - mark alpha) / 255,
+// with scalar, SSE2 and AVX2 kernels that agree exactly. JPEGs are watermarked
+// in the coefficient domain: only the MCUs under the mark are decoded, blended
+// and quantized again with the image's own tables, so every other block keeps
+// its coefficients and no generation loss reaches the rest of the image. PNGs
+// are decoded, blended and written with the simple encoder in png.hpp.
+#pragma once
+
+#include <algorithm>    // For std::min, std::max
+#include <array>        // For the rules per shape
+#include <cmath>        // For std::lround
+#include <cstdint>      // For pixels
+#include <cstdlib>      // For std::atof
+#include <filesystem>   // For fs::path
+#include <map>          // For the scaled marks
+#include <mutex>        // For the cache, shared by the pipeline workers
+#include <sstream>      // For parsing rules
+#include <string>       // For specs and errors
+#include <utility>      // For std::pair
+#include <vector>       // For pixels
+
+#include "jpeg_transform.hpp" // For the coefficient decoder, orientation and encoder
+#include "mapped_file.hpp"
+#include "png.hpp"
+#include "simd.hpp"
+
+namespace fs = std::filesystem;
+
+namespace watermark {
+
+constexpr double LANDSCAPE = 1.2;  // Width / height from which an image is landscape (portrait below 1 / 1.2)
+constexpr double MARGIN = 0.03;    // Distance from the edges, share of the shorter side
+constexpr int MIN_WIDTH = 16;      // Smaller marks are not drawn
+
+// Premultiplied RGBA.
+struct Mark {
+    int width = 0, height = 0;
+    std::vector<std::uint8_t> rgba;
+};
+
+// Anchor 0, 1 or 2 per axis (start, center, end) and the mark's width as a share of the image's.
+struct Rule {
+    int anchor_x = 2, anchor_y = 2;
+    double width = 0.2;
+};
+
+enum Shape { LANDSCAPE_SHAPE = 0, PORTRAIT_SHAPE = 1, SQUARE_SHAPE = 2 };
+
+using Rules = std::array<Rule, 3>; // By Shape
+
+inline Rules defaultRules() {
+    return {Rule{2, 2, 0.20}, Rule{1, 2, 0.40}, Rule{2, 2, 0.25}};
+}
+
+// "landscape=bottom-right:20,portrait=bottom:40,square=center:30": anchor and width in
+// percent per shape; shapes not listed keep their default.
+inline bool parseRules(const std::string& spec, Rules& rules, std::string& error) {
+    static const char* shapes[3] = {"landscape", "portrait", "square"};
+    static const char* anchors[3][3] = {{"top-left", "top", "top-right"},
+                                        {"left", "center", "right"},
+                                        {"bottom-left", "bottom", "bottom-right"}};
+    std::stringstream list(spec);
+    for (std::string item; std::getline(list, item, ',');) {
+        std::size_t eq = item.find('='), colon = item.find(':');
+        if (eq == std::string::npos || colon == std::string::npos || colon < eq) {
+            error = "bad watermark rule '" + item + "' (expected SHAPE=ANCHOR:PERCENT)";
+            return false;
+        }
+        std::string shape = item.substr(0, eq), anchor = item.substr(eq + 1, colon - eq - 1);
+        int s = -1;
+        for (int i = 0; i < 3; ++i) {
+            s = shape == shapes[i] ? i : s;
+        }
+        Rule rule;
+        bool found = false;
+        for (int y = 0; y < 3; ++y) {
+            for (int x = 0; x < 3; ++x) {
+                if (anchor == anchors[y][x]) {
+                    rule.anchor_x = x;
+                    rule.anchor_y = y;
+                    found = true;
+                }
+            }
+        }
+        rule.width = std::atof(item.c_str() + colon + 1) / 100.0;
+        if (s < 0 || !found || rule.width <= 0 || rule.width > 1) {
+            error = "bad watermark rule '" + item + "'";
+            return false;
+        }
+        rules[s] = rule;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Blend kernels: dst = mark + dst * (255 - mark alpha) / 255, dst premultiplied or opaque
+// ---------------------------------------------------------------------------
+
+// x / 255 rounded, exact for x <= 255 * 255.
+inline std::uint32_t div255(std::uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+inline void blendRowScalar(std::uint8_t* dst, const std::uint8_t* mark, std::size_t n) {
+    for (std::size_t i = 0; i < n * 4; i += 4) {
+        std::uint32_t inv = 255 - mark[i + 3];
+        for (int c = 0; c < 4; ++c) {
+            dst[i + c] = static_cast<std::uint8_t>(mark[i + c] + div255(dst[i + c] * inv));
+        }
+    }
+}
+
+#if CARO_X86_SIMD
+// Two pixels as 16-bit channels: dst * (255 - alpha) / 255, alpha broadcast from 'm'.
+inline __m128i scaleSse2(__m128i d, __m128i m) {
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(m, 0xFF), 0xFF);
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), alpha)), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+inline void blendRowSse2(std::uint8_t* dst, const std::uint8_t* mark, std::size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + 4 * i));
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mark + 4 * i));
+        __m128i lo = scaleSse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(m, zero));
+        __m128i hi = scaleSse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(m, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), m));
+    }
+    blendRowScalar(dst + 4 * i, mark + 4 * i, n - i);
+}
+
+CARO_TARGET_AVX2 inline __m256i scaleAvx2(__m256i d, __m256i m) {
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(m, 0xFF), 0xFF);
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(d, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha)),
+                                 _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+// Unpack and pack both work per 128-bit lane, so the pixel order survives.
+CARO_TARGET_AVX2 inline void blendRowAvx2(std::uint8_t* dst, const std::uint8_t* mark, std::size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + 4 * i));
+        __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mark + 4 * i));
+        __m256i lo = scaleAvx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(m, zero));
+        __m256i hi = scaleAvx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(m, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * i), _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), m));
+    }
+    blendRowSse2(dst + 4 * i, mark + 4 * i, n - i);
+}
+#endif
+
+inline void blendRow(std::uint8_t* dst, const std::uint8_t* mark, std::size_t n) {
+#if CARO_X86_SIMD
+    switch (activeSimdLevel()) {
+    case SimdLevel::Avx2: blendRowAvx2(dst, mark, n); return;
+    case SimdLevel::Sse2: blendRowSse2(dst, mark, n); return;
+    default: break;
+    }
+#endif
+    blendRowScalar(dst, mark, n);
+}
+
+inline void premultiplyRow(std::uint8_t* px, std::size_t n) {
+    for (std::size_t i = 0; i < n * 4; i += 4) {
+        for (int c = 0; c < 3; ++c) {
+            px[i + c] = static_cast<std::uint8_t>(div255(px[i + c] * px[i + 3]));
+        }
+    }
+}
+
+inline void unpremultiplyRow(std::uint8_t* px, std::size_t n) {
+    for (std::size_t i = 0; i < n * 4; i += 4) {
+        std::uint32_t a = px[i + 3];
+        for (int c = 0; c < 3 && a > 0; ++c) {
+            px[i + c] = static_cast<std::uint8_t>(std::min<std::uint32_t>(255, (px[i + c] * 255 + a / 2) / a));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Watermarker
+// ---------------------------------------------------------------------------
+
+class Watermarker {
+public:
+    // Loads the mark from a PNG; 'opacity' (0-1) scales its alpha.
+    bool load(const fs::path& path, double opacity, const Rules& rules, std::string& error) {
+        MappedFile file;
+        if (!file.open(path)) {
+            error = "cannot read " + path.string();
+            return false;
+        }
+        if (!png::decode(file.data(), file.size(), mark_.width, mark_.height, mark_.rgba, error)) {
+            error = path.string() + ": " + error;
+            return false;
+        }
+        std::uint32_t scale = static_cast<std::uint32_t>(std::lround(std::max(0.0, std::min(1.0, opacity)) * 255));
+        for (std::size_t i = 0; i < mark_.rgba.size(); i += 4) {
+            mark_.rgba[i + 3] = static_cast<std::uint8_t>(div255(mark_.rgba[i + 3] * scale));
+        }
+        premultiplyRow(mark_.rgba.data(), mark_.rgba.size() / 4);
+        rules_ = rules;
+        return true;
+    }
+
+    struct Placement {
+        int x = 0, y = 0;
+        const Mark* mark = nullptr; // Null if the image is too small
+    };
+
+    // Where the mark goes on a width x height image, scaled to fit its rule.
+    Placement place(int width, int height) {
+        Placement p;
+        double aspect = static_cast<double>(width) / height;
+        const Rule& rule = rules_[aspect >= LANDSCAPE ? LANDSCAPE_SHAPE : aspect <= 1 / LANDSCAPE ? PORTRAIT_SHAPE : SQUARE_SHAPE];
+        int margin = static_cast<int>(std::lround(MARGIN * std::min(width, height)));
+        double w = width * rule.width;
+        double h = w * mark_.height / mark_.width;
+        double fit = std::min({1.0, (width - 2.0 * margin) / w, (height - 2.0 * margin) / h});
+        int mw = static_cast<int>(w * fit), mh = static_cast<int>(h * fit);
+        if (mw < MIN_WIDTH || mh < 1) {
+            return p;
+        }
+        auto offset = [margin](int anchor, int room, int size) {
+            return anchor == 0 ? margin : anchor == 1 ? (room - size) / 2 : room - margin - size;
+        };
+        p.x = offset(rule.anchor_x, width, mw);
+        p.y = offset(rule.anchor_y, height, mh);
+        p.mark = &scaled(mw, mh);
+        return p;
+    }
+
+    // Watermarks a PNG or JPEG ('format' as probed) into 'out'.
+    bool render(const fs::path& path, const std::string& format, std::string& out, std::string& error) {
+        MappedFile file;
+        if (!file.open(path)) {
+            error = "cannot read file";
+            return false;
+        }
+        if (format == "jpeg") {
+            return renderJpeg(file.data(), file.size(), out, error);
+        }
+        if (format == "png") {
+            return renderPng(file.data(), file.size(), out, error);
+        }
+        error = format + " images are not supported";
+        return false;
+    }
+
+    bool renderPng(const std::uint8_t* data, std::size_t len, std::string& out, std::string& error) {
+        int width = 0, height = 0;
+        std::vector<std::uint8_t> rgba;
+        if (!png::decode(data, len, width, height, rgba, error)) {
+            return false;
+        }
+        Placement p = place(width, height);
+        if (!p.mark) {
+            error = "too small for the watermark";
+            return false;
+        }
+        bool alpha = false;
+        for (std::size_t i = 3; i < rgba.size() && !alpha; i += 4) {
+            alpha = rgba[i] != 255;
+        }
+        const Mark& m = *p.mark;
+        for (int y = 0; y < m.height; ++y) {
+            std::uint8_t* row = rgba.data() + ((static_cast<std::size_t>(p.y) + y) * width + p.x) * 4;
+            if (alpha) {
+                premultiplyRow(row, m.width);
+            }
+            blendRow(row, m.rgba.data() + static_cast<std::size_t>(y) * m.width * 4, m.width);
+            if (alpha) {
+                unpremultiplyRow(row, m.width);
+            }
+        }
+        out = png::encode(width, height, rgba.data(), alpha);
+        return true;
+    }
+
+    bool renderJpeg(const std::uint8_t* data, std::size_t len, std::string& out, std::string& error) {
+        jpeg::CoefImage img;
+        if (!jpeg::decodeCoefficients(data, len, img, error)) {
+            return false;
+        }
+        // The mark belongs on the image as displayed: turn it upright first (losslessly).
+        int orientation = jpeg::orientationOf(img);
+        if (orientation != 1) {
+            jpeg::CoefImage upright;
+            if (!jpeg::transformImage(img, jpeg::transformForOrientation(orientation), upright, error)) {
+                return false;
+            }
+            for (auto& segment : upright.segments) {
+                if (segment.first == 0xE1) {
+                    jpeg::transformExif(segment.second, jpeg::transformForOrientation(orientation), upright.width,
+                                        upright.height);
+                }
+            }
+            img = std::move(upright);
+        }
+        bool ycc = false;
+        if (!jpeg::colorModel(img, ycc, error)) {
+            return false;
+        }
+        Placement p = place(img.width, img.height);
+        if (!p.mark) {
+            error = "too small for the watermark";
+            return false;
+        }
+        const Mark& m = *p.mark;
+        int count = static_cast<int>(img.comps.size());
+        int mcu_w = 8 * img.hmax, mcu_h = 8 * img.vmax;
+        int mx0 = p.x / mcu_w, mx1 = (p.x + m.width - 1) / mcu_w;
+        int my0 = p.y / mcu_h, my1 = (p.y + m.height - 1) / mcu_h;
+
+        // Samples of the MCUs under the mark, per component.
+        struct Plane {
+            int bx0 = 0, by0 = 0, bw = 0, bh = 0;
+            std::size_t stride = 0;
+            std::vector<std::uint8_t> px;
+            std::vector<float> sum;         // Blended values per sample
+            std::vector<std::uint8_t> hits; // Blended pixels per sample
+        };
+        std::vector<Plane> planes(count);
+        for (int c = 0; c < count; ++c) {
+            const jpeg::Component& comp = img.comps[c];
+            Plane& plane = planes[c];
+            plane.bx0 = mx0 * comp.h;
+            plane.by0 = my0 * comp.v;
+            plane.bw = std::min((mx1 + 1) * comp.h, comp.grid_w) - plane.bx0;
+            plane.bh = std::min((my1 + 1) * comp.v, comp.grid_h) - plane.by0;
+            plane.stride = static_cast<std::size_t>(plane.bw) * 8;
+            plane.px.resize(plane.stride * plane.bh * 8);
+            plane.sum.assign(plane.px.size(), 0);
+            plane.hits.assign(plane.px.size(), 0);
+            for (int by = 0; by < plane.bh; ++by) {
+                for (int bx = 0; bx < plane.bw; ++bx) {
+                    jpeg::idctBlock(comp.block(plane.bx0 + bx, plane.by0 + by), img.qt[comp.tq],
+                                    plane.px.data() + by * 8 * plane.stride + bx * 8, plane.stride);
+                }
+            }
+        }
+        auto sampleIndex = [&](int c, int x, int y) {
+            const jpeg::Component& comp = img.comps[c];
+            std::size_t sx = static_cast<std::size_t>(x) * comp.h / img.hmax - planes[c].bx0 * 8;
+            std::size_t sy = static_cast<std::size_t>(y) * comp.v / img.vmax - planes[c].by0 * 8;
+            return sy * planes[c].stride + sx;
+        };
+
+        // Blend in RGB, then add each pixel's new components to the samples it maps to.
+        std::vector<std::uint8_t> row(static_cast<std::size_t>(m.width) * 4);
+        int sample[3] = {0, 0, 0};
+        for (int y = p.y; y < p.y + m.height; ++y) {
+            for (int x = p.x; x < p.x + m.width; ++x) {
+                for (int c = 0; c < count; ++c) {
+                    sample[c] = planes[c].px[sampleIndex(c, x, y)];
+                }
+                jpeg::storePixel(count, ycc, sample, row.data() + (x - p.x) * 4);
+            }
+            blendRow(row.data(), m.rgba.data() + static_cast<std::size_t>(y - p.y) * m.width * 4, m.width);
+            for (int x = p.x; x < p.x + m.width; ++x) {
+                const std::uint8_t* px = row.data() + (x - p.x) * 4;
+                float r = px[0], g = px[1], b = px[2];
+                float values[3] = {r, g, b};
+                if (count == 1 || ycc) {
+                    values[0] = 0.299f * r + 0.587f * g + 0.114f * b;
+                    values[1] = -0.168736f * r - 0.331264f * g + 0.5f * b + 128.0f;
+                    values[2] = 0.5f * r - 0.418688f * g - 0.081312f * b + 128.0f;
+                }
+                for (int c = 0; c < count; ++c) {
+                    std::size_t i = sampleIndex(c, x, y);
+                    planes[c].sum[i] += values[c];
+                    ++planes[c].hits[i];
+                }
+            }
+        }
+
+        // A sample becomes the mean of the pixels it covers: blended ones at their new
+        // value, the others (only partly covered chroma samples have any) at the old.
+        for (int c = 0; c < count; ++c) {
+            const jpeg::Component& comp = img.comps[c];
+            Plane& plane = planes[c];
+            std::vector<bool> dirty(static_cast<std::size_t>(plane.bw) * plane.bh, false);
+            for (std::size_t i = 0; i < plane.px.size(); ++i) {
+                if (plane.hits[i] == 0) {
+                    continue;
+                }
+                int sx = static_cast<int>(i % plane.stride) + plane.bx0 * 8;
+                int sy = static_cast<int>(i / plane.stride) + plane.by0 * 8;
+                auto covered = [](int s, int factor, int max_factor, int size) {
+                    int lo = (s * max_factor + factor - 1) / factor, hi = ((s + 1) * max_factor + factor - 1) / factor;
+                    return std::max(1, std::min(hi, size) - lo);
+                };
+                int total = covered(sx, comp.h, img.hmax, img.width) * covered(sy, comp.v, img.vmax, img.height);
+                float value = (plane.sum[i] + plane.px[i] * static_cast<float>(std::max(0, total - plane.hits[i]))) /
+                              std::max<int>(total, plane.hits[i]);
+                plane.px[i] = static_cast<std::uint8_t>(std::max(0.0f, std::min(255.0f, value + 0.5f)));
+                dirty[(i / plane.stride / 8) * plane.bw + (i % plane.stride) / 8] = true;
+            }
+            jpeg::Component& target = img.comps[c];
+            for (int by = 0; by < plane.bh; ++by) {
+                for (int bx = 0; bx < plane.bw; ++bx) {
+                    if (dirty[static_cast<std::size_t>(by) * plane.bw + bx]) {
+                        jpeg::fdctBlock(plane.px.data() + by * 8 * plane.stride + bx * 8, plane.stride,
+                                        img.qt[comp.tq], target.block(plane.bx0 + bx, plane.by0 + by));
+                    }
+                }
+            }
+        }
+        out = jpeg::encodeBaseline(img);
+        return true;
+    }
+
+private:
+    Mark mark_;
+    Rules rules_ = defaultRules();
+    std::mutex mutex_;
+    std::map<std::pair<int, int>, Mark> scaled_; // Node-based: references stay valid
+
+    // The mark at width x height, scaled once by area averaging.
+    const Mark& scaled(int width, int height) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = scaled_.find({width, height});
+        if (found != scaled_.end()) {
+            return found->second;
+        }
+        Mark out{width, height, std::vector<std::uint8_t>(static_cast<std::size_t>(width) * height * 4)};
+        for (int y = 0; y < height; ++y) {
+            int y0 = y * mark_.height / height, y1 = std::max(y0 + 1, (y + 1) * mark_.height / height);
+            for (int x = 0; x < width; ++x) {
+                int x0 = x * mark_.width / width, x1 = std::max(x0 + 1, (x + 1) * mark_.width / width);
+                std::uint32_t sum[4] = {0, 0, 0, 0};
+                for (int sy = y0; sy < y1; ++sy) {
+                    const std::uint8_t* src = mark_.rgba.data() + (static_cast<std::size_t>(sy) * mark_.width + x0) * 4;
+                    for (int sx = x0; sx < x1; ++sx, src += 4) {
+                        for (int c = 0; c < 4; ++c) {
+                            sum[c] += src[c];
+                        }
+                    }
+                }
+                std::uint32_t n = static_cast<std::uint32_t>((y1 - y0) * (x1 - x0));
+                for (int c = 0; c < 4; ++c) {
+                    out.rgba[(static_cast<std::size_t>(y) * width + x) * 4 + c] = static_cast<std::uint8_t>((sum[c] + n / 2) / n);
+                }
+            }
+        }
+        return scaled_.emplace(std::make_pair(width, height), std::move(out)).first->second;
+    }
+};
+
+} // namespace watermark
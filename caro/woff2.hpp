@@ -0,0 +1,539 @@
+// woff2.hpp - TrueType/OpenType to WOFF2 converter.
+//
+// Builds a WOFF2 file (W3C WOFF File Format 2.0) from an sfnt font: the table
+// directory with known-tag indices and UIntBase128 lengths, the glyf/loca
+// transform for TrueType outlines (glyphs split into contour, point, flag,
+// triplet-coded coordinate, composite, bbox and instruction streams; loca is
+// dropped and rebuilt by the browser), and one brotli stream in font mode over
+// all tables. CFF fonts and fonts whose glyf table cannot be parsed keep
+// every table as is (null transforms). DSIG is dropped, as the transform
+// invalidates it.
+//
+// Brotli is an optional dependency: build with -DCARO_WITH_BROTLI and link
+// -lbrotlienc. Without it, transformFont() still works (it is what the
+// benchmarks time) but encode() reports that WOFF2 output is unavailable.
+#pragma once
+
+#include <algorithm>    // For std::min, std::max
+#include <cstdint>      // For fixed-width integers
+#include <cstdlib>      // For std::abs
+#include <string>       // For output buffers and errors
+#include <vector>       // For the table list
+
+#if defined(CARO_WITH_BROTLI)
+#include <brotli/encode.h>
+#endif
+
+namespace woff2 {
+
+inline std::uint16_t u16(const std::uint8_t* p) {
+    return static_cast<std::uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline std::int16_t s16(const std::uint8_t* p) {
+    return static_cast<std::int16_t>(u16(p));
+}
+
+inline std::uint32_t u32(const std::uint8_t* p) {
+    return (static_cast<std::uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+inline void put16(std::string& out, int v) {
+    out += static_cast<char>((v >> 8) & 0xFF);
+    out += static_cast<char>(v & 0xFF);
+}
+
+inline void put32(std::string& out, std::uint32_t v) {
+    put16(out, static_cast<int>(v >> 16));
+    put16(out, static_cast<int>(v & 0xFFFF));
+}
+
+inline std::uint32_t tagOf(const char* name) {
+    return u32(reinterpret_cast<const std::uint8_t*>(name));
+}
+
+// UIntBase128: big-endian groups of 7 bits, high bit set on all but the last byte.
+inline void putBase128(std::string& out, std::uint32_t v) {
+    int bytes = 1;
+    while (bytes < 5 && (v >> (7 * bytes))) {
+        ++bytes;
+    }
+    for (int i = bytes - 1; i >= 0; --i) {
+        out += static_cast<char>(((v >> (7 * i)) & 0x7F) | (i ? 0x80 : 0));
+    }
+}
+
+// 255UInt16: one byte below 253, otherwise an escape code and one or two bytes.
+inline void put255(std::string& out, unsigned v) {
+    if (v < 253) {
+        out += static_cast<char>(v);
+    } else if (v < 506) {
+        out += static_cast<char>(255);
+        out += static_cast<char>(v - 253);
+    } else if (v < 762) {
+        out += static_cast<char>(254);
+        out += static_cast<char>(v - 506);
+    } else {
+        out += static_cast<char>(253);
+        put16(out, static_cast<int>(v));
+    }
+}
+
+// Tags with a one-byte index in the WOFF2 table directory.
+inline int knownTagIndex(std::uint32_t tag) {
+    static const char* const known[63] = {
+        "cmap", "head", "hhea", "hmtx", "maxp", "name", "OS/2", "post", "cvt ", "fpgm", "glyf", "loca", "prep",
+        "CFF ", "VORG", "EBDT", "EBLC", "gasp", "hdmx", "kern", "LTSH", "PCLT", "VDMX", "vhea", "vmtx", "BASE",
+        "GDEF", "GPOS", "GSUB", "EBSC", "JSTF", "MATH", "CBDT", "CBLC", "COLR", "CPAL", "SVG ", "sbix", "acnt",
+        "avar", "bdat", "bloc", "bsln", "cvar", "fdsc", "feat", "fmtx", "fvar", "gvar", "hsty", "just", "lcar",
+        "mort", "morx", "opbd", "prop", "trak", "Zapf", "Silf", "Glat", "Gloc", "Feat", "Sill"};
+    for (int i = 0; i < 63; ++i) {
+        if (tagOf(known[i]) == tag) {
+            return i;
+        }
+    }
+    return 63;
+}
+
+struct Table {
+    std::uint32_t tag = 0;
+    std::uint32_t offset = 0;
+    std::uint32_t length = 0;
+    std::string data;                 // Bytes stored in the WOFF2 stream (possibly transformed)
+    bool transformed = false;         // glyf/loca with the glyph transform applied
+};
+
+struct Font {
+    std::uint32_t flavor = 0;         // 0x00010000 for TrueType, 'OTTO' for CFF
+    std::vector<Table> tables;        // In the order they are written
+    std::uint32_t sfnt_size = 0;      // Size of the font the browser rebuilds (advisory)
+};
+
+// Reads the sfnt table directory and copies every table but DSIG.
+inline bool parseSfnt(const std::uint8_t* data, std::size_t len, Font& font, std::string& error) {
+    if (len < 12) {
+        error = "not a font file";
+        return false;
+    }
+    font.flavor = u32(data);
+    if (font.flavor != 0x00010000 && font.flavor != tagOf("OTTO") && font.flavor != tagOf("true")) {
+        error = font.flavor == tagOf("ttcf") ? "font collections are not supported" : "not a TrueType or OpenType font";
+        return false;
+    }
+    int count = u16(data + 4);
+    if (len < 12u + 16u * count) {
+        error = "truncated table directory";
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        const std::uint8_t* entry = data + 12 + 16 * i;
+        Table table;
+        table.tag = u32(entry);
+        table.offset = u32(entry + 8);
+        table.length = u32(entry + 12);
+        if (table.offset > len || table.length > len - table.offset) {
+            error = "table outside the file";
+            return false;
+        }
+        if (table.tag == tagOf("DSIG")) {
+            continue;
+        }
+        table.data.assign(reinterpret_cast<const char*>(data) + table.offset, table.length);
+        font.tables.push_back(std::move(table));
+    }
+    return true;
+}
+
+inline Table* findTable(Font& font, const char* name) {
+    for (auto& table : font.tables) {
+        if (table.tag == tagOf(name)) {
+            return &table;
+        }
+    }
+    return nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// glyf/loca transform
+// ---------------------------------------------------------------------------
+
+// Appends one point delta to the flag and glyph streams (the WOFF2 triplet encoding).
+inline void putTriplet(std::string& flags, std::string& glyphs, bool on_curve, int dx, int dy) {
+    int ax = std::abs(dx), ay = std::abs(dy);
+    int on = on_curve ? 0 : 128;
+    int x_sign = dx < 0 ? 0 : 1;
+    int y_sign = dy < 0 ? 0 : 1;
+    int signs = x_sign + 2 * y_sign;
+    if (dx == 0 && ay < 1280) {
+        flags += static_cast<char>(on + ((ay & 0xF00) >> 7) + y_sign);
+        glyphs += static_cast<char>(ay & 0xFF);
+    } else if (dy == 0 && ax < 1280) {
+        flags += static_cast<char>(on + 10 + ((ax & 0xF00) >> 7) + x_sign);
+        glyphs += static_cast<char>(ax & 0xFF);
+    } else if (ax < 65 && ay < 65) {
+        flags += static_cast<char>(on + 20 + ((ax - 1) & 0x30) + (((ay - 1) & 0x30) >> 2) + signs);
+        glyphs += static_cast<char>((((ax - 1) & 0xF) << 4) | ((ay - 1) & 0xF));
+    } else if (ax < 769 && ay < 769) {
+        flags += static_cast<char>(on + 84 + 12 * (((ax - 1) & 0x300) >> 8) + (((ay - 1) & 0x300) >> 6) + signs);
+        glyphs += static_cast<char>((ax - 1) & 0xFF);
+        glyphs += static_cast<char>((ay - 1) & 0xFF);
+    } else if (ax < 4096 && ay < 4096) {
+        flags += static_cast<char>(on + 120 + signs);
+        glyphs += static_cast<char>(ax >> 4);
+        glyphs += static_cast<char>(((ax & 0xF) << 4) | (ay >> 8));
+        glyphs += static_cast<char>(ay & 0xFF);
+    } else {
+        flags += static_cast<char>(on + 124 + signs);
+        put16(glyphs, ax);
+        put16(glyphs, ay);
+    }
+}
+
+class GlyfTransformer {
+public:
+    // Replaces glyf with its transformed form and empties loca. Returns false (leaving
+    // the tables untouched) if the outlines cannot be parsed.
+    bool run(Font& font, std::string& error) {
+        Table* glyf = findTable(font, "glyf");
+        Table* loca = findTable(font, "loca");
+        Table* head = findTable(font, "head");
+        Table* maxp = findTable(font, "maxp");
+        if (!glyf || !loca || !head || !maxp || head->data.size() < 54 || maxp->data.size() < 6) {
+            error = "no TrueType outlines";
+            return false;
+        }
+        const auto* hd = reinterpret_cast<const std::uint8_t*>(head->data.data());
+        const auto* lo = reinterpret_cast<const std::uint8_t*>(loca->data.data());
+        glyf_ = reinterpret_cast<const std::uint8_t*>(glyf->data.data());
+        glyf_len_ = glyf->data.size();
+        int index_format = s16(hd + 50);
+        int num_glyphs = u16(reinterpret_cast<const std::uint8_t*>(maxp->data.data()) + 4);
+        std::size_t entry = index_format ? 4 : 2;
+        if (loca->data.size() < entry * (num_glyphs + 1)) {
+            error = "loca table too short";
+            return false;
+        }
+
+        bbox_bitmap_.assign(((num_glyphs + 31) >> 5) << 2, 0);
+        for (int g = 0; g < num_glyphs; ++g) {
+            std::size_t start = index_format ? u32(lo + 4 * g) : 2u * u16(lo + 2 * g);
+            std::size_t end = index_format ? u32(lo + 4 * g + 4) : 2u * u16(lo + 2 * g + 2);
+            if (end < start || end > glyf_len_) {
+                error = "bad loca entry";
+                return false;
+            }
+            if (!glyph(g, glyf_ + start, end - start, error)) {
+                return false;
+            }
+        }
+
+        std::string out;
+        put16(out, 0);             // Reserved
+        put16(out, 0);             // Option flags: no overlapSimpleBitmap
+        put16(out, num_glyphs);
+        put16(out, index_format);
+        std::string bbox = std::string(bbox_bitmap_.begin(), bbox_bitmap_.end()) + bboxes_;
+        for (const std::string* stream : {&n_contours_, &n_points_, &flags_, &glyphs_, &composites_, &bbox, &instructions_}) {
+            put32(out, static_cast<std::uint32_t>(stream->size()));
+        }
+        for (const std::string* stream : {&n_contours_, &n_points_, &flags_, &glyphs_, &composites_, &bbox, &instructions_}) {
+            out += *stream;
+        }
+        glyf->data = std::move(out);
+        glyf->transformed = true;
+        loca->data.clear();
+        loca->transformed = true;
+        return true;
+    }
+
+private:
+    const std::uint8_t* glyf_ = nullptr;
+    std::size_t glyf_len_ = 0;
+    std::string n_contours_, n_points_, flags_, glyphs_, composites_, bboxes_, instructions_;
+    std::vector<std::uint8_t> bbox_bitmap_;
+    std::vector<std::uint16_t> end_points_;
+    std::vector<std::uint8_t> point_flags_;
+    std::vector<int> xs_, ys_;
+
+    void explicitBbox(int g, const std::uint8_t* p) {
+        bbox_bitmap_[g >> 3] |= static_cast<std::uint8_t>(0x80 >> (g & 7));
+        bboxes_.append(reinterpret_cast<const char*>(p + 2), 8);
+    }
+
+    bool glyph(int g, const std::uint8_t* p, std::size_t len, std::string& error) {
+        if (len == 0) {
+            put16(n_contours_, 0);
+            return true;
+        }
+        if (len < 10) {
+            error = "glyph " + std::to_string(g) + " is truncated";
+            return false;
+        }
+        int contours = s16(p);
+        if (contours == 0) {
+            put16(n_contours_, 0); // Nothing to draw; the browser rebuilds an empty glyph
+            return true;
+        }
+        put16(n_contours_, contours);
+        return contours > 0 ? simple(g, p, len, contours, error) : composite(g, p, len, error);
+    }
+
+    bool simple(int g, const std::uint8_t* p, std::size_t len, int contours, std::string& error) {
+        const std::uint8_t* end = p + len;
+        const std::uint8_t* q = p + 10;
+        if (q + 2 * contours + 2 > end) {
+            error = "glyph " + std::to_string(g) + " is truncated";
+            return false;
+        }
+        end_points_.resize(contours);
+        int points = 0;
+        for (int c = 0; c < contours; ++c) {
+            end_points_[c] = u16(q + 2 * c);
+            if (end_points_[c] + 1 <= points) {
+                error = "glyph " + std::to_string(g) + " has unordered contours";
+                return false;
+            }
+            points = end_points_[c] + 1;
+        }
+        q += 2 * contours;
+        std::size_t instruction_len = u16(q);
+        q += 2;
+        if (q + instruction_len > end) {
+            error = "glyph " + std::to_string(g) + " is truncated";
+            return false;
+        }
+        const std::uint8_t* instructions = q;
+        q += instruction_len;
+
+        point_flags_.clear();
+        while (static_cast<int>(point_flags_.size()) < points) {
+            if (q >= end) {
+                error = "glyph " + std::to_string(g) + " is truncated";
+                return false;
+            }
+            std::uint8_t f = *q++;
+            int repeat = 0;
+            if (f & 8) {
+                if (q >= end) {
+                    error = "glyph " + std::to_string(g) + " is truncated";
+                    return false;
+                }
+                repeat = *q++;
+            }
+            for (int r = 0; r <= repeat && static_cast<int>(point_flags_.size()) < points; ++r) {
+                point_flags_.push_back(f);
+            }
+        }
+        xs_.resize(points);
+        ys_.resize(points);
+        for (int axis = 0; axis < 2; ++axis) {
+            std::vector<int>& values = axis ? ys_ : xs_;
+            std::uint8_t short_bit = axis ? 0x04 : 0x02;
+            std::uint8_t same_bit = axis ? 0x20 : 0x10;
+            int v = 0;
+            for (int i = 0; i < points; ++i) {
+                std::uint8_t f = point_flags_[i];
+                if (f & short_bit) {
+                    if (q >= end) {
+                        error = "glyph " + std::to_string(g) + " is truncated";
+                        return false;
+                    }
+                    v += (f & same_bit) ? *q : -*q;
+                    ++q;
+                } else if (!(f & same_bit)) {
+                    if (q + 2 > end) {
+                        error = "glyph " + std::to_string(g) + " is truncated";
+                        return false;
+                    }
+                    v += s16(q);
+                    q += 2;
+                }
+                values[i] = v;
+            }
+        }
+
+        int start = 0;
+        int px = 0, py = 0;
+        int x_min = 0, y_min = 0, x_max = 0, y_max = 0;
+        for (int c = 0; c < contours; ++c) {
+            put255(n_points_, end_points_[c] + 1 - start);
+            for (int i = start; i <= end_points_[c]; ++i) {
+                putTriplet(flags_, glyphs_, point_flags_[i] & 1, xs_[i] - px, ys_[i] - py);
+                px = xs_[i];
+                py = ys_[i];
+                if (i == 0) {
+                    x_min = x_max = px;
+                    y_min = y_max = py;
+                } else {
+                    x_min = std::min(x_min, px);
+                    x_max = std::max(x_max, px);
+                    y_min = std::min(y_min, py);
+                    y_max = std::max(y_max, py);
+                }
+            }
+            start = end_points_[c] + 1;
+        }
+        put255(glyphs_, static_cast<unsigned>(instruction_len));
+        instructions_.append(reinterpret_cast<const char*>(instructions), instruction_len);
+        // The browser computes the bbox from the points; store it only if the font's differs.
+        if (s16(p + 2) != x_min || s16(p + 4) != y_min || s16(p + 6) != x_max || s16(p + 8) != y_max) {
+            explicitBbox(g, p);
+        }
+        return true;
+    }
+
+    bool composite(int g, const std::uint8_t* p, std::size_t len, std::string& error) {
+        const std::uint8_t* end = p + len;
+        const std::uint8_t* q = p + 10;
+        bool instructions = false;
+        std::uint16_t flags;
+        do {
+            if (q + 4 > end) {
+                error = "glyph " + std::to_string(g) + " is truncated";
+                return false;
+            }
+            flags = u16(q);
+            instructions = instructions || (flags & 0x0100);
+            std::size_t size = 4 + ((flags & 0x0001) ? 4 : 2);
+            if (flags & 0x0008) {
+                size += 2;
+            } else if (flags & 0x0040) {
+                size += 4;
+            } else if (flags & 0x0080) {
+                size += 8;
+            }
+            if (q + size > end) {
+                error = "glyph " + std::to_string(g) + " is truncated";
+                return false;
+            }
+            q += size;
+        } while (flags & 0x0020);
+        composites_.append(reinterpret_cast<const char*>(p + 10), q - (p + 10));
+        if (instructions) {
+            if (q + 2 > end || q + 2 + u16(q) > end) {
+                error = "glyph " + std::to_string(g) + " is truncated";
+                return false;
+            }
+            put255(glyphs_, u16(q));
+            instructions_.append(reinterpret_cast<const char*>(q + 2), u16(q));
+        }
+        explicitBbox(g, p); // Composite glyphs always carry their bbox
+        return true;
+    }
+};
+
+// Applies the glyf/loca transform where possible, puts loca right after glyf (the
+// format requires it) and marks head as transformed. Returns false only for fonts
+// that cannot be read at all.
+inline bool transformFont(const std::uint8_t* data, std::size_t len, Font& font, std::string& error) {
+    if (!parseSfnt(data, len, font, error)) {
+        return false;
+    }
+    std::string ignored;
+    GlyfTransformer transformer;
+    if (findTable(font, "glyf") && transformer.run(font, ignored)) {
+        std::vector<Table> ordered;
+        Table loca;
+        for (auto& table : font.tables) {
+            if (table.tag == tagOf("loca")) {
+                loca = std::move(table);
+            }
+        }
+        for (auto& table : font.tables) {
+            if (table.tag == tagOf("loca")) {
+                continue;
+            }
+            bool is_glyf = table.tag == tagOf("glyf");
+            ordered.push_back(std::move(table));
+            if (is_glyf) {
+                ordered.push_back(std::move(loca));
+            }
+        }
+        font.tables = std::move(ordered);
+    }
+    if (Table* head = findTable(font, "head")) {
+        if (head->data.size() >= 18) {
+            head->data[16] = static_cast<char>(head->data[16] | 0x08); // Bit 11: lossless transform applied
+        }
+    }
+    font.sfnt_size = 12 + 16 * static_cast<std::uint32_t>(font.tables.size());
+    for (const auto& table : font.tables) {
+        font.sfnt_size += (table.length + 3) & ~3u;
+    }
+    return true;
+}
+
+// Concatenation of every table's stored bytes, the input to brotli.
+inline std::string tableStream(const Font& font) {
+    std::string stream;
+    for (const auto& table : font.tables) {
+        stream += table.data;
+    }
+    return stream;
+}
+
+// Converts a TTF/OTF file to WOFF2.
+inline bool encode(const std::uint8_t* data, std::size_t len, std::string& out, std::string& error) {
+#if defined(CARO_WITH_BROTLI)
+    Font font;
+    if (!transformFont(data, len, font, error)) {
+        return false;
+    }
+    std::string stream = tableStream(font);
+    std::size_t compressed_size = BrotliEncoderMaxCompressedSize(stream.size());
+    std::string compressed(compressed_size ? compressed_size : stream.size() + 1024, '\0');
+    compressed_size = compressed.size();
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_MAX_WINDOW_BITS, BROTLI_MODE_FONT, stream.size(),
+                               reinterpret_cast<const std::uint8_t*>(stream.data()), &compressed_size,
+                               reinterpret_cast<std::uint8_t*>(&compressed[0]))) {
+        error = "brotli compression failed";
+        return false;
+    }
+    compressed.resize(compressed_size);
+
+    std::string directory;
+    for (const auto& table : font.tables) {
+        bool glyph_table = table.tag == tagOf("glyf") || table.tag == tagOf("loca");
+        int index = knownTagIndex(table.tag);
+        // Transform version 0 is the glyph transform for glyf/loca and "none" for the rest;
+        // untransformed glyf/loca use version 3.
+        int version = glyph_table && !table.transformed ? 3 : 0;
+        directory += static_cast<char>(index | (version << 6));
+        if (index == 63) {
+            put32(directory, table.tag);
+        }
+        putBase128(directory, table.length);
+        if (table.transformed) {
+            putBase128(directory, static_cast<std::uint32_t>(table.data.size()));
+        }
+    }
+
+    std::size_t total = 48 + directory.size() + compressed.size();
+    std::size_t padded = (total + 3) & ~static_cast<std::size_t>(3);
+    out.clear();
+    out += "wOF2";
+    put32(out, font.flavor);
+    put32(out, static_cast<std::uint32_t>(padded));
+    put16(out, static_cast<int>(font.tables.size()));
+    put16(out, 0);
+    put32(out, font.sfnt_size);
+    put32(out, static_cast<std::uint32_t>(compressed.size()));
+    put16(out, 1); // Version of the WOFF file
+    put16(out, 0);
+    for (int i = 0; i < 5; ++i) {
+        put32(out, 0); // No metadata, no private data
+    }
+    out += directory;
+    out += compressed;
+    out.append(padded - total, '\0');
+    return true;
+#else
+    (void)data;
+    (void)len;
+    (void)out;
+    error = "WOFF2 output needs brotli: rebuild with -DCARO_WITH_BROTLI and -lbrotlienc";
+    return false;
+#endif
+}
+
+} // namespace woff2
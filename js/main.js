@@ -238,6 +238,60 @@
 	};
 	contentWayPoint();
 
+	// Gallery pages: "caro publish" inlines the first page of the carousel and lists the
+	// others in the manifest as content-hashed HTML fragments. Fetch the next page when
+	// the carousel gets within two slides of the last one it has. Paged markup names the
+	// manifest on its first item; a carousel without one has nothing to fetch.
+	var carouselPages = function() {
+		var $carousel = $('.caro-carousel').has('.item[data-manifest]').first();
+		if (!$carousel.length) {
+			return;
+		}
+		var manifestUrl = $carousel.find('.item[data-manifest]').first().data('manifest');
+		var pages = null, next = 0, loading = false;
+		// Items written into the page before the carousel starts; a page listing every image
+		// (no paged markup) has nothing to fetch.
+		var initial = $carousel.children('.item').length;
+
+		var loadPage = function() {
+			if (loading || !pages || next >= pages.length) {
+				return;
+			}
+			var page = pages[next];
+			if (!page.html) {
+				pages = null; // Still being published: look again later
+				$.getJSON(manifestUrl).done(function(manifest) {
+					pages = manifest.pages || [];
+				});
+				return;
+			}
+			loading = true;
+			$.get(page.html).done(function(html) {
+				$($.parseHTML(html)).filter('.item').each(function() {
+					$carousel.trigger('add.owl.carousel', [$(this)]);
+				});
+				$carousel.trigger('refresh.owl.carousel');
+				next++;
+			}).always(function() {
+				loading = false;
+			});
+		};
+
+		$.getJSON(manifestUrl).done(function(manifest) {
+			pages = initial > (manifest.items || []).length ? [] : (manifest.pages || []);
+		});
+		$carousel.on('changed.owl.carousel', function(event) {
+			if (!event.relatedTarget || event.item.index === null) {
+				return;
+			}
+			var position = event.relatedTarget.relative(event.item.index);
+			if (position >= event.item.count - 2) {
+				loadPage();
+			}
+		});
+	};
+	carouselPages();
+
 	// magnific popup
 	$('.image-popup').magnificPopup({
     type: 'image',